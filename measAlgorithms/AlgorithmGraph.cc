@@ -0,0 +1,106 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+
+#include "AlgorithmGraph.h"
+
+/**
+ * Add an algorithm, returning its index
+ *
+ * The graph must be sort()ed again before it's used
+ */
+int AlgorithmGraph::add(std::string const& name,                ///< the algorithm's name
+                        std::vector<std::string> const& inputs, ///< the names of what it needs
+                        std::string const& provides             ///< what else it may be called
+                       ) {
+    _names.push_back(name);
+    _provides.push_back(provides);
+    _inputNames.push_back(inputs);
+
+    _inputs.clear();
+    _levels.clear();
+    _order.clear();
+    _nLevel = 0;
+
+    return _names.size() - 1;
+}
+
+/// Return the algorithm called, or providing, name;  -1 if there isn't one
+int AlgorithmGraph::_find(std::string const& name) const {
+    int found = -1;
+    for (int i = 0; i != size(); ++i) {
+        if (_names[i] == name || (_provides[i] != "" && _provides[i] == name)) {
+            if (found >= 0) {
+                throw std::runtime_error("Both " + _names[found] + " and " + _names[i] + " provide " + name);
+            }
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Resolve everyone's inputs, and work out the levels and the order to run the algorithms in
+ */
+void AlgorithmGraph::sort() {
+    int const n = size();
+    for (int i = 0; i != n; ++i) {      // check for duplicates, even those that nobody asks for
+        _find(_names[i]);
+        if (_provides[i] != "") {
+            _find(_provides[i]);
+        }
+    }
+
+    _inputs.assign(n, std::vector<int>());
+    for (int i = 0; i != n; ++i) {
+        for (unsigned int j = 0; j != _inputNames[i].size(); ++j) {
+            _inputs[i].push_back(_find(_inputNames[i][j]));
+        }
+    }
+    //
+    // Assign levels by relaxation;  if an algorithm's level reaches n there must be a cycle
+    //
+    _levels.assign(n, 0);
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int i = 0; i != n; ++i) {
+            for (unsigned int j = 0; j != _inputs[i].size(); ++j) {
+                int const in = _inputs[i][j];
+                if (in >= 0 && _levels[i] <= _levels[in]) {
+                    _levels[i] = _levels[in] + 1;
+                    if (_levels[i] >= n) {
+                        throw std::runtime_error("The inputs of algorithm " + _names[i] + " form a cycle");
+                    }
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    _nLevel = 0;
+    _order.clear();
+    for (int level = 0; static_cast<int>(_order.size()) != n; ++level) {
+        for (int i = 0; i != n; ++i) {
+            if (_levels[i] == level) {
+                _order.push_back(i);
+            }
+        }
+        _nLevel = level + 1;
+    }
+}
+
+/// Split a list of names separated by spaces and/or commas
+std::vector<std::string> AlgorithmGraph::split(std::string const& names) {
+    std::vector<std::string> words;
+    std::string::size_type end = 0;
+    for (;;) {
+        std::string::size_type const begin = names.find_first_not_of(" ,", end);
+        if (begin == std::string::npos) {
+            break;
+        }
+        end = names.find_first_of(" ,", begin);
+        words.push_back(names.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+    }
+
+    return words;
+}
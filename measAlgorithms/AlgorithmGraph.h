@@ -0,0 +1,135 @@
+// -*- lsst-c++ -*-
+#if !defined(ALGORITHM_GRAPH_H)
+#define ALGORITHM_GRAPH_H 1
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "boost/make_shared.hpp"
+#include "boost/shared_ptr.hpp"
+
+/**
+ * The order in which to run a set of measurement algorithms, given what each needs from the others
+ *
+ * Each algorithm has a name, may provide a more general name for what it measures (e.g. "gaussian"
+ * provides "centroid"), and may ask for the results of other algorithms by either sort of name.  An input
+ * that none of the algorithms provides is simply missing (the algorithm must cope without it);  it's an
+ * error for two algorithms to provide the same thing, or for inputs to form a cycle.
+ *
+ * Each algorithm's level is one more than the largest level of its inputs (0 if it has none), so
+ * algorithms with the same level don't depend on one another and may be run at the same time
+ */
+class AlgorithmGraph {
+public:
+    AlgorithmGraph() : _names(), _provides(), _inputNames(), _inputs(), _levels(), _order(), _nLevel(0) {}
+
+    int add(std::string const& name, std::vector<std::string> const& inputs, std::string const& provides="");
+    void sort();
+
+    /// Return the number of algorithms
+    int size() const { return _names.size(); }
+    /// Return the name of the i'th algorithm
+    std::string const& getName(int i) const { return _names[i]; }
+    /// Return the algorithms in an order that puts every algorithm after its inputs
+    std::vector<int> const& getOrder() const { return _order; }
+    /// Return the algorithms that provide the i'th algorithm's inputs, in the order asked for (-1 if missing)
+    std::vector<int> const& getInputs(int i) const { return _inputs[i]; }
+    /// Return the level of the i'th algorithm
+    int getLevel(int i) const { return _levels[i]; }
+    /// Return the number of levels
+    int getNLevel() const { return _nLevel; }
+
+    static std::vector<std::string> split(std::string const& names);
+private:
+    std::vector<std::string> _names;
+    std::vector<std::string> _provides;
+    std::vector<std::vector<std::string> > _inputNames;
+    // Set by sort()
+    std::vector<std::vector<int> > _inputs;
+    std::vector<int> _levels;
+    std::vector<int> _order;
+    int _nLevel;
+
+    int _find(std::string const& name) const;
+};
+
+/************************************************************************************************************/
+/**
+ * The results of the algorithms that an algorithm asked for as its inputs, in the order that it asked for
+ * them.  This is a view of the results of all the algorithms measuring the current peak
+ */
+class AlgorithmInputs {
+public:
+    /// One algorithm's result, and the type of measurement that it is (e.g. Astrometry)
+    struct Result {
+        Result() : value(), type(0) {}
+        template<typename U>
+        explicit Result(boost::shared_ptr<U> const& value_) : value(value_), type(&typeid(U)) {}
+
+        boost::shared_ptr<void> value;
+        std::type_info const* type;
+    };
+
+    AlgorithmInputs() : _results(0), _indices(0), _n(0), _stride(1), _previous(0) {}
+    /**
+     * The inputs are results[stride*indices[0]], results[stride*indices[1]], ...;  a negative index is a
+     * missing input.  If previous isn't NULL, it's the algorithm's own result for an earlier peak
+     * (\sa makeResult)
+     */
+    AlgorithmInputs(Result const* results, int const* indices, int n, int stride=1,
+                    Result const* previous=0) :
+        _results(results), _indices(indices), _n(n), _stride(stride), _previous(previous) {}
+
+    /// Return the number of inputs that the algorithm asked for
+    int size() const { return _n; }
+
+    /**
+     * Return the i'th input, or an empty pointer if it's missing
+     *
+     * U must be the type of measurement (e.g. Astrometry) that the algorithm providing the input makes
+     */
+    template<typename U>
+    boost::shared_ptr<U const> get(int i) const {
+        if (i < 0 || i >= _n || _indices[i] < 0 || !_results[_stride*_indices[i]].value) {
+            return boost::shared_ptr<U const>();
+        }
+        Result const& result = _results[_stride*_indices[i]];
+        if (*result.type != typeid(U)) {
+            std::ostringstream msg;
+            msg << "Input " << i << " is a " << result.type->name() << " not a " << typeid(U).name();
+            throw std::runtime_error(msg.str());
+        }
+
+        return boost::static_pointer_cast<U const>(result.value);
+    }
+
+    /**
+     * Return a U in which to put the algorithm's result:  its result for an earlier peak if that's a U that
+     * nobody else is using any longer, otherwise a new (default-constructed) U
+     *
+     * Reusing results means that measuring needn't allocate memory once every algorithm has a previous
+     * result (\sa MeasureSources::measureInto);  so the algorithm must set all of U's values
+     */
+    template<typename U>
+    boost::shared_ptr<U> makeResult() const {
+        typedef typename U::QuantityType Quantity; // e.g. Photometry;  what a Result holds
+        if (_previous && _previous->value.unique() && *_previous->type == typeid(Quantity)) {
+            boost::shared_ptr<Quantity> const previous = boost::static_pointer_cast<Quantity>(_previous->value);
+            if (typeid(*previous) == typeid(U)) {
+                return boost::static_pointer_cast<U>(previous);
+            }
+        }
+
+        return boost::make_shared<U>();
+    }
+private:
+    Result const* _results;
+    int const* _indices;
+    int _n;
+    int _stride;
+    Result const* _previous;
+};
+
+#endif
@@ -2,12 +2,16 @@
 /************************************************************************************************************/
 /**
  * Implement aperture photometry.  We have an extra data member which we want to appear in the schema;
- * if we didn't it could just be a regular (private?) data member 
+ * if we didn't it could just be a regular (private?) data member
  *
  * We only need to provide a separate header file so that we can perform the dynamic cast in main
  * to call getRadius();  if we were willing to say photom->get("radius") instead this wouldn't be necessary
  */
+#include <algorithm>
+#include <cmath>
+#include "boost/atomic.hpp"
 #include "AperturePhotometry.h"
+#include "Astrometry.h"
 
 /************************************************************************************************************/
 /// Virtual function called by operator<< to dynamically dispatch the type to a stream
@@ -24,32 +28,185 @@ std::ostream &AperturePhotometry::output(std::ostream &os ///< the output stream
 }
 
 /************************************************************************************************************/
+
+namespace {
+    /// The configured radii, and whether they may still be changed
+    struct RadiiConfig {
+        RadiiConfig() : frozen(false) {
+            radii.push_back(6.66);
+            radii.push_back(7.66);
+            radii.push_back(8.66);
+        }
+
+        std::vector<float> radii;
+        boost::atomic<bool> frozen;     // have the radii been used?  Read by every measurement, in any thread
+    };
+
+    RadiiConfig &radiiConfig() {
+        static RadiiConfig config;
+
+        return config;
+    }
+}
+
+/**
+ * Set the radii (in pixels) of the apertures to measure
+ *
+ * Must be called before the first AperturePhotometry is created (the radii are baked into the schema and
+ * the cached aperture weights), and before any threads are started.  There may be up to MAX_NRADIUS radii
+ */
+void AperturePhotometry::setRadii(std::vector<float> const& radii) {
+    RadiiConfig &config = radiiConfig();
+    if (config.frozen) {
+        throw std::runtime_error("You may not change the aperture radii once they have been used");
+    }
+    if (radii.empty()) {
+        throw std::runtime_error("Please specify at least one aperture radius");
+    }
+    if (radii.size() > MAX_NRADIUS) {
+        std::ostringstream msg;
+        msg << "Please specify no more than " << MAX_NRADIUS << " aperture radii, not " << radii.size();
+        throw std::runtime_error(msg.str());
+    }
+    for (unsigned int i = 0; i != radii.size(); ++i) {
+        if (!(radii[i] > 0)) {
+            std::ostringstream msg;
+            msg << "Invalid aperture radius " << radii[i];
+            throw std::runtime_error(msg.str());
+        }
+    }
+
+    config.radii = radii;
+}
+
+/// Return the radii (in pixels) of the apertures
+std::vector<float> const& AperturePhotometry::getRadii() {
+    return radiiConfig().radii;
+}
+
 /**
- * Process the image; calculate values
+ * Return the radii, forbidding any further calls to setRadii()
+ *
+ * Called by every measurement, from all the pool's threads, so the flag is only written the first time;
+ * after that each thread just reads it, and the cache line isn't passed between cores
  */
-template<typename ImageT>
-Photometry::Ptr AperturePhotometry::doMeasure(typename ImageT::ConstPtr im, Peak const&) {
-    /// Measure your fluxes here
-    std::vector<float> rad(AperturePhotometry::NRADIUS);
-    std::vector<double> flux(AperturePhotometry::NRADIUS);
-    std::vector<float> fluxErr(AperturePhotometry::NRADIUS);
+std::vector<float> const& AperturePhotometry::_freezeRadii() {
+    RadiiConfig &config = radiiConfig();
+    if (!config.frozen.load(boost::memory_order_relaxed)) {
+        config.frozen.store(true);
+    }
 
-    double const val = *im;
-    rad[0] =       6.66; flux[0] = val;     fluxErr[0] = -1;
-    rad[1] = rad[0] + 1; flux[1] = 1.1*val; fluxErr[1] = -1;
-    rad[2] = rad[1] + 1; flux[2] = 1.2*val; fluxErr[2] = -1;
+    return config.radii;
+}
+
+/************************************************************************************************************/
+
+namespace {
+    /// Return \int_0^u sqrt(r^2 - t^2) dt, the area under a circle of radius r between 0 and u (<= r)
+    double chordIntegral(double r, double u) {
+        return 0.5*(u*std::sqrt(std::max(0.0, r*r - u*u)) + r*r*std::asin(std::min(1.0, u/r)));
+    }
+
+    /**
+     * Return the (signed) area of the intersection of a circle of radius r centred at the origin
+     * with the rectangle [0, x] x [0, y].  The area is odd in both x and y
+     */
+    double quadrantArea(double r, double x, double y) {
+        if (x < 0) {
+            return -quadrantArea(r, -x, y);
+        } else if (y < 0) {
+            return -quadrantArea(r, x, -y);
+        }
+
+        double const xm = std::min(x, r);
+        double const tStar = (y < r) ? std::sqrt(r*r - y*y) : 0.0; // the circle is above y for |t| < tStar
+        if (xm <= tStar) {
+            return xm*y;
+        }
+        return tStar*y + chordIntegral(r, xm) - chordIntegral(r, tStar);
+    }
+
+    /// Return the area of the pixel [x0, x1] x [y0, y1] that's within r of the origin
+    double pixelArea(double r, double x0, double x1, double y0, double y1) {
+        return quadrantArea(r, x1, y1) - quadrantArea(r, x0, y1) - quadrantArea(r, x1, y0) +
+            quadrantArea(r, x0, y0);
+    }
+}
+
+namespace aperturePhotometry {
+    Weights::Weights(std::vector<float> const& radii) :
+        _nRadius(radii.size()), _halfWidth(_nRadius), _firstRow(_nRadius), _rows(), _weights()
+    {
+        std::vector<float> row;
+        for (int ir = 0; ir != _nRadius; ++ir) {
+            double const r = radii[ir];
+            int const hw = static_cast<int>(std::ceil(r + 0.5));
+            _halfWidth[ir] = hw;
+            _firstRow[ir] = _rows.size();
+
+            row.resize(2*hw + 1);
+            for (int by = 0; by != NSUB; ++by) {
+                double const dy = (by + 0.5)/NSUB - 0.5; // centre's offset from the middle of its pixel
+                for (int bx = 0; bx != NSUB; ++bx) {
+                    double const dx = (bx + 0.5)/NSUB - 0.5;
+                    for (int j = -hw; j <= hw; ++j) {
+                        int first = -1, last = -2;
+                        for (int i = -hw; i <= hw; ++i) {
+                            double const w = pixelArea(r, i - 0.5 - dx, i + 0.5 - dx, j - 0.5 - dy, j + 0.5 - dy);
+                            row[i + hw] = (w > 0) ? w : 0;
+                            if (w > 0) {
+                                if (first < 0) {
+                                    first = i + hw;
+                                }
+                                last = i + hw;
+                            }
+                        }
+
+                        double area = 0;
+                        for (int i = first; i <= last; ++i) {
+                            area += row[i];
+                        }
+                        Row const desc = { first - hw, last - first + 1, static_cast<int>(_weights.size()),
+                                           area };
+                        _rows.push_back(desc);
+                        if (desc.n > 0) {
+                            _weights.insert(_weights.end(), row.begin() + first, row.begin() + last + 1);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Return the weights for the configured radii, calculating them on first use
+aperturePhotometry::Weights const& AperturePhotometry::_getWeights() {
+    static aperturePhotometry::Weights const weights(_freezeRadii());
+
+    return weights;
+}
+
+/************************************************************************************************************/
+/// Return the half-width of the cutout needed to hold the largest aperture, wherever the centroid is
+int AperturePhotometry::getHalfWidth() {
+    std::vector<float> const& radii = getRadii();
 
-    return boost::make_shared<AperturePhotometry>(rad, flux, fluxErr);
+    return static_cast<int>(std::ceil(*std::max_element(radii.begin(), radii.end()) + 0.5)) +
+        Astrometry::MAX_CENTROID_SHIFT;
 }
 
 /************************************************************************************************************/
 /**
  * Declare the existence of an "aper" algorithm
  */
-#define INSTANTIATE(TYPE) \
-    MeasurePhotometry<Image<TYPE> >::declare("aper", &AperturePhotometry::doMeasure<Image<TYPE> >)
+#define INSTANTIATE(IMAGE_T) \
+    MeasurePhotometry<IMAGE_T >::declare(AperturePhotometry::getName(), \
+                                         &AperturePhotometry::doMeasure<IMAGE_T >, \
+                                         &AperturePhotometry::getHalfWidth, "centroid")
 
 volatile bool isInstance[] = {
-    INSTANTIATE(float),
-    INSTANTIATE(double)
+    INSTANTIATE(Image<float>),
+    INSTANTIATE(Image<double>),
+    INSTANTIATE(MaskedImage<float>),
+    INSTANTIATE(MaskedImage<double>)
 };
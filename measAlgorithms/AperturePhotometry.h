@@ -1,11 +1,144 @@
 // -*- lsst-c++ -*-
 #if !defined(APERTURE_PHOTOMETRY_H)
 #define APERTURE_PHOTOMETRY_H 1
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Astrometry.h"
+#include "MaskedImage.h"
 #include "Photometry.h"
+#include "Simd.h"
+
+/************************************************************************************************************/
+
+namespace aperturePhotometry {
+    /**
+     * The weights for a set of circular apertures:  the area of each pixel that lies within the aperture
+     *
+     * A source's centre is usually not at the centre of a pixel, so we tabulate the weights for NSUB x NSUB
+     * sub-pixel offsets and use the table whose offset is closest to the source's position.  For each
+     * radius, offset, and row of the stamp we only keep the run of pixels with non-zero weight
+     */
+    class Weights {
+    public:
+        enum { NSUB = 8 };              // number of sub-pixel offsets tabulated along each axis
+
+        /// The non-zero weights in one row of an aperture
+        struct Row {
+            int x0;                     // column of w[0], relative to the pixel containing the centre
+            int n;                      // number of weights
+            int offset;                 // index of w[0] in _weights
+            double area;                // sum of the weights
+        };
+
+        explicit Weights(std::vector<float> const& radii);
+
+        template<typename T>
+        void sum(Image<T> const& im, Image<T> const* variance, Image<MaskPixel> const* mask,
+                 double xc, double yc, double *flux, double *fluxVar, double *area, int *nUnusable) const;
+    private:
+        int _nRadius;
+        std::vector<int> _halfWidth;    // half-width of the stamp for each radius
+        std::vector<int> _firstRow;     // index in _rows of each radius's first row at offset (0, 0)
+        std::vector<Row> _rows;
+        std::vector<float> _weights;
+
+        /// Are any of the n pixels of mask unusable?
+        static bool _isUnusable(MaskPixel const* mask, int n) {
+            MaskPixel any = 0;
+            for (int i = 0; i != n; ++i) {
+                any |= mask[i];
+            }
+            return (any & maskedImage::UNUSABLE) != 0;
+        }
+
+        /// Return the Row describing row j (in [-halfWidth, halfWidth]) of radius ir with offset (bx, by)
+        Row const& _getRow(int ir, int bx, int by, int j) const {
+            int const size = 2*_halfWidth[ir] + 1;
+            return _rows[_firstRow[ir] + (by*NSUB + bx)*size + j + _halfWidth[ir]];
+        }
+    };
+
+    /**
+     * Sum the pixels in each aperture centred at (xc, yc) (in im's pixel coordinates), along with their
+     * variances if variance is non-NULL, and the area (the sum of the weights) that was used
+     *
+     * We make one pass over the rows of the largest aperture, accumulating all the radii from each row
+     * while it's in cache.  Pixels that fall off the image are ignored, as are pixels that mask (if
+     * non-NULL) says are unusable;  nUnusable counts the latter in each aperture
+     */
+    template<typename T>
+    void Weights::sum(Image<T> const& im, Image<T> const* variance, Image<MaskPixel> const* mask,
+                      double xc, double yc,
+                      double *flux, double *fluxVar, double *area, int *nUnusable) const {
+        int const ix = static_cast<int>(std::floor(xc + 0.5));
+        int const iy = static_cast<int>(std::floor(yc + 0.5));
+        int const bx = std::min(static_cast<int>((xc - ix + 0.5)*NSUB), NSUB - 1);
+        int const by = std::min(static_cast<int>((yc - iy + 0.5)*NSUB), NSUB - 1);
+
+        int hwMax = 0;
+        for (int ir = 0; ir != _nRadius; ++ir) {
+            flux[ir] = fluxVar[ir] = area[ir] = 0;
+            nUnusable[ir] = 0;
+            hwMax = std::max(hwMax, _halfWidth[ir]);
+        }
+
+        int const width = im.getWidth();
+        int const j0 = std::max(-hwMax, -iy);
+        int const j1 = std::min(hwMax, im.getHeight() - 1 - iy);
+        for (int j = j0; j <= j1; ++j) {
+            T const* pix = im.getRow(iy + j);
+            T const* var = variance ? variance->getRow(iy + j) : 0;
+            MaskPixel const* msk = mask ? mask->getRow(iy + j) : 0;
+
+            for (int ir = 0; ir != _nRadius; ++ir) {
+                if (j < -_halfWidth[ir] || j > _halfWidth[ir]) {
+                    continue;
+                }
+                Row const& row = _getRow(ir, bx, by, j);
+                int const x0 = ix + row.x0;
+                int const lo = std::max(0, x0);
+                int const hi = std::min(width, x0 + row.n);
+                if (hi <= lo) {
+                    continue;
+                }
+                float const* w = &_weights[row.offset + lo - x0];
+                if (msk && _isUnusable(msk + lo, hi - lo)) { // sum the usable pixels one by one
+                    for (int i = 0; i != hi - lo; ++i) {
+                        if (msk[lo + i] & maskedImage::UNUSABLE) {
+                            ++nUnusable[ir];
+                        } else {
+                            flux[ir] += w[i]*pix[lo + i];
+                            if (var) {
+                                fluxVar[ir] += w[i]*w[i]*var[lo + i];
+                            }
+                            area[ir] += w[i];
+                        }
+                    }
+                    continue;
+                }
+                simd::weightedSum(w, pix + lo, var ? var + lo : 0, hi - lo, &flux[ir], &fluxVar[ir]);
+                if (hi - lo == row.n) {
+                    area[ir] += row.area;
+                } else {                // the row's clipped by the edge of the image
+                    for (int i = 0; i != hi - lo; ++i) {
+                        area[ir] += w[i];
+                    }
+                }
+            }
+        }
+    }
+}
 
 /**
  * Implement aperture photometry.  We include the radius in the schema, and also provide
  * an accessor function
+ *
+ * The radii (in pixels) are set by setRadii() before the first AperturePhotometry is created, and their
+ * number sets the dimension of the flux, fluxErr, radius, and flags arrays in the schema.  As that isn't
+ * known at compile time the slots are [0, n) for flux, [n, 2n) for fluxErr, [2n, 3n) for radius, and
+ * [3n, 4n) for flags.
+ * doMeasure is defined here, so that StaticMeasurePhotometry can inline it
  */
 #if defined(__ICC)
 #pragma warning (push)
@@ -14,65 +147,144 @@
 
 class AperturePhotometry : public Photometry
 {
-public:
-    enum { NRADIUS = 3 };               // dimension of RADIUS array
-private:
-    /// We need a new, unused, index to save the radius in.  [0, Photometry::NVALUE) are already taken
-    enum { FLUX=Photometry::FLUX,
-           FLUX_ERR = FLUX     + NRADIUS,
-           RADIUS   = FLUX_ERR + NRADIUS,
-           NVALUE   = RADIUS   + NRADIUS };
 public:
     typedef boost::shared_ptr<AperturePhotometry> Ptr;
     typedef boost::shared_ptr<AperturePhotometry const> ConstPtr;
 
+    enum { MAX_NRADIUS = 32 };          // the most radii that may be set
+
+    /// The bits that may be set in each aperture's flags
+    enum {
+        BAD_PIXELS = 0x1                // some pixels were masked (\sa maskedImage::UNUSABLE) so not used
+    };
+
+    /// Create an AperturePhotometry;  the values are undefined until setValues() is called
+    AperturePhotometry() {
+        init(this);                     // This allocates space for everything in the schema
+    }
     /// Create an AperturePhotometry to record our measurements
-    AperturePhotometry(std::vector<float> const& radius,
-                       std::vector<double> const& flux,
+    AperturePhotometry(std::vector<double> const& flux,
                        std::vector<float> const& fluxErr) {
-        init();                         // This allocates space for everything in the schema
+        init(this);
 
-        assert(radius.size() == NRADIUS);
-        for (int i = 0; i != NRADIUS; ++i) {
-            set<RADIUS>(i, radius[i]);
-            set<FLUX>(i, flux[i]);
-            set<FLUX_ERR>(i, fluxErr[i]);
+        assert(flux.size() == getRadii().size() && fluxErr.size() == getRadii().size());
+        setValues(&flux[0], &fluxErr[0]);
+    }
+    /**
+     * Set our values, e.g. when reusing an AperturePhotometry (\sa AlgorithmInputs::makeResult)
+     *
+     * flux, fluxErr, and flags (if non-NULL;  otherwise the flags are 0) have a value for each radius
+     */
+    void setValues(double const* flux, float const* fluxErr, int const* flags=0) {
+        std::vector<float> const& radius = getRadii();
+        int const nRadius = radius.size();
+        for (int i = 0; i != nRadius; ++i) {
+            setSlot(FLUX + i, flux[i]);
+            setSlot(FLUX + nRadius + i, fluxErr[i]);
+            setSlot(FLUX + 2*nRadius + i, radius[i]);
+            setSlot(FLUX + 3*nRadius + i, flags ? flags[i] : 0);
         }
     }
 
     /// Add desired fields to the schema
     virtual void defineSchema(Schema::Ptr schema ///< our schema; == AperturePhotometry::_mySchema
                       ) {
-        schema->add(SchemaEntry("flux",    FLUX,     Schema::DOUBLE, NRADIUS));
-        schema->add(SchemaEntry("fluxErr", FLUX_ERR, Schema::FLOAT,  NRADIUS));
-        schema->add(SchemaEntry("radius",  RADIUS,   Schema::FLOAT,  NRADIUS, "arcsec"));
+        int const nRadius = _freezeRadii().size();
+
+        schema->add(SchemaEntry("flux",    FLUX,               Schema::DOUBLE, nRadius));
+        schema->add(SchemaEntry("fluxErr", FLUX + nRadius,     Schema::FLOAT,  nRadius));
+        schema->add(SchemaEntry("radius",  FLUX + 2*nRadius,   Schema::FLOAT,  nRadius, "pixel"));
+        schema->add(SchemaEntry("flags",   FLUX + 3*nRadius,   Schema::INT,    nRadius));
     }
 
+    /// Return the name that we're registered under
+    static char const* getName() { return "aper"; }
     template<typename ImageT>
-    static Photometry::Ptr doMeasure(typename ImageT::ConstPtr im, Peak const&);
+    static void doMeasure(Cutout<ImageT> const& cutout, Peak const& peak, AlgorithmInputs const& inputs,
+                          AperturePhotometry *val);
+    /// Measure peak, returning a new result or reusing our previous one (\sa AlgorithmInputs::makeResult)
+    template<typename ImageT>
+    static Photometry::Ptr doMeasure(Cutout<ImageT> const& cutout, Peak const& peak,
+                                     AlgorithmInputs const& inputs) {
+        AperturePhotometry::Ptr val = inputs.makeResult<AperturePhotometry>();
+        doMeasure(cutout, peak, inputs, val.get());
+        return val;
+    }
+    static int getHalfWidth();
+
+    static void setRadii(std::vector<float> const& radii);
+    static std::vector<float> const& getRadii();
 
     /// Return the number of radii
     int getNRadius() const {
-        return NRADIUS;
+        return getRadii().size();
     }
 
     /// Return the flux
     double getFlux(int i) const {
-        return get<FLUX, double>(i);
+        return getSlot<double>(FLUX + i);
     }
     /// Return the error in the flux
     float getFluxErr(int i) const {
-        return get<FLUX_ERR, float>(i);
+        return getSlot<float>(FLUX + getNRadius() + i);
     }
     /// Return the radius
     float getRadius(int i) const {
-        return get<RADIUS, float>(i);
+        return getSlot<float>(FLUX + 2*getNRadius() + i);
+    }
+    /// Return the flags;  a bitwise OR of BAD_PIXELS etc.
+    int getFlags(int i) const {
+        return getSlot<int>(FLUX + 3*getNRadius() + i);
     }
-    
+
     virtual std::ostream &output(std::ostream &os) const;
+private:
+    static std::vector<float> const& _freezeRadii();
+    static aperturePhotometry::Weights const& _getWeights();
 };
 #if defined(__ICC)
 #pragma warning (pop)
 #endif
 
+/************************************************************************************************************/
+/**
+ * Process the image; calculate values
+ *
+ * The apertures are centred on the centroid (our input), if there is one, and the sky
+ * (\sa Cutout::getBackground) is subtracted from each aperture's sum.  Pixels that are masked as unusable
+ * are left out of both the sum and the area used for the sky, and set BAD_PIXELS in the aperture's flags.
+ * The errors come from the image's variance plane, summed in the same pass as the fluxes;  if there's no
+ * variance plane they're set to -1.  The answer is written to val
+ */
+template<typename ImageT>
+void AperturePhotometry::doMeasure(Cutout<ImageT> const& cutout, Peak const& peak,
+                                   AlgorithmInputs const& inputs, AperturePhotometry *val) {
+    Image<typename ImageT::Pixel> const& im = cutout.getImage();
+    std::vector<float> const& radii = _freezeRadii();
+    int const nRadius = radii.size();
+
+    double xc = 0, yc = 0;
+    Astrometry::getPosition(inputs.get<Astrometry>(0), peak, &xc, &yc);
+
+    double sum[MAX_NRADIUS], sumVar[MAX_NRADIUS], area[MAX_NRADIUS];
+    int nUnusable[MAX_NRADIUS];
+    Image<MaskPixel> const* mask = cutout.hasUnusablePixels(0, im.getHeight() - 1) ? cutout.getMask() : 0;
+    _getWeights().sum(im, cutout.getVariance(), mask, xc - im.getX0(), yc - im.getY0(),
+                      sum, sumVar, area, nUnusable);
+
+    double const background = cutout.getBackground();
+    for (int ir = 0; ir != nRadius; ++ir) {
+        sum[ir] -= background*area[ir];
+    }
+
+    float fluxErr[MAX_NRADIUS];
+    int flags[MAX_NRADIUS];
+    for (int ir = 0; ir != nRadius; ++ir) {
+        fluxErr[ir] = cutout.getVariance() ? std::sqrt(sumVar[ir]) : -1.0;
+        flags[ir] = (nUnusable[ir] > 0) ? BAD_PIXELS : 0;
+    }
+
+    val->setValues(sum, fluxErr, flags);
+}
+
 #endif
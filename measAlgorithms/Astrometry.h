@@ -19,6 +19,10 @@ public:
     typedef boost::shared_ptr<Astrometry> Ptr;
     typedef boost::shared_ptr<Astrometry const> ConstPtr;
 
+    /// Centroiders don't move more than this (in pixels) from the peak;  algorithms that are given a
+    /// centroid allow this much extra room in their cutouts
+    enum { MAX_CENTROID_SHIFT = 2 };
+
     /// Add desired members to the schema
     virtual void defineSchema(Schema::Ptr schema) {
         schema->add(SchemaEntry("x", X, Schema::DOUBLE, 1, "pixel"));
@@ -47,6 +51,26 @@ public:
     virtual std::ostream &output(std::ostream &os) const {
         return os << "(" << getX() << "+-" << getXErr() << ", " << getY() << "+-" << getYErr() << ")";
     }
+
+    /**
+     * Return the position at which to measure an object:  the centroid, unless it's missing, NaN, or
+     * more than MAX_CENTROID_SHIFT from the peak, in which case the peak
+     */
+    static void getPosition(ConstPtr centroid, ///< the object's centroid (may be empty)
+                            Peak const& peak,  ///< the object's peak
+                            double *x,         ///< the column to use
+                            double *y          ///< the row to use
+                           ) {
+        *x = peak.getX();
+        *y = peak.getY();
+        if (centroid) {
+            double const cx = centroid->getX(), cy = centroid->getY();
+            if (std::fabs(cx - *x) <= MAX_CENTROID_SHIFT && std::fabs(cy - *y) <= MAX_CENTROID_SHIFT) {
+                *x = cx;                // n.b. NaNs fail the test
+                *y = cy;
+            }
+        }
+    }
 };
 /**
  * Here's the object that remembers and can execute our choice of astrometric algorithms
@@ -0,0 +1,383 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cfloat>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "boost/bind/bind.hpp"
+
+#include "Background.h"
+#include "Simd.h"
+
+namespace {
+    /**
+     * Return the k'th smallest of data[0, n);  data and scratch[0, 2n) are overwritten
+     *
+     * A quickselect, with the partitioning done by simd::partition:  each pass copies the values less than
+     * the pivot to one buffer and those greater than it to another, so we cycle through three buffers
+     */
+    float select(float *data, int n, int k, float *scratch) {
+        float *bufs[3] = { data, scratch, scratch + n };
+        int cur = 0;
+        while (n > 32) {
+            float const* src = bufs[cur];
+            float const a = src[0], b = src[n/2], c = src[n - 1];
+            float const pivot = std::max(std::min(a, b), std::min(std::max(a, b), c)); // median of three
+            int const below = (cur + 1)%3, above = (cur + 2)%3;
+            int nBelow = 0, nAbove = 0;
+            simd::partition(src, n, pivot, bufs[below], &nBelow, bufs[above], &nAbove);
+
+            if (k < nBelow) {
+                cur = below;
+                n = nBelow;
+            } else if (k >= n - nAbove) {
+                k -= n - nAbove;
+                cur = above;
+                n = nAbove;
+            } else {
+                return pivot;           // k is one of the values equal to the pivot
+            }
+        }
+
+        std::nth_element(bufs[cur], bufs[cur] + k, bufs[cur] + n);
+        return bufs[cur][k];
+    }
+
+    /**
+     * Return the sigma-clipped median of pix[0, n), or NaN if n == 0
+     *
+     * The width of the distribution is estimated from the interquartile range, so a few bright pixels don't
+     * inflate it.  pix and clipped[0, n) are overwritten, and work must have room for 3n values
+     */
+    double clippedMedian(float *pix, int n, double nSigma, int nIter, float *clipped, float *work) {
+        if (n == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        for (int iter = 0; ; ++iter) {
+            std::copy(pix, pix + n, work);
+            float const median = select(work, n, n/2, work + n);
+            if (iter == nIter) {
+                return median;
+            }
+            std::copy(pix, pix + n, work);
+            float const q1 = select(work, n, n/4, work + n);
+            std::copy(pix, pix + n, work);
+            float const q3 = select(work, n, (3*n)/4, work + n);
+
+            double const sigma = (q3 - q1)/1.349; // the interquartile range of a Gaussian is 1.349 sigma
+            int const nGood = simd::clip(pix, n, median - nSigma*sigma, median + nSigma*sigma, clipped);
+            if (nGood == n) {
+                return median;
+            }
+            std::swap(pix, clipped);
+            n = nGood;
+        }
+    }
+
+    /**
+     * A natural cubic spline through n knots x[i];  the knots are fixed, so the tridiagonal system that
+     * gives the second derivatives is factored once and then used for any values at the knots
+     */
+    class Spline {
+    public:
+        /// The weights that give the spline at a point:  a*y[lo] + b*y[hi] + c*d2[lo] + d*d2[hi]
+        struct Weights {
+            int lo, hi;
+            double a, b, c, d;
+        };
+
+        Spline(double const* x, int n) : _x(x), _n(n), _sig(n, 0.0), _beta(n, 0.0), _invP(n, 0.0),
+                                         _invH(n, 0.0), _sixOverSpan(n, 0.0), _u(n, 0.0) {
+            for (int i = 0; i < n - 1; ++i) {
+                _invH[i] = 1/(x[i + 1] - x[i]);
+            }
+            for (int i = 1; i < n - 1; ++i) {
+                _sig[i] = (x[i] - x[i - 1])/(x[i + 1] - x[i - 1]);
+                _invP[i] = 1/(_sig[i]*_beta[i - 1] + 2);
+                _beta[i] = (_sig[i] - 1)*_invP[i];
+                _sixOverSpan[i] = 6/(x[i + 1] - x[i - 1]);
+            }
+        }
+
+        /// Set d2[0, n) to the second derivatives of the spline through the values y[0, n)
+        void fit(double const* y, double *d2) {
+            std::fill(d2, d2 + _n, 0.0);
+            if (_n < 3) {
+                return;                 // constant or linear
+            }
+
+            _u[0] = 0;
+            for (int i = 1; i < _n - 1; ++i) {
+                double const dSlope = (y[i + 1] - y[i])*_invH[i] - (y[i] - y[i - 1])*_invH[i - 1];
+                _u[i] = (_sixOverSpan[i]*dSlope - _sig[i]*_u[i - 1])*_invP[i];
+            }
+            for (int i = _n - 2; i > 0; --i) {
+                d2[i] = _beta[i]*d2[i + 1] + _u[i];
+            }
+        }
+
+        /**
+         * Return the weights for the spline at xx;  beyond the first and last knots it's continued as a
+         * straight line (a natural spline's second derivative is zero at its ends)
+         */
+        Weights getWeights(double xx) const {
+            double const* x = _x;
+            int const n = _n;
+            Weights w = { 0, 0, 1, 0, 0, 0 };
+            if (n == 1) {
+                return w;
+            }
+
+            if (xx <= x[0]) {
+                double const h = x[1] - x[0], t = (xx - x[0])/h;
+                Weights const left = { 0, 1, 1 - t, t, 0, -t*h*h/6 };
+                w = left;
+            } else if (xx >= x[n - 1]) {
+                double const h = x[n - 1] - x[n - 2], t = (xx - x[n - 1])/h;
+                Weights const right = { n - 2, n - 1, -t, 1 + t, t*h*h/6, 0 };
+                w = right;
+            } else {
+                int const lo = std::min(static_cast<int>(std::upper_bound(x, x + n, xx) - x) - 1, n - 2);
+                double const h = x[lo + 1] - x[lo];
+                double const a = (x[lo + 1] - xx)/h, b = (xx - x[lo])/h;
+                Weights const inside = { lo, lo + 1, a, b, (a*a*a - a)*h*h/6, (b*b*b - b)*h*h/6 };
+                w = inside;
+            }
+            return w;
+        }
+
+        /// Evaluate the spline with values y and second derivatives d2 (\sa fit) at the point described by w
+        static double evaluate(Weights const& w, double const* y, double const* d2) {
+            return w.a*y[w.lo] + w.b*y[w.hi] + w.c*d2[w.lo] + w.d*d2[w.hi];
+        }
+    private:
+        double const* _x;
+        int _n;
+        std::vector<double> _sig, _beta, _invP; // the factored system
+        std::vector<double> _invH;      // 1/(x[i + 1] - x[i])
+        std::vector<double> _sixOverSpan; // 6/(x[i + 1] - x[i - 1])
+        std::vector<double> _u;         // scratch for fit()
+    };
+}
+
+/************************************************************************************************************/
+/**
+ * Model the sky in im
+ */
+template<typename ImageT>
+Background::Background(ImageT const& im, ///< The image to model
+                       int cellSize,     ///< Side of the cells whose sky is measured (pixels)
+                       double nSigma,    ///< Clip pixels more than nSigma from the median
+                       int nIter         ///< Number of clipping iterations
+                      ) :
+    _bbox(im.getBBox()), _cellSize(cellSize), _nSigma(nSigma), _nIter(nIter), _nCellX(0), _nCellY(0),
+    _cells(), _centreX(), _centreY(), _d2x(), _nTileX(0), _nTileY(0), _tiles(), _nEvaluated(0)
+{
+    _init();
+    _measureCells(im, 0, 0, _cells.size(), 0);
+    _fit();
+}
+
+/**
+ * Model the sky in im, measuring the cells using all the threads in pool;  the model is the same as
+ * Background(im)'s
+ */
+template<typename ImageT>
+Background::Background(ImageT const& im, ///< The image to model
+                       ThreadPool &pool, ///< The threads to use
+                       int cellSize,     ///< Side of the cells whose sky is measured (pixels)
+                       double nSigma,    ///< Clip pixels more than nSigma from the median
+                       int nIter         ///< Number of clipping iterations
+                      ) :
+    _bbox(im.getBBox()), _cellSize(cellSize), _nSigma(nSigma), _nIter(nIter), _nCellX(0), _nCellY(0),
+    _cells(), _centreX(), _centreY(), _d2x(), _nTileX(0), _nTileY(0), _tiles(), _nEvaluated(0)
+{
+    _init();
+    pool.run(_cells.size(), 1, boost::bind(&Background::_measureCells<ImageT>, this, boost::cref(im), 0,
+                                           boost::placeholders::_1, boost::placeholders::_2,
+                                           boost::placeholders::_3));
+    _fit();
+}
+
+/**
+ * Model the sky in an image that may be larger than memory, reading a row of cells at a time
+ */
+template<typename T>
+Background::Background(ImageFile<T> const& file, ///< The image to model
+                       ThreadPool &pool,         ///< The threads to use
+                       int cellSize,             ///< Side of the cells whose sky is measured (pixels)
+                       double nSigma,            ///< Clip pixels more than nSigma from the median
+                       int nIter                 ///< Number of clipping iterations
+                      ) :
+    _bbox(file.getBBox()), _cellSize(cellSize), _nSigma(nSigma), _nIter(nIter), _nCellX(0), _nCellY(0),
+    _cells(), _centreX(), _centreY(), _d2x(), _nTileX(0), _nTileY(0), _tiles(), _nEvaluated(0)
+{
+    _init();
+
+    int const width = _bbox.getWidth(), height = _bbox.getHeight();
+    Image<T> band(width, std::min(_cellSize, height));
+    for (int j = 0; j != _nCellY; ++j) {
+        int const y0 = j*_cellSize;
+        file.read(BBox(0, y0, width, std::min(_cellSize, height - y0)), band);
+        if (j + 1 < _nCellY) {
+            file.prefetch(BBox(0, y0 + _cellSize, width, std::min(_cellSize, height - y0 - _cellSize)));
+        }
+        pool.run(_nCellX, 1, boost::bind(&Background::_measureCells<Image<T> >, this, boost::cref(band),
+                                         static_cast<std::size_t>(j)*_nCellX, boost::placeholders::_1,
+                                         boost::placeholders::_2, boost::placeholders::_3));
+    }
+    _fit();
+}
+
+Background::~Background() {
+    for (int i = 0; i != getNTile(); ++i) {
+        delete _tiles[i].load(boost::memory_order_relaxed);
+    }
+}
+
+/**
+ * Check our parameters and lay out the cells and tiles
+ */
+void Background::_init() {
+    if (_bbox.empty() || _cellSize <= 0 || !(_nSigma > 0) || _nIter < 0) {
+        std::ostringstream msg;
+        msg << "Invalid Background: bbox " << _bbox.getWidth() << "x" << _bbox.getHeight() <<
+            ", cellSize " << _cellSize << ", nSigma " << _nSigma << ", nIter " << _nIter;
+        throw std::runtime_error(msg.str());
+    }
+
+    int const width = _bbox.getWidth(), height = _bbox.getHeight();
+    _nCellX = (width + _cellSize - 1)/_cellSize;
+    _nCellY = (height + _cellSize - 1)/_cellSize;
+    _cells.assign(_nCellX*_nCellY, std::numeric_limits<double>::quiet_NaN());
+    //
+    // The centre of each cell;  the cells at the right and top may be smaller than the rest
+    //
+    _centreX.resize(_nCellX);
+    for (int i = 0; i != _nCellX; ++i) {
+        _centreX[i] = _bbox.getX0() + 0.5*(i*_cellSize + std::min((i + 1)*_cellSize, width) - 1);
+    }
+    _centreY.resize(_nCellY);
+    for (int j = 0; j != _nCellY; ++j) {
+        _centreY[j] = _bbox.getY0() + 0.5*(j*_cellSize + std::min((j + 1)*_cellSize, height) - 1);
+    }
+
+    _nTileX = (width + TILE_SIZE - 1)/TILE_SIZE;
+    _nTileY = (height + TILE_SIZE - 1)/TILE_SIZE;
+    _tiles.reset(new boost::atomic<Image<float> const*>[getNTile()]);
+    for (int i = 0; i != getNTile(); ++i) {
+        _tiles[i].store(0, boost::memory_order_relaxed);
+    }
+}
+
+/**
+ * Measure the sky in cells cell0 + [begin, end), which lie within im
+ */
+template<typename ImageT>
+void Background::_measureCells(ImageT const& im, std::size_t cell0, std::size_t begin, std::size_t end, int) {
+    std::size_t const nMax = static_cast<std::size_t>(_cellSize)*_cellSize;
+    std::vector<float> pix(nMax), clipped(nMax), work(3*nMax), row(_cellSize);
+
+    for (std::size_t c = cell0 + begin; c != cell0 + end; ++c) {
+        int const i = c%_nCellX, j = c/_nCellX;
+        int const x0 = _bbox.getX0() + i*_cellSize, y0 = _bbox.getY0() + j*_cellSize;
+        int const x1 = std::min(x0 + _cellSize, _bbox.getX1()), y1 = std::min(y0 + _cellSize, _bbox.getY1());
+        //
+        // Gather the cell's pixels, dropping NaNs and infinities
+        //
+        int n = 0;
+        for (int y = y0; y != y1; ++y) {
+            typename ImageT::Pixel const* ptr = im.getRow(y - im.getY0()) + (x0 - im.getX0());
+            for (int x = 0; x != x1 - x0; ++x) {
+                row[x] = ptr[x];
+            }
+            n += simd::clip(&row[0], x1 - x0, -FLT_MAX, FLT_MAX, &pix[n]);
+        }
+
+        _cells[c] = clippedMedian(&pix[0], n, _nSigma, _nIter, &clipped[0], &work[0]);
+    }
+}
+
+/**
+ * Fill in any cells without a measurement, and fit the splines along each row of cells
+ */
+void Background::_fit() {
+    std::vector<double> good;
+    for (unsigned int i = 0; i != _cells.size(); ++i) {
+        if (_cells[i] == _cells[i]) {
+            good.push_back(_cells[i]);
+        }
+    }
+    if (good.size() < _cells.size()) {
+        double median = 0;              // no good cells;  assume that the sky's been subtracted
+        if (!good.empty()) {
+            std::nth_element(good.begin(), good.begin() + good.size()/2, good.end());
+            median = good[good.size()/2];
+        }
+        for (unsigned int i = 0; i != _cells.size(); ++i) {
+            if (_cells[i] != _cells[i]) {
+                _cells[i] = median;
+            }
+        }
+    }
+
+    _d2x.resize(_cells.size());
+    Spline splineX(&_centreX[0], _nCellX);
+    for (int j = 0; j != _nCellY; ++j) {
+        splineX.fit(&_cells[j*_nCellX], &_d2x[j*_nCellX]);
+    }
+}
+
+/**
+ * Evaluate tile (tx, ty) of the map and publish it, unless another thread beat us to it
+ *
+ * Each column is interpolated in x along every row of cells, and then in y between the rows
+ */
+Image<float> const& Background::_makeTile(int tx, int ty) const {
+    int const x0 = tx*TILE_SIZE, y0 = ty*TILE_SIZE;
+    int const width = std::min(static_cast<int>(TILE_SIZE), _bbox.getWidth() - x0);
+    int const height = std::min(static_cast<int>(TILE_SIZE), _bbox.getHeight() - y0);
+
+    Spline const splineX(&_centreX[0], _nCellX);
+    std::vector<Spline::Weights> wx(width), wy(height);
+    for (int i = 0; i != width; ++i) {
+        wx[i] = splineX.getWeights(_bbox.getX0() + x0 + i);
+    }
+    Spline splineY(&_centreY[0], _nCellY);
+    for (int k = 0; k != height; ++k) {
+        wy[k] = splineY.getWeights(_bbox.getY0() + y0 + k);
+    }
+
+    Image<float> *made = new Image<float>(width, height);
+    std::vector<double> column(_nCellY), d2y(_nCellY);
+    for (int i = 0; i != width; ++i) {
+        for (int j = 0; j != _nCellY; ++j) {
+            column[j] = Spline::evaluate(wx[i], &_cells[j*_nCellX], &_d2x[j*_nCellX]);
+        }
+        splineY.fit(&column[0], &d2y[0]);
+
+        for (int k = 0; k != height; ++k) {
+            made->getRow(k)[i] = Spline::evaluate(wy[k], &column[0], &d2y[0]);
+        }
+    }
+
+    boost::atomic<Image<float> const*> &slot = _tiles[ty*_nTileX + tx];
+    Image<float> const* tile = 0;
+    if (!slot.compare_exchange_strong(tile, made, boost::memory_order_acq_rel, boost::memory_order_acquire)) {
+        delete made;                    // tile is now the other thread's
+        return *tile;
+    }
+    _nEvaluated.fetch_add(1, boost::memory_order_relaxed);
+
+    return *made;
+}
+
+/************************************************************************************************************/
+
+template Background::Background(Image<float> const&, int, double, int);
+template Background::Background(Image<double> const&, int, double, int);
+template Background::Background(Image<float> const&, ThreadPool &, int, double, int);
+template Background::Background(Image<double> const&, ThreadPool &, int, double, int);
+template Background::Background(ImageFile<float> const&, ThreadPool &, int, double, int);
+template Background::Background(ImageFile<double> const&, ThreadPool &, int, double, int);
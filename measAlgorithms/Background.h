@@ -0,0 +1,97 @@
+// -*- lsst-c++ -*-
+#if !defined(BACKGROUND_H)
+#define BACKGROUND_H 1
+
+#include <vector>
+
+#include "boost/atomic.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_array.hpp"
+#include "boost/shared_ptr.hpp"
+
+#include "Image.h"
+#include "ImageFile.h"
+#include "ThreadPool.h"
+
+/**
+ * A model of the sky level across an image, made once and shared by everything that measures it
+ * (\sa MeasureSources::setBackground, Cutout::getBackground)
+ *
+ * The image is divided into cells of cellSize x cellSize pixels (those at the right and top edges may be
+ * smaller), and each cell's sky level estimated as the sigma-clipped median of its pixels;  the cells are
+ * independent, so they may be measured in parallel.  The sky at a pixel is then found by bicubic spline
+ * interpolation between the cells' centres (and linear extrapolation beyond the outermost centres).
+ *
+ * The interpolated map is only made where it's wanted:  it's divided into TILE_SIZE x TILE_SIZE tiles, each
+ * of which is evaluated the first time that one of its pixels is asked for and then remembered.  Like
+ * PsfCache::getKernel, getValue() is thread safe and doesn't take a lock
+ */
+class Background : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<Background> Ptr;
+    typedef boost::shared_ptr<Background const> ConstPtr;
+
+    enum { TILE_SIZE = 64 };            // side of the tiles in which the map is evaluated
+
+    template<typename ImageT>
+    explicit Background(ImageT const& im, int cellSize=128, double nSigma=3.0, int nIter=3);
+    template<typename ImageT>
+    Background(ImageT const& im, ThreadPool &pool, int cellSize=128, double nSigma=3.0, int nIter=3);
+    template<typename T>
+    Background(ImageFile<T> const& file, ThreadPool &pool, int cellSize=128, double nSigma=3.0, int nIter=3);
+    ~Background();
+
+    /// Return the region that we model, in the parent image's coordinates
+    BBox const& getBBox() const { return _bbox; }
+    /// Return the side of the cells
+    int getCellSize() const { return _cellSize; }
+    /// Return the number of columns of cells
+    int getNCellX() const { return _nCellX; }
+    /// Return the number of rows of cells
+    int getNCellY() const { return _nCellY; }
+    /// Return the sky level measured in cell (i, j)
+    double getCell(int i, int j) const { return _cells[j*_nCellX + i]; }
+
+    /**
+     * Return the sky level at pixel (x, y), in the parent image's coordinates;  pixels outside getBBox()
+     * are treated as the nearest pixel inside
+     */
+    float getValue(int x, int y) const {
+        x = (x < _bbox.getX0()) ? 0 : (x >= _bbox.getX1()) ? _bbox.getWidth() - 1 : x - _bbox.getX0();
+        y = (y < _bbox.getY0()) ? 0 : (y >= _bbox.getY1()) ? _bbox.getHeight() - 1 : y - _bbox.getY0();
+
+        Image<float> const& tile = _getTile(x/TILE_SIZE, y/TILE_SIZE);
+        return tile(x%TILE_SIZE, y%TILE_SIZE);
+    }
+
+    /// Return the number of tiles that the map's divided into
+    int getNTile() const { return _nTileX*_nTileY; }
+    /// Return the number of tiles that have been evaluated
+    long getNEvaluated() const { return _nEvaluated; }
+private:
+    BBox _bbox;
+    int _cellSize;
+    double _nSigma;
+    int _nIter;
+    int _nCellX, _nCellY;
+    std::vector<double> _cells;         // the sky in each cell, a row of cells at a time
+    std::vector<double> _centreX, _centreY; // the centres of the columns and rows of cells
+    std::vector<double> _d2x;           // the second derivatives of each row of cells' spline in x
+    int _nTileX, _nTileY;
+
+    mutable boost::scoped_array<boost::atomic<Image<float> const*> > _tiles;
+    mutable boost::atomic<long> _nEvaluated;
+
+    void _init();
+    template<typename ImageT>
+    void _measureCells(ImageT const& im, std::size_t cell0, std::size_t begin, std::size_t end, int);
+    void _fit();
+
+    Image<float> const& _getTile(int tx, int ty) const {
+        Image<float> const* tile = _tiles[ty*_nTileX + tx].load(boost::memory_order_acquire);
+        return tile ? *tile : _makeTile(tx, ty);
+    }
+    Image<float> const& _makeTile(int tx, int ty) const;
+};
+
+#endif
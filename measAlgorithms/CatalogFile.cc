@@ -0,0 +1,509 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "boost/cstdint.hpp"
+
+#include "CatalogFile.h"
+
+namespace {
+    typedef boost::uint32_t uint32;
+    typedef boost::uint64_t uint64;
+
+    uint32 const VERSION = 1;
+    uint32 const BYTE_ORDER_MARK = 0x01020304; // reads differently if the file's byte order isn't ours
+    std::size_t const FILE_HEADER_SIZE = 24; // magic, version, byte order, sizeof(long), schema size
+    std::size_t const ROW_GROUP_HEADER_SIZE = catalogFile::ALIGNMENT; // magic, nrow, nbyte; padded
+    int const MAX_NSLOT = 1 << 16;      // the most slots that a member of a file's schemas may have
+
+    /// Round n up to a multiple of ALIGNMENT
+    std::size_t align(std::size_t n) {
+        return ((n + catalogFile::ALIGNMENT - 1)/catalogFile::ALIGNMENT)*catalogFile::ALIGNMENT;
+    }
+
+    /// Throw a std::runtime_error describing a failed system call
+    void throwErrno(std::string const& what, std::string const& filename) {
+        std::ostringstream msg;
+        msg << "Unable to " << what << " " << filename << ": " << std::strerror(errno);
+        throw std::runtime_error(msg.str());
+    }
+
+    /************************************************************************************************************/
+    /*
+     * The schemas are written as a tree of nodes, each of which is
+     *    type component  name index dimen units    (a leaf, i.e. a SchemaEntry;  type != UNKNOWN)
+     *    type component  nEntry entry...           (a composite;  type == UNKNOWN)
+     * where the numbers are uint32 and the strings are a uint32 length followed by the chars
+     */
+    void putUint32(std::string *buf, uint32 n) {
+        buf->append(reinterpret_cast<char const*>(&n), sizeof(n));
+    }
+
+    void putString(std::string *buf, std::string const& str) {
+        putUint32(buf, str.size());
+        *buf += str;
+    }
+
+    void putSchema(std::string *buf, Schema const& schema) {
+        putUint32(buf, schema.getType());
+        putString(buf, schema.getComponent());
+        if (schema.getType() != Schema::UNKNOWN) {
+            putString(buf, schema.getName());
+            putUint32(buf, schema.getIndex());
+            putUint32(buf, schema.getDimen());
+            putString(buf, schema.getUnits());
+        } else {
+            putUint32(buf, schema.end() - schema.begin());
+            for (Schema::const_iterator ptr = schema.begin(); ptr != schema.end(); ++ptr) {
+                putSchema(buf, **ptr);
+            }
+        }
+    }
+
+    /// Return the description of a pair of schemas that's written to a file's header
+    std::string describeSchemas(Schema const& astromSchema, Schema const& photomSchema) {
+        std::string buf;
+        putSchema(&buf, astromSchema);
+        putSchema(&buf, photomSchema);
+
+        return buf;
+    }
+
+    /// Read the values written by put*() back from [ptr, end)
+    class SchemaParser {
+    public:
+        SchemaParser(char const* begin, char const* end, std::string const& filename) :
+            _ptr(begin), _end(end), _filename(filename) {}
+
+        /// Read a node, and all its entries
+        Schema::Ptr getSchema(int depth=0) {
+            uint32 const type = getUint32();
+            std::string const component = getString();
+            if (type > Schema::DOUBLE) {
+                _corrupt("unknown type");
+            }
+
+            Schema::Ptr schema;
+            if (type != Schema::UNKNOWN) {
+                if (depth != 2) {       // entries belong to members (e.g. "psf") of a catalogue's schema
+                    _corrupt("entry is not in a member of the schema");
+                }
+                std::string const name = getString();
+                int const index = getUint32();
+                int const dimen = getUint32();
+                std::string const units = getString();
+                if (index < 0 || dimen < 1 || index >= MAX_NSLOT || dimen > MAX_NSLOT - index) {
+                    _corrupt("invalid index or dimension");
+                }
+                schema.reset(new SchemaEntry(name, index, static_cast<Schema::Type>(type), dimen, units));
+            } else {
+                if (depth > 1) {        // a catalogue's schema is made of members, which are made of entries
+                    _corrupt("schema is nested too deeply");
+                }
+                schema.reset(new Schema);
+                uint32 const nEntry = getUint32();
+                int nSlot = 0;
+                for (uint32 i = 0; i != nEntry; ++i) {
+                    Schema::Ptr const entry = getSchema(depth + 1);
+                    if (depth == 1) {   // a member's entries;  their slots are checked by _checkSlots
+                        nSlot += entry->size();
+                        if (nSlot > MAX_NSLOT) {
+                            _corrupt("too many slots");
+                        }
+                    }
+                    schema->add(entry); // in order, so the layout is the same as the writer's
+                }
+                if (depth == 1) {
+                    _checkSlots(*schema);
+                }
+            }
+            schema->setComponent(component);
+
+            return schema;
+        }
+
+        uint32 getUint32() {
+            uint32 n;
+            _get(&n, sizeof(n));
+            return n;
+        }
+
+        std::string getString() {
+            uint32 const n = getUint32();
+            if (n > static_cast<std::size_t>(_end - _ptr)) {
+                _corrupt("string is too long");
+            }
+            std::string const str(_ptr, n);
+            _ptr += n;
+
+            return str;
+        }
+
+        /// Are there any unread bytes?
+        bool empty() const { return _ptr == _end; }
+    private:
+        char const* _ptr;
+        char const* _end;
+        std::string const& _filename;
+
+        void _get(void *dest, std::size_t n) {
+            if (n > static_cast<std::size_t>(_end - _ptr)) {
+                _corrupt("header is truncated");
+            }
+            std::memcpy(dest, _ptr, n);
+            _ptr += n;
+        }
+
+        /**
+         * Check that a member of a catalogue's schema (e.g. one algorithm's measurements) is made of leaves
+         * whose slots cover [0, member.size()) exactly once, as getSlotTypes and Measurement assume
+         */
+        void _checkSlots(Schema const& member) const {
+            std::vector<bool> used(member.size(), false);
+            for (Schema::const_iterator ptr = member.begin(); ptr != member.end(); ++ptr) {
+                Schema const& se = **ptr;
+                for (int i = 0; i != se.getDimen(); ++i) {
+                    unsigned int const slot = se.getIndex() + i;
+                    if (slot >= used.size() || used[slot]) {
+                        _corrupt("entries' slots overlap or leave gaps");
+                    }
+                    used[slot] = true;
+                }
+            }
+        }
+
+        void _corrupt(char const* why) const {
+            throw std::runtime_error("Corrupt catalogue file " + _filename + ": " + why);
+        }
+    };
+
+    /// Append the Type of each slot of a composite schema (\sa MeasurementColumns) to types
+    void getSlotTypes(Schema const& schema, std::vector<Schema::Type> *types) {
+        for (Schema::const_iterator mptr = schema.begin(); mptr != schema.end(); ++mptr) {
+            std::size_t const base = types->size();
+            types->resize(base + (*mptr)->size(), Schema::UNKNOWN);
+
+            for (Schema::const_iterator sptr = (*mptr)->begin(); sptr != (*mptr)->end(); ++sptr) {
+                Schema const& se = **sptr;
+                for (int i = 0; i != se.getDimen(); ++i) {
+                    assert(static_cast<int>(se.getIndex()) + i < (*mptr)->size()); // \sa SchemaParser
+                    (*types)[base + se.getIndex() + i] = se.getType();
+                }
+            }
+        }
+    }
+
+    /// Return the number of bytes needed by the columns of a row group of nrow rows
+    std::size_t getRowGroupNByte(std::vector<Schema::Type> const& types, std::size_t nrow) {
+        std::size_t nbyte = 0;
+        for (unsigned int i = 0; i != types.size(); ++i) {
+            nbyte += align(nrow*Schema::sizeOf(types[i]));
+        }
+
+        return nbyte;
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Create a catalogue file for Sources measured with the given schemas
+ *
+ * If append is true and filename already exists, its schemas must be the same as ours, and new rows are
+ * added after its last complete row group
+ */
+CatalogWriter::CatalogWriter(std::string const& filename,      ///< the file to write
+                             Schema::ConstPtr astromSchema,    ///< the catalogues' astrometric schema
+                             Schema::ConstPtr photomSchema,    ///< the catalogues' photometric schema
+                             bool append,                      ///< add to an existing file?
+                             std::size_t rowGroupSize          ///< maximum number of rows in a row group
+                            ) :
+    _filename(filename), _fd(-1), _astromSchema(astromSchema), _photomSchema(photomSchema), _slotSizes(),
+    _rowGroupSize(std::max<std::size_t>(rowGroupSize, 1)), _nrow(0)
+{
+    std::vector<Schema::Type> types;
+    getSlotTypes(*astromSchema, &types);
+    getSlotTypes(*photomSchema, &types);
+    for (unsigned int i = 0; i != types.size(); ++i) {
+        _slotSizes.push_back(Schema::sizeOf(types[i]));
+    }
+
+    std::string const schemas = describeSchemas(*astromSchema, *photomSchema);
+
+    struct stat st;
+    if (append && ::stat(filename.c_str(), &st) == 0 && st.st_size > 0) {
+        std::size_t nbyte = 0;          // the size of the existing file's complete contents
+        {
+            CatalogReader const old(filename);
+            if (describeSchemas(*old.getAstrometrySchema(), *old.getPhotometrySchema()) != schemas) {
+                throw std::runtime_error("Unable to append to " + filename + ", which has different schemas");
+            }
+            _nrow = old.size();
+            nbyte = old.getNByte();
+        }
+
+        _fd = ::open(filename.c_str(), O_WRONLY);
+        if (_fd < 0) {
+            throwErrno("open", filename);
+        }
+        if (::ftruncate(_fd, nbyte) != 0 || ::lseek(_fd, nbyte, SEEK_SET) < 0) { // discard an incomplete row group
+            int const err = errno;
+            ::close(_fd);
+            errno = err;
+            throwErrno("append to", filename);
+        }
+        return;
+    }
+
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0) {
+        throwErrno("create", filename);
+    }
+
+    std::string header(catalogFile::MAGIC, sizeof(catalogFile::MAGIC));
+    putUint32(&header, VERSION);
+    putUint32(&header, BYTE_ORDER_MARK);
+    putUint32(&header, sizeof(long));
+    putUint32(&header, schemas.size());
+    header += schemas;
+    header.resize(align(header.size()), '\0');
+    try {
+        _write(header.data(), header.size());
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+/// Close the file
+CatalogWriter::~CatalogWriter() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+/**
+ * Close the file, reporting any error
+ */
+void CatalogWriter::close() {
+    if (_fd >= 0) {
+        int const fd = _fd;
+        _fd = -1;
+        if (::close(fd) != 0) {
+            throwErrno("close", _filename);
+        }
+    }
+}
+
+/**
+ * Append rows [begin, end) of cat (which must have been made with our schemas) to the file, as one or
+ * more row groups
+ */
+void CatalogWriter::write(SourceCatalog const& cat, std::size_t begin, std::size_t end) {
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to write to " + _filename + ", which has been closed");
+    }
+    if (cat.getAstrometry().getSchema() != _astromSchema || cat.getPhotometry().getSchema() != _photomSchema) {
+        throw std::runtime_error("SourceCatalog was not created with this CatalogWriter's schemas");
+    }
+    end = std::min(end, cat.size());
+
+    for (std::size_t row = begin; row < end; row += _rowGroupSize) {
+        _writeRowGroup(cat, row, std::min(end, row + _rowGroupSize));
+    }
+}
+
+/// Write rows [begin, end) of cat as a row group
+void CatalogWriter::_writeRowGroup(SourceCatalog const& cat, std::size_t begin, std::size_t end) {
+    std::size_t const nrow = end - begin;
+    int const nAstromSlot = cat.getAstrometry().getNSlot();
+
+    uint64 nbyte = 0;
+    for (unsigned int i = 0; i != _slotSizes.size(); ++i) {
+        nbyte += align(nrow*_slotSizes[i]);
+    }
+    char header[ROW_GROUP_HEADER_SIZE] = {};
+    uint64 const n = nrow;
+    std::memcpy(header, catalogFile::ROW_GROUP_MAGIC, sizeof(catalogFile::ROW_GROUP_MAGIC));
+    std::memcpy(header + 8, &n, sizeof(n));
+    std::memcpy(header + 16, &nbyte, sizeof(nbyte));
+    _write(header, sizeof(header));
+
+    static char const padding[catalogFile::ALIGNMENT] = {};
+    for (int i = 0; i != static_cast<int>(_slotSizes.size()); ++i) {
+        char const* column = static_cast<char const*>(i < nAstromSlot ? cat.getAstrometry().getColumn(i) :
+                                                      cat.getPhotometry().getColumn(i - nAstromSlot));
+        std::size_t const size = nrow*_slotSizes[i];
+        _write(column + begin*_slotSizes[i], size);
+        _write(padding, align(size) - size);
+    }
+
+    _nrow += nrow;
+}
+
+/// Write n bytes from data to the file
+void CatalogWriter::_write(void const* data, std::size_t n) {
+    char const* ptr = static_cast<char const*>(data);
+    while (n > 0) {
+        ssize_t const nwritten = ::write(_fd, ptr, n);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwErrno("write to", _filename);
+        }
+        ptr += nwritten;
+        n -= nwritten;
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Open a catalogue file, mapping it into memory and reading its schemas and the positions of its row groups
+ */
+CatalogReader::CatalogReader(std::string const& filename) :
+    _filename(filename), _data(0), _nbyte(0), _astromSchema(), _photomSchema(), _nAstromSlot(0), _types(),
+    _rowGroups(), _nrow(0), _end(0)
+{
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throwErrno("open", filename);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int const err = errno;
+        ::close(fd);
+        errno = err;
+        throwErrno("stat", filename);
+    }
+    _nbyte = st.st_size;
+    if (_nbyte < FILE_HEADER_SIZE) {
+        ::close(fd);
+        throw std::runtime_error(filename + " is not a catalogue file");
+    }
+
+    void *const data = ::mmap(0, _nbyte, PROT_READ, MAP_SHARED, fd, 0);
+    int const err = errno;
+    ::close(fd);                        // the mapping keeps the file open
+    if (data == MAP_FAILED) {
+        errno = err;
+        throwErrno("map", filename);
+    }
+    _data = static_cast<char const*>(data);
+
+    try {
+        _readHeader();
+    } catch (...) {
+        ::munmap(const_cast<char *>(_data), _nbyte);
+        throw;
+    }
+}
+
+/// Unmap the file
+CatalogReader::~CatalogReader() {
+    ::munmap(const_cast<char *>(_data), _nbyte);
+}
+
+/// Read the file's header, and find its complete row groups
+void CatalogReader::_readHeader() {
+    if (std::memcmp(_data, catalogFile::MAGIC, sizeof(catalogFile::MAGIC)) != 0) {
+        throw std::runtime_error(_filename + " is not a catalogue file");
+    }
+    SchemaParser header(_data + sizeof(catalogFile::MAGIC), _data + FILE_HEADER_SIZE, _filename);
+    uint32 const version = header.getUint32();
+    uint32 const byteOrder = header.getUint32();
+    uint32 const sizeofLong = header.getUint32();
+    uint32 const nSchemaByte = header.getUint32();
+    if (version != VERSION) {
+        std::ostringstream msg;
+        msg << _filename << " is a version " << version << " catalogue file; I can only read version " << VERSION;
+        throw std::runtime_error(msg.str());
+    }
+    if (byteOrder != BYTE_ORDER_MARK || sizeofLong != sizeof(long)) {
+        throw std::runtime_error(_filename + " was written on a machine with a different byte order or "
+                                 "sizeof(long)");
+    }
+    if (nSchemaByte > _nbyte - FILE_HEADER_SIZE) {
+        throw std::runtime_error("Corrupt catalogue file " + _filename + ": header is truncated");
+    }
+
+    SchemaParser schemas(_data + FILE_HEADER_SIZE, _data + FILE_HEADER_SIZE + nSchemaByte, _filename);
+    _astromSchema = schemas.getSchema();
+    _photomSchema = schemas.getSchema();
+    if (!schemas.empty()) {
+        throw std::runtime_error("Corrupt catalogue file " + _filename + ": unexpected data after the schemas");
+    }
+    getSlotTypes(*_astromSchema, &_types);
+    _nAstromSlot = _types.size();
+    getSlotTypes(*_photomSchema, &_types);
+    //
+    // Walk the row groups.  An incomplete row group at the end is ignored, as it's probably still being
+    // written (or its writer died)
+    //
+    std::size_t offset = align(FILE_HEADER_SIZE + nSchemaByte);
+    while (offset + ROW_GROUP_HEADER_SIZE <= _nbyte) {
+        char const* group = _data + offset;
+        uint64 nrow = 0, nbyte = 0;
+        std::memcpy(&nrow, group + 8, sizeof(nrow));
+        std::memcpy(&nbyte, group + 16, sizeof(nbyte));
+        if (std::memcmp(group, catalogFile::ROW_GROUP_MAGIC, sizeof(catalogFile::ROW_GROUP_MAGIC)) != 0 ||
+            nrow > _nbyte || nbyte != getRowGroupNByte(_types, nrow)) {
+            std::ostringstream msg;
+            msg << "Corrupt catalogue file " << _filename << ": invalid row group at byte " << offset;
+            throw std::runtime_error(msg.str());
+        }
+        if (nbyte > _nbyte - offset - ROW_GROUP_HEADER_SIZE) {
+            break;
+        }
+
+        RowGroup const rowGroup = { _nrow, nrow, offset + ROW_GROUP_HEADER_SIZE };
+        _rowGroups.push_back(rowGroup);
+        _nrow += nrow;
+        offset += ROW_GROUP_HEADER_SIZE + nbyte;
+    }
+    _end = std::min(offset, _nbyte);
+}
+
+/// Throw a std::runtime_error if we don't have a row group called group
+void CatalogReader::_checkGroup(int group) const {
+    if (group < 0 || group >= getNRowGroup()) {
+        std::ostringstream msg;
+        msg << "Row group " << group << " is out of range for " << _filename << "[0," << getNRowGroup() - 1 << "]";
+        throw std::runtime_error(msg.str());
+    }
+}
+
+/// Return the start of a slot's column in a row group
+char const* CatalogReader::_getColumnData(int slot, int group) const {
+    _checkGroup(group);
+    RowGroup const& rowGroup = _rowGroups[group];
+
+    std::size_t offset = rowGroup.offset;
+    for (int i = 0; i != slot; ++i) {
+        offset += align(rowGroup.nrow*Schema::sizeOf(_types[i]));
+    }
+
+    return _data + offset;
+}
+
+/**
+ * Copy a row group into cat, which must have been created with our schemas;  cat is resized to hold
+ * exactly the row group's rows
+ */
+void CatalogReader::read(int group, SourceCatalog *cat) const {
+    if (cat->getAstrometry().getSchema() != _astromSchema || cat->getPhotometry().getSchema() != _photomSchema) {
+        throw std::runtime_error("SourceCatalog was not created with this CatalogReader's schemas");
+    }
+    _checkGroup(group);
+    std::size_t const nrow = getRowGroupSize(group);
+    cat->resize(nrow);
+
+    for (int i = 0; i != static_cast<int>(_types.size()); ++i) {
+        void *column = (i < _nAstromSlot) ? cat->getAstrometry().getColumn(i) :
+                                            cat->getPhotometry().getColumn(i - _nAstromSlot);
+        std::memcpy(column, _getColumnData(i, group), nrow*Schema::sizeOf(_types[i]));
+    }
+}
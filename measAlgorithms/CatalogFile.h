@@ -0,0 +1,173 @@
+// -*- lsst-c++ -*-
+#if !defined(CATALOG_FILE_H)
+#define CATALOG_FILE_H 1
+
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Schema.h"
+#include "SourceCatalog.h"
+
+/**
+ * A binary, columnar file holding a catalogue of Sources
+ *
+ * The file starts with a header describing the astrometric and photometric schemas (the whole Schema
+ * tree:  components, and each entry's name, index, type, dimension, and units), followed by any number of
+ * row groups.  Each row group holds some rows of every slot of both schemas (astrometry first, in slot
+ * order;  \sa MeasurementColumns) as contiguous columns, each aligned to ALIGNMENT bytes, so a reader may
+ * map the file into memory and use the columns in place.
+ *
+ * Row groups are self-delimiting and are only ever appended, so a catalogue may be written as it's measured,
+ * and a file whose last row group is incomplete (e.g. because the writer died) is still readable.  The
+ * numbers are in the writer's native byte order, which the reader checks
+ */
+namespace catalogFile {
+    enum { ALIGNMENT = 64 };            // alignment of the header, the row groups, and each column
+    char const MAGIC[] = "MEASCAT";     // the first 8 bytes of every file (including the '\0')
+    char const ROW_GROUP_MAGIC[] = "ROWGRP"; // the first 8 bytes of every row group (with padding)
+}
+
+/**
+ * Write SourceCatalogs to a catalogue file, a row group at a time
+ */
+class CatalogWriter : boost::noncopyable {
+public:
+    CatalogWriter(std::string const& filename, Schema::ConstPtr astromSchema, Schema::ConstPtr photomSchema,
+                  bool append=false, std::size_t rowGroupSize=65536);
+    ~CatalogWriter();
+
+    /// Return the number of rows in the file
+    std::size_t size() const { return _nrow; }
+
+    /// Write all of cat's rows
+    void write(SourceCatalog const& cat) { write(cat, 0, cat.size()); }
+    void write(SourceCatalog const& cat, std::size_t begin, std::size_t end);
+    void close();
+private:
+    std::string _filename;
+    int _fd;                            // our file, or -1 when it's closed
+    Schema::ConstPtr _astromSchema;
+    Schema::ConstPtr _photomSchema;
+    std::vector<int> _slotSizes;        // the size of an element of each column (astrometry then photometry)
+    std::size_t _rowGroupSize;          // the largest number of rows to put in one row group
+    std::size_t _nrow;                  // the number of rows in the file
+
+    void _writeRowGroup(SourceCatalog const& cat, std::size_t begin, std::size_t end);
+    void _write(void const* data, std::size_t n);
+};
+
+/************************************************************************************************************/
+/**
+ * A read-only view of part of a column
+ */
+template<typename U>
+class ColumnSpan {
+public:
+    typedef U const* const_iterator;
+
+    ColumnSpan() : _data(0), _size(0) {}
+    ColumnSpan(U const* data, std::size_t size) : _data(data), _size(size) {}
+
+    /// Return the number of values
+    std::size_t size() const { return _size; }
+    /// Are there any values?
+    bool empty() const { return _size == 0; }
+    /// Return the first value
+    const_iterator begin() const { return _data; }
+    /// Return one past the last value
+    const_iterator end() const { return _data + _size; }
+    /// Return the i'th value
+    U const& operator[](std::size_t i) const { return _data[i]; }
+private:
+    U const* _data;
+    std::size_t _size;
+};
+
+/**
+ * Read a catalogue file
+ *
+ * The file is mapped into memory, and the columns are returned as ColumnSpans pointing into the mapping;
+ * opening a file only reads its header and the headers of its row groups, and the pages of a column are
+ * only read from disk when they're used.  Columns are looked up by the Keys of our schemas, e.g.
+ *     CatalogReader cat("sources.cat");
+ *     Schema::Key<double> const fluxKey = cat.getPhotometrySchema()->getKey<double>("flux", "psf");
+ *     for (int g = 0; g != cat.getNRowGroup(); ++g) {
+ *         ColumnSpan<double> const flux = cat.getPhotometryColumn(fluxKey, g);
+ *         ...
+ *     }
+ */
+class CatalogReader : boost::noncopyable {
+public:
+    explicit CatalogReader(std::string const& filename);
+    ~CatalogReader();
+
+    /// Return the schema of the astrometric columns
+    Schema::ConstPtr getAstrometrySchema() const { return _astromSchema; }
+    /// Return the schema of the photometric columns
+    Schema::ConstPtr getPhotometrySchema() const { return _photomSchema; }
+    /// Return the number of rows
+    std::size_t size() const { return _nrow; }
+    /// Return the number of row groups
+    int getNRowGroup() const { return _rowGroups.size(); }
+    /// Return the index of the first row of a row group
+    std::size_t getRowGroupBegin(int group) const { return _rowGroups[group].row0; }
+    /// Return the number of rows in a row group
+    std::size_t getRowGroupSize(int group) const { return _rowGroups[group].nrow; }
+    /// Return the number of bytes used by the header and the complete row groups
+    std::size_t getNByte() const { return _end; }
+
+    /// Return the part of the astrometric column for key that's in a row group
+    template<typename U>
+    ColumnSpan<U> getAstrometryColumn(Schema::Key<U> const& key, int group) const {
+        return _getColumn<U>(key.getSlot(), group);
+    }
+    /// Return the part of the photometric column for key that's in a row group
+    template<typename U>
+    ColumnSpan<U> getPhotometryColumn(Schema::Key<U> const& key, int group) const {
+        return _getColumn<U>(_nAstromSlot + key.getSlot(), group);
+    }
+
+    void read(int group, SourceCatalog *cat) const;
+private:
+    /// Where to find a row group
+    struct RowGroup {
+        std::size_t row0;               // the index of its first row
+        std::size_t nrow;               // the number of rows
+        std::size_t offset;             // the offset of its first column in the file
+    };
+
+    std::string _filename;
+    char const* _data;                  // the mapped file
+    std::size_t _nbyte;                 // the size of the mapping
+    Schema::ConstPtr _astromSchema;
+    Schema::ConstPtr _photomSchema;
+    int _nAstromSlot;                   // the number of astrometric columns
+    std::vector<Schema::Type> _types;   // the type of each column (astrometry then photometry)
+    std::vector<RowGroup> _rowGroups;
+    std::size_t _nrow;                  // the number of rows in the complete row groups
+    std::size_t _end;                   // the end of the last complete row group
+
+    void _readHeader();
+    void _checkGroup(int group) const;
+    char const* _getColumnData(int slot, int group) const;
+
+    template<typename U>
+    ColumnSpan<U> _getColumn(int slot, int group) const {
+        if (slot < 0 || slot >= static_cast<int>(_types.size()) ||
+            _types[slot] != static_cast<Schema::Type>(Schema::TypeOf<U>::value)) {
+            std::ostringstream msg;
+            msg << "Key for slot " << slot << " of type " << static_cast<Schema::Type>(Schema::TypeOf<U>::value)
+                << " doesn't match " << _filename;
+            throw std::runtime_error(msg.str());
+        }
+
+        U const* data = reinterpret_cast<U const*>(_getColumnData(slot, group)); // checks group
+        return ColumnSpan<U>(data, getRowGroupSize(group));
+    }
+};
+
+#endif
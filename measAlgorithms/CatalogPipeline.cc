@@ -0,0 +1,158 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <stdexcept>
+#include "boost/bind/bind.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+
+#include "CatalogPipeline.h"
+
+namespace {
+    /**
+     * Wait a little for the other end of a queue:  spin at first (a batch usually turns up very soon),
+     * then yield, and finally sleep, so a thread that's waiting for slow I/O doesn't burn a core
+     */
+    void backoff(int *nTry) {
+        ++*nTry;
+        if (*nTry < 64) {
+            ;
+        } else if (*nTry < 128) {
+            boost::this_thread::yield();
+        } else {
+            boost::this_thread::sleep(boost::posix_time::microseconds(100));
+        }
+    }
+}
+
+/**
+ * Start a writer thread that passes batches of rows to sink
+ */
+CatalogPipeline::CatalogPipeline(Schema::ConstPtr astromSchema, ///< the catalogues' astrometric schema
+                                 Schema::ConstPtr photomSchema, ///< the catalogues' photometric schema
+                                 Sink const& sink,              ///< where to write the rows
+                                 std::size_t batchSize,         ///< the largest number of rows in a batch
+                                 int nBatch                     ///< the number of batches
+                                ) :
+    _sink(sink), _batchSize(std::max<std::size_t>(batchSize, 1)), _batches(),
+    _full(std::max(nBatch, 2) + 1), _empty(std::max(nBatch, 2)), _current(0), _nrow(0), _writer(),
+    _closed(false), _mutex(), _failed(false), _error()
+{
+    nBatch = std::max(nBatch, 2);       // so that filling and writing overlap
+    for (int i = 0; i != nBatch; ++i) {
+        _batches.push_back(boost::shared_ptr<SourceCatalog>(new SourceCatalog(astromSchema, photomSchema)));
+        _batches.back()->reserve(_batchSize);
+        _empty.push(_batches.back().get());
+    }
+
+    _writer = boost::thread(boost::bind(&CatalogPipeline::_loop, this));
+}
+
+/// Write everything that's been submitted;  any error is lost
+CatalogPipeline::~CatalogPipeline() {
+    try {
+        close();
+    } catch (...) {
+        ;
+    }
+}
+
+/**
+ * Return an empty batch to fill, waiting until one's available
+ *
+ * The batch has room for getBatchSize() rows, but its size is 0;  resize() it (or let
+ * MeasureSources::measure do so) before setting values
+ */
+SourceCatalog &CatalogPipeline::acquire() {
+    if (_closed) {
+        throw std::runtime_error("Unable to acquire a batch from a closed CatalogPipeline");
+    }
+    _checkError();
+
+    if (!_current) {
+        for (int nTry = 0; !_empty.pop(_current); backoff(&nTry)) {
+            ;
+        }
+        _current->resize(0);
+    }
+
+    return *_current;
+}
+
+/**
+ * Pass the batch returned by acquire() to the writer thread
+ */
+void CatalogPipeline::submit() {
+    if (!_current) {
+        throw std::runtime_error("There is no acquired batch to submit to the CatalogPipeline");
+    }
+    _checkError();
+
+    while (!_full.push(_current)) {     // can't happen:  _full has room for every batch
+        boost::this_thread::yield();
+    }
+    _current = 0;
+}
+
+/**
+ * Wait for all the submitted batches to be written, and stop the writer thread
+ *
+ * If the sink threw, a std::runtime_error with the same message is thrown (as it may be by acquire() and
+ * submit());  after an error, no more rows are written
+ */
+void CatalogPipeline::close() {
+    if (_closed) {
+        return;
+    }
+    _closed = true;
+
+    //
+    // A batch that was acquired but never submitted is dropped.  We mustn't push it onto _empty, as the
+    // writer thread is _empty's producer (and nothing can be acquired once we're closed);  it's freed
+    // along with the rest of _batches
+    //
+    _current = 0;
+    SourceCatalog *const end = 0;
+    while (!_full.push(end)) {
+        boost::this_thread::yield();
+    }
+    _writer.join();
+
+    _checkError();
+}
+
+/// Throw if the sink has failed
+void CatalogPipeline::_checkError() {
+    if (_failed) {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        throw std::runtime_error(_error);
+    }
+}
+
+/// The writer thread:  write batches until a NULL one arrives
+void CatalogPipeline::_loop() {
+    for (;;) {
+        SourceCatalog *batch = 0;
+        for (int nTry = 0; !_full.pop(batch); backoff(&nTry)) {
+            ;
+        }
+        if (!batch) {
+            return;
+        }
+
+        if (!_failed) {
+            try {
+                _sink(*batch);
+                _nrow += batch->size();
+            } catch (std::exception const& e) {
+                boost::lock_guard<boost::mutex> lock(_mutex);
+                _error = e.what();
+                _failed = true;
+            } catch (...) {
+                boost::lock_guard<boost::mutex> lock(_mutex);
+                _error = "Unknown exception while writing a catalogue";
+                _failed = true;
+            }
+        }
+
+        _empty.push(batch);             // always room:  it holds at most every batch
+    }
+}
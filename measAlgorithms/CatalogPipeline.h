@@ -0,0 +1,89 @@
+// -*- lsst-c++ -*-
+#if !defined(CATALOG_PIPELINE_H)
+#define CATALOG_PIPELINE_H 1
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "boost/atomic.hpp"
+#include "boost/function.hpp"
+#include "boost/lockfree/spsc_queue.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "Schema.h"
+#include "SourceCatalog.h"
+
+/**
+ * Write catalogues on a thread of their own while the caller carries on measuring
+ *
+ * The rows flow in batches:  the caller acquire()s an empty SourceCatalog, fills it, and submit()s it;  the
+ * batch is passed through a bounded lock-free queue to a writer thread, which hands it to the sink (e.g. a
+ * CsvWriter, CatalogWriter, or FitsWriter;  \sa WriteTo) and then returns it to be refilled.  There are
+ * only nBatch batches, so memory use doesn't grow with the number of rows, and if the sink falls behind
+ * acquire() waits for it (and vice versa).
+ *
+ * Only one thread may acquire() and submit() batches, but it may use as many threads as it likes to fill
+ * them (\sa MeasureSources::measure)
+ */
+class CatalogPipeline : boost::noncopyable {
+public:
+    /// Where to write a batch of rows:  sink(cat)
+    typedef boost::function<void (SourceCatalog const&)> Sink;
+
+    CatalogPipeline(Schema::ConstPtr astromSchema, Schema::ConstPtr photomSchema, Sink const& sink,
+                    std::size_t batchSize=8192, int nBatch=4);
+    ~CatalogPipeline();
+
+    /// Return the largest number of rows that a batch should hold
+    std::size_t getBatchSize() const { return _batchSize; }
+    /// Return the number of rows written so far
+    std::size_t size() const { return _nrow; }
+
+    SourceCatalog &acquire();
+    void submit();
+    void close();
+private:
+    typedef boost::lockfree::spsc_queue<SourceCatalog *> Queue;
+
+    Sink _sink;
+    std::size_t _batchSize;
+    std::vector<boost::shared_ptr<SourceCatalog> > _batches;
+    Queue _full;                        // batches waiting to be written
+    Queue _empty;                       // batches waiting to be filled
+    SourceCatalog *_current;            // the batch that's been acquired, if any
+    boost::atomic<std::size_t> _nrow;
+    boost::thread _writer;
+    bool _closed;
+    // The what() of the first exception thrown by the sink;  set by the writer thread
+    boost::mutex _mutex;
+    boost::atomic<bool> _failed;
+    std::string _error;
+
+    void _loop();
+    void _checkError();
+};
+
+/**
+ * A CatalogPipeline::Sink that writes with a writer (CsvWriter, CatalogWriter, FitsWriter, ...), which
+ * must outlive it
+ */
+template<typename Writer>
+class WriteTo {
+public:
+    explicit WriteTo(Writer &writer) : _writer(&writer) {}
+
+    void operator()(SourceCatalog const& cat) const { _writer->write(cat); }
+private:
+    Writer *_writer;
+};
+
+/// Return a CatalogPipeline::Sink that writes with writer
+template<typename Writer>
+WriteTo<Writer> writeTo(Writer &writer) {
+    return WriteTo<Writer>(writer);
+}
+
+#endif
@@ -0,0 +1,629 @@
+// -*- lsst-c++ -*-
+/**
+ * Convolution of Images
+ *
+ * There are three ways to convolve an image, all of which treat pixels beyond its edges as zero and
+ * work in single precision:
+ *   - SEPARABLE:  correlate each row with the column factor, and then sum rows weighted by the row factor
+ *   - DIRECT:     correlate each row of the image with each row of the kernel, a block of columns at a time
+ *                 so that the output stays in L1 cache
+ *   - FFT:        cut the image into overlapping tiles and multiply each tile's Fourier transform by the
+ *                 kernel's (overlap-save).  The tiles are convolved two at a time, one as the real part and
+ *                 one as the imaginary part of the same complex transform
+ *
+ * The work is divided into bands of rows, which are independent and may be processed on different threads
+ */
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <sstream>
+#include <stdexcept>
+#include "boost/ref.hpp"
+
+#include "Convolve.h"
+#include "Simd.h"
+
+namespace {
+    int const BAND_HEIGHT = 64;         // number of rows in a band (SEPARABLE and DIRECT)
+    int const BLOCK_WIDTH = 512;        // number of columns in a block (DIRECT)
+    int const TRANSPOSE_BLOCK = 16;     // side of the blocks in which tiles are transposed (FFT)
+    int const MAX_FFT_SIZE = 2048;      // largest tile (FFT)
+    int const CACHE_FFT_SIZE = 256;     // largest tile that fits in L2 cache (FFT)
+    /*
+     * The cost of a pixel's share of a butterfly relative to a multiply-add in the direct path's SIMD
+     * loops, and the extra cost of tiles that don't fit in cache (measured with AVX-512);  used to choose
+     * the size of the tiles, and between DIRECT and FFT
+     */
+    double const BUTTERFLY_COST = 40.0;
+    double const OUT_OF_CACHE_COST = 2.0;
+
+    typedef std::complex<float> Complex;
+
+    /// Return the smallest power of 2 that's at least n
+    int nextPow2(int n) {
+        int p = 1;
+        while (p < n) {
+            p *= 2;
+        }
+        return p;
+    }
+
+    /**
+     * Return the side of the tiles to use to convolve a width x height image with a kernelWidth x
+     * kernelHeight kernel by FFT, and (if cost is non-NULL) the cost per pixel in units of multiply-adds
+     */
+    int chooseFftSize(int kernelWidth, int kernelHeight, int width, int height, double *cost=0) {
+        int best = 0;
+        double bestCost = 0;
+        for (int n = nextPow2(std::max(std::max(kernelWidth, kernelHeight), 2)); n <= MAX_FFT_SIZE; n *= 2) {
+            int const mx = std::min(n - kernelWidth + 1, width), my = std::min(n - kernelHeight + 1, height);
+            double const log2n = std::log(double(n))/std::log(2.0);
+            // 2 forward and 2 inverse passes of n log2(n)/2 butterflies over each of the tile's n columns
+            double const c = (double(n)*n*log2n*BUTTERFLY_COST)/(double(mx)*my)*
+                ((n > CACHE_FFT_SIZE) ? OUT_OF_CACHE_COST : 1.0);
+            if (best == 0 || c < bestCost) {
+                best = n;
+                bestCost = c;
+            }
+            if (n >= width + kernelWidth && n >= height + kernelHeight) { // a larger tile can't help
+                break;
+            }
+        }
+        if (cost) {
+            *cost = bestCost;
+        }
+        return best;
+    }
+
+    /************************************************************************************************************/
+    /**
+     * A radix-2 complex FFT of a fixed size, applied to all the columns of a square array at once
+     *
+     * Each butterfly combines two whole rows with the same twiddle factor, so the work is done by long
+     * SIMD loops along the rows;  a 2-D transform transposes the array and transforms its columns again
+     */
+    class Fft {
+    public:
+        explicit Fft(int n);
+
+        /// Return the size of the transform
+        int getSize() const { return _n; }
+
+        void transformColumns(Complex *data, bool inverse) const;
+    private:
+        int _n;
+        std::vector<int> _swaps;             // pairs of rows exchanged by the bit-reversal permutation
+        std::vector<Complex> _twiddles;      // exp(-2 pi i k/len), k < len/2, for len = 2, 4, ... n
+    };
+
+    Fft::Fft(int n) : _n(n), _swaps(), _twiddles() {
+        if (n < 1 || (n & (n - 1)) != 0) {
+            std::ostringstream msg;
+            msg << "FFT size " << n << " is not a power of 2";
+            throw std::runtime_error(msg.str());
+        }
+        for (int i = 0, j = 0; i != n; ++i) {
+            if (i < j) {
+                _swaps.push_back(i);
+                _swaps.push_back(j);
+            }
+            int bit = n >> 1;           // increment j, bit-reversed
+            for (; bit > 0 && (j & bit); bit >>= 1) {
+                j ^= bit;
+            }
+            j |= bit;
+        }
+        // The twiddles for a stage of length len start at index len/2 - 1
+        _twiddles.reserve(n > 1 ? n - 1 : 0);
+        for (int half = 1; half < n; half *= 2) {
+            for (int k = 0; k != half; ++k) {
+                double const theta = -M_PI*k/half;
+                _twiddles.push_back(Complex(std::cos(theta), std::sin(theta)));
+            }
+        }
+    }
+
+    /**
+     * Transform each column of an n x n array in place;  the inverse isn't normalised (i.e. it's n times
+     * too large)
+     */
+    void Fft::transformColumns(Complex *data, bool inverse) const {
+        int const n = _n;
+        for (std::size_t i = 0; i < _swaps.size(); i += 2) {
+            std::swap_ranges(data + _swaps[i]*n, data + (_swaps[i] + 1)*n, data + _swaps[i + 1]*n);
+        }
+        float const sign = inverse ? -1 : 1;
+        for (int half = 1; half < n; half *= 2) {
+            Complex const* tw = &_twiddles[half - 1];
+            for (int i = 0; i < n; i += 2*half) {
+                for (int k = 0; k != half; ++k) {
+                    simd::butterfly(reinterpret_cast<float *>(data + (i + k)*n),
+                                    reinterpret_cast<float *>(data + (i + k + half)*n), n,
+                                    tw[k].real(), sign*tw[k].imag());
+                }
+            }
+        }
+    }
+
+    /**
+     * Transpose an n x n array in place, a block at a time so that both the rows and the columns being
+     * exchanged stay in cache
+     */
+    void transpose(Complex *data, int n) {
+        for (int i0 = 0; i0 < n; i0 += TRANSPOSE_BLOCK) {
+            int const i1 = std::min(i0 + TRANSPOSE_BLOCK, n);
+            for (int j0 = i0; j0 < n; j0 += TRANSPOSE_BLOCK) {
+                int const j1 = std::min(j0 + TRANSPOSE_BLOCK, n);
+                for (int i = i0; i < i1; ++i) {
+                    for (int j = (j0 == i0) ? i + 1 : j0; j < j1; ++j) {
+                        std::swap(data[i*n + j], data[j*n + i]);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Transform an n x n array in place:  transform the columns, transpose, and transform the columns again
+     *
+     * The forward transform is left transposed, and the inverse expects a transposed input, so that
+     * transforming forward and then back returns (n^2 times) the original data
+     */
+    void transform2d(Complex *data, Fft const& fft, bool inverse) {
+        fft.transformColumns(data, inverse);
+        transpose(data, fft.getSize());
+        fft.transformColumns(data, inverse);
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Create a kernel from width x height values, stored a row at a time;  it's centred on (width/2, height/2)
+ */
+ConvolutionKernel::ConvolutionKernel(int width, int height, float const* values) :
+    _width(width), _height(height), _values(), _kx(), _ky()
+{
+    _check();
+    _values.assign(values, values + width*height);
+    _factor();
+}
+
+/**
+ * Create a separable kernel, (*this)(i, j) = kx[i]*ky[j];  it's centred on (kx.size()/2, ky.size()/2)
+ */
+ConvolutionKernel::ConvolutionKernel(std::vector<float> const& kx, std::vector<float> const& ky) :
+    _width(kx.size()), _height(ky.size()), _values(), _kx(kx), _ky(ky)
+{
+    _check();
+    _values.resize(_width*_height);
+    for (int j = 0; j != _height; ++j) {
+        for (int i = 0; i != _width; ++i) {
+            _values[j*_width + i] = kx[i]*ky[j];
+        }
+    }
+}
+
+/**
+ * Create a kernel from an image of the PSF (e.g. to smooth an image before detection)
+ */
+ConvolutionKernel::ConvolutionKernel(PsfKernel const& psf) :
+    _width(2*psf.getHalfWidth() + 1), _height(2*psf.getHalfWidth() + 1), _values(), _kx(), _ky()
+{
+    _values.reserve(_width*_height);
+    for (int j = -psf.getHalfWidth(); j <= psf.getHalfWidth(); ++j) {
+        _values.insert(_values.end(), psf.getRow(j), psf.getRow(j) + _width);
+    }
+    _factor();
+}
+
+/**
+ * Return a separable circular Gaussian kernel, normalised to unit sum
+ */
+ConvolutionKernel ConvolutionKernel::makeGaussian(double sigma,   ///< the Gaussian's sigma, in pixels
+                                                  int halfWidth   ///< kernel's half-width; default: 4 sigma
+                                                 ) {
+    if (!(sigma > 0)) {
+        std::ostringstream msg;
+        msg << "Gaussian kernel's sigma must be positive (not " << sigma << ")";
+        throw std::runtime_error(msg.str());
+    }
+    if (halfWidth < 0) {
+        halfWidth = static_cast<int>(std::ceil(4*sigma));
+    }
+
+    std::vector<float> k(2*halfWidth + 1);
+    double sum = 0;
+    for (int i = -halfWidth; i <= halfWidth; ++i) {
+        sum += std::exp(-0.5*i*i/(sigma*sigma));
+    }
+    for (int i = -halfWidth; i <= halfWidth; ++i) {
+        k[i + halfWidth] = std::exp(-0.5*i*i/(sigma*sigma))/sum;
+    }
+
+    return ConvolutionKernel(k, k);
+}
+
+void ConvolutionKernel::_check() const {
+    if (_width <= 0 || _height <= 0) {
+        std::ostringstream msg;
+        msg << "Invalid ConvolutionKernel dimensions " << _width << "x" << _height;
+        throw std::runtime_error(msg.str());
+    }
+}
+
+/**
+ * If our values are (to within rounding) the product of a column and a row factor, remember the factors
+ *
+ * If they are, the row and column through the largest value are proportional to the factors
+ */
+void ConvolutionKernel::_factor() {
+    int imax = 0, jmax = 0;
+    float vmax = 0;
+    for (int j = 0; j != _height; ++j) {
+        for (int i = 0; i != _width; ++i) {
+            if (std::fabs((*this)(i, j)) > std::fabs(vmax)) {
+                imax = i; jmax = j;
+                vmax = (*this)(i, j);
+            }
+        }
+    }
+    if (vmax == 0) {
+        return;
+    }
+
+    std::vector<float> kx(_width), ky(_height);
+    for (int i = 0; i != _width; ++i) {
+        kx[i] = (*this)(i, jmax);
+    }
+    for (int j = 0; j != _height; ++j) {
+        ky[j] = (*this)(imax, j)/vmax;
+    }
+
+    float const tol = 1e-6*std::fabs(vmax);
+    for (int j = 0; j != _height; ++j) {
+        for (int i = 0; i != _width; ++i) {
+            if (std::fabs((*this)(i, j) - kx[i]*ky[j]) > tol) {
+                return;
+            }
+        }
+    }
+    _kx.swap(kx);
+    _ky.swap(ky);
+}
+
+/************************************************************************************************************/
+
+namespace convolution {
+
+/// Print a Strategy
+std::ostream &operator<<(std::ostream &os, Strategy strategy) {
+    switch (strategy) {
+      case AUTO:      return os << "auto";
+      case SEPARABLE: return os << "separable";
+      case DIRECT:    return os << "direct";
+      case FFT:       return os << "FFT";
+    }
+    return os << "Strategy(" << int(strategy) << ")";
+}
+
+/**
+ * Return the cheapest Strategy to convolve a width x height image with kernel
+ */
+Strategy chooseStrategy(ConvolutionKernel const& kernel, int width, int height) {
+    int const kw = kernel.getWidth(), kh = kernel.getHeight();
+    if (kernel.isSeparable()) {
+        return SEPARABLE;               // kw + kh operations per pixel;  FFT never wins
+    }
+
+    double fftCost = 0;
+    chooseFftSize(kw, kh, std::max(width, 1), std::max(height, 1), &fftCost);
+
+    return (double(kw)*kh <= fftCost) ? DIRECT : FFT;
+}
+
+}
+
+/************************************************************************************************************/
+
+namespace {
+    /**
+     * Convolve an image with a kernel, one band of rows at a time
+     */
+    template<typename T>
+    class Convolver {
+    public:
+        Convolver(Image<T> const& in, Image<T> &out, ConvolutionKernel const& kernel,
+                  convolution::Strategy strategy);
+
+        /// Return the number of bands
+        std::size_t getNBand() const { return _nBand; }
+
+        void operator()(std::size_t begin, std::size_t end, int) const;
+    private:
+        Image<T> const& _in;
+        Image<T> &_out;
+        convolution::Strategy _strategy;
+        int _width, _height;
+        int _kw, _kh;
+        int _left, _below;              // the number of columns (rows) of the kernel left of (below) its centre,
+                                        // once it's been flipped to make a convolution into a correlation
+        std::vector<float> _kernel;     // flipped (DIRECT);  or kx then ky, flipped (SEPARABLE)
+        int _bandHeight;
+        std::size_t _nBand;
+        // FFT only
+        boost::shared_ptr<Fft> _fft;
+        std::vector<Complex> _spectrum; // the kernel's transform, normalised by the size of the tile
+
+        void _loadRow(int y, float *buf) const;
+        void _storeRow(float const* buf, int y) const;
+
+        void _separable(int y0, int y1) const;
+        void _direct(int y0, int y1) const;
+        void _fftBand(int y0, int y1) const;
+    };
+
+    template<typename T>
+    Convolver<T>::Convolver(Image<T> const& in, Image<T> &out, ConvolutionKernel const& kernel,
+                            convolution::Strategy strategy) :
+        _in(in), _out(out), _strategy(strategy), _width(in.getWidth()), _height(in.getHeight()),
+        _kw(kernel.getWidth()), _kh(kernel.getHeight()),
+        _left(kernel.getWidth() - 1 - kernel.getCtrX()), _below(kernel.getHeight() - 1 - kernel.getCtrY()),
+        _kernel(), _bandHeight(BAND_HEIGHT), _nBand(0), _fft(), _spectrum()
+    {
+        if (out.getWidth() != _width || out.getHeight() != _height) {
+            std::ostringstream msg;
+            msg << "Unable to convolve a " << _width << "x" << _height << " Image into a " <<
+                out.getWidth() << "x" << out.getHeight() << " Image";
+            throw std::runtime_error(msg.str());
+        }
+        if (_width > 0 && _height > 0 && out.getRow(0) == in.getRow(0)) {
+            throw std::runtime_error("Unable to convolve an Image in place");
+        }
+        out.setXY0(in.getX0(), in.getY0());
+
+        if (_strategy == convolution::AUTO) {
+            _strategy = convolution::chooseStrategy(kernel, _width, _height);
+        }
+        switch (_strategy) {
+          case convolution::SEPARABLE:
+            if (!kernel.isSeparable()) {
+                throw std::runtime_error("Unable to convolve with a non-separable kernel in SEPARABLE mode");
+            }
+            _kernel.insert(_kernel.end(), kernel.getKernelX().rbegin(), kernel.getKernelX().rend());
+            _kernel.insert(_kernel.end(), kernel.getKernelY().rbegin(), kernel.getKernelY().rend());
+            break;
+          case convolution::DIRECT:
+            _kernel.reserve(_kw*_kh);
+            for (int j = _kh - 1; j >= 0; --j) {
+                for (int i = _kw - 1; i >= 0; --i) {
+                    _kernel.push_back(kernel(i, j));
+                }
+            }
+            break;
+          case convolution::FFT:
+            {
+                //
+                // A tile of n x n pixels produces (n - kw + 1) x (n - kh + 1) good ones;  the circular
+                // convolution of the tile with the kernel (placed at (0, 0)) puts pixel (x, y) of the
+                // output at (x + kw - 1, y + kh - 1)
+                //
+                int const n = chooseFftSize(_kw, _kh, std::max(_width, 1), std::max(_height, 1));
+                _fft.reset(new Fft(n));
+                _bandHeight = n - _kh + 1;
+
+                _spectrum.assign(n*n, Complex(0, 0));
+                float const norm = 1.0/(double(n)*n);
+                for (int j = 0; j != _kh; ++j) {
+                    for (int i = 0; i != _kw; ++i) {
+                        _spectrum[j*n + i] = Complex(norm*kernel(i, j), 0);
+                    }
+                }
+                transform2d(&_spectrum[0], *_fft, false);
+            }
+            break;
+          default:
+            {
+                std::ostringstream msg;
+                msg << "Unknown convolution strategy " << _strategy;
+                throw std::runtime_error(msg.str());
+            }
+        }
+
+        _nBand = (_height + _bandHeight - 1)/_bandHeight;
+    }
+
+    /// Convolve the bands [begin, end)
+    template<typename T>
+    void Convolver<T>::operator()(std::size_t begin, std::size_t end, int) const {
+        for (std::size_t b = begin; b != end; ++b) {
+            int const y0 = b*_bandHeight, y1 = std::min(_height, y0 + _bandHeight);
+            switch (_strategy) {
+              case convolution::SEPARABLE: _separable(y0, y1); break;
+              case convolution::DIRECT:    _direct(y0, y1);    break;
+              default:                     _fftBand(y0, y1);   break;
+            }
+        }
+    }
+
+    /**
+     * Copy row y of the input into buf, padded with _left zeros before and _kw - 1 - _left after
+     */
+    template<typename T>
+    void Convolver<T>::_loadRow(int y, float *buf) const {
+        T const* row = _in.getRow(y);
+        std::fill(buf, buf + _left, 0.0f);
+        std::copy(row, row + _width, buf + _left);
+        std::fill(buf + _left + _width, buf + _width + _kw - 1, 0.0f);
+    }
+
+    /// Copy buf to row y of the output
+    template<typename T>
+    void Convolver<T>::_storeRow(float const* buf, int y) const {
+        std::copy(buf, buf + _width, _out.getRow(y));
+    }
+
+    /**
+     * Convolve rows [y0, y1) with a separable kernel:  correlate the rows that contribute with the column
+     * factor, and then sum them weighted by the row factor
+     */
+    template<typename T>
+    void Convolver<T>::_separable(int y0, int y1) const {
+        float const* kx = &_kernel[0];
+        float const* ky = &_kernel[_kw];
+        int const r0 = y0 - _below;     // the first input row that contributes (possibly off the image)
+        int const nrow = y1 - y0 + _kh - 1;
+
+        std::vector<float> buf(_width + _kw - 1);
+        std::vector<float> tmp(static_cast<std::size_t>(nrow)*_width);
+        for (int r = std::max(r0, 0); r < std::min(r0 + nrow, _height); ++r) {
+            _loadRow(r, &buf[0]);
+            float *row = &tmp[(r - r0)*_width];
+            simd::correlate(&buf[0], kx, _kw, _width, row);
+        }
+
+        std::vector<float const*> rows(_kh);
+        std::vector<float> weights(_kh);
+        for (int y = y0; y != y1; ++y) {
+            int n = 0;
+            for (int j = 0; j != _kh; ++j) {
+                int const r = y - _below + j;
+                if (r >= 0 && r < _height) {
+                    rows[n] = &tmp[(r - r0)*_width];
+                    weights[n] = ky[j];
+                    ++n;
+                }
+            }
+            simd::weightedRowSum(&rows[0], &weights[0], n, _width, &buf[0]);
+            _storeRow(&buf[0], y);
+        }
+    }
+
+    /**
+     * Convolve rows [y0, y1) directly:  correlate each input row that contributes to an output row with
+     * the corresponding row of the kernel, a block of columns at a time
+     */
+    template<typename T>
+    void Convolver<T>::_direct(int y0, int y1) const {
+        int const r0 = std::max(0, y0 - _below);
+        int const r1 = std::min(_height, y1 - _below + _kh - 1);
+        int const padWidth = _width + _kw - 1;
+
+        std::vector<float> padded(static_cast<std::size_t>(std::max(0, r1 - r0))*padWidth);
+        for (int r = r0; r < r1; ++r) {
+            _loadRow(r, &padded[(r - r0)*padWidth]);
+        }
+
+        std::vector<float> buf(_width);
+        for (int y = y0; y != y1; ++y) {
+            int const j0 = std::max(0, r0 - (y - _below)), j1 = std::min(_kh, r1 - (y - _below));
+            std::fill(buf.begin(), buf.end(), 0.0f);
+            for (int x0 = 0; x0 < _width; x0 += BLOCK_WIDTH) {
+                int const nx = std::min(BLOCK_WIDTH, _width - x0);
+                for (int j = j0; j < j1; ++j) {
+                    float const* row = &padded[(y - _below + j - r0)*padWidth];
+                    simd::correlate(row + x0, &_kernel[j*_kw], _kw, nx, &buf[x0]);
+                }
+            }
+            _storeRow(&buf[0], y);
+        }
+    }
+
+    /**
+     * Convolve rows [y0, y1) by FFT, a pair of tiles at a time
+     */
+    template<typename T>
+    void Convolver<T>::_fftBand(int y0, int y1) const {
+        int const n = _fft->getSize();
+        int const tileWidth = n - _kw + 1;
+        int const nTile = (_width + tileWidth - 1)/tileWidth;
+
+        std::vector<Complex> data(n*n);
+        for (int t = 0; t < nTile; t += 2) {
+            //
+            // Tile t is the real part and tile t + 1 (if it exists) the imaginary part
+            //
+            int const tx0[2] = { t*tileWidth - _left, (t + 1)*tileWidth - _left };
+            bool const pair = (t + 1 < nTile);
+            for (int j = 0; j != n; ++j) {
+                Complex *drow = &data[j*n];
+                int const y = y0 - _below + j;
+                if (y < 0 || y >= _height) {
+                    std::fill(drow, drow + n, Complex(0, 0));
+                    continue;
+                }
+                T const* row = _in.getRow(y);
+                for (int i = 0; i != n; ++i) {
+                    int const x = tx0[0] + i, x2 = tx0[1] + i;
+                    float const re = (x >= 0 && x < _width) ? row[x] : 0;
+                    float const im = (pair && x2 >= 0 && x2 < _width) ? row[x2] : 0;
+                    drow[i] = Complex(re, im);
+                }
+            }
+
+            transform2d(&data[0], *_fft, false);
+            for (int i = 0; i != n*n; ++i) {
+                float const ar = data[i].real(), ai = data[i].imag();
+                float const br = _spectrum[i].real(), bi = _spectrum[i].imag();
+                data[i] = Complex(ar*br - ai*bi, ar*bi + ai*br);
+            }
+            transform2d(&data[0], *_fft, true);
+
+            for (int y = y0; y != y1; ++y) {
+                Complex const* drow = &data[(y - y0 + _kh - 1)*n + _kw - 1];
+                T *orow = _out.getRow(y);
+                for (int i = 0; i != tileWidth; ++i) {
+                    int const x = t*tileWidth + i;
+                    if (x >= _width) {
+                        break;
+                    }
+                    orow[x] = drow[i].real();
+                    if (pair && x + tileWidth < _width) {
+                        orow[x + tileWidth] = drow[i].imag();
+                    }
+                }
+            }
+        }
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Set out to in convolved with kernel, treating pixels beyond in's edges as zero
+ *
+ * out must be the same size as in, and mustn't share its pixels;  it's given in's (x0, y0).  The arithmetic
+ * is done in single precision whatever the type of the pixels
+ */
+template<typename T>
+void convolve(Image<T> const& in,               ///< the image to convolve
+              Image<T> &out,                    ///< the convolved image
+              ConvolutionKernel const& kernel,  ///< the kernel
+              convolution::Strategy strategy    ///< how to do it
+             ) {
+    Convolver<T> const convolver(in, out, kernel, strategy);
+    convolver(0, convolver.getNBand(), 0);
+}
+
+/**
+ * Set out to in convolved with kernel, processing bands of rows in parallel on pool's threads;  the
+ * answers are identical to the serial version's
+ */
+template<typename T>
+void convolve(Image<T> const& in,               ///< the image to convolve
+              Image<T> &out,                    ///< the convolved image
+              ConvolutionKernel const& kernel,  ///< the kernel
+              ThreadPool &pool,                 ///< the threads to use
+              convolution::Strategy strategy    ///< how to do it
+             ) {
+    Convolver<T> const convolver(in, out, kernel, strategy);
+    pool.run(convolver.getNBand(), 1, boost::cref(convolver));
+}
+
+/*
+ * Explicit instantiations
+ */
+template void convolve(Image<float> const&, Image<float> &, ConvolutionKernel const&, convolution::Strategy);
+template void convolve(Image<double> const&, Image<double> &, ConvolutionKernel const&, convolution::Strategy);
+template void convolve(Image<float> const&, Image<float> &, ConvolutionKernel const&, ThreadPool &,
+                       convolution::Strategy);
+template void convolve(Image<double> const&, Image<double> &, ConvolutionKernel const&, ThreadPool &,
+                       convolution::Strategy);
@@ -0,0 +1,79 @@
+// -*- lsst-c++ -*-
+#if !defined(CONVOLVE_H)
+#define CONVOLVE_H 1
+
+#include <iostream>
+#include <vector>
+
+#include "Image.h"
+#include "Psf.h"
+#include "ThreadPool.h"
+
+/**
+ * A kernel to convolve an Image with:  width x height values, centred on (getCtrX(), getCtrY())
+ *
+ * Kernels that are the product of a function of column and a function of row (e.g. a circular Gaussian)
+ * are separable, and can be applied as two 1-D passes;  kernels built from 2-D values are checked to see
+ * whether they're separable
+ */
+class ConvolutionKernel {
+public:
+    ConvolutionKernel(int width, int height, float const* values);
+    ConvolutionKernel(std::vector<float> const& kx, std::vector<float> const& ky);
+    explicit ConvolutionKernel(PsfKernel const& psf);
+
+    static ConvolutionKernel makeGaussian(double sigma, int halfWidth=-1);
+
+    /// Return the number of columns
+    int getWidth() const { return _width; }
+    /// Return the number of rows
+    int getHeight() const { return _height; }
+    /// Return the column of the kernel's centre
+    int getCtrX() const { return _width/2; }
+    /// Return the row of the kernel's centre
+    int getCtrY() const { return _height/2; }
+    /// Return a pointer to row j of the kernel, j in [0, getHeight())
+    float const* getRow(int j) const { return &_values[j*_width]; }
+    /// Return the kernel's value at column i, row j
+    float operator()(int i, int j) const { return _values[j*_width + i]; }
+
+    /// Is the kernel separable, i.e. (*this)(i, j) == getKernelX()[i]*getKernelY()[j]?
+    bool isSeparable() const { return !_kx.empty(); }
+    /// Return the kernel's column factor;  empty unless isSeparable()
+    std::vector<float> const& getKernelX() const { return _kx; }
+    /// Return the kernel's row factor;  empty unless isSeparable()
+    std::vector<float> const& getKernelY() const { return _ky; }
+private:
+    int _width, _height;
+    std::vector<float> _values;
+    std::vector<float> _kx, _ky;
+
+    void _check() const;
+    void _factor();
+};
+
+namespace convolution {
+    /// Ways to convolve an Image
+    typedef enum {
+        AUTO,                           // choose for me
+        SEPARABLE,                      // two 1-D passes;  separable kernels only
+        DIRECT,                         // sum over the kernel at each pixel;  best for small kernels
+        FFT                             // multiply the Fourier transforms of tiles;  best for large kernels
+    } Strategy;
+
+    std::ostream &operator<<(std::ostream &os, Strategy strategy);
+
+    Strategy chooseStrategy(ConvolutionKernel const& kernel, int width, int height);
+}
+
+/*
+ * Set out to in convolved with kernel;  \sa Convolve.cc
+ */
+template<typename T>
+void convolve(Image<T> const& in, Image<T> &out, ConvolutionKernel const& kernel,
+              convolution::Strategy strategy=convolution::AUTO);
+template<typename T>
+void convolve(Image<T> const& in, Image<T> &out, ConvolutionKernel const& kernel, ThreadPool &pool,
+              convolution::Strategy strategy=convolution::AUTO);
+
+#endif
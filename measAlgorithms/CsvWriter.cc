@@ -0,0 +1,588 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include "boost/bind/bind.hpp"
+#include "boost/cstdint.hpp"
+
+#include "CsvWriter.h"
+
+/************************************************************************************************************/
+/*
+ * Shortest round-trip formatting of floating point numbers, using Florian Loitsch's Grisu2 algorithm
+ * ("Printing Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010)
+ */
+namespace {
+    typedef boost::uint64_t uint64;
+    typedef boost::uint32_t uint32;
+
+    /// A number f*2^e with a 64-bit significand ("do-it-yourself floating point")
+    struct DiyFp {
+        DiyFp() : f(0), e(0) {}
+        DiyFp(uint64 f_, int e_) : f(f_), e(e_) {}
+
+        /// Return *this with its significand shifted so that its top bit is set;  f must be non-zero
+        DiyFp normalize() const {
+            DiyFp res = *this;
+            for (int shift = 32; shift != 0; shift >>= 1) {
+                if ((res.f >> (64 - shift)) == 0) {
+                    res.f <<= shift;
+                    res.e -= shift;
+                }
+            }
+            return res;
+        }
+        /// Return the difference of two DiyFps with the same exponent
+        DiyFp operator-(DiyFp const& rhs) const {
+            return DiyFp(f - rhs.f, e);
+        }
+        /// Return the product, rounded to 64 bits
+        DiyFp operator*(DiyFp const& rhs) const {
+#if defined(__SIZEOF_INT128__)
+            __extension__ typedef unsigned __int128 uint128;
+            uint128 const p = static_cast<uint128>(f)*rhs.f + (static_cast<uint128>(1) << 63);
+
+            return DiyFp(static_cast<uint64>(p >> 64), e + rhs.e + 64);
+#else
+            uint64 const M32 = 0xffffffff;
+            uint64 const a = f >> 32, b = f & M32, c = rhs.f >> 32, d = rhs.f & M32;
+            uint64 const ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+            uint64 const mid = (bd >> 32) + (ad & M32) + (bc & M32) + (static_cast<uint64>(1) << 31);
+
+            return DiyFp(ac + (ad >> 32) + (bc >> 32) + (mid >> 32), e + rhs.e + 64);
+#endif
+        }
+
+        uint64 f;
+        int e;
+    };
+
+    /// The layout of an IEEE float or double
+    template<typename FloatT> struct IeeeTraits;
+
+    template<>
+    struct IeeeTraits<double> {
+        typedef uint64 Bits;
+        enum { SIGNIFICAND_SIZE = 52, EXPONENT_BIAS = 1023 + 52, EXPONENT_MASK = 0x7ff };
+    };
+
+    template<>
+    struct IeeeTraits<float> {
+        typedef uint32 Bits;
+        enum { SIGNIFICAND_SIZE = 23, EXPONENT_BIAS = 127 + 23, EXPONENT_MASK = 0xff };
+    };
+
+    /**
+     * Split the positive, finite, non-zero x (as its bits) into a normalised DiyFp v, and the normalised
+     * boundaries mMinus and mPlus (with v's exponent) halfway to its neighbours;  any number strictly
+     * between the boundaries reads back as x
+     */
+    template<typename FloatT>
+    void getBoundaries(typename IeeeTraits<FloatT>::Bits bits, DiyFp *v, DiyFp *mMinus, DiyFp *mPlus) {
+        typedef IeeeTraits<FloatT> Traits;
+        uint64 const hidden = static_cast<uint64>(1) << Traits::SIGNIFICAND_SIZE;
+        int const biasedE = (bits >> Traits::SIGNIFICAND_SIZE) & Traits::EXPONENT_MASK;
+        uint64 const significand = bits & (hidden - 1);
+
+        DiyFp const x = (biasedE == 0) ? DiyFp(significand, 1 - Traits::EXPONENT_BIAS) :
+                                         DiyFp(significand | hidden, biasedE - Traits::EXPONENT_BIAS);
+        *mPlus = DiyFp((x.f << 1) + 1, x.e - 1).normalize();
+        if (x.f == hidden && biasedE > 1) { // the gap to the next smaller number is half the usual size
+            *mMinus = DiyFp((x.f << 2) - 1, x.e - 2);
+        } else {
+            *mMinus = DiyFp((x.f << 1) - 1, x.e - 1);
+        }
+        mMinus->f <<= mMinus->e - mPlus->e;
+        mMinus->e = mPlus->e;
+        *v = x.normalize();
+    }
+
+    /// Normalised approximations to 10^-348, 10^-340, ..., 10^340 as f*2^e
+    struct CachedPower {
+        uint32 hi, lo;                  // f's top and bottom 32 bits
+        int e;
+    };
+
+    CachedPower const cachedPowers[] = {
+        { 0xfa8fd5a0, 0x081c0288, -1220 }, { 0xbaaee17f, 0xa23ebf76, -1193 }, { 0x8b16fb20, 0x3055ac76, -1166 },
+        { 0xcf42894a, 0x5dce35ea, -1140 }, { 0x9a6bb0aa, 0x55653b2d, -1113 }, { 0xe61acf03, 0x3d1a45df, -1087 },
+        { 0xab70fe17, 0xc79ac6ca, -1060 }, { 0xff77b1fc, 0xbebcdc4f, -1034 }, { 0xbe5691ef, 0x416bd60c, -1007 },
+        { 0x8dd01fad, 0x907ffc3c,  -980 }, { 0xd3515c28, 0x31559a83,  -954 }, { 0x9d71ac8f, 0xada6c9b5,  -927 },
+        { 0xea9c2277, 0x23ee8bcb,  -901 }, { 0xaecc4991, 0x4078536d,  -874 }, { 0x823c1279, 0x5db6ce57,  -847 },
+        { 0xc2109436, 0x4dfb5637,  -821 }, { 0x9096ea6f, 0x3848984f,  -794 }, { 0xd77485cb, 0x25823ac7,  -768 },
+        { 0xa086cfcd, 0x97bf97f4,  -741 }, { 0xef340a98, 0x172aace5,  -715 }, { 0xb23867fb, 0x2a35b28e,  -688 },
+        { 0x84c8d4df, 0xd2c63f3b,  -661 }, { 0xc5dd4427, 0x1ad3cdba,  -635 }, { 0x936b9fce, 0xbb25c996,  -608 },
+        { 0xdbac6c24, 0x7d62a584,  -582 }, { 0xa3ab6658, 0x0d5fdaf6,  -555 }, { 0xf3e2f893, 0xdec3f126,  -529 },
+        { 0xb5b5ada8, 0xaaff80b8,  -502 }, { 0x87625f05, 0x6c7c4a8b,  -475 }, { 0xc9bcff60, 0x34c13053,  -449 },
+        { 0x964e858c, 0x91ba2655,  -422 }, { 0xdff97724, 0x70297ebd,  -396 }, { 0xa6dfbd9f, 0xb8e5b88f,  -369 },
+        { 0xf8a95fcf, 0x88747d94,  -343 }, { 0xb9447093, 0x8fa89bcf,  -316 }, { 0x8a08f0f8, 0xbf0f156b,  -289 },
+        { 0xcdb02555, 0x653131b6,  -263 }, { 0x993fe2c6, 0xd07b7fac,  -236 }, { 0xe45c10c4, 0x2a2b3b06,  -210 },
+        { 0xaa242499, 0x697392d3,  -183 }, { 0xfd87b5f2, 0x8300ca0e,  -157 }, { 0xbce50864, 0x92111aeb,  -130 },
+        { 0x8cbccc09, 0x6f5088cc,  -103 }, { 0xd1b71758, 0xe219652c,   -77 }, { 0x9c400000, 0x00000000,   -50 },
+        { 0xe8d4a510, 0x00000000,   -24 }, { 0xad78ebc5, 0xac620000,     3 }, { 0x813f3978, 0xf8940984,    30 },
+        { 0xc097ce7b, 0xc90715b3,    56 }, { 0x8f7e32ce, 0x7bea5c70,    83 }, { 0xd5d238a4, 0xabe98068,   109 },
+        { 0x9f4f2726, 0x179a2245,   136 }, { 0xed63a231, 0xd4c4fb27,   162 }, { 0xb0de6538, 0x8cc8ada8,   189 },
+        { 0x83c7088e, 0x1aab65db,   216 }, { 0xc45d1df9, 0x42711d9a,   242 }, { 0x924d692c, 0xa61be758,   269 },
+        { 0xda01ee64, 0x1a708dea,   295 }, { 0xa26da399, 0x9aef774a,   322 }, { 0xf209787b, 0xb47d6b85,   348 },
+        { 0xb454e4a1, 0x79dd1877,   375 }, { 0x865b8692, 0x5b9bc5c2,   402 }, { 0xc83553c5, 0xc8965d3d,   428 },
+        { 0x952ab45c, 0xfa97a0b3,   455 }, { 0xde469fbd, 0x99a05fe3,   481 }, { 0xa59bc234, 0xdb398c25,   508 },
+        { 0xf6c69a72, 0xa3989f5c,   534 }, { 0xb7dcbf53, 0x54e9bece,   561 }, { 0x88fcf317, 0xf22241e2,   588 },
+        { 0xcc20ce9b, 0xd35c78a5,   614 }, { 0x98165af3, 0x7b2153df,   641 }, { 0xe2a0b5dc, 0x971f303a,   667 },
+        { 0xa8d9d153, 0x5ce3b396,   694 }, { 0xfb9b7cd9, 0xa4a7443c,   720 }, { 0xbb764c4c, 0xa7a44410,   747 },
+        { 0x8bab8eef, 0xb6409c1a,   774 }, { 0xd01fef10, 0xa657842c,   800 }, { 0x9b10a4e5, 0xe9913129,   827 },
+        { 0xe7109bfb, 0xa19c0c9d,   853 }, { 0xac2820d9, 0x623bf429,   880 }, { 0x80444b5e, 0x7aa7cf85,   907 },
+        { 0xbf21e440, 0x03acdd2d,   933 }, { 0x8e679c2f, 0x5e44ff8f,   960 }, { 0xd433179d, 0x9c8cb841,   986 },
+        { 0x9e19db92, 0xb4e31ba9,  1013 }, { 0xeb96bf6e, 0xbadf77d9,  1039 }, { 0xaf87023b, 0x9bf0ee6b,  1066 },
+    };
+
+    /**
+     * Return a cached power of ten, c = 10^-K, such that c*2^e (where e is the exponent of a normalised
+     * DiyFp) has an exponent in [-60, -32]
+     */
+    DiyFp getCachedPower(int e, int *K) {
+        double const dk = (-61 - e)*0.30102999566398114 + 347; // 347 makes dk positive, so ceil is easy
+        int k = static_cast<int>(dk);
+        if (dk - k > 0.0) {
+            ++k;
+        }
+        int const index = (k >> 3) + 1;
+        *K = -(-348 + (index << 3));
+
+        CachedPower const& c = cachedPowers[index];
+        return DiyFp((static_cast<uint64>(c.hi) << 32) | c.lo, c.e);
+    }
+
+    uint32 const pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+    /// Return the number of decimal digits in n
+    int countDigits(uint32 n) {
+        int nDigit = 1;
+        while (nDigit < 10 && n >= pow10[nDigit]) {
+            ++nDigit;
+        }
+        return nDigit;
+    }
+
+    /// The two digits of 0, 1, ..., 99
+    char const digitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    /// Write the digits of n starting at buf, returning one past the end
+    char *formatUnsigned(unsigned long n, char *buf) {
+        char digits[3*sizeof(long)];
+        char *const end = digits + sizeof(digits);
+        char *ptr = end;
+        while (n >= 100) {              // two digits at a time, to halve the (multiplicative) divisions
+            ptr -= 2;
+            std::memcpy(ptr, digitPairs + 2*(n%100), 2);
+            n /= 100;
+        }
+        if (n >= 10) {
+            ptr -= 2;
+            std::memcpy(ptr, digitPairs + 2*n, 2);
+        } else {
+            *--ptr = static_cast<char>('0' + n);
+        }
+
+        std::memcpy(buf, ptr, end - ptr);
+        return buf + (end - ptr);
+    }
+
+    /**
+     * Move the last digit of buffer towards w (the number being formatted), as long as we stay within the
+     * boundaries;  rest is the distance from buffer's value to the upper boundary, delta the width of the
+     * range, wpw the distance from w to the upper boundary, and tenKappa the value of the last digit
+     */
+    void roundWeed(char *buffer, int length, uint64 delta, uint64 rest, uint64 tenKappa, uint64 wpw) {
+        while (rest < wpw && delta - rest >= tenKappa &&
+               (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+            --buffer[length - 1];
+            rest += tenKappa;
+        }
+    }
+
+    /**
+     * Generate the shortest digits of a number in (mPlus - delta, mPlus) as near to w as possible;  on
+     * return buffer[0, length)*10^K is the number
+     */
+    void generateDigits(DiyFp const& w, DiyFp const& mPlus, uint64 delta, char *buffer, int *length, int *K) {
+        DiyFp const one(static_cast<uint64>(1) << -mPlus.e, mPlus.e);
+        DiyFp const wpw = mPlus - w;
+        uint32 p1 = static_cast<uint32>(mPlus.f >> -one.e); // the integral part
+        uint64 p2 = mPlus.f & (one.f - 1);                 // the fractional part
+
+        *length = 0;
+        //
+        // The rest after each integral digit is at least p2, so if p2 > delta (as it almost always is for a
+        // double) we can't stop within the integral part, and may write all of it at once
+        //
+        if (p2 > delta) {
+            if (p1 != 0) {
+                *length = formatUnsigned(p1, buffer) - buffer;
+            }
+        } else {
+            for (int kappa = countDigits(p1); kappa > 0; ) {
+                uint32 d = 0;
+                switch (kappa) {        // constant divisors, which the compiler replaces by multiplications
+                  case 10: d = p1/1000000000; p1 %= 1000000000; break;
+                  case  9: d = p1/100000000;  p1 %= 100000000;  break;
+                  case  8: d = p1/10000000;   p1 %= 10000000;   break;
+                  case  7: d = p1/1000000;    p1 %= 1000000;    break;
+                  case  6: d = p1/100000;     p1 %= 100000;     break;
+                  case  5: d = p1/10000;      p1 %= 10000;      break;
+                  case  4: d = p1/1000;       p1 %= 1000;       break;
+                  case  3: d = p1/100;        p1 %= 100;        break;
+                  case  2: d = p1/10;         p1 %= 10;         break;
+                  case  1: d = p1;            p1 = 0;           break;
+                }
+                if (d || *length) {
+                    buffer[(*length)++] = static_cast<char>('0' + d);
+                }
+                --kappa;
+                uint64 const rest = (static_cast<uint64>(p1) << -one.e) + p2;
+                if (rest <= delta) {
+                    *K += kappa;
+                    roundWeed(buffer, *length, delta, rest, static_cast<uint64>(pow10[kappa]) << -one.e, wpw.f);
+                    return;
+                }
+            }
+        }
+
+        for (int kappa = 0; ; ) {
+            p2 *= 10;
+            delta *= 10;
+            char const d = static_cast<char>(p2 >> -one.e);
+            if (d || *length) {
+                buffer[(*length)++] = static_cast<char>('0' + d);
+            }
+            p2 &= one.f - 1;
+            --kappa;
+            if (p2 < delta) {
+                *K += kappa;
+                roundWeed(buffer, *length, delta, p2, one.f, wpw.f*(-kappa < 10 ? pow10[-kappa] : 0));
+                return;
+            }
+        }
+    }
+
+    /// Write the exponent K (e.g. "-7" or "23") starting at buf, returning one past the end
+    char *writeExponent(int K, char *buf) {
+        if (K < 0) {
+            *buf++ = '-';
+            K = -K;
+        }
+        if (K >= 100) {
+            *buf++ = static_cast<char>('0' + K/100);
+            K %= 100;
+            *buf++ = static_cast<char>('0' + K/10);
+        } else if (K >= 10) {
+            *buf++ = static_cast<char>('0' + K/10);
+        }
+        *buf++ = static_cast<char>('0' + K%10);
+
+        return buf;
+    }
+
+    /**
+     * Lay out the digits buffer[0, length)*10^k:  as an integer or a plain decimal if that's reasonably
+     * short, otherwise in scientific notation.  Return one past the end
+     */
+    char *prettify(char *buffer, int length, int k) {
+        int const kk = length + k;      // 10^(kk - 1) <= value < 10^kk
+
+        if (k >= 0 && kk <= 21) {       // 1234e2 -> 123400
+            std::fill(buffer + length, buffer + kk, '0');
+            return buffer + kk;
+        } else if (kk > 0 && kk <= 21) { // 1234e-2 -> 12.34
+            std::memmove(buffer + kk + 1, buffer + kk, length - kk);
+            buffer[kk] = '.';
+            return buffer + length + 1;
+        } else if (kk > -6 && kk <= 0) { // 1234e-6 -> 0.001234
+            int const offset = 2 - kk;
+            std::memmove(buffer + offset, buffer, length);
+            buffer[0] = '0';
+            buffer[1] = '.';
+            std::fill(buffer + 2, buffer + offset, '0');
+            return buffer + length + offset;
+        } else if (length == 1) {       // 1e30
+            buffer[1] = 'e';
+            return writeExponent(kk - 1, buffer + 2);
+        } else {                        // 1234e30 -> 1.234e33
+            std::memmove(buffer + 2, buffer + 1, length - 1);
+            buffer[1] = '.';
+            buffer[length + 1] = 'e';
+            return writeExponent(kk - 1, buffer + length + 2);
+        }
+    }
+
+    template<typename FloatT>
+    char *formatFloat(FloatT x, char *buf) {
+        typedef IeeeTraits<FloatT> Traits;
+        typedef typename Traits::Bits Bits;
+        Bits bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+
+        Bits const sign = static_cast<Bits>(1) << (8*sizeof(Bits) - 1);
+        if (bits & sign) {
+            *buf++ = '-';
+            bits &= ~sign;
+        }
+        if ((bits >> Traits::SIGNIFICAND_SIZE) == Traits::EXPONENT_MASK) {
+            bool const isNan = (bits & ((static_cast<Bits>(1) << Traits::SIGNIFICAND_SIZE) - 1)) != 0;
+            std::memcpy(buf, isNan ? "nan" : "inf", 3);
+            return buf + 3;
+        }
+        if (bits == 0) {
+            *buf++ = '0';
+            return buf;
+        }
+        //
+        // Integers small enough that every integer near them is representable (e.g. the -1 that stands
+        // for a missing error) are their own shortest representation
+        //
+        FloatT ax;
+        std::memcpy(&ax, &bits, sizeof(bits));
+        if (ax < static_cast<FloatT>(static_cast<uint64>(1) << (Traits::SIGNIFICAND_SIZE + 1))) {
+            unsigned long const n = static_cast<unsigned long>(ax);
+            if (n == ax) {
+                return formatUnsigned(n, buf);
+            }
+        }
+
+        DiyFp v, mMinus, mPlus;
+        getBoundaries<FloatT>(bits, &v, &mMinus, &mPlus);
+
+        int K = 0;
+        DiyFp const c = getCachedPower(mPlus.e, &K);
+        DiyFp const w = v*c;
+        DiyFp wPlus = mPlus*c, wMinus = mMinus*c;
+        ++wMinus.f;                     // allow for the errors in the products
+        --wPlus.f;
+
+        int length = 0;
+        generateDigits(w, wPlus, wPlus.f - wMinus.f, buf, &length, &K);
+
+        return prettify(buf, length, K);
+    }
+}
+
+namespace csv {
+    /// Write x with the fewest digits that read back as x
+    char *format(double x, char *buf) {
+        return formatFloat(x, buf);
+    }
+
+    /// Write x with the fewest digits that read back as x (as a float)
+    char *format(float x, char *buf) {
+        return formatFloat(x, buf);
+    }
+
+    /// Write x
+    char *format(long x, char *buf) {
+        unsigned long u = x;
+        if (x < 0) {
+            *buf++ = '-';
+            u = 0UL - u;
+        }
+
+        return formatUnsigned(u, buf);
+    }
+}
+
+/************************************************************************************************************/
+
+namespace {
+    char const SEPARATOR[] = ", ";
+    int const SEPARATOR_LENGTH = sizeof(SEPARATOR) - 1;
+}
+
+/// Add the columns of one of our schemas (a composite) to _columns, and their names and units to the lines
+void CsvWriter::_planColumns(Schema const& schema, int table, std::string *names, std::string *units) {
+    int slot = 0;                       // the first slot of the current member
+    for (Schema::const_iterator mptr = schema.begin(); mptr != schema.end(); ++mptr) {
+        Schema const& sch = **mptr;
+        for (Schema::const_iterator sptr = sch.begin(); sptr != sch.end(); ++sptr) {
+            Schema const& se = **sptr;
+            for (int i = 0; i != se.getDimen(); ++i) {
+                if (!_columns.empty()) {
+                    *names += SEPARATOR;
+                    *units += SEPARATOR;
+                }
+                Column const column = { table, slot + static_cast<int>(se.getIndex()) + i, se.getType() };
+                _columns.push_back(column);
+
+                *names += sch.getComponent() + "." + se.getName();
+                if (se.isArray()) {
+                    char buf[csv::MAX_NUMBER_LENGTH];
+                    names->append(buf, csv::format(static_cast<long>(i), buf));
+                }
+                *units += se.getUnits();
+            }
+        }
+        slot += sch.size();
+    }
+}
+
+/**
+ * Prepare to write catalogues with the given schemas (those of the MeasureAstrometry and
+ * MeasurePhotometry objects that measured them) to os
+ */
+CsvWriter::CsvWriter(std::ostream &os,                  ///< where to write
+                     Schema::ConstPtr astromSchema,     ///< the catalogues' astrometric schema
+                     Schema::ConstPtr photomSchema,     ///< the catalogues' photometric schema
+                     std::size_t bufferSize             ///< how many chars to buffer before writing
+                    ) :
+    _os(os), _astromSchema(astromSchema), _photomSchema(photomSchema), _columns(), _header(),
+    _maxRowLength(0), _buffer(), _used(0), _fields(), _chunks(), _chunkSizes()
+{
+    std::string names, units;
+    _planColumns(*astromSchema, 0, &names, &units);
+    _planColumns(*photomSchema, 1, &names, &units);
+    _header = names + "\n" + units + "\n";
+
+    _maxRowLength = _columns.size()*(csv::MAX_NUMBER_LENGTH + SEPARATOR_LENGTH) + 1;
+    _buffer.resize(std::max(bufferSize, std::max(_maxRowLength, _header.size())));
+}
+
+/// Write anything that's still buffered
+CsvWriter::~CsvWriter() {
+    flush();
+}
+
+/// Write the column names, then their units, one line each
+void CsvWriter::writeHeader() {
+    if (_buffer.size() - _used < _header.size()) {
+        flush();
+    }
+    std::memcpy(&_buffer[_used], _header.data(), _header.size());
+    _used += _header.size();
+}
+
+/// Write everything that's buffered to the stream, and flush it
+void CsvWriter::flush() {
+    if (_used > 0) {
+        _os.write(&_buffer[0], _used);
+        _used = 0;
+    }
+    _os.flush();
+}
+
+/// Find the columns of cat, which must have been made with our schemas
+void CsvWriter::_setFields(SourceCatalog const& cat) {
+    if (cat.getAstrometry().getSchema() != _astromSchema || cat.getPhotometry().getSchema() != _photomSchema) {
+        throw std::runtime_error("SourceCatalog was not created with this CsvWriter's schemas");
+    }
+
+    _fields.resize(_columns.size());
+    for (unsigned int i = 0; i != _columns.size(); ++i) {
+        Column const& column = _columns[i];
+        Field const field = {
+            static_cast<char const*>(column.table == 0 ? cat.getAstrometry().getColumn(column.slot) :
+                                                         cat.getPhotometry().getColumn(column.slot)),
+            column.type
+        };
+        _fields[i] = field;
+    }
+}
+
+/// Format one row of the current catalogue (\sa _setFields), ending with '\n';  return one past the end
+char *CsvWriter::_formatRow(std::size_t row, char *buf) const {
+    for (std::vector<Field>::const_iterator ptr = _fields.begin(); ptr != _fields.end(); ++ptr) {
+        if (ptr != _fields.begin()) {
+            std::memcpy(buf, SEPARATOR, SEPARATOR_LENGTH);
+            buf += SEPARATOR_LENGTH;
+        }
+        char const* data = ptr->data;
+        switch (ptr->type) {
+          case Schema::CHAR:
+            buf = csv::format(static_cast<long>(reinterpret_cast<char const*>(data)[row]), buf);
+            break;
+          case Schema::SHORT:
+            buf = csv::format(static_cast<long>(reinterpret_cast<short const*>(data)[row]), buf);
+            break;
+          case Schema::INT:
+            buf = csv::format(static_cast<long>(reinterpret_cast<int const*>(data)[row]), buf);
+            break;
+          case Schema::LONG:
+            buf = csv::format(reinterpret_cast<long const*>(data)[row], buf);
+            break;
+          case Schema::FLOAT:
+            buf = csv::format(reinterpret_cast<float const*>(data)[row], buf);
+            break;
+          case Schema::DOUBLE:
+            buf = csv::format(reinterpret_cast<double const*>(data)[row], buf);
+            break;
+          default:
+            break;
+        }
+    }
+    *buf++ = '\n';
+
+    return buf;
+}
+
+/**
+ * Write rows [begin, end) of cat, which must have been made with the schemas passed to our ctor
+ */
+void CsvWriter::write(SourceCatalog const& cat, std::size_t begin, std::size_t end) {
+    _setFields(cat);
+
+    for (std::size_t row = begin; row < end; ++row) {
+        if (_buffer.size() - _used < _maxRowLength) {
+            _os.write(&_buffer[0], _used);
+            _used = 0;
+        }
+        _used = _formatRow(row, &_buffer[_used]) - &_buffer[0];
+    }
+}
+
+/**
+ * Write all of cat's rows, formatting chunks of chunkSize rows in parallel using the threads in pool.
+ * The output is the same as write(cat)'s
+ */
+void CsvWriter::write(SourceCatalog const& cat, ThreadPool &pool, std::size_t chunkSize) {
+    _setFields(cat);
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+
+    std::size_t const nChunk = 4*pool.getNThread(); // the number of chunks to format at a time
+    _chunks.resize(nChunk);
+    _chunkSizes.resize(nChunk);
+
+    std::size_t const end = cat.size();
+    for (std::size_t row0 = 0; row0 < end; row0 += nChunk*chunkSize) {
+        std::size_t const n = std::min(nChunk, (end - row0 + chunkSize - 1)/chunkSize);
+        pool.run(n, 1, boost::bind(&CsvWriter::_formatChunks, this, row0, end, chunkSize,
+                                   boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3));
+
+        if (_used > 0) {                // keep the rows in order
+            _os.write(&_buffer[0], _used);
+            _used = 0;
+        }
+        for (std::size_t i = 0; i != n; ++i) {
+            _os.write(&_chunks[i][0], _chunkSizes[i]);
+        }
+    }
+}
+
+/**
+ * Format chunks [b, e) of the rows starting at row0 (and stopping before end) into _chunks;  used by the
+ * parallel write()
+ */
+void CsvWriter::_formatChunks(std::size_t row0, std::size_t end, std::size_t chunkSize,
+                              std::size_t b, std::size_t e, int) {
+    for (std::size_t i = b; i != e; ++i) {
+        std::vector<char> &chunk = _chunks[i];
+        std::size_t used = 0;
+        std::size_t const rowEnd = std::min(end, row0 + (i + 1)*chunkSize);
+        for (std::size_t row = row0 + i*chunkSize; row < rowEnd; ++row) {
+            if (chunk.size() - used < _maxRowLength) {
+                chunk.resize(std::max(2*chunk.size(), used + _maxRowLength));
+            }
+            used = _formatRow(row, &chunk[used]) - &chunk[0];
+        }
+        _chunkSizes[i] = used;
+    }
+}
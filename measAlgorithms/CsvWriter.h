@@ -0,0 +1,90 @@
+// -*- lsst-c++ -*-
+#if !defined(CSV_WRITER_H)
+#define CSV_WRITER_H 1
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Schema.h"
+#include "SourceCatalog.h"
+#include "ThreadPool.h"
+
+/**
+ * Fast conversion of numbers to text
+ *
+ * Each function writes its number starting at buf, which must have room for MAX_NUMBER_LENGTH chars, and
+ * returns a pointer to one past the last char written (no '\0' is added).  Floating point numbers are
+ * written with the fewest digits that read back as the same float or double (using Grisu2, which finds
+ * the shortest string for all but a tiny fraction of numbers, and always one that reads back exactly);
+ * NaNs are "nan" and infinities "inf"
+ */
+namespace csv {
+    enum { MAX_NUMBER_LENGTH = 32 };
+
+    char *format(double x, char *buf);
+    char *format(float x, char *buf);
+    char *format(long x, char *buf);
+}
+
+/**
+ * Write SourceCatalogs to a stream as comma-separated values
+ *
+ * The columns (every slot of the astrometric then the photometric schema, in the order of writeCsv) are
+ * worked out once, when the CsvWriter is created.  Rows are formatted into a large buffer which is only
+ * written to the stream when it's full (or by flush(), or when the CsvWriter is destroyed);  given a
+ * ThreadPool, write() formats chunks of rows in parallel and writes them in order
+ */
+class CsvWriter : boost::noncopyable {
+public:
+    CsvWriter(std::ostream &os, Schema::ConstPtr astromSchema, Schema::ConstPtr photomSchema,
+              std::size_t bufferSize=1 << 20);
+    ~CsvWriter();
+
+    /// Return the number of columns
+    int getNColumn() const { return _columns.size(); }
+
+    void writeHeader();
+    /// Write all of cat's rows
+    void write(SourceCatalog const& cat) { write(cat, 0, cat.size()); }
+    void write(SourceCatalog const& cat, std::size_t begin, std::size_t end);
+    void write(SourceCatalog const& cat, ThreadPool &pool, std::size_t chunkSize=1024);
+    void flush();
+private:
+    /// Where to find one column of the output
+    struct Column {
+        int table;                      // 0: astrometry, 1: photometry
+        int slot;                       // the slot in that table's MeasurementColumns
+        Schema::Type type;
+    };
+    /// A Column of a particular catalogue
+    struct Field {
+        char const* data;
+        Schema::Type type;
+    };
+
+    std::ostream &_os;
+    Schema::ConstPtr _astromSchema;
+    Schema::ConstPtr _photomSchema;
+    std::vector<Column> _columns;
+    std::string _header;                // the column names and units, one line each
+    std::size_t _maxRowLength;          // the most chars that a row can need
+    // Our output buffer;  [0, _used) is waiting to be written
+    std::vector<char> _buffer;
+    std::size_t _used;
+    // Used by write() to find the columns of the current catalogue, and by the parallel write() to hold
+    // formatted chunks
+    std::vector<Field> _fields;
+    std::vector<std::vector<char> > _chunks;
+    std::vector<std::size_t> _chunkSizes;
+
+    void _planColumns(Schema const& schema, int table, std::string *names, std::string *units);
+    void _setFields(SourceCatalog const& cat);
+    char *_formatRow(std::size_t row, char *buf) const;
+    void _formatChunks(std::size_t row0, std::size_t end, std::size_t chunkSize,
+                       std::size_t b, std::size_t e, int thread);
+};
+
+#endif
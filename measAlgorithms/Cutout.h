@@ -0,0 +1,141 @@
+// -*- lsst-c++ -*-
+#if !defined(CUTOUT_H)
+#define CUTOUT_H 1
+
+#include <algorithm>
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Background.h"
+#include "Image.h"
+#include "MaskedImage.h"
+
+/**
+ * The pixels around a peak, copied out of the image being measured so that all the algorithms that
+ * measure the peak read them from the cache rather than from the (large, strided) parent
+ *
+ * The cutout covers (2*halfWidth + 1) pixels on a side centred on the peak's pixel, clipped to the
+ * parent;  getImage() has its origin set to the cutout's position in the parent, so code that indexes
+ * with peak.getIx() - im.getX0() is unchanged.  The pixels live in a buffer allocated when the Cutout is
+ * created, so a Cutout may be reset() to peak after peak without allocating memory
+ *
+ * If ImageT is a MaskedImage the cutout also has mask and variance planes (getMask, getVariance), copied in
+ * the same pass as the pixels;  the algorithms always see planar Images, however the parent is laid out.
+ * As the mask is copied we note which rows contain pixels that mustn't be used (\sa maskedImage::UNUSABLE),
+ * so that algorithms need only look at the mask of those rows (\sa hasUnusablePixels)
+ */
+template<typename ImageT>
+class Cutout : boost::noncopyable {
+public:
+    typedef typename ImageT::Pixel Pixel;
+
+    explicit Cutout(int halfWidth) :
+        _halfWidth(halfWidth), _buffer(2*halfWidth + 1, 2*halfWidth + 1), _image(_buffer, BBox(0, 0, 0, 0)),
+        _maskBuffer(_planeSize(), _planeSize()), _mask(_maskBuffer, BBox(0, 0, 0, 0)),
+        _varianceBuffer(_planeSize(), _planeSize()), _variance(_varianceBuffer, BBox(0, 0, 0, 0)),
+        _unusableRows(_planeSize(), false), _nUnusableRow(0), _background(0), _ix(0), _iy(0) {}
+
+    /// Return the half-width that we were created with
+    int getHalfWidth() const { return _halfWidth; }
+    /// Return the pixels around the current peak;  their (x0, y0) is the cutout's corner in the parent
+    Image<Pixel> const& getImage() const { return _image; }
+    /// Return the mask of the pixels around the current peak, or NULL if ImageT has no mask
+    Image<MaskPixel> const* getMask() const { return HasVariance<ImageT>::value ? &_mask : 0; }
+    /// Return the variance of the pixels around the current peak, or NULL if ImageT has no variance
+    Image<Pixel> const* getVariance() const { return HasVariance<ImageT>::value ? &_variance : 0; }
+    /// Return the region of the parent that we cover
+    BBox getBBox() const { return _image.getBBox(); }
+    /**
+     * Do any of rows [y0, y1] of getImage() (relative to its corner) contain pixels that mustn't be used?
+     * Always false if ImageT has no mask
+     */
+    bool hasUnusablePixels(int y0, int y1) const {
+        if (_nUnusableRow == 0) {       // the usual case
+            return false;
+        }
+        for (int y = std::max(y0, 0), end = std::min(y1, _image.getHeight() - 1); y <= end; ++y) {
+            if (_unusableRows[y]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Copy the pixels around the pixel (ix, iy) (in the parent's coordinates) out of im
+     */
+    void reset(ImageT const& im, int ix, int iy,
+               Background const* background=0 ///< im's sky, or NULL if it's already been subtracted
+              ) {
+        int const x0 = std::max(0, ix - im.getX0() - _halfWidth);
+        int const y0 = std::max(0, iy - im.getY0() - _halfWidth);
+        int const x1 = std::min(im.getWidth(), ix - im.getX0() + _halfWidth + 1);
+        int const y1 = std::min(im.getHeight(), iy - im.getY0() + _halfWidth + 1);
+        int const width = std::max(0, x1 - x0), height = std::max(0, y1 - y0);
+
+        BBox const bbox(0, 0, width, height);
+        _copy(im, BBox(x0, y0, width, height));
+        _image = Image<Pixel>(_buffer, bbox);
+        _image.setXY0(im.getX0() + x0, im.getY0() + y0);
+        if (HasVariance<ImageT>::value) {
+            _mask = Image<MaskPixel>(_maskBuffer, bbox);
+            _mask.setXY0(im.getX0() + x0, im.getY0() + y0);
+            _variance = Image<Pixel>(_varianceBuffer, bbox);
+            _variance.setXY0(im.getX0() + x0, im.getY0() + y0);
+        }
+        _background = background;
+        _ix = ix;
+        _iy = iy;
+    }
+
+    /**
+     * Return the sky level at the peak, from the image's Background (\sa MeasureSources::setBackground);
+     * 0 if there's no Background, i.e. the image's sky has already been subtracted
+     */
+    double getBackground() const {
+        return _background ? _background->getValue(_ix, _iy) : 0.0;
+    }
+private:
+    int _halfWidth;
+    Image<Pixel> _buffer;               // (2*_halfWidth + 1) pixels square;  _image is its corner
+    Image<Pixel> _image;
+    Image<MaskPixel> _maskBuffer;       // the same for the mask and variance;  empty if ImageT has neither
+    Image<MaskPixel> _mask;
+    Image<Pixel> _varianceBuffer;
+    Image<Pixel> _variance;
+    std::vector<bool> _unusableRows;    // does each row of _mask have any UNUSABLE pixels?
+    int _nUnusableRow;                  // the number of true _unusableRows
+    Background const* _background;      // the sky model, shared by all the peaks;  may be NULL
+    int _ix, _iy;                       // the peak's pixel
+
+    /// Return the side of the mask and variance buffers
+    int _planeSize() const { return HasVariance<ImageT>::value ? 2*_halfWidth + 1 : 0; }
+
+    /// Copy the pixels in bbox (in im's coordinates) to the corner of our buffer;  there's no mask
+    void _copy(Image<Pixel> const& im, BBox const& bbox) {
+        for (int j = 0; j < bbox.getHeight(); ++j) {
+            Pixel const* row = im.getRow(bbox.getY0() + j) + bbox.getX0();
+            std::copy(row, row + bbox.getWidth(), _buffer.getRow(j));
+        }
+    }
+    /**
+     * Copy the pixels, mask and variance in bbox (in im's coordinates) to the corners of our buffers, and
+     * note which rows have UNUSABLE pixels while the mask's in cache
+     */
+    void _copy(MaskedImage<Pixel> const& im, BBox const& bbox) {
+        im.copyTo(bbox, _buffer, _maskBuffer, _varianceBuffer);
+
+        _nUnusableRow = 0;
+        for (int j = 0; j < bbox.getHeight(); ++j) {
+            MaskPixel const* mask = _maskBuffer.getRow(j);
+            MaskPixel any = 0;
+            for (int i = 0; i < bbox.getWidth(); ++i) {
+                any |= mask[i];
+            }
+            _unusableRows[j] = (any & maskedImage::UNUSABLE) != 0;
+            _nUnusableRow += _unusableRows[j];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+
+#include "Detection.h"
+
+/**
+ * Add a Span;  they should be added in raster order
+ */
+void Footprint::addSpan(Span const& span) {
+    _spans.push_back(span);
+    _npix += span.x1 - span.x0;
+
+    BBox const bbox(span.x0, span.y, span.x1 - span.x0, 1);
+    if (_bbox.empty()) {
+        _bbox = bbox;
+    } else {
+        int const x0 = std::min(_bbox.getX0(), bbox.getX0()), y0 = std::min(_bbox.getY0(), bbox.getY0());
+        int const x1 = std::max(_bbox.getX1(), bbox.getX1()), y1 = std::max(_bbox.getY1(), bbox.getY1());
+        _bbox = BBox(x0, y0, x1 - x0, y1 - y0);
+    }
+}
+
+/**
+ * Return the peaks of all the footprints, in order, ready to be measured (\sa MeasureSources::measure)
+ */
+std::vector<Peak> getPeaks(std::vector<Footprint> const& footprints) {
+    std::size_t n = 0;
+    for (std::vector<Footprint>::const_iterator ptr = footprints.begin(); ptr != footprints.end(); ++ptr) {
+        n += ptr->getPeaks().size();
+    }
+
+    std::vector<Peak> peaks;
+    peaks.reserve(n);
+    for (std::vector<Footprint>::const_iterator ptr = footprints.begin(); ptr != footprints.end(); ++ptr) {
+        peaks.insert(peaks.end(), ptr->getPeaks().begin(), ptr->getPeaks().end());
+    }
+
+    return peaks;
+}
+
+/************************************************************************************************************/
+
+namespace detection {
+
+namespace {
+    /// Return the root of i's tree, halving the path as we go
+    int find(std::vector<int> &parent, int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    /// Join the trees containing i and j;  the root is the smaller index, i.e. the first span in raster order
+    void join(std::vector<int> &parent, int i, int j) {
+        i = find(parent, i);
+        j = find(parent, j);
+        if (i < j) {
+            parent[j] = i;
+        } else if (j < i) {
+            parent[i] = j;
+        }
+    }
+
+    /// Sort Maxima brightest first (and then in raster order)
+    struct Brighter {
+        bool operator()(Maximum const& a, Maximum const& b) const {
+            if (a.value != b.value) {
+                return a.value > b.value;
+            }
+            return (a.y != b.y) ? a.y < b.y : a.x < b.x;
+        }
+    };
+}
+
+/**
+ * Join the spans in a row to the 8-connected spans in the previous row
+ *
+ * Both rows' spans are sorted by x0;  their indices in parent are prevOffset + i and offset + i
+ */
+void linkRows(Span const* prev, int nPrev, int prevOffset, Span const* spans, int nSpan, int offset,
+              std::vector<int> &parent) {
+    int i = 0;
+    for (int j = 0; j != nSpan; ++j) {
+        while (i < nPrev && prev[i].x1 < spans[j].x0) { // ends more than a pixel before spans[j] starts
+            ++i;
+        }
+        for (int k = i; k < nPrev && prev[k].x0 <= spans[j].x1; ++k) {
+            join(parent, prevOffset + k, offset + j);
+        }
+    }
+}
+
+/**
+ * Join the strips at their boundaries, and make the Footprints (in raster order of their first pixel)
+ */
+void assemble(std::vector<Strip> &strips, int minPixels, std::vector<Footprint> &footprints) {
+    footprints.clear();
+    //
+    // Make one forest out of all the strips' spans
+    //
+    std::vector<int> offsets(strips.size() + 1, 0);
+    for (unsigned int s = 0; s != strips.size(); ++s) {
+        offsets[s + 1] = offsets[s] + strips[s].spans.size();
+    }
+    std::vector<int> parent(offsets.back());
+    for (unsigned int s = 0; s != strips.size(); ++s) {
+        for (unsigned int i = 0; i != strips[s].parent.size(); ++i) {
+            parent[offsets[s] + i] = offsets[s] + strips[s].parent[i];
+        }
+    }
+    for (unsigned int s = 1; s < strips.size(); ++s) {
+        Strip const& lower = strips[s - 1];
+        Strip const& upper = strips[s];
+        if (lower.y1 != upper.y0 || lower.rowBegins.size() < 2 || upper.rowBegins.size() < 2) {
+            continue;
+        }
+        int const prevBegin = lower.rowBegins[lower.rowBegins.size() - 2], prevEnd = lower.rowBegins.back();
+        int const nSpan = upper.rowBegins[1];
+        if (prevEnd > prevBegin && nSpan > 0) {
+            linkRows(&lower.spans[prevBegin], prevEnd - prevBegin, offsets[s - 1] + prevBegin,
+                     &upper.spans[0], nSpan, offsets[s], parent);
+        }
+    }
+    //
+    // Each tree is a Footprint;  a tree's root is its first span, so numbering the roots as we meet them
+    // puts the Footprints in raster order
+    //
+    std::vector<int> index(parent.size(), -1); // the Footprint of each root
+    std::vector<Footprint> all;
+    for (unsigned int s = 0; s != strips.size(); ++s) {
+        for (unsigned int i = 0; i != strips[s].spans.size(); ++i) {
+            int const root = find(parent, offsets[s] + i);
+            if (index[root] < 0) {
+                index[root] = all.size();
+                all.push_back(Footprint());
+            }
+            all[index[root]].addSpan(strips[s].spans[i]);
+        }
+    }
+
+    std::vector<std::vector<Maximum> > maxima(all.size());
+    for (unsigned int s = 0; s != strips.size(); ++s) {
+        for (unsigned int i = 0; i != strips[s].maxima.size(); ++i) {
+            Maximum const& max = strips[s].maxima[i];
+            maxima[index[find(parent, offsets[s] + max.span)]].push_back(max);
+        }
+    }
+
+    for (unsigned int i = 0; i != all.size(); ++i) {
+        if (all[i].getNPix() < minPixels) {
+            continue;
+        }
+        std::sort(maxima[i].begin(), maxima[i].end(), Brighter());
+        for (unsigned int j = 0; j != maxima[i].size(); ++j) {
+            all[i].addPeak(Peak(maxima[i][j].x, maxima[i][j].y));
+        }
+
+        footprints.push_back(Footprint());
+        std::swap(footprints.back(), all[i]);
+    }
+}
+
+}
@@ -0,0 +1,214 @@
+// -*- lsst-c++ -*-
+#if !defined(DETECTION_H)
+#define DETECTION_H 1
+
+#include <algorithm>
+#include <vector>
+#include "boost/bind/bind.hpp"
+
+#include "Image.h"
+#include "Peak.h"
+#include "ThreadPool.h"
+
+/**
+ * A run of pixels in one row:  [x0, x1) in row y
+ */
+struct Span {
+    Span(int y_=0, int x0_=0, int x1_=0) : y(y_), x0(x0_), x1(x1_) {}
+
+    int y;
+    int x0, x1;
+};
+
+/**
+ * A set of connected pixels above a threshold, stored as Spans (in raster order), and the peaks within it
+ * (brightest first)
+ */
+class Footprint {
+public:
+    Footprint() : _spans(), _bbox(), _npix(0), _peaks() {}
+
+    /// Return our Spans
+    std::vector<Span> const& getSpans() const { return _spans; }
+    /// Return the smallest BBox containing all our pixels
+    BBox const& getBBox() const { return _bbox; }
+    /// Return the number of pixels
+    int getNPix() const { return _npix; }
+    /// Return our peaks, brightest first
+    std::vector<Peak> const& getPeaks() const { return _peaks; }
+
+    void addSpan(Span const& span);
+    /// Add a peak;  they should be added brightest first
+    void addPeak(Peak const& peak) { _peaks.push_back(peak); }
+private:
+    std::vector<Span> _spans;
+    BBox _bbox;
+    int _npix;
+    std::vector<Peak> _peaks;
+};
+
+std::vector<Peak> getPeaks(std::vector<Footprint> const& footprints);
+
+namespace detection {
+    /// A local maximum, found while scanning a strip
+    struct Maximum {
+        int x, y;
+        double value;
+        int span;                       // the index of the span containing it, within the strip
+    };
+
+    /// The spans and maxima found in a strip of rows [y0, y1), with the spans linked within the strip
+    struct Strip {
+        Strip() : y0(0), y1(0), spans(), rowBegins(), parent(), maxima() {}
+
+        int y0, y1;
+        std::vector<Span> spans;
+        std::vector<int> rowBegins;     // row y0 + j's spans are spans[rowBegins[j], rowBegins[j + 1])
+        std::vector<int> parent;        // the union-find forest of spans (indices within the strip)
+        std::vector<Maximum> maxima;
+    };
+
+    void linkRows(Span const* prev, int nPrev, int prevOffset, Span const* spans, int nSpan, int offset,
+                  std::vector<int> &parent);
+    void assemble(std::vector<Strip> &strips, int minPixels, std::vector<Footprint> &footprints);
+}
+
+/**
+ * Find the Footprints of the objects in an image:  the 8-connected regions above a threshold, and the
+ * peaks (local maxima) within each
+ *
+ * The image's rows are divided into strips, which are scanned independently (in parallel, given a
+ * ThreadPool):  each row's pixels above threshold are found as Spans, which are linked to the previous row's
+ * with a union-find, and each span's local maxima found.  The strips are then joined at their boundaries.
+ * Only the Spans are stored, never a mask of the whole image, so an image is read just once.
+ *
+ * To detect faint objects, smooth the image first (e.g. with the PSF) and detect on the smoothed image
+ */
+template<typename ImageT>
+class DetectSources {
+public:
+    typedef typename ImageT::Pixel Pixel;
+
+    explicit DetectSources(double threshold, ///< detect pixels above this value
+                           int minPixels=1   ///< ignore Footprints with fewer pixels than this
+                          ) : _threshold(threshold), _minPixels(minPixels) {}
+
+    /// Return the detection threshold
+    double getThreshold() const { return _threshold; }
+    /// Return the smallest number of pixels in a Footprint
+    int getMinPixels() const { return _minPixels; }
+
+    /**
+     * Find the Footprints in im;  their coordinates are in im's parent's frame (i.e. include getX0/getY0)
+     */
+    void detect(ImageT const& im, std::vector<Footprint> &footprints) const {
+        std::vector<detection::Strip> strips(1);
+        strips[0].y1 = im.getHeight();
+        _scanStrip(im, strips[0]);
+        detection::assemble(strips, _minPixels, footprints);
+    }
+    /**
+     * Find the Footprints in im, using all the threads in pool;  the answers are the same as detect(im)
+     */
+    void detect(ImageT const& im, std::vector<Footprint> &footprints, ThreadPool &pool,
+                int stripHeight=256     ///< the number of rows in each strip
+               ) const {
+        stripHeight = std::max(1, stripHeight);
+        std::vector<detection::Strip> strips((im.getHeight() + stripHeight - 1)/stripHeight);
+        for (unsigned int i = 0; i != strips.size(); ++i) {
+            strips[i].y0 = i*stripHeight;
+            strips[i].y1 = std::min(im.getHeight(), static_cast<int>(i + 1)*stripHeight);
+        }
+        pool.run(strips.size(), 1, boost::bind(&DetectSources::_scanStrips, this, boost::cref(im),
+                                               boost::ref(strips), boost::placeholders::_1,
+                                               boost::placeholders::_2, boost::placeholders::_3));
+        detection::assemble(strips, _minPixels, footprints);
+    }
+private:
+    double _threshold;
+    int _minPixels;
+
+    void _scanStrips(ImageT const& im, std::vector<detection::Strip> &strips, std::size_t b, std::size_t e,
+                     int) const;
+    void _scanStrip(ImageT const& im, detection::Strip &strip) const;
+};
+
+/// Scan strips [b, e);  used by the threaded detect()
+template<typename ImageT>
+void DetectSources<ImageT>::_scanStrips(ImageT const& im, std::vector<detection::Strip> &strips,
+                                        std::size_t b, std::size_t e, int) const {
+    for (std::size_t i = b; i != e; ++i) {
+        _scanStrip(im, strips[i]);
+    }
+}
+
+/**
+ * Find the spans and maxima in a strip of im, linking each row's spans to the previous row's
+ */
+template<typename ImageT>
+void DetectSources<ImageT>::_scanStrip(ImageT const& im, detection::Strip &strip) const {
+    int const width = im.getWidth(), height = im.getHeight();
+    int const x0 = im.getX0(), y0 = im.getY0();
+    double const threshold = _threshold;
+
+    strip.spans.clear();
+    strip.rowBegins.assign(1, 0);
+    strip.parent.clear();
+    strip.maxima.clear();
+
+    for (int y = strip.y0; y < strip.y1; ++y) {
+        Pixel const* row = im.getRow(y);
+        Pixel const* below = (y > 0) ? im.getRow(y - 1) : 0;
+        Pixel const* above = (y + 1 < height) ? im.getRow(y + 1) : 0;
+        int const rowBegin = strip.spans.size();
+        //
+        // Find the runs of pixels above threshold.  The common case is a long run of sky, so the inner
+        // loop is just a comparison
+        //
+        for (int x = 0; x < width; ) {
+            while (x < width && !(row[x] > threshold)) {
+                ++x;
+            }
+            if (x == width) {
+                break;
+            }
+            int const sx0 = x;
+            while (x < width && row[x] > threshold) {
+                ++x;
+            }
+            int const span = strip.spans.size();
+            strip.spans.push_back(Span(y0 + y, x0 + sx0, x0 + x));
+            strip.parent.push_back(span);
+            //
+            // Local maxima:  greater than the neighbours before in raster order, and no less than those after
+            //
+            for (int i = sx0; i != x; ++i) {
+                Pixel const v = row[i];
+                int const il = (i > 0) ? i - 1 : i, ir = (i + 1 < width) ? i + 1 : i;
+                bool isMax = (i == il || v > row[il]) && v >= row[ir];
+                if (isMax && below) {
+                    isMax = v > below[il] && v > below[i] && v > below[ir];
+                }
+                if (isMax && above) {
+                    isMax = v >= above[il] && v >= above[i] && v >= above[ir];
+                }
+                if (isMax) {
+                    detection::Maximum const max = { x0 + i, y0 + y, static_cast<double>(v), span };
+                    strip.maxima.push_back(max);
+                }
+            }
+        }
+        strip.rowBegins.push_back(strip.spans.size());
+
+        if (y > strip.y0) {
+            int const prevBegin = strip.rowBegins[y - strip.y0 - 1];
+            int const nSpan = strip.spans.size() - rowBegin;
+            if (nSpan > 0 && rowBegin > prevBegin) {
+                detection::linkRows(&strip.spans[prevBegin], rowBegin - prevBegin, prevBegin,
+                                    &strip.spans[rowBegin], nSpan, rowBegin, strip.parent);
+            }
+        }
+    }
+}
+
+#endif
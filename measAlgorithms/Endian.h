@@ -0,0 +1,28 @@
+// -*- lsst-c++ -*-
+#if !defined(ENDIAN_H)
+#define ENDIAN_H 1
+
+#include <algorithm>
+#include <cstddef>
+
+/// Is this a big-endian machine?
+inline bool isBigEndian() {
+    union {
+        unsigned short s;
+        unsigned char c[sizeof(unsigned short)];
+    } u;
+    u.s = 1;
+
+    return u.c[0] == 0;
+}
+
+/**
+ * Reverse the bytes of each of the n size-byte values in data
+ */
+inline void swapBytes(char *data, std::size_t n, int size) {
+    for (std::size_t i = 0; i != n; ++i, data += size) {
+        std::reverse(data, data + size);
+    }
+}
+
+#endif
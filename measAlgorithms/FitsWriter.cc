@@ -0,0 +1,348 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Endian.h"
+#include "FitsWriter.h"
+#include "Simd.h"
+
+namespace {
+    std::size_t const BLOCK_SIZE = 2880;  // FITS files are made of blocks of this many bytes
+    std::size_t const CARD_SIZE = 80;     // the size of a header card
+    std::size_t const NAXIS2_CARD = 4;    // the index of NAXIS2 in the BINTABLE header (\sa _makeHeader)
+
+    /// Round n up to a multiple of BLOCK_SIZE
+    std::size_t roundUp(std::size_t n) {
+        return ((n + BLOCK_SIZE - 1)/BLOCK_SIZE)*BLOCK_SIZE;
+    }
+
+    /// Throw a std::runtime_error describing a failed system call
+    void throwErrno(std::string const& what, std::string const& filename) {
+        std::ostringstream msg;
+        msg << "Unable to " << what << " " << filename << ": " << std::strerror(errno);
+        throw std::runtime_error(msg.str());
+    }
+
+    /************************************************************************************************************/
+    /*
+     * Header cards, in FITS's fixed format:  the keyword in columns 1-8, "= " in 9-10, and the value
+     * right-justified in 11-30 (or, for a string, quoted and starting in column 11)
+     */
+    void addCard(std::string *header, std::string const& keyword, std::string const& value,
+                 std::string const& comment="") {
+        std::string card = keyword;
+        card.resize(8, ' ');
+        card += "= ";
+        if (value[0] != '\'' && value.size() < 20) {
+            card.append(20 - value.size(), ' ');
+        }
+        card += value;
+        if (comment != "") {
+            card += " / " + comment;
+        }
+        card.resize(CARD_SIZE, ' ');
+        *header += card;
+    }
+
+    void addCard(std::string *header, std::string const& keyword, long value, std::string const& comment="") {
+        std::ostringstream os;
+        os << value;
+        addCard(header, keyword, os.str(), comment);
+    }
+
+    void addCard(std::string *header, std::string const& keyword, bool value, std::string const& comment="") {
+        addCard(header, keyword, std::string(value ? "T" : "F"), comment);
+    }
+
+    /// Return str as a FITS string value:  quoted, with embedded quotes doubled and at least 8 chars long
+    std::string quote(std::string const& str) {
+        std::string value = "'";
+        for (std::size_t i = 0; i != str.size() && value.size() < 68; ++i) { // leave room for the quotes
+            value += str[i];
+            if (str[i] == '\'') {
+                value += '\'';
+            }
+        }
+        if (value.size() < 9) {
+            value.resize(9, ' ');
+        }
+
+        return value + "'";
+    }
+
+    /// Append the END card to a header, and pad it to a whole number of blocks
+    void endHeader(std::string *header) {
+        std::string card = "END";
+        card.resize(CARD_SIZE, ' ');
+        *header += card;
+        header->resize(roundUp(header->size()), ' ');
+    }
+
+    /// Return the TFORM code for a Type
+    char getTformCode(Schema::Type type) {
+        switch (type) {
+          case Schema::CHAR:   return 'B';
+          case Schema::SHORT:  return 'I';
+          case Schema::INT:    return 'J';
+          case Schema::LONG:   return (sizeof(long) == 8) ? 'K' : 'J';
+          case Schema::FLOAT:  return 'E';
+          case Schema::DOUBLE: return 'D';
+          default:
+            break;
+        }
+
+        std::ostringstream msg;
+        msg << "Unable to write a column of type " << type << " to a FITS table";
+        throw std::runtime_error(msg.str());
+    }
+
+    /************************************************************************************************************/
+    bool const bigEndian = isBigEndian();
+
+    /// Copy n values of size bytes from src to dest, converting them to big-endian
+    void toBigEndian(char *dest, char const *src, int size, std::size_t n) {
+        if (bigEndian) {
+            std::memcpy(dest, src, n*size);
+        } else {
+            simd::byteSwap(dest, src, size, n);
+        }
+    }
+
+    /// Copy n values of N bytes from src into every rowSize'th N bytes of dest
+    template<int N>
+    void scatter(char *dest, std::size_t rowSize, char const *src, std::size_t n) {
+        for (std::size_t i = 0; i != n; ++i, dest += rowSize, src += N) {
+            std::memcpy(dest, src, N);
+        }
+    }
+
+    /// Copy n signed chars from src into every rowSize'th byte of dest, adding 128 (\sa TZERO)
+    void scatterSignedBytes(char *dest, std::size_t rowSize, char const *src, std::size_t n) {
+        for (std::size_t i = 0; i != n; ++i, dest += rowSize) {
+            *dest = src[i] ^ 0x80;
+        }
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Create a FITS file for Sources measured with the given schemas (those of the MeasureAstrometry and
+ * MeasurePhotometry objects that measured them), and write its headers
+ */
+FitsWriter::FitsWriter(std::string const& filename,     ///< the file to write
+                       Schema::ConstPtr astromSchema,   ///< the catalogues' astrometric schema
+                       Schema::ConstPtr photomSchema,   ///< the catalogues' photometric schema
+                       std::size_t bufferSize           ///< how many bytes of rows to buffer before writing
+                      ) :
+    _filename(filename), _fd(-1), _astromSchema(astromSchema), _photomSchema(photomSchema), _fields(),
+    _nColumn(0), _rowSize(0), _naxis2Offset(0), _nrow(0), _blockSize(0), _rows(), _swapped()
+{
+    std::string const header = _makeHeader();
+
+    _blockSize = std::max<std::size_t>(1, bufferSize/std::max<std::size_t>(_rowSize, 1));
+    _rows.resize(_blockSize*_rowSize);
+    _swapped.resize(_blockSize*sizeof(double));
+
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0) {
+        throwErrno("create", filename);
+    }
+    try {
+        _write(header.data(), header.size());
+    } catch (...) {
+        ::close(_fd);
+        _fd = -1;
+        throw;
+    }
+}
+
+/// Close the file, if close() wasn't called;  any error is lost
+FitsWriter::~FitsWriter() {
+    try {
+        close();
+    } catch (...) {
+        ;
+    }
+}
+
+/// Add the columns of one of our schemas (a composite) to _fields, and their keywords to header
+void FitsWriter::_planColumns(Schema const& schema, int table, std::string *header) {
+    int slot = 0;                       // the first slot of the current member
+    for (Schema::const_iterator mptr = schema.begin(); mptr != schema.end(); ++mptr) {
+        Schema const& sch = **mptr;
+        for (Schema::const_iterator sptr = sch.begin(); sptr != sch.end(); ++sptr) {
+            Schema const& se = **sptr;
+            int const size = Schema::sizeOf(se.getType());
+            for (int i = 0; i != se.getDimen(); ++i) {
+                Field const field = { table, slot + static_cast<int>(se.getIndex()) + i, size,
+                                      _rowSize + i*size, se.getType() == Schema::CHAR };
+                _fields.push_back(field);
+            }
+            _rowSize += se.getDimen()*size;
+
+            std::ostringstream n, tform;
+            n << ++_nColumn;
+            tform << se.getDimen() << getTformCode(se.getType());
+
+            addCard(header, "TTYPE" + n.str(), quote(sch.getComponent() + "." + se.getName()));
+            addCard(header, "TFORM" + n.str(), quote(tform.str()));
+            if (se.getUnits() != "") {
+                addCard(header, "TUNIT" + n.str(), quote(se.getUnits()));
+            }
+            if (se.getType() == Schema::CHAR) {
+                addCard(header, "TZERO" + n.str(), -128L, "the values are signed");
+            }
+        }
+        slot += sch.size();
+    }
+}
+
+/// Work out our columns, and return the headers of the primary HDU and the BINTABLE
+std::string FitsWriter::_makeHeader() {
+    std::string columns;
+    _planColumns(*_astromSchema, 0, &columns);
+    _planColumns(*_photomSchema, 1, &columns);
+
+    std::string header;
+    addCard(&header, "SIMPLE", true, "conforms to FITS standard");
+    addCard(&header, "BITPIX", 8L);
+    addCard(&header, "NAXIS", 0L);
+    addCard(&header, "EXTEND", true);
+    endHeader(&header);
+
+    std::size_t const primarySize = header.size();
+    addCard(&header, "XTENSION", quote("BINTABLE"), "binary table extension");
+    addCard(&header, "BITPIX", 8L);
+    addCard(&header, "NAXIS", 2L);
+    addCard(&header, "NAXIS1", static_cast<long>(_rowSize), "bytes per row");
+    _naxis2Offset = header.size();
+    assert(_naxis2Offset == primarySize + NAXIS2_CARD*CARD_SIZE);
+    addCard(&header, "NAXIS2", 0L, "number of rows");
+    addCard(&header, "PCOUNT", 0L);
+    addCard(&header, "GCOUNT", 1L);
+    addCard(&header, "TFIELDS", static_cast<long>(_nColumn), "number of columns");
+    header += columns;
+    endHeader(&header);
+
+    return header;
+}
+
+/**
+ * Close the file, padding the table to a whole block and setting NAXIS2, and report any error
+ */
+void FitsWriter::close() {
+    if (_fd < 0) {
+        return;
+    }
+
+    try {
+        std::size_t const nbyte = _nrow*_rowSize;
+        std::vector<char> const padding(roundUp(nbyte) - nbyte, '\0');
+        if (!padding.empty()) {
+            _write(&padding[0], padding.size());
+        }
+
+        std::string card;
+        addCard(&card, "NAXIS2", static_cast<long>(_nrow), "number of rows");
+        if (::pwrite(_fd, card.data(), card.size(), _naxis2Offset) != static_cast<ssize_t>(card.size())) {
+            throwErrno("set NAXIS2 in", _filename);
+        }
+    } catch (...) {
+        ::close(_fd);
+        _fd = -1;
+        throw;
+    }
+
+    int const fd = _fd;
+    _fd = -1;
+    if (::close(fd) != 0) {
+        throwErrno("close", _filename);
+    }
+}
+
+/**
+ * Append rows [begin, end) of cat (which must have been made with our schemas) to the table
+ */
+void FitsWriter::write(SourceCatalog const& cat, std::size_t begin, std::size_t end) {
+    if (_fd < 0) {
+        throw std::runtime_error("Unable to write to " + _filename + ", which has been closed");
+    }
+    if (cat.getAstrometry().getSchema() != _astromSchema || cat.getPhotometry().getSchema() != _photomSchema) {
+        throw std::runtime_error("SourceCatalog was not created with this FitsWriter's schemas");
+    }
+    end = std::min(end, cat.size());
+
+    for (std::size_t row = begin; row < end; row += _blockSize) {
+        _writeBlock(cat, row, std::min(end, row + _blockSize));
+    }
+}
+
+/**
+ * Convert rows [begin, end) of cat to FITS rows and write them
+ *
+ * Each slot's values are byte swapped a column at a time (where the SIMD kernels can work on contiguous
+ * data), and then scattered into their place in the rows
+ */
+void FitsWriter::_writeBlock(SourceCatalog const& cat, std::size_t begin, std::size_t end) {
+    std::size_t const n = end - begin;
+    char *const rows = &_rows[0];
+    char *const swapped = &_swapped[0];
+
+    for (std::vector<Field>::const_iterator fptr = _fields.begin(); fptr != _fields.end(); ++fptr) {
+        Field const& field = *fptr;
+        char const* column = static_cast<char const*>(field.table == 0 ?
+                                                      cat.getAstrometry().getColumn(field.slot) :
+                                                      cat.getPhotometry().getColumn(field.slot));
+        column += begin*field.size;
+        char *const dest = rows + field.offset;
+
+        switch (field.size) {
+          case 1:
+            if (field.isSignedByte) {
+                scatterSignedBytes(dest, _rowSize, column, n);
+            } else {
+                scatter<1>(dest, _rowSize, column, n);
+            }
+            break;
+          case 2:
+            toBigEndian(swapped, column, 2, n);
+            scatter<2>(dest, _rowSize, swapped, n);
+            break;
+          case 4:
+            toBigEndian(swapped, column, 4, n);
+            scatter<4>(dest, _rowSize, swapped, n);
+            break;
+          case 8:
+            toBigEndian(swapped, column, 8, n);
+            scatter<8>(dest, _rowSize, swapped, n);
+            break;
+          default:
+            assert(0);
+        }
+    }
+
+    _write(rows, n*_rowSize);
+    _nrow += n;
+}
+
+/// Write n bytes from data to the file
+void FitsWriter::_write(void const* data, std::size_t n) {
+    char const* ptr = static_cast<char const*>(data);
+    while (n > 0) {
+        ssize_t const nwritten = ::write(_fd, ptr, n);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwErrno("write to", _filename);
+        }
+        ptr += nwritten;
+        n -= nwritten;
+    }
+}
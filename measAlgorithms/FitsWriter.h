@@ -0,0 +1,73 @@
+// -*- lsst-c++ -*-
+#if !defined(FITS_WRITER_H)
+#define FITS_WRITER_H 1
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Schema.h"
+#include "SourceCatalog.h"
+
+/**
+ * Write SourceCatalogs to a FITS file as a binary table (BINTABLE), streaming the rows as they're measured
+ *
+ * The file is an empty primary HDU followed by a BINTABLE extension with one column per SchemaEntry of the
+ * astrometric then the photometric schema, named component.name;  Schema::Types map onto TFORMs as
+ *      CHAR -> B (with TZERO = -128, FITS's convention for signed bytes)
+ *      SHORT -> I   INT -> J   LONG -> K (or J if a long has 32 bits)   FLOAT -> E   DOUBLE -> D
+ * with the entry's dimension as the repeat count, and its units (if any) as TUNIT.
+ *
+ * Rows are converted to big-endian FITS rows a block at a time, in a buffer of fixed size, so the writer
+ * uses the same memory however many rows it writes.  NAXIS2 (the number of rows) is written as 0 and
+ * patched by close();  until then the file's a valid, but empty, table
+ */
+class FitsWriter : boost::noncopyable {
+public:
+    FitsWriter(std::string const& filename, Schema::ConstPtr astromSchema, Schema::ConstPtr photomSchema,
+               std::size_t bufferSize=1 << 20);
+    ~FitsWriter();
+
+    /// Return the number of columns (TFIELDS)
+    int getNColumn() const { return _nColumn; }
+    /// Return the number of bytes in a row (NAXIS1)
+    std::size_t getRowSize() const { return _rowSize; }
+    /// Return the number of rows written
+    std::size_t size() const { return _nrow; }
+
+    /// Write all of cat's rows
+    void write(SourceCatalog const& cat) { write(cat, 0, cat.size()); }
+    void write(SourceCatalog const& cat, std::size_t begin, std::size_t end);
+    void close();
+private:
+    /// Where to find one slot of the input, and where it goes in a row
+    struct Field {
+        int table;                      // 0: astrometry, 1: photometry
+        int slot;                       // the slot in that table's MeasurementColumns
+        int size;                       // the size of a value, in bytes
+        std::size_t offset;             // the byte offset of the value within a row
+        bool isSignedByte;              // a CHAR, which is offset by 128 (\sa TZERO)
+    };
+
+    std::string _filename;
+    int _fd;                            // our file, or -1 when it's closed
+    Schema::ConstPtr _astromSchema;
+    Schema::ConstPtr _photomSchema;
+    std::vector<Field> _fields;
+    int _nColumn;                       // the number of FITS columns (an array is one column)
+    std::size_t _rowSize;               // NAXIS1
+    std::size_t _naxis2Offset;          // the byte offset of the NAXIS2 card in the file
+    std::size_t _nrow;                  // the number of rows written
+    // Our buffers:  a block of FITS rows, and one column of the same rows, byte swapped
+    std::size_t _blockSize;             // the number of rows in a block
+    std::vector<char> _rows;
+    std::vector<char> _swapped;
+
+    std::string _makeHeader();
+    void _planColumns(Schema const& schema, int table, std::string *header);
+    void _writeBlock(SourceCatalog const& cat, std::size_t begin, std::size_t end);
+    void _write(void const* data, std::size_t n);
+};
+
+#endif
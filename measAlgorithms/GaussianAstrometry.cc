@@ -0,0 +1,243 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Astrometry.h"
+#include "Simd.h"
+
+namespace {
+/**
+ * Implement centroiding with an iterated Gaussian-weighted first moment
+ */
+class GaussianAstrometry : public Astrometry
+{
+    /// A new, unused, index to save our flags in.  [0, Astrometry::NVALUE) are taken
+    enum { FLAGS=Astrometry::NVALUE, NVALUE };
+public:
+    typedef boost::shared_ptr<GaussianAstrometry> Ptr;
+    typedef boost::shared_ptr<GaussianAstrometry const> ConstPtr;
+
+    /// The bits that may be set in our flags
+    enum {
+        BAD_PIXELS = 0x1                // some pixels were masked (\sa maskedImage::UNUSABLE) so not used
+    };
+
+    /// Ctor;  the values are undefined until setValues() is called
+    GaussianAstrometry() {
+        init(this);                     // This allocates space for fields added by defineSchema
+    }
+    /// Ctor
+    GaussianAstrometry(double x, float xErr, double y, float yErr, int flags=0) {
+        init(this);
+        setValues(x, xErr, y, yErr, flags);
+    }
+    /// Set our values, e.g. when reusing a GaussianAstrometry (\sa AlgorithmInputs::makeResult)
+    void setValues(double x, float xErr, double y, float yErr, int flags=0) {
+        set<X>(x);                      // if init() wasn't called, these set calls will fail an assertion
+        set<X_ERR>(xErr);               // the type of the value must match the schema
+        set<Y>(y);
+        set<Y_ERR>(yErr);
+        set<FLAGS>(flags);
+    }
+
+    /// Add desired fields to the schema
+    virtual void defineSchema(Schema::Ptr schema ///< our schema; == _mySchema
+                             ) {
+        Astrometry::defineSchema(schema);
+        schema->add(SchemaEntry("flags", FLAGS, Schema::INT));
+    }
+
+    template<typename ImageT>
+    static Astrometry::Ptr doMeasure(Cutout<ImageT> const& cutout, Peak const&, AlgorithmInputs const&);
+    static int getHalfWidth();
+};
+
+double const SIGMA = 2.0;               // sigma of the weight function
+int const HALF_WIDTH = 7;               // half-size of the stamp; a little over 3 SIGMA
+int const MAX_ITER = 8;                 // maximum number of iterations
+double const TOL = 1e-3;                // stop when the centroid moves less than this (pixels)
+double const MAX_SHIFT = 1.5;           // give up if the centroid moves further than this from the peak;
+                                        // <= Astrometry::MAX_CENTROID_SHIFT
+
+/// Return the half-width of the stamp that we use
+int GaussianAstrometry::getHalfWidth() {
+    return HALF_WIDTH;
+}
+
+/**
+ * Process the image; calculate values
+ *
+ * The weight is a Gaussian centred at the current estimate (xc, yc), and we step by twice the weighted
+ * first moment, which converges in one step for a Gaussian star of width SIGMA (Lupton et al.'s SDSS
+ * centroider);  for other widths the error still shrinks geometrically.  The weight is separable, so each
+ * iteration needs only 2*(2*HALF_WIDTH + 1) exponentials;  the sums over each row use simd::weightedSum.
+ *
+ * The sky (\sa Cutout::getBackground) is subtracted from the pixels.  Pixels that are masked as unusable are
+ * left out of the moments, and set BAD_PIXELS in our flags.
+ * The errors come from the image's variance plane, summed with the same weights in the same pass as the
+ * moments;  if there's no variance plane they assume that each pixel's variance is the variance of the
+ * pixels around the edge of the stamp.  If the centroid doesn't stay within MAX_SHIFT of the peak we
+ * return the peak with NaN errors
+ */
+template<typename ImageT>
+Astrometry::Ptr GaussianAstrometry::doMeasure(Cutout<ImageT> const& cutout, Peak const& peak,
+                                              AlgorithmInputs const& inputs) {
+    typedef typename ImageT::Pixel PixelT;
+    Image<PixelT> const& im = cutout.getImage();
+    Image<PixelT> const* varianceImage = cutout.getVariance();
+    int const size = 2*HALF_WIDTH + 1;
+    double const NaN = std::numeric_limits<double>::quiet_NaN();
+    GaussianAstrometry::Ptr val = inputs.makeResult<GaussianAstrometry>();
+    double const background = cutout.getBackground();
+
+    int const ix = peak.getIx() - im.getX0();
+    int const iy = peak.getIy() - im.getY0();
+    int const x0 = std::max(0, ix - HALF_WIDTH), x1 = std::min(im.getWidth() - 1, ix + HALF_WIDTH);
+    int const y0 = std::max(0, iy - HALF_WIDTH), y1 = std::min(im.getHeight() - 1, iy + HALF_WIDTH);
+    int const nx = x1 - x0 + 1, ny = y1 - y0 + 1;
+    if (nx <= 0 || ny <= 0) {
+        val->setValues(peak.getX(), NaN, peak.getY(), NaN);
+        return val;
+    }
+    //
+    // Without a variance plane, estimate the per-pixel variance from the edge of the stamp
+    //
+    double sum = 0, sum2 = 0;
+    int n = 0;
+    for (int y = y0; y <= y1 && !varianceImage; ++y) {
+        PixelT const* row = im.getRow(y);
+        int const step = (y == y0 || y == y1) ? 1 : nx - 1;
+        for (int x = x0; x <= x1; x += std::max(step, 1)) {
+            double const value = row[x] - background;
+            sum += value;
+            sum2 += value*value;
+            ++n;
+        }
+    }
+    double const variance = (n > 1) ? std::max(0.0, (sum2 - sum*sum/n)/(n - 1)) : 0.0;
+    //
+    // Iterate
+    //
+    float wx[size], wxdx[size], wy[size];  // weights and weight*(x - xc) for the columns; weights for the rows
+    double xc = peak.getX() - im.getX0(), yc = peak.getY() - im.getY0();
+    double s = 0, sx = 0, sy = 0;           // sum(w I), sum(w I (x - xc)), sum(w I (y - yc))
+    double varSx = 0, varSy = 0;            // the variances of sx and sy, if we have a variance plane
+    bool const masked = cutout.hasUnusablePixels(y0, y1);
+    int flags = 0;
+    bool ok = false;
+    for (int iter = 0; iter != MAX_ITER; ++iter) {
+        double sumWx = 0, sumWxdx = 0;  // the sky contributes background*sumWx to rowSum, and so on
+        for (int i = 0; i != nx; ++i) {
+            double const dx = x0 + i - xc;
+            wx[i] = std::exp(-0.5*dx*dx/(SIGMA*SIGMA));
+            wxdx[i] = wx[i]*dx;
+            sumWx += wx[i];
+            sumWxdx += wxdx[i];
+        }
+        for (int j = 0; j != ny; ++j) {
+            double const dy = y0 + j - yc;
+            wy[j] = std::exp(-0.5*dy*dy/(SIGMA*SIGMA));
+        }
+
+        s = sx = sy = varSx = varSy = 0;
+        for (int j = 0; j != ny; ++j) {
+            PixelT const* row = im.getRow(y0 + j) + x0;
+            PixelT const* var = varianceImage ? varianceImage->getRow(y0 + j) + x0 : 0;
+            double rowSum = 0, rowSumX = 0, rowVar = 0, rowVarX = 0;
+            if (masked && cutout.hasUnusablePixels(y0 + j, y0 + j)) { // use the usable pixels one by one
+                MaskPixel const* mask = cutout.getMask()->getRow(y0 + j) + x0;
+                for (int i = 0; i != nx; ++i) {
+                    if (mask[i] & maskedImage::UNUSABLE) {
+                        flags |= BAD_PIXELS;
+                        continue;
+                    }
+                    double const value = row[i] - background;
+                    rowSum += wx[i]*value;
+                    rowSumX += wxdx[i]*value;
+                    if (var) {
+                        rowVar += wx[i]*wx[i]*var[i];
+                        rowVarX += wxdx[i]*wxdx[i]*var[i];
+                    }
+                }
+            } else {
+                simd::weightedSum(wx, row, var, nx, &rowSum, &rowVar);
+                simd::weightedSum(wxdx, row, var, nx, &rowSumX, &rowVarX);
+                rowSum -= background*sumWx;
+                rowSumX -= background*sumWxdx;
+            }
+
+            double const dy = y0 + j - yc;
+            s += wy[j]*rowSum;
+            sx += wy[j]*rowSumX;
+            sy += wy[j]*dy*rowSum;
+            varSx += wy[j]*wy[j]*rowVarX;
+            varSy += wy[j]*wy[j]*dy*dy*rowVar;
+        }
+        if (!(s > 0)) {
+            break;
+        }
+
+        double const dx = 2*sx/s, dy = 2*sy/s;
+        xc += dx;
+        yc += dy;
+        if (std::fabs(xc + im.getX0() - peak.getX()) > MAX_SHIFT ||
+            std::fabs(yc + im.getY0() - peak.getY()) > MAX_SHIFT) {
+            break;
+        }
+        if (std::fabs(dx) < TOL && std::fabs(dy) < TOL) {
+            ok = true;
+            break;
+        }
+    }
+    if (!ok) {
+        val->setValues(peak.getX(), NaN, peak.getY(), NaN, flags);
+        return val;
+    }
+    //
+    // The error in 2*sum(w I dx)/sum(w I) is 2 sqrt(sum(w^2 dx^2 variance))/sum(w I).  With a variance
+    // plane we summed it as we went (with the last iteration's weights, which moved by less than TOL);
+    // otherwise the variance is constant, and as the weights are separable sum(w^2 dx^2) is
+    // sum(wx^2 dx^2) sum(wy^2)
+    //
+    if (varianceImage) {
+        val->setValues(xc + im.getX0(), 2*std::sqrt(varSx)/s, yc + im.getY0(), 2*std::sqrt(varSy)/s, flags);
+        return val;
+    }
+
+    double sumWx2 = 0, sumWx2dx2 = 0, sumWy2 = 0, sumWy2dy2 = 0;
+    for (int i = 0; i != nx; ++i) {
+        double const dx = x0 + i - xc;
+        double const w = std::exp(-0.5*dx*dx/(SIGMA*SIGMA));
+        sumWx2 += w*w;
+        sumWx2dx2 += w*w*dx*dx;
+    }
+    for (int j = 0; j != ny; ++j) {
+        double const dy = y0 + j - yc;
+        double const w = std::exp(-0.5*dy*dy/(SIGMA*SIGMA));
+        sumWy2 += w*w;
+        sumWy2dy2 += w*w*dy*dy;
+    }
+    double const xErr = 2*std::sqrt(variance*sumWx2dx2*sumWy2)/s;
+    double const yErr = 2*std::sqrt(variance*sumWy2dy2*sumWx2)/s;
+
+    val->setValues(xc + im.getX0(), xErr, yc + im.getY0(), yErr);
+
+    return val;
+}
+
+/************************************************************************************************************/
+/**
+ * Declare the existence of a "gaussian" algorithm
+ */
+#define INSTANTIATE(IMAGE_T) \
+    MeasureAstrometry<IMAGE_T >::declare("gaussian", &GaussianAstrometry::doMeasure<IMAGE_T >, \
+                                         &GaussianAstrometry::getHalfWidth, "", "centroid")
+
+volatile bool isInstance[] = {
+    INSTANTIATE(Image<float>),
+    INSTANTIATE(Image<double>),
+    INSTANTIATE(MaskedImage<float>),
+    INSTANTIATE(MaskedImage<double>)
+};
+}
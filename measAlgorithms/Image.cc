@@ -0,0 +1,141 @@
+// -*- lsst-c++ -*-
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "boost/thread/thread.hpp"
+
+#include "Image.h"
+
+/************************************************************************************************************/
+/**
+ * Map filename into memory
+ *
+ * If copyOnWrite is true the mapping is writable, but changes are private to this process and are
+ * never written back to the file
+ */
+MappedFile::MappedFile(std::string const& filename, ///< The file to map
+                       bool copyOnWrite             ///< Allow the mapping to be modified?
+                      ) : _filename(filename), _data(0), _size(0)
+{
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open " + filename + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int const err = errno;
+        ::close(fd);
+        throw std::runtime_error("Unable to stat " + filename + ": " + std::strerror(err));
+    }
+    _size = st.st_size;
+
+    if (_size > 0) {
+        void *data = ::mmap(0, _size, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                            MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int const err = errno;
+            ::close(fd);
+            throw std::runtime_error("Unable to mmap " + filename + ": " + std::strerror(err));
+        }
+        _data = static_cast<char *>(data);
+    }
+    ::close(fd);                        // the mapping keeps the file open
+}
+
+MappedFile::~MappedFile() {
+    if (_data != 0) {
+        ::munmap(_data, _size);
+    }
+}
+
+/************************************************************************************************************/
+
+namespace {
+    /// Return the integer value of keyword in an 80-character FITS card, or false if it's not that keyword
+    bool parseCard(char const *card, char const *keyword, int *value) {
+        std::size_t const len = std::strlen(keyword);
+        if (std::strncmp(card, keyword, len) != 0 || (len < 8 && card[len] != ' ') || card[8] != '=') {
+            return false;
+        }
+
+        std::string const str(card + 10, 70);
+        *value = std::atoi(str.c_str());
+        return true;
+    }
+}
+
+/**
+ * Read the header of a FITS file's primary HDU, which must be a 2-dimensional image
+ */
+FitsHeader readFitsHeader(MappedFile const& file) {
+    int const CARD = 80;                // length of a FITS header card
+    int const BLOCK = 2880;             // FITS files are made of blocks this large
+
+    FitsHeader hdr;
+    hdr.bitpix = 0;
+    hdr.naxis1 = hdr.naxis2 = -1;
+    int naxis = -1;
+
+    char const *data = file.getData();
+    if (file.size() < static_cast<std::size_t>(BLOCK) || std::strncmp(data, "SIMPLE  =", 9) != 0) {
+        throw std::runtime_error(file.getFilename() + " is not a FITS file");
+    }
+
+    std::size_t off = 0;
+    for (; off + CARD <= file.size(); off += CARD) {
+        char const *card = data + off;
+        if (std::strncmp(card, "END     ", 8) == 0) {
+            break;
+        }
+        parseCard(card, "BITPIX", &hdr.bitpix) || parseCard(card, "NAXIS", &naxis) ||
+            parseCard(card, "NAXIS1", &hdr.naxis1) || parseCard(card, "NAXIS2", &hdr.naxis2);
+    }
+    if (off + CARD > file.size()) {
+        throw std::runtime_error(file.getFilename() + " has no END card");
+    }
+    if (naxis != 2 || hdr.naxis1 < 0 || hdr.naxis2 < 0) {
+        std::ostringstream msg;
+        msg << file.getFilename() << " is not a 2-d image (NAXIS = " << naxis << ")";
+        throw std::runtime_error(msg.str());
+    }
+    hdr.dataOffset = ((off + CARD + BLOCK - 1)/BLOCK)*BLOCK;
+
+    return hdr;
+}
+
+/************************************************************************************************************/
+/**
+ * Prepare to swap the nRow rows of nPerRow size-byte values starting at data, none of which has been
+ * swapped yet
+ */
+RowSwapper::RowSwapper(char *data, int nRow, int nPerRow, int size) :
+    _data(data), _nPerRow(nPerRow), _size(size), _state(new boost::atomic<char>[nRow]), _nSwapped(0)
+{
+    for (int y = 0; y != nRow; ++y) {
+        _state[y].store(TODO, boost::memory_order_relaxed);
+    }
+}
+
+/**
+ * Swap row y, unless another thread beats us to it (in which case we wait for it to finish)
+ */
+void RowSwapper::_swapRow(int y) const {
+    char todo = TODO;
+    if (_state[y].compare_exchange_strong(todo, static_cast<char>(BUSY), boost::memory_order_acquire)) {
+        swapBytes(_data + static_cast<std::size_t>(y)*_nPerRow*_size, _nPerRow, _size);
+        ++_nSwapped;
+        _state[y].store(DONE, boost::memory_order_release);
+    } else {
+        while (_state[y].load(boost::memory_order_acquire) != DONE) {
+            boost::this_thread::yield();
+        }
+    }
+}
@@ -1,18 +1,329 @@
 #if !defined(IMAGE_H)
 #define IMAGE_H 1
 
+#include <cassert>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "boost/atomic.hpp"
+#include "boost/checked_delete.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_array.hpp"
 #include "boost/shared_ptr.hpp"
 
+#include "Endian.h"
+
+/**
+ * A rectangular region of an Image:  pixels [x0, x0 + width) x [y0, y0 + height)
+ */
+class BBox {
+public:
+    BBox(int x0=0, int y0=0, int width=0, int height=0) :
+        _x0(x0), _y0(y0), _width(width), _height(height) {}
+
+    int getX0() const { return _x0; }
+    int getY0() const { return _y0; }
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+    /// Return one past the last column
+    int getX1() const { return _x0 + _width; }
+    /// Return one past the last row
+    int getY1() const { return _y0 + _height; }
+    /// Is the BBox empty?
+    bool empty() const { return _width <= 0 || _height <= 0; }
+
+    /// Does the BBox contain the pixel (x, y)?
+    bool contains(int x, int y) const {
+        return x >= _x0 && x < getX1() && y >= _y0 && y < getY1();
+    }
+    /// Does the BBox entirely contain bbox?
+    bool contains(BBox const& bbox) const {
+        return bbox.empty() ||
+            (bbox._x0 >= _x0 && bbox.getX1() <= getX1() && bbox._y0 >= _y0 && bbox.getY1() <= getY1());
+    }
+    /// Return the overlap of this BBox and bbox
+    BBox clip(BBox const& bbox) const {
+        int const x0 = (_x0 > bbox._x0) ? _x0 : bbox._x0;
+        int const y0 = (_y0 > bbox._y0) ? _y0 : bbox._y0;
+        int const x1 = (getX1() < bbox.getX1()) ? getX1() : bbox.getX1();
+        int const y1 = (getY1() < bbox.getY1()) ? getY1() : bbox.getY1();
+
+        return (x1 > x0 && y1 > y0) ? BBox(x0, y0, x1 - x0, y1 - y0) : BBox(x0, y0, 0, 0);
+    }
+private:
+    int _x0, _y0;
+    int _width, _height;
+};
+
+/************************************************************************************************************/
+/**
+ * A read-only memory mapping of a file;  the mapping lasts as long as the MappedFile
+ */
+class MappedFile {
+public:
+    typedef boost::shared_ptr<MappedFile> Ptr;
+
+    MappedFile(std::string const& filename, bool copyOnWrite=false);
+    ~MappedFile();
+
+    /// Return the name of the file
+    std::string const& getFilename() const { return _filename; }
+    /// Return the start of the mapped file
+    char *getData() const { return _data; }
+    /// Return the size of the file, in bytes
+    std::size_t size() const { return _size; }
+private:
+    std::string _filename;
+    char *_data;
+    std::size_t _size;
+
+    MappedFile(MappedFile const&);
+    MappedFile &operator=(MappedFile const&);
+};
+
+/// Information about the pixels in a FITS file's primary HDU (\sa readFitsHeader)
+struct FitsHeader {
+    int bitpix;                         // FITS BITPIX
+    int naxis1, naxis2;                 // width and height
+    std::size_t dataOffset;             // where the data start in the file
+};
+
+FitsHeader readFitsHeader(MappedFile const& file);
+
+/**
+ * Byte swap the rows of a mapped image the first time that each is asked for (\sa Image::readFits), so
+ * only the pages that are used are touched (and, as the mapping's copy-on-write, copied).  Like
+ * PsfCache::getKernel, swap() is thread safe and doesn't take a lock
+ */
+class RowSwapper : boost::noncopyable {
+public:
+    RowSwapper(char *data, int nRow, int nPerRow, int size);
+
+    /// Make sure that row y has been swapped
+    void swap(int y) const {
+        if (_state[y].load(boost::memory_order_acquire) != DONE) {
+            _swapRow(y);
+        }
+    }
+
+    /// Return the number of rows that have been swapped
+    long getNSwapped() const { return _nSwapped; }
+private:
+    enum { TODO, BUSY, DONE };          // the states of a row
+
+    char *_data;
+    int _nPerRow;                       // values in a row
+    int _size;                          // bytes in a value
+    mutable boost::scoped_array<boost::atomic<char> > _state;
+    mutable boost::atomic<long> _nSwapped;
+
+    void _swapRow(int y) const;
+};
+
+/************************************************************************************************************/
+/**
+ * A 2-D image of pixels of type T
+ *
+ * Rows are stride pixels apart;  an Image that allocates its own pixels starts each row on an ALIGNMENT
+ * byte boundary.  Images share their pixels with their subimages, and images read from files use the
+ * file's pages directly (\sa readRaw, readFits) rather than copying them to the heap;  if the file's
+ * byte order isn't ours, each row is swapped when getRow() first returns it.
+ *
+ * Pixels are indexed relative to the Image's corner, (x, y) = (0, 0);  a subimage remembers where it
+ * came from in its parent's coordinates (getX0, getY0)
+ */
 template<typename T>
 class Image {
 public:
     typedef boost::shared_ptr<Image> Ptr;
     typedef boost::shared_ptr<Image const> ConstPtr;
-    
-    Image(T val) : _val(val) {}
-    operator T() const { return _val; }
+    typedef T Pixel;
+
+    enum { ALIGNMENT = 64 };            // alignment of each row of an Image that allocates its pixels
+
+    Image(int width, int height, T val=0);
+    Image(Image const& parent, BBox const& bbox);
+
+    static Ptr readRaw(std::string const& filename, int width, int height, std::size_t offset=0);
+    static Ptr readFits(std::string const& filename);
+
+    /// Return a subimage covering bbox (in our coordinates), sharing our pixels
+    Ptr subimage(BBox const& bbox) {
+        return Ptr(new Image(*this, bbox));
+    }
+    /// Return a subimage covering bbox (in our coordinates), sharing our pixels
+    ConstPtr subimage(BBox const& bbox) const {
+        return ConstPtr(new Image(*this, bbox));
+    }
+
+    /// Return the number of columns
+    int getWidth() const { return _width; }
+    /// Return the number of rows
+    int getHeight() const { return _height; }
+    /// Return the number of pixels between the starts of consecutive rows
+    std::ptrdiff_t getStride() const { return _stride; }
+    /// Return the column of our (0, 0) pixel in our parent's coordinates
+    int getX0() const { return _x0; }
+    /// Return the row of our (0, 0) pixel in our parent's coordinates
+    int getY0() const { return _y0; }
+    /// Return our extent, in our parent's coordinates
+    BBox getBBox() const { return BBox(_x0, _y0, _width, _height); }
+    /// Set the position of our (0, 0) pixel in our parent's coordinates
+    void setXY0(int x0, int y0) { _x0 = x0; _y0 = y0; }
+
+    /// Return a pointer to the start of row y
+    T *getRow(int y) {
+        assert(y >= 0 && y < _height);
+        if (_swapper) {
+            _swapper->swap(_row0 + y);
+        }
+        return _pixels + y*_stride;
+    }
+    /// Return a pointer to the start of row y
+    T const* getRow(int y) const {
+        assert(y >= 0 && y < _height);
+        if (_swapper) {
+            _swapper->swap(_row0 + y);
+        }
+        return _pixels + y*_stride;
+    }
+    /// Return the object that swaps our rows as they're used, or NULL if they're already in our byte order
+    boost::shared_ptr<RowSwapper const> getSwapper() const { return _swapper; }
+    /// Return the pixel (x, y)
+    T &operator()(int x, int y) {
+        assert(x >= 0 && x < _width);
+        return getRow(y)[x];
+    }
+    /// Return the pixel (x, y)
+    T const& operator()(int x, int y) const {
+        assert(x >= 0 && x < _width);
+        return getRow(y)[x];
+    }
 private:
-    T _val;
+    int _width, _height;
+    std::ptrdiff_t _stride;
+    int _x0, _y0;
+    T *_pixels;                         // our (0, 0) pixel
+    boost::shared_ptr<void> _memory;    // keeps the memory that _pixels points into alive
+    boost::shared_ptr<RowSwapper const> _swapper; // swaps the memory's rows as they're used;  may be NULL
+    int _row0;                          // the row of the memory that's our row 0
+
+    Image(boost::shared_ptr<void> memory, T *pixels, int width, int height, std::ptrdiff_t stride,
+          boost::shared_ptr<RowSwapper const> swapper=boost::shared_ptr<RowSwapper const>()) :
+        _width(width), _height(height), _stride(stride), _x0(0), _y0(0), _pixels(pixels), _memory(memory),
+        _swapper(swapper), _row0(0) {}
+
+    static MappedFile::Ptr _checkFile(MappedFile::Ptr file, std::size_t offset, int width, int height);
 };
 
+/// Map a pixel type to a FITS BITPIX
+template<typename T> struct FitsBitpix { enum { value = 0 }; };
+template<> struct FitsBitpix<short>  { enum { value = 16 }; };
+template<> struct FitsBitpix<int>    { enum { value = 32 }; };
+template<> struct FitsBitpix<float>  { enum { value = -32 }; };
+template<> struct FitsBitpix<double> { enum { value = -64 }; };
+
+/**
+ * Create an Image, allocating its pixels and setting them all to val
+ */
+template<typename T>
+Image<T>::Image(int width, int height, T val) :
+    _width(width), _height(height),
+    _stride(((width*sizeof(T) + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT/sizeof(T)),
+    _x0(0), _y0(0), _pixels(0), _memory(), _swapper(), _row0(0)
+{
+    if (width < 0 || height < 0) {
+        std::ostringstream msg;
+        msg << "Invalid Image dimensions " << width << "x" << height;
+        throw std::runtime_error(msg.str());
+    }
+
+    std::size_t const nbyte = static_cast<std::size_t>(_stride)*height*sizeof(T);
+    char *buf = new char[nbyte + ALIGNMENT];
+    _memory = boost::shared_ptr<char>(buf, boost::checked_array_deleter<char>());
+    _pixels = reinterpret_cast<T *>(buf + (ALIGNMENT - reinterpret_cast<std::size_t>(buf)%ALIGNMENT)%ALIGNMENT);
+
+    for (int y = 0; y != height; ++y) {
+        T *row = getRow(y);
+        for (int x = 0; x != width; ++x) {
+            row[x] = val;
+        }
+    }
+}
+
+/**
+ * Create a subimage covering bbox (relative to parent's corner), sharing parent's pixels
+ */
+template<typename T>
+Image<T>::Image(Image const& parent, BBox const& bbox) :
+    _width(bbox.getWidth()), _height(bbox.getHeight()), _stride(parent._stride),
+    _x0(parent._x0 + bbox.getX0()), _y0(parent._y0 + bbox.getY0()),
+    _pixels(parent._pixels + bbox.getY0()*parent._stride + bbox.getX0()), _memory(parent._memory),
+    _swapper(parent._swapper), _row0(parent._row0 + bbox.getY0())
+{
+    if (!BBox(0, 0, parent._width, parent._height).contains(bbox)) {
+        std::ostringstream msg;
+        msg << "Subimage " << bbox.getWidth() << "x" << bbox.getHeight() << "+" <<
+            bbox.getX0() << "+" << bbox.getY0() << " doesn't fit in a " <<
+            parent._width << "x" << parent._height << " Image";
+        throw std::runtime_error(msg.str());
+    }
+}
+
+template<typename T>
+MappedFile::Ptr Image<T>::_checkFile(MappedFile::Ptr file, std::size_t offset, int width, int height) {
+    if (offset + static_cast<std::size_t>(width)*height*sizeof(T) > file->size()) {
+        std::ostringstream msg;
+        msg << file->getFilename() << " is too small to hold a " << width << "x" << height << " image";
+        throw std::runtime_error(msg.str());
+    }
+    if ((reinterpret_cast<std::size_t>(file->getData()) + offset)%sizeof(T) != 0) {
+        throw std::runtime_error("Pixels in " + file->getFilename() + " are not correctly aligned");
+    }
+
+    return file;
+}
+
+/**
+ * Return an Image whose pixels are a width x height array of native-endian Ts, starting offset bytes into
+ * filename.  The file is mapped into memory, not read
+ */
+template<typename T>
+typename Image<T>::Ptr Image<T>::readRaw(std::string const& filename, int width, int height, std::size_t offset) {
+    MappedFile::Ptr file = _checkFile(MappedFile::Ptr(new MappedFile(filename)), offset, width, height);
+
+    return Ptr(new Image(file, reinterpret_cast<T *>(file->getData() + offset), width, height, width));
+}
+
+/**
+ * Return an Image whose pixels are the primary HDU of a FITS file
+ *
+ * The file is mapped into memory.  FITS data are big-endian, so on a little-endian machine the mapping
+ * is copy-on-write and each row of pixels is swapped in place the first time that it's used (\sa
+ * RowSwapper), which means that only the pages holding rows that are used are read and copied;  on
+ * big-endian machines the file's pages are used as-is
+ */
+template<typename T>
+typename Image<T>::Ptr Image<T>::readFits(std::string const& filename) {
+    bool const swap = !isBigEndian() && sizeof(T) > 1;
+    MappedFile::Ptr file(new MappedFile(filename, swap));
+    FitsHeader const hdr = readFitsHeader(*file);
+    if (hdr.bitpix != FitsBitpix<T>::value) {
+        std::ostringstream msg;
+        msg << filename << " has BITPIX = " << hdr.bitpix << "; expected " << FitsBitpix<T>::value;
+        throw std::runtime_error(msg.str());
+    }
+    _checkFile(file, hdr.dataOffset, hdr.naxis1, hdr.naxis2);
+
+    char *data = file->getData() + hdr.dataOffset;
+    boost::shared_ptr<RowSwapper const> swapper;
+    if (swap) {
+        swapper.reset(new RowSwapper(data, hdr.naxis2, hdr.naxis1, sizeof(T)));
+    }
+
+    return Ptr(new Image(file, reinterpret_cast<T *>(data), hdr.naxis1, hdr.naxis2, hdr.naxis1, swapper));
+}
+
 #endif
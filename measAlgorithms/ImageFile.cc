@@ -0,0 +1,63 @@
+// -*- lsst-c++ -*-
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ImageFile.h"
+
+namespace imageFile {
+
+/// Open filename for reading
+int open(std::string const& filename) {
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open " + filename + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+/// Close a file returned by open()
+void close(int fd) {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/**
+ * Read n bytes, starting offset bytes into the file fd (called filename), into buf
+ *
+ * Safe to call from several threads at once
+ */
+void read(int fd, void *buf, std::size_t n, std::size_t offset, std::string const& filename) {
+    char *ptr = static_cast<char *>(buf);
+    while (n > 0) {
+        ssize_t const nread = ::pread(fd, ptr, n, offset);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Unable to read " + filename + ": " + std::strerror(errno));
+        }
+        if (nread == 0) {
+            throw std::runtime_error("Unexpected end of file reading " + filename);
+        }
+        ptr += nread;
+        offset += nread;
+        n -= nread;
+    }
+}
+
+/**
+ * Tell the kernel that bytes [offset, offset + n) of fd will be read soon;  purely advisory
+ */
+void willNeed(int fd, std::size_t offset, std::size_t n) {
+#if defined(POSIX_FADV_WILLNEED)
+    (void)::posix_fadvise(fd, offset, n, POSIX_FADV_WILLNEED);
+#else
+    (void)fd; (void)offset; (void)n;
+#endif
+}
+
+}
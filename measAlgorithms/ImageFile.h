@@ -0,0 +1,154 @@
+// -*- lsst-c++ -*-
+#if !defined(IMAGE_FILE_H)
+#define IMAGE_FILE_H 1
+
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+
+#include "Image.h"
+#include "Simd.h"
+
+namespace imageFile {
+    int open(std::string const& filename);
+    void close(int fd);
+    void read(int fd, void *buf, std::size_t n, std::size_t offset, std::string const& filename);
+    void willNeed(int fd, std::size_t offset, std::size_t n);
+}
+
+/**
+ * A 2-d image in a file, from which rectangles of pixels are read on demand
+ *
+ * Unlike Image::readRaw and Image::readFits, nothing is mapped or read until it's asked for, so the image
+ * may be much larger than memory;  read() copies a BBox of pixels (converting them from FITS's big-endian
+ * order if needs be) into an Image, and prefetch() tells the kernel that a BBox will soon be wanted
+ */
+template<typename T>
+class ImageFile : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<ImageFile> Ptr;
+    typedef boost::shared_ptr<ImageFile const> ConstPtr;
+
+    static Ptr openRaw(std::string const& filename, int width, int height, std::size_t offset=0);
+    static Ptr openFits(std::string const& filename);
+    ~ImageFile() { imageFile::close(_fd); }
+
+    /// Return the name of the file
+    std::string const& getFilename() const { return _filename; }
+    /// Return the number of columns
+    int getWidth() const { return _width; }
+    /// Return the number of rows
+    int getHeight() const { return _height; }
+    /// Return the extent of the image
+    BBox getBBox() const { return BBox(0, 0, _width, _height); }
+
+    void read(BBox const& bbox, Image<T> &im) const;
+    void prefetch(BBox const& bbox) const;
+private:
+    std::string _filename;
+    int _fd;
+    int _width, _height;
+    std::size_t _offset;                // where the pixels start in the file
+    bool _swap;                         // are the pixels in the other byte order?
+
+    ImageFile(std::string const& filename, int width, int height, std::size_t offset, bool swap);
+
+    /// Return the offset in the file of pixel (x, y)
+    std::size_t _getOffset(int x, int y) const {
+        return _offset + (static_cast<std::size_t>(y)*_width + x)*sizeof(T);
+    }
+};
+
+template<typename T>
+ImageFile<T>::ImageFile(std::string const& filename, int width, int height, std::size_t offset, bool swap) :
+    _filename(filename), _fd(imageFile::open(filename)), _width(width), _height(height), _offset(offset),
+    _swap(swap)
+{
+    if (width < 0 || height < 0) {
+        imageFile::close(_fd);
+
+        std::ostringstream msg;
+        msg << "Invalid Image dimensions " << width << "x" << height;
+        throw std::runtime_error(msg.str());
+    }
+}
+
+/**
+ * Return an ImageFile whose pixels are a width x height array of native-endian Ts, starting offset bytes
+ * into filename
+ */
+template<typename T>
+typename ImageFile<T>::Ptr ImageFile<T>::openRaw(std::string const& filename, int width, int height,
+                                                 std::size_t offset) {
+    return Ptr(new ImageFile(filename, width, height, offset, false));
+}
+
+/**
+ * Return an ImageFile whose pixels are the primary HDU of a FITS file
+ */
+template<typename T>
+typename ImageFile<T>::Ptr ImageFile<T>::openFits(std::string const& filename) {
+    FitsHeader hdr;
+    {
+        MappedFile const file(filename); // only the header's pages are read
+        hdr = readFitsHeader(file);
+    }
+    if (hdr.bitpix != FitsBitpix<T>::value) {
+        std::ostringstream msg;
+        msg << filename << " has BITPIX = " << hdr.bitpix << "; expected " << FitsBitpix<T>::value;
+        throw std::runtime_error(msg.str());
+    }
+
+    return Ptr(new ImageFile(filename, hdr.naxis1, hdr.naxis2, hdr.dataOffset, !isBigEndian() && sizeof(T) > 1));
+}
+
+/**
+ * Read the pixels in bbox (which must lie within the image) into the corner of im, which must be at
+ * least as large as bbox;  im's (x0, y0) is set to bbox's corner
+ */
+template<typename T>
+void ImageFile<T>::read(BBox const& bbox, Image<T> &im) const {
+    if (!getBBox().contains(bbox) || bbox.getWidth() > im.getWidth() || bbox.getHeight() > im.getHeight()) {
+        std::ostringstream msg;
+        msg << "Unable to read " << bbox.getWidth() << "x" << bbox.getHeight() << "+" <<
+            bbox.getX0() << "+" << bbox.getY0() << " from " << _filename << " into a " <<
+            im.getWidth() << "x" << im.getHeight() << " Image";
+        throw std::runtime_error(msg.str());
+    }
+
+    for (int j = 0; j < bbox.getHeight(); ++j) {
+        T *row = im.getRow(j);
+        imageFile::read(_fd, row, bbox.getWidth()*sizeof(T), _getOffset(bbox.getX0(), bbox.getY0() + j), _filename);
+        if (_swap) {
+            simd::byteSwap(row, row, sizeof(T), bbox.getWidth());
+        }
+    }
+    im.setXY0(bbox.getX0(), bbox.getY0());
+}
+
+/**
+ * Ask the kernel to start reading the pixels in bbox, without waiting for them
+ */
+template<typename T>
+void ImageFile<T>::prefetch(BBox const& bbox) const {
+    BBox const box = getBBox().clip(bbox);
+    if (box.empty()) {
+        return;
+    }
+    // The rows of a tile are scattered through the file, but a little extra read-ahead is cheaper than
+    // one request per row when the tile's nearly as wide as the image
+    std::size_t const begin = _getOffset(box.getX0(), box.getY0());
+    std::size_t const end = _getOffset(box.getX1(), box.getY1() - 1);
+    if (end - begin <= 2*static_cast<std::size_t>(box.getHeight())*box.getWidth()*sizeof(T)) {
+        imageFile::willNeed(_fd, begin, end - begin);
+    } else {
+        for (int y = box.getY0(); y < box.getY1(); ++y) {
+            imageFile::willNeed(_fd, _getOffset(box.getX0(), y), box.getWidth()*sizeof(T));
+        }
+    }
+}
+
+#endif
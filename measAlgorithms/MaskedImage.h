@@ -0,0 +1,223 @@
+// -*- lsst-c++ -*-
+#if !defined(MASKED_IMAGE_H)
+#define MASKED_IMAGE_H 1
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "Image.h"
+
+typedef unsigned short MaskPixel;       // a pixel of a mask;  each bit is a plane
+
+namespace maskedImage {
+    /// How a MaskedImage stores its pixels
+    typedef enum {
+        PLANAR,                         // three Images:  the image, the mask, and the variance
+        INTERLEAVED                     // one Image of Pixels, each a pixel's value, variance and mask
+    } Layout;
+
+    /// The standard mask planes
+    enum {
+        BAD = 0x1,                      // the pixel's value is meaningless
+        SATURATED = 0x2,                // the pixel was saturated
+        CR = 0x4,                       // the pixel was hit by a cosmic ray
+        EDGE = 0x8,                     // the pixel's near the edge of the detector
+        DETECTED = 0x10                 // the pixel's part of a detected object
+    };
+    /// The planes that mean that a pixel's value mustn't be used to measure a source
+    enum { UNUSABLE = BAD | SATURATED | CR };
+
+    /// A pixel of an INTERLEAVED MaskedImage;  everything that we know about a pixel, in one cache line
+    template<typename T>
+    struct Pixel {
+        Pixel(T image_=0, T variance_=0, MaskPixel mask_=0) :
+            image(image_), variance(variance_), mask(mask_) {}
+
+        T image;
+        T variance;
+        MaskPixel mask;
+    };
+}
+
+/**
+ * An image with a mask and a variance for each pixel
+ *
+ * The pixels may be stored either as three Images (PLANAR), or as one Image of maskedImage::Pixels
+ * (INTERLEAVED), so that a pixel's value, variance and mask are read together.  Either way the algorithms
+ * see the same thing, as a Cutout copies the pixels it needs into planes of its own (\sa copyTo)
+ *
+ * Like Images, MaskedImages share their pixels with their subimages;  pixels are indexed relative to the
+ * MaskedImage's corner, which is at (getX0(), getY0()) in its parent
+ */
+template<typename T>
+class MaskedImage {
+public:
+    typedef boost::shared_ptr<MaskedImage> Ptr;
+    typedef boost::shared_ptr<MaskedImage const> ConstPtr;
+    typedef T Pixel;                    // the type of the image and variance
+    typedef maskedImage::Pixel<T> InterleavedPixel;
+
+    MaskedImage(int width, int height, maskedImage::Layout layout=maskedImage::PLANAR);
+    MaskedImage(Image<T> const& image, Image<MaskPixel> const& mask, Image<T> const& variance);
+    MaskedImage(MaskedImage const& parent, BBox const& bbox);
+
+    /// Return a subimage covering bbox (in our coordinates), sharing our pixels
+    ConstPtr subimage(BBox const& bbox) const {
+        return ConstPtr(new MaskedImage(*this, bbox));
+    }
+
+    /// Return how our pixels are stored
+    maskedImage::Layout getLayout() const { return _layout; }
+    /// Return the number of columns
+    int getWidth() const { return _bbox.getWidth(); }
+    /// Return the number of rows
+    int getHeight() const { return _bbox.getHeight(); }
+    /// Return the column of our (0, 0) pixel in our parent's coordinates
+    int getX0() const { return _bbox.getX0(); }
+    /// Return the row of our (0, 0) pixel in our parent's coordinates
+    int getY0() const { return _bbox.getY0(); }
+    /// Return our extent, in our parent's coordinates
+    BBox const& getBBox() const { return _bbox; }
+    void setXY0(int x0, int y0);
+
+    /// Return the image plane;  PLANAR only
+    Image<T> &getImage() { _checkLayout(maskedImage::PLANAR); return _image; }
+    /// Return the image plane;  PLANAR only
+    Image<T> const& getImage() const { _checkLayout(maskedImage::PLANAR); return _image; }
+    /// Return the mask plane;  PLANAR only
+    Image<MaskPixel> &getMask() { _checkLayout(maskedImage::PLANAR); return _mask; }
+    /// Return the mask plane;  PLANAR only
+    Image<MaskPixel> const& getMask() const { _checkLayout(maskedImage::PLANAR); return _mask; }
+    /// Return the variance plane;  PLANAR only
+    Image<T> &getVariance() { _checkLayout(maskedImage::PLANAR); return _variance; }
+    /// Return the variance plane;  PLANAR only
+    Image<T> const& getVariance() const { _checkLayout(maskedImage::PLANAR); return _variance; }
+    /// Return the pixels;  INTERLEAVED only
+    Image<InterleavedPixel> &getPixels() { _checkLayout(maskedImage::INTERLEAVED); return _pixels; }
+    /// Return the pixels;  INTERLEAVED only
+    Image<InterleavedPixel> const& getPixels() const {
+        _checkLayout(maskedImage::INTERLEAVED);
+        return _pixels;
+    }
+
+    /// Set the pixel (x, y)
+    void set(int x, int y, T image, T variance, MaskPixel mask=0) {
+        if (_layout == maskedImage::PLANAR) {
+            _image(x, y) = image;
+            _variance(x, y) = variance;
+            _mask(x, y) = mask;
+        } else {
+            _pixels(x, y) = InterleavedPixel(image, variance, mask);
+        }
+    }
+
+    void copyTo(BBox const& bbox, Image<T> &image, Image<MaskPixel> &mask, Image<T> &variance) const;
+private:
+    maskedImage::Layout _layout;
+    BBox _bbox;
+    Image<T> _image;                    // the planes, if we're PLANAR
+    Image<MaskPixel> _mask;
+    Image<T> _variance;
+    Image<InterleavedPixel> _pixels;    // the pixels, if we're INTERLEAVED
+
+    void _checkLayout(maskedImage::Layout layout) const {
+        if (_layout != layout) {
+            throw std::runtime_error(layout == maskedImage::PLANAR ?
+                                     "This MaskedImage is INTERLEAVED, not PLANAR" :
+                                     "This MaskedImage is PLANAR, not INTERLEAVED");
+        }
+    }
+};
+
+/// Does ImageT have mask and variance planes?  (\sa Cutout)
+template<typename ImageT> struct HasVariance { enum { value = false }; };
+template<typename T> struct HasVariance<MaskedImage<T> > { enum { value = true }; };
+
+/**
+ * Create a MaskedImage, allocating its pixels and setting them all to 0
+ */
+template<typename T>
+MaskedImage<T>::MaskedImage(int width, int height, maskedImage::Layout layout) :
+    _layout(layout), _bbox(0, 0, width, height),
+    _image(layout == maskedImage::PLANAR ? width : 0, layout == maskedImage::PLANAR ? height : 0),
+    _mask(layout == maskedImage::PLANAR ? width : 0, layout == maskedImage::PLANAR ? height : 0),
+    _variance(layout == maskedImage::PLANAR ? width : 0, layout == maskedImage::PLANAR ? height : 0),
+    _pixels(layout == maskedImage::INTERLEAVED ? width : 0, layout == maskedImage::INTERLEAVED ? height : 0,
+            InterleavedPixel())
+{}
+
+/**
+ * Create a PLANAR MaskedImage from three Images of the same size, sharing their pixels
+ */
+template<typename T>
+MaskedImage<T>::MaskedImage(Image<T> const& image, Image<MaskPixel> const& mask, Image<T> const& variance) :
+    _layout(maskedImage::PLANAR), _bbox(image.getBBox()), _image(image), _mask(mask), _variance(variance),
+    _pixels(0, 0, InterleavedPixel())
+{
+    if (mask.getWidth() != image.getWidth() || mask.getHeight() != image.getHeight() ||
+        variance.getWidth() != image.getWidth() || variance.getHeight() != image.getHeight()) {
+        std::ostringstream msg;
+        msg << "Image, mask and variance differ in size: " <<
+            image.getWidth() << "x" << image.getHeight() << ", " <<
+            mask.getWidth() << "x" << mask.getHeight() << ", " <<
+            variance.getWidth() << "x" << variance.getHeight();
+        throw std::runtime_error(msg.str());
+    }
+    setXY0(image.getX0(), image.getY0());
+}
+
+/**
+ * Create a subimage covering bbox (relative to parent's corner), sharing parent's pixels
+ */
+template<typename T>
+MaskedImage<T>::MaskedImage(MaskedImage const& parent, BBox const& bbox) :
+    _layout(parent._layout),
+    _bbox(parent.getX0() + bbox.getX0(), parent.getY0() + bbox.getY0(), bbox.getWidth(), bbox.getHeight()),
+    _image(parent._image, _layout == maskedImage::PLANAR ? bbox : BBox()),
+    _mask(parent._mask, _layout == maskedImage::PLANAR ? bbox : BBox()),
+    _variance(parent._variance, _layout == maskedImage::PLANAR ? bbox : BBox()),
+    _pixels(parent._pixels, _layout == maskedImage::INTERLEAVED ? bbox : BBox())
+{}
+
+/// Set the position of our (0, 0) pixel in our parent's coordinates
+template<typename T>
+void MaskedImage<T>::setXY0(int x0, int y0) {
+    _bbox = BBox(x0, y0, _bbox.getWidth(), _bbox.getHeight());
+    _image.setXY0(x0, y0);
+    _mask.setXY0(x0, y0);
+    _variance.setXY0(x0, y0);
+    _pixels.setXY0(x0, y0);
+}
+
+/**
+ * Copy the pixels in bbox (in our coordinates) to the corners of image, mask and variance;  an INTERLEAVED
+ * MaskedImage is read just once
+ */
+template<typename T>
+void MaskedImage<T>::copyTo(BBox const& bbox,
+                            Image<T> &image, Image<MaskPixel> &mask, Image<T> &variance) const {
+    int const x0 = bbox.getX0(), y0 = bbox.getY0(), width = bbox.getWidth();
+
+    for (int j = 0; j < bbox.getHeight(); ++j) {
+        T *imRow = image.getRow(j), *varRow = variance.getRow(j);
+        MaskPixel *maskRow = mask.getRow(j);
+        if (_layout == maskedImage::PLANAR) {
+            T const* im = _image.getRow(y0 + j) + x0;
+            std::copy(im, im + width, imRow);
+            MaskPixel const* msk = _mask.getRow(y0 + j) + x0;
+            std::copy(msk, msk + width, maskRow);
+            T const* var = _variance.getRow(y0 + j) + x0;
+            std::copy(var, var + width, varRow);
+        } else {
+            InterleavedPixel const* pix = _pixels.getRow(y0 + j) + x0;
+            for (int i = 0; i < width; ++i) {
+                imRow[i] = pix[i].image;
+                varRow[i] = pix[i].variance;
+                maskRow[i] = pix[i].mask;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,441 @@
+// -*- lsst-c++ -*-
+#if !defined(MEASURE_SOURCES_H)
+#define MEASURE_SOURCES_H 1
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Astrometry.h"
+#include "CatalogPipeline.h"
+#include "Photometry.h"
+#include "Source.h"
+#include "SourceCatalog.h"
+
+/**
+ * Measure Sources with a set of astrometric and photometric algorithms, giving each algorithm the results
+ * that it asked for (\sa MeasureQuantity::declare) whichever kind of algorithm provides them;  e.g.
+ * "psf" and "model" are given the centroid measured by "gaussian"
+ *
+ * The algorithms are run in an order that puts each after its inputs (\sa AlgorithmGraph), and each
+ * result is computed only once.  Serially, each peak is measured by all the algorithms in turn from one
+ * shared Cutout.  With a ThreadPool the peaks are processed in chunks, one level of the graph at a time;
+ * the threads share out the chunk's peaks, and run all the algorithms in the level (which don't depend on
+ * each other) on each peak's Cutout in turn
+ */
+template<typename ImageT>
+class MeasureSources : boost::noncopyable {
+    typedef AlgorithmInputs::Result Result;
+    typedef boost::shared_ptr<Cutout<ImageT> > CutoutPtr;
+public:
+    enum { CHUNK_SIZE = 8192 };         // number of peaks whose results are kept by the threaded measure()
+
+    explicit MeasureSources(typename ImageT::ConstPtr im) :
+        _im(im), _background(), _astrom(im), _photom(im), _nodes(), _graph(), _levels(), _halfWidth(0),
+        _mutex(), _prepared(false) {}
+
+    /**
+     * Include the algorithm called name, which may be astrometric or photometric
+     *
+     * N.b. Not safe to call while another thread is using this MeasureSources
+     */
+    void addAlgorithm(std::string const& name ///< The name of the algorithm
+                     ) {
+        bool const isPhotometry = MeasurePhotometry<ImageT>::isDeclared(name);
+        if (isPhotometry && MeasureAstrometry<ImageT>::isDeclared(name)) {
+            throw std::runtime_error("Algorithm " + name + " is both astrometric and photometric");
+        }
+
+        if (isPhotometry) {
+            _photom.addAlgorithm(name);
+        } else {
+            _astrom.addAlgorithm(name); // complains if name is unknown
+        }
+        _prepared = false;
+    }
+
+    /**
+     * Measure im from now on (e.g. the next tile of a large image;  \sa TiledMeasureSources).  The
+     * algorithms only see the pixels in each peak's Cutout, so the answers are the same as they'd be
+     * from a larger image as long as im covers the cutouts
+     *
+     * N.b. Not safe to call while another thread is using this MeasureSources
+     */
+    void setImage(typename ImageT::ConstPtr im) {
+        _im = im;
+        _astrom.setImage(im);
+        _photom.setImage(im);
+    }
+    /**
+     * Use background as the sky under each peak (\sa Cutout::getBackground);  an empty pointer means that
+     * the image's sky has already been subtracted
+     *
+     * N.b. Not safe to call while another thread is using this MeasureSources
+     */
+    void setBackground(Background::ConstPtr background) {
+        _background = background;
+        _astrom.setBackground(background);
+        _photom.setBackground(background);
+    }
+
+    /// Return the schema of the Sources' astrometry (\sa MeasureQuantity::getSchema)
+    Schema::ConstPtr getAstrometrySchema() const { return _astrom.getSchema(); }
+    /// Return the schema of the Sources' photometry (\sa MeasureQuantity::getSchema)
+    Schema::ConstPtr getPhotometrySchema() const { return _photom.getSchema(); }
+    /// Return the half-width of the cutout made around each peak;  set by prepare()
+    int getHalfWidth() const { return _halfWidth; }
+
+    /**
+     * Make sure that the schemas are complete, and decide the order to run the algorithms in
+     *
+     * This is the only part of measuring that modifies *this, and it's protected by a mutex
+     */
+    void prepare(Peak const& peak       ///< a suitable object to measure
+                ) {
+        if (_prepared) {                // the fast path; no need to lock
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        if (_prepared) {                // someone beat us to it
+            return;
+        }
+
+        _astrom.prepare(peak);
+        _photom.prepare(peak);
+
+        std::vector<Node> nodes;
+        AlgorithmGraph graph;
+        for (int i = 0; i != _astrom.getNAlgorithm(); ++i) {
+            nodes.push_back(Node(ASTROMETRY, i));
+            graph.add(_astrom.getAlgorithmName(i), _astrom.getAlgorithmInputs(i), _astrom.getAlgorithmProvides(i));
+        }
+        for (int i = 0; i != _photom.getNAlgorithm(); ++i) {
+            nodes.push_back(Node(PHOTOMETRY, i));
+            graph.add(_photom.getAlgorithmName(i), _photom.getAlgorithmInputs(i), _photom.getAlgorithmProvides(i));
+        }
+        graph.sort();
+
+        _levels.assign(graph.getNLevel(), std::vector<int>());
+        for (int i = 0; i != graph.size(); ++i) {
+            _levels[graph.getLevel(i)].push_back(i);
+        }
+        _nodes = nodes;
+        _graph = graph;
+        _halfWidth = std::max(_astrom.getHalfWidth(), _photom.getHalfWidth());
+
+        _prepared = true;
+    }
+
+    /**
+     * Measure a Source at peak with all our algorithms
+     *
+     * Once prepare() has run (it's called for you the first time) this doesn't modify *this, so you
+     * may call measure() from as many threads as you like
+     */
+    Source measure(Peak const& peak     ///< approximate position of object's centre
+                  ) {
+        prepare(peak);
+
+        Cutout<ImageT> cutout(_halfWidth);
+        cutout.reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+        std::vector<Result> results(_nodes.size());
+        _measure(cutout, peak, results);
+
+        Measurement<Astrometry> astrom(_astrom.getSchema());
+        Measurement<Photometry> photom(_photom.getSchema());
+        for (unsigned int i = 0; i != _nodes.size(); ++i) { // in the order of the schemas' members
+            if (_nodes[i].quantity == ASTROMETRY) {
+                astrom.add(boost::static_pointer_cast<Astrometry>(results[i].value));
+            } else {
+                photom.add(boost::static_pointer_cast<Photometry>(results[i].value));
+            }
+        }
+
+        Source source;
+        source.setAstrometry(astrom);
+        source.setPhotometry(photom);
+
+        return source;
+    }
+
+    /**
+     * Scratch space for measureInto(), kept from one call to the next;  each thread needs its own
+     */
+    class Workspace : boost::noncopyable {
+    public:
+        Workspace() : _cutout(), _results() {}
+    private:
+        friend class MeasureSources;
+
+        CutoutPtr _cutout;              // the pixels around the peak
+        std::vector<Result> _results;   // each node's result for the current (or previous) peak
+    };
+
+    /**
+     * Measure a Source at peak with all our algorithms, putting the answers in source
+     *
+     * The same as source = measure(peak), except that source's values are overwritten rather than
+     * replaced, as long as nothing else is using them;  so when source and workspace are reused for peak
+     * after peak, no memory is allocated once they've been used for a peak or two (and the PSF cache is
+     * warm).  Like measure(), may be called from many threads at once, but each needs its own workspace
+     */
+    void measureInto(Peak const& peak,  ///< approximate position of object's centre
+                     Source &source,    ///< where to put the answers
+                     Workspace &workspace ///< this thread's scratch space
+                    ) {
+        prepare(peak);
+
+        if (!workspace._cutout || workspace._cutout->getHalfWidth() != _halfWidth) {
+            workspace._cutout.reset(new Cutout<ImageT>(_halfWidth));
+        }
+        workspace._results.resize(_nodes.size());
+
+        Measurement<Astrometry> &astrom = source.getAstrometry();
+        Measurement<Photometry> &photom = source.getPhotometry();
+        if (astrom.getSchema() != _astrom.getSchema()) {
+            astrom = Measurement<Astrometry>(_astrom.getSchema());
+        }
+        if (photom.getSchema() != _photom.getSchema()) {
+            photom = Measurement<Photometry>(_photom.getSchema());
+        }
+        astrom.clear();                 // so source isn't using the results that we'd like to reuse
+        photom.clear();
+
+        workspace._cutout->reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+        _measure(*workspace._cutout, peak, workspace._results);
+
+        for (unsigned int i = 0; i != _nodes.size(); ++i) { // in the order of the schemas' members
+            Result const& result = workspace._results[i];
+            if (_nodes[i].quantity == ASTROMETRY) {
+                astrom.add(boost::static_pointer_cast<Astrometry>(result.value));
+            } else {
+                photom.add(boost::static_pointer_cast<Photometry>(result.value));
+            }
+        }
+    }
+
+    /**
+     * Measure Sources at each of the peaks in [begin, end), writing the results into rows row0, row0 + 1,
+     * ... of cat (which is resized if needs be)
+     *
+     * cat must have been created with our schemas (\sa getAstrometrySchema, getPhotometrySchema, prepare).
+     * Once their values are in cat, the algorithms' results are reused for the next peak
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 SourceCatalog &cat,    ///< where to put the answers
+                 std::size_t row0=0     ///< the row for *begin
+                ) {
+        if (begin == end) {
+            return;
+        }
+        _prepareCatalog(*begin, cat, row0 + std::distance(begin, end));
+
+        Cutout<ImageT> cutout(_halfWidth);
+        std::vector<Result> results(_nodes.size());
+        std::size_t row = row0;
+        for (PeakIterator peak = begin; peak != end; ++peak, ++row) {
+            cutout.reset(*_im, peak->getIx(), peak->getIy(), _background.get());
+            _measure(cutout, *peak, results);
+
+            for (unsigned int i = 0; i != _nodes.size(); ++i) {
+                _set(cat, row, i, results[i]);
+            }
+        }
+    }
+
+    /**
+     * Measure Sources at each of the peaks in [begin, end) using all the threads in pool, writing the
+     * results into rows row0, row0 + 1, ... of cat (which is resized if needs be)
+     *
+     * The peaks are processed CHUNK_SIZE at a time.  For each level of the graph, the chunk's peaks are
+     * handed to the threads in blocks of about blockSize (algorithm, peak) pairs;  a thread copies each
+     * peak's pixels into its Cutout once, and runs all the level's algorithms (which don't depend on each
+     * other) on it.  The answers are the same as those from a serial run
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 SourceCatalog &cat,    ///< where to put the answers
+                 ThreadPool &pool,      ///< the threads to use
+                 std::size_t row0=0,    ///< the row for *begin
+                 std::size_t blockSize=256 ///< the number of (algorithm, peak) pairs to give a thread at a time
+                ) {
+        if (begin == end) {
+            return;
+        }
+        std::size_t const n = std::distance(begin, end);
+        _prepareCatalog(*begin, cat, row0 + n);
+
+        std::vector<CutoutPtr> cutouts(pool.getNThread()); // made by each thread as it starts work
+        std::vector<Result> results(_nodes.size()*std::min<std::size_t>(n, CHUNK_SIZE));
+        for (std::size_t c0 = 0; c0 < n; c0 += CHUNK_SIZE) {
+            Chunk<PeakIterator> chunk(begin + c0, std::min<std::size_t>(n - c0, CHUNK_SIZE), row0 + c0,
+                                      cat, cutouts, results);
+            for (unsigned int level = 0; level != _levels.size(); ++level) {
+                chunk.nodes = &_levels[level];
+                pool.run(chunk.nPeak, std::max<std::size_t>(blockSize/chunk.nodes->size(), 1),
+                         boost::bind(&MeasureSources::template _measureChunk<PeakIterator>, this,
+                                     boost::ref(chunk), boost::placeholders::_1, boost::placeholders::_2,
+                                     boost::placeholders::_3));
+            }
+        }
+    }
+
+    /**
+     * Measure Sources at each of the peaks in [begin, end), passing the results to pipeline a batch at a
+     * time;  each batch is written by the pipeline's thread while the next one is being measured.
+     *
+     * The batches must have been created with our schemas.  With a ThreadPool, each batch is measured
+     * with all its threads (as for measure(begin, end, cat, pool))
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 CatalogPipeline &pipeline ///< where to send the answers
+                ) {
+        _measurePipelined(begin, end, pipeline, 0, 0);
+    }
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 CatalogPipeline &pipeline, ///< where to send the answers
+                 ThreadPool &pool,      ///< the threads to use
+                 std::size_t blockSize=256 ///< the number of (algorithm, peak) pairs to give a thread at a time
+                ) {
+        _measurePipelined(begin, end, pipeline, &pool, blockSize);
+    }
+private:
+    enum Quantity { ASTROMETRY, PHOTOMETRY };
+    /// One of our algorithms:  the index'th algorithm of _astrom or _photom
+    struct Node {
+        Node(Quantity quantity_, int index_) : quantity(quantity_), index(index_) {}
+
+        Quantity quantity;
+        int index;
+    };
+    /// The state of the threaded measure() while it processes a chunk of peaks
+    template<typename PeakIterator>
+    struct Chunk {
+        Chunk(PeakIterator begin_, std::size_t nPeak_, std::size_t row0_, SourceCatalog &cat_,
+              std::vector<CutoutPtr> &cutouts_, std::vector<Result> &results_) :
+            begin(begin_), nPeak(nPeak_), row0(row0_), cat(cat_), cutouts(cutouts_), results(results_),
+            nodes(0) {}
+
+        PeakIterator begin;             // the first peak
+        std::size_t nPeak;              // the number of peaks
+        std::size_t row0;               // the row for *begin
+        SourceCatalog &cat;
+        std::vector<CutoutPtr> &cutouts; // a Cutout for each thread
+        std::vector<Result> &results;   // node i's result for peak k is results[i*nPeak + k]
+        std::vector<int> const* nodes;  // the nodes in the current level
+    };
+
+    typename ImageT::ConstPtr _im;
+    Background::ConstPtr _background;
+    MeasureAstrometry<ImageT> _astrom;
+    MeasurePhotometry<ImageT> _photom;
+    // Set by prepare()
+    std::vector<Node> _nodes;           // _astrom's algorithms, then _photom's;  indices into _graph
+    AlgorithmGraph _graph;
+    std::vector<std::vector<int> > _levels; // the nodes in each level of _graph
+    int _halfWidth;                     // the half-width of our cutouts
+    // Protect prepare(), and remember if it's been done
+    boost::mutex _mutex;
+    boost::atomic<bool> _prepared;
+
+    /// Measure [begin, end) into batches from pipeline, using pool if it isn't NULL
+    template<typename PeakIterator>
+    void _measurePipelined(PeakIterator begin, PeakIterator end, CatalogPipeline &pipeline,
+                           ThreadPool *pool, std::size_t blockSize) {
+        std::size_t const batchSize = pipeline.getBatchSize();
+        for (std::size_t n = std::distance(begin, end); n > 0; ) {
+            std::size_t const nPeak = std::min(n, batchSize);
+            PeakIterator batchEnd = begin;
+            std::advance(batchEnd, nPeak);
+
+            SourceCatalog &batch = pipeline.acquire();
+            batch.resize(nPeak);
+            if (pool) {
+                measure(begin, batchEnd, batch, *pool, 0, blockSize);
+            } else {
+                measure(begin, batchEnd, batch);
+            }
+            pipeline.submit();
+
+            begin = batchEnd;
+            n -= nPeak;
+        }
+    }
+    /// Prepare, and check that cat has our schemas and at least nrow rows
+    void _prepareCatalog(Peak const& peak, SourceCatalog &cat, std::size_t nrow) {
+        prepare(peak);                  // after this, measuring doesn't modify *this
+        if (cat.getAstrometry().getSchema() != _astrom.getSchema() ||
+            cat.getPhotometry().getSchema() != _photom.getSchema()) {
+            throw std::runtime_error("SourceCatalog was not created with this MeasureSources's schemas");
+        }
+        if (cat.size() < nrow) {
+            cat.resize(nrow);
+        }
+    }
+    /**
+     * Measure peak with node, given the results of all the nodes for this peak (results[stride*i]);  node's
+     * result for an earlier peak, if it's still in results, may be reused
+     */
+    void _measure(int node, Cutout<ImageT> const& cutout, Peak const& peak,
+                  Result *results, int stride) const {
+        std::vector<int> const& in = _graph.getInputs(node);
+        AlgorithmInputs const inputs(results, in.empty() ? 0 : &in[0], in.size(), stride, &results[stride*node]);
+
+        Node const& n = _nodes[node];
+        if (n.quantity == ASTROMETRY) {
+            results[stride*node] = Result(_astrom.measureAlgorithm(n.index, cutout, peak, inputs));
+        } else {
+            results[stride*node] = Result(_photom.measureAlgorithm(n.index, cutout, peak, inputs));
+        }
+    }
+    /// Measure the peak in cutout with all our algorithms in turn, putting the answers in results
+    void _measure(Cutout<ImageT> const& cutout, Peak const& peak, std::vector<Result> &results) const {
+        std::vector<int> const& order = _graph.getOrder();
+        for (unsigned int k = 0; k != order.size(); ++k) {
+            _measure(order[k], cutout, peak, &results[0], 1);
+        }
+    }
+    /// Copy node's result into cat's row
+    void _set(SourceCatalog &cat, std::size_t row, int node, Result const& result) const {
+        Node const& n = _nodes[node];
+        if (n.quantity == ASTROMETRY) {
+            cat.getAstrometry().set(row, n.index, *boost::static_pointer_cast<Astrometry>(result.value));
+        } else {
+            cat.getPhotometry().set(row, n.index, *boost::static_pointer_cast<Photometry>(result.value));
+        }
+    }
+    /**
+     * Measure peaks [b, e) of chunk with all the nodes in its current level, copying each peak's pixels
+     * just once;  used by the threaded measure()
+     */
+    template<typename PeakIterator>
+    void _measureChunk(Chunk<PeakIterator> &chunk, std::size_t b, std::size_t e, int thread) const {
+        CutoutPtr &cutout = chunk.cutouts[thread];
+        if (!cutout) {
+            cutout.reset(new Cutout<ImageT>(_halfWidth));
+        }
+
+        std::vector<int> const& nodes = *chunk.nodes;
+        for (std::size_t k = b; k != e; ++k) {
+            Peak const& peak = *(chunk.begin + k);
+
+            cutout->reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+            for (unsigned int j = 0; j != nodes.size(); ++j) {
+                int const node = nodes[j];
+                _measure(node, *cutout, peak, &chunk.results[k], chunk.nPeak);
+                _set(chunk.cat, chunk.row0 + k, node, chunk.results[node*chunk.nPeak + k]);
+            }
+        }
+    }
+};
+
+#endif
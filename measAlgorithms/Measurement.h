@@ -1,10 +1,21 @@
 #if !defined(MEASUREMENT_H)
 #define MEASUREMENT_H 1
 
+#include <algorithm>
+#include <iterator>
 #include <map>
+#include "boost/atomic.hpp"
+#include "boost/bind/bind.hpp"
 #include "boost/make_shared.hpp"
+#include "boost/ref.hpp"
+#include "boost/thread/mutex.hpp"
 
+#include "AlgorithmGraph.h"
+#include "Cutout.h"
 #include "Schema.h"
+#include "ThreadPool.h"
+
+template<typename T> class MeasurementColumns;
 
 /************************************************************************************************************/
 /*
@@ -19,11 +30,14 @@ template<typename T>
 class Measurement {
     typedef boost::shared_ptr<T> TPtr;
 public:
+    typedef T QuantityType;             ///< the type of quantity measured, e.g. Photometry
     typedef boost::shared_ptr<Measurement> Ptr;
     typedef typename std::vector<TPtr>::iterator iterator;
     typedef typename std::vector<TPtr>::const_iterator const_iterator;
 
-    Measurement() : _measuredValues(), _mySchema(new Schema) { }
+    Measurement() : _measuredValues(), _mySchema(_emptySchema()) { }
+    /// A composite whose members are described by the given schema (\sa MeasureQuantity::getSchema)
+    explicit Measurement(Schema::ConstPtr schema) : _measuredValues(), _mySchema(schema) { }
     virtual ~Measurement() {}
 
     /// Are there any known algorithms?
@@ -61,6 +75,10 @@ public:
     void add(TPtr val) {
         _measuredValues.push_back(val);
     }
+    /// Remove all the individual measurements, keeping the space to add more
+    void clear() {
+        _measuredValues.clear();
+    }
 
     /// Print all the values to os;  note that this is a virtual function called by operator<<
     virtual std::ostream &output(std::ostream &os) const {
@@ -75,16 +93,30 @@ public:
     }
 
     /// Return our Measurement's schema
-    virtual Schema::Ptr getSchema() const {
+    virtual Schema::ConstPtr getSchema() const {
         return _mySchema;
     }
-    /// Resize the list of individual measurements of type T
+    /// Replace our schema by an equivalent one (e.g. a copy of our class's schema that names the component)
+    void setSchema(Schema::ConstPtr schema ///< The new schema; must have the same layout as the old one
+                  ) {
+        assert(_data.empty() || schema->getNByte() == static_cast<int>(_data.size()));
+        _mySchema = schema;
+    }
+    /// Resize the storage for the values of T (in bytes)
     void resize(int n) { _data.resize(n); }
 
-    /// Allocate enough space in _data to hold all values declared in the schema
-    void init() {
-        defineSchema(_mySchema);
-        resize(getSchema()->size());    // getSchema() is virtual, but this is called from most-derived ctor
+    /**
+     * Allocate enough space in _data to hold all values declared in the schema
+     *
+     * The schema is built by defineSchema() the first time that a Derived is created, and is then
+     * shared (read-only) by all Deriveds.  Call as init(this) from the most-derived class's ctor
+     */
+    template<typename Derived>
+    void init(Derived const*) {
+        static Schema::ConstPtr const schema = _makeSchema();
+
+        _mySchema = schema;
+        resize(_mySchema->getNByte());
     }
     /**
      * Return the name of the algorithm used to measure this component
@@ -158,13 +190,26 @@ public:
               ) const {
         return get(i, getSchema()->find(name, component));
     }             
+    /**
+     * Return a value given a Key
+     *
+     * This is the fast way to retrieve values:  look up the Key once (\sa Schema::getKey) and reuse it
+     * for all Measurements that share our schema.  No checking is done beyond assertions
+     */
+    template<typename U>
+    U get(Schema::Key<U> const& key     ///< The Key for the desired value
+         ) const {
+        Measurement const& m = (key.getElement() < 0) ? *this : *_measuredValues[key.getElement()];
+        assert(key.getOffset() + sizeof(U) <= m._data.size());
+
+        return *reinterpret_cast<U const *>(&m._data[key.getOffset()]);
+    }
 protected:
     /// Fast compile-time-computed access to set the values of _data
     template<unsigned int INDEX, typename U>
     void set(U value                    ///< Desired value
             ) {
-        assert(INDEX < _data.size());
-        _data[INDEX] = value;
+        _at<U>(INDEX) = value;
     }
 
     /// Fast compile-time-computed access to set the values of _data
@@ -172,28 +217,71 @@ protected:
     void set(unsigned int i,            ///< Index to set
              U value                    ///< Desired value
             ) {
-        assert(INDEX + i < _data.size());
-        _data[INDEX + i] = value;
+        _at<U>(INDEX + i) = value;
     }
 
     /// Fast compile-time-computed access to retrieve the values of _data
     template<unsigned int INDEX, typename U>
     U get() const {
-        assert(INDEX < _data.size());
-        return boost::any_cast<U>(_data[INDEX]);
+        return _at<U>(INDEX);
     }
 
     /// Fast compile-time-computed access to retrieve the values of _data as an array
     template<unsigned int INDEX, typename U>
     U get(unsigned int i                ///< Desired index
          ) const {
-        assert(INDEX + i < _data.size());
-        return boost::any_cast<U>(_data[INDEX + i]);
+        return _at<U>(INDEX + i);
+    }
+
+    /// Set the value in slot index, for subclasses whose layout is only known at runtime
+    template<typename U>
+    void setSlot(unsigned int index,    ///< Slot to set
+                 U value                ///< Desired value
+                ) {
+        _at<U>(index) = value;
+    }
+
+    /// Retrieve the value in slot index, for subclasses whose layout is only known at runtime
+    template<typename U>
+    U getSlot(unsigned int index        ///< Desired slot
+             ) const {
+        return _at<U>(index);
     }
 
 private:
+    template<typename> friend class MeasurementColumns; // allow a catalog to copy _data
+
     virtual void defineSchema(Schema::Ptr ) {}
 
+    /// Build our class's schema;  defineSchema() is virtual, but this is called from most-derived ctor
+    Schema::ConstPtr _makeSchema() {
+        Schema::Ptr schema(new Schema);
+        defineSchema(schema);
+
+        return schema;
+    }
+    /// The schema used by composites, which have no values of their own
+    static Schema::ConstPtr _emptySchema() {
+        static Schema::ConstPtr const empty(new Schema);
+
+        return empty;
+    }
+
+    /// Return a reference to the value in slot index (a SchemaEntry's index plus any array index)
+    template<typename U>
+    U &_at(unsigned int index) {
+        assert(_mySchema->getType(index) == static_cast<Schema::Type>(Schema::TypeOf<U>::value));
+        assert(_mySchema->getOffset(index) + sizeof(U) <= _data.size());
+        return *reinterpret_cast<U *>(&_data[_mySchema->getOffset(index)]);
+    }
+    /// Return a const reference to the value in slot index
+    template<typename U>
+    U const& _at(unsigned int index) const {
+        assert(_mySchema->getType(index) == static_cast<Schema::Type>(Schema::TypeOf<U>::value));
+        assert(_mySchema->getOffset(index) + sizeof(U) <= _data.size());
+        return *reinterpret_cast<U const *>(&_data[_mySchema->getOffset(index)]);
+    }
+
     /// Return a value as the specified type
     template<typename U>
     U getAsType(Schema const& se        ///< The schema entry for the value you want
@@ -206,39 +294,39 @@ private:
     U getAsType(unsigned int i,         ///< Index into array (if se is an array)
                 Schema const& se        ///< The schema entry for the value you want
                ) const {
-        unsigned int const index = se.getIndex() + i;
-        if (index >= _data.size()) {
+        unsigned int const offset = se.getOffset() + i*Schema::sizeOf(se.getType());
+        if (i >= static_cast<unsigned int>(se.getDimen()) || offset >= _data.size()) {
             std::ostringstream msg;
-            if (index - i < _data.size()) { // the problem is that i takes us out of range
+            if (static_cast<unsigned int>(se.getOffset()) < _data.size()) { // the problem is that i takes us out of range
                 msg << "Index " << i << " is out of range for " << se.getName() <<
                     "[0," << se.getDimen() - 1 << "]";
             } else {
-                msg << "Index " << index << " out of range [0," << _data.size() << "] for " << se.getName();
+                msg << "Offset " << offset << " out of range [0," << _data.size() << "] for " << se.getName();
             }
             throw std::runtime_error(msg.str());
         }
-        boost::any const& val = _data[index];
+        char const *val = &_data[offset];
 
         switch (se.getType()) {
           case Schema::CHAR:
-            return static_cast<U>(boost::any_cast<char>(val));
+            return static_cast<U>(*reinterpret_cast<char const *>(val));
           case Schema::SHORT:
-            return static_cast<U>(boost::any_cast<short>(val));
+            return static_cast<U>(*reinterpret_cast<short const *>(val));
           case Schema::INT:
-            return static_cast<U>(boost::any_cast<int>(val));
+            return static_cast<U>(*reinterpret_cast<int const *>(val));
           case Schema::LONG:
 #if defined(__ICC)
 #pragma warning (push)
 #pragma warning (disable: 2259)          // conversion from "long" to "double" may lose significant bits
 #endif
-            return static_cast<U>(boost::any_cast<long>(val));
+            return static_cast<U>(*reinterpret_cast<long const *>(val));
 #if defined(__ICC)
 #pragma warning (pop)
 #endif
           case Schema::FLOAT:
-            return static_cast<U>(boost::any_cast<float>(val));
+            return static_cast<U>(*reinterpret_cast<float const *>(val));
           case Schema::DOUBLE:
-            return static_cast<U>(boost::any_cast<double>(val));
+            return static_cast<U>(*reinterpret_cast<double const *>(val));
           default:
             break;
         }
@@ -248,15 +336,19 @@ private:
         throw std::runtime_error(msg.str());
     }
 
-    typedef std::vector<boost::any> DataStore;
+    /*
+     * The values of T, laid out as described by the schema (\sa Schema::getOffset).  The memory returned by
+     * std::allocator is suitably aligned for any of the Schema::Types
+     */
+    typedef std::vector<char> DataStore;
     // The elements of T (if a leaf)
     DataStore _data;
 
     // The set of Ts (if a composite)
     std::vector<TPtr> _measuredValues;
 
-    // T's schema
-    Schema::Ptr _mySchema;
+    // T's schema;  shared by all Ts of the same class and component
+    Schema::ConstPtr _mySchema;
 };
 
 /// Print v to os, using dynamic dispatch
@@ -274,12 +366,37 @@ template<typename T, typename ImageT, typename PeakT>
 class MeasureQuantity {
 public:
     typedef Measurement<typename T::element_type> Values;
-    typedef T (*makeMeasureQuantityFunc)(typename ImageT::ConstPtr, PeakT const&);
+    typedef T (*makeMeasureQuantityFunc)(Cutout<ImageT> const&, PeakT const&, AlgorithmInputs const&);
+    /// Return the half-width of the cutout around each peak that an algorithm needs
+    typedef int (*getHalfWidthFunc)();
 private:
-    typedef std::map<std::string, makeMeasureQuantityFunc> AlgorithmList;
+    /// A registered algorithm
+    struct Factory {
+        explicit Factory(makeMeasureQuantityFunc func_=0, getHalfWidthFunc getHalfWidth_=0,
+                         std::vector<std::string> const& inputs_=std::vector<std::string>(),
+                         std::string const& provides_="") :
+            func(func_), getHalfWidth(getHalfWidth_), inputs(inputs_), provides(provides_) {}
+
+        makeMeasureQuantityFunc func;   // the factory function
+        getHalfWidthFunc getHalfWidth;  // the size of cutout that func needs;  NULL means just the peak
+        std::vector<std::string> inputs; // the algorithms whose results func needs (\sa AlgorithmGraph)
+        std::string provides;           // what else the algorithm may be called (e.g. "centroid")
+    };
+    /// An algorithm that we've been asked to use, and the schema to give its results
+    struct Algorithm {
+        explicit Algorithm(Factory factory_=Factory()) : factory(factory_), classSchema(0), schema() {}
+
+        Factory factory;                // how to make the algorithm, and what it needs
+        Schema const *classSchema;      // the schema shared by the class that func returns
+        Schema::Ptr schema;             // a copy of *classSchema with the component set to our name
+    };
+    typedef std::vector<std::pair<std::string, Algorithm> > AlgorithmList; // sorted by name
+    typedef AlgorithmInputs::Result Result;
 public:
 
-    MeasureQuantity(typename ImageT::ConstPtr im) : _im(im), _algorithms() {}
+    MeasureQuantity(typename ImageT::ConstPtr im) :
+        _im(im), _background(), _algorithms(), _schema(new Schema), _halfWidth(0), _graph(), _mutex(),
+        _prepared(false) {}
     virtual ~MeasureQuantity() {}
 
     /// Include the algorithm called name in the list of measurement algorithms to use
@@ -287,52 +404,348 @@ public:
     /// This name is looked up in the registry (\sa declare), and used as the name of the
     /// measurement if you wish to retrieve it using the schema
     ///
+    /// N.b. Not safe to call while another thread is using this MeasureQuantity
+    ///
     void addAlgorithm(std::string const& name ///< The name of the algorithm
                      ) {
-        _algorithms[name] = _lookupAlgorithm(name);
+        Algorithm const algorithm(_lookupAlgorithm(name));
+
+        typename AlgorithmList::iterator ptr = _algorithms.begin();
+        while (ptr != _algorithms.end() && ptr->first < name) {
+            ++ptr;
+        }
+        if (ptr != _algorithms.end() && ptr->first == name) {
+            ptr->second = algorithm;
+        } else {
+            _algorithms.insert(ptr, std::make_pair(name, algorithm));
+        }
+        _schema.reset(new Schema);
+        _prepared = false;
+    }
+    /**
+     * Measure im from now on (e.g. the next tile of a large image;  \sa TiledMeasureSources)
+     *
+     * N.b. Not safe to call while another thread is using this MeasureQuantity
+     */
+    void setImage(typename ImageT::ConstPtr im) {
+        _im = im;
+    }
+    /**
+     * Use background as the sky under each peak (\sa Cutout::getBackground);  an empty pointer means that
+     * the image's sky has already been subtracted
+     *
+     * N.b. Not safe to call while another thread is using this MeasureQuantity
+     */
+    void setBackground(Background::ConstPtr background) {
+        _background = background;
+    }
+    /**
+     * Return the schema of the Values returned by measure(), suitable for Schema::getKey
+     *
+     * The members' schemas are only known once each algorithm has been run, so this is empty until
+     * measure() (or prepare()) has been called
+     */
+    Schema::ConstPtr getSchema() const {
+        return _schema;
     }
-    /// Actually measure im using all requested algorithms, returning the result
+    /**
+     * Return the half-width of the cutout made around each peak;  the largest needed by any algorithm
+     *
+     * Like the schema, this is set by prepare()
+     */
+    int getHalfWidth() const {
+        return _halfWidth;
+    }
+    /**
+     * Actually measure im using all requested algorithms, returning the result
+     *
+     * The algorithms are run in an order that puts each after the algorithms whose results it asked for
+     * (\sa declare);  inputs that none of our algorithms provides are missing.  Once prepare() has run
+     * (it's called for you the first time) this doesn't modify *this, so you may call measure() from as many
+     * threads as you like
+     */
     Values measure(PeakT const& peak     ///< approximate position of object's centre
                   ) {
-        Values values;
+        prepare(peak);
+
+        Cutout<ImageT> cutout(_halfWidth);
+        cutout.reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+        std::vector<Result> results(_algorithms.size());
+        _measure(cutout, peak, results);
 
-        for (typename AlgorithmList::iterator ptr = _algorithms.begin(); ptr != _algorithms.end(); ++ptr) {
-            T val = ptr->second(_im, peak);
-            val->getSchema()->setComponent(ptr->first); // name this type of measurement (e.g. psf)
-            values.add(val);
+        Values values(_schema);
+        for (unsigned int i = 0; i != results.size(); ++i) {
+            values.add(_getResult(results[i]));
         }
 
         return values;
     }
 
-    static bool declare(std::string const& name, makeMeasureQuantityFunc func);
+    /**
+     * Measure im at each of the peaks in [begin, end), writing the results into rows row0, row0 + 1, ...
+     * of columns (which is resized if needs be)
+     *
+     * The pixels around each peak are copied into a Cutout once, and all the algorithms measure it while
+     * it's in the cache;  once its values are in columns, each algorithm's result is reused for the next
+     * peak.  The columns must have been created with our schema (\sa getSchema, prepare)
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 MeasurementColumns<typename T::element_type> &columns, ///< where to put the answers
+                 std::size_t row0=0     ///< the row for *begin
+                ) {
+        if (begin == end) {
+            return;
+        }
+        prepare(*begin);
+        if (columns.getSchema() != _schema) {
+            throw std::runtime_error("Columns were not created with this MeasureQuantity's schema");
+        }
+        std::size_t const nrow = row0 + std::distance(begin, end);
+        if (columns.size() < nrow) {
+            columns.resize(nrow);
+        }
+
+        Cutout<ImageT> cutout(_halfWidth);
+        _measure(begin, end, columns, row0, cutout);
+    }
+
+    /**
+     * Measure im at each of the peaks in [begin, end) using all the threads in pool, writing the results
+     * into rows row0, row0 + 1, ... of columns (which is resized if needs be)
+     *
+     * The peaks are processed in blocks of blockSize as by the batch measure(), with a Cutout for each
+     * thread that's reused for all of its blocks;  as each peak's results go into its own row, the answers
+     * are the same as those from a serial run
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 MeasurementColumns<typename T::element_type> &columns, ///< where to put the answers
+                 ThreadPool &pool,      ///< the threads to use
+                 std::size_t row0=0,    ///< the row for *begin
+                 std::size_t blockSize=256 ///< the number of peaks to give a thread at a time
+                ) {
+        if (begin == end) {
+            return;
+        }
+        prepare(*begin);                // after this, measuring doesn't modify *this
+        if (columns.getSchema() != _schema) {
+            throw std::runtime_error("Columns were not created with this MeasureQuantity's schema");
+        }
+        std::size_t const n = std::distance(begin, end);
+        if (columns.size() < row0 + n) {
+            columns.resize(row0 + n);
+        }
+
+        std::vector<CutoutPtr> cutouts(pool.getNThread()); // made by each thread as it starts work
+        pool.run(n, blockSize, boost::bind(&MeasureQuantity::template _measureBlock<PeakIterator>, this,
+                                           begin, boost::ref(columns), row0, boost::ref(cutouts),
+                                           boost::placeholders::_1, boost::placeholders::_2,
+                                           boost::placeholders::_3));
+    }
+
+    /**
+     * Make sure that getSchema() is complete by running our algorithms on peak, set the size of the
+     * cutouts to the largest that any algorithm needs, and decide the order to run the algorithms in
+     *
+     * This is the only part of measuring that modifies *this, and it's protected by a mutex
+     */
+    void prepare(PeakT const& peak     ///< a suitable object to measure
+                ) {
+        if (_prepared) {                // the fast path; no need to lock
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        if (_prepared) {                // someone beat us to it
+            return;
+        }
+
+        AlgorithmGraph graph;
+        _halfWidth = 0;
+        for (int i = 0; i != getNAlgorithm(); ++i) {
+            graph.add(getAlgorithmName(i), getAlgorithmInputs(i), getAlgorithmProvides(i));
+            _halfWidth = std::max(_halfWidth, getAlgorithmHalfWidth(i));
+        }
+        graph.sort();
+        _graph = graph;
+
+        Cutout<ImageT> cutout(_halfWidth);
+        cutout.reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+        std::vector<Result> results(_algorithms.size());
+        _measure(cutout, peak, results);
+
+        for (int i = 0; i != getNAlgorithm(); ++i) {
+            if (!_algorithms[i].second.schema) {
+                _setSchema(_algorithms[i].first, _algorithms[i].second, _getResult(results[i]));
+            }
+        }
+        _makeSchema();
+
+        _prepared = true;
+    }
+    /*
+     * Our algorithms one at a time, in the order of the members of getSchema();  for the use of schedulers
+     * that combine the algorithms of several MeasureQuantities (\sa MeasureSources)
+     */
+    /// Return the number of algorithms
+    int getNAlgorithm() const { return _algorithms.size(); }
+    /// Return the name of the i'th algorithm
+    std::string const& getAlgorithmName(int i) const { return _algorithms[i].first; }
+    /// Return the names of the results that the i'th algorithm needs
+    std::vector<std::string> const& getAlgorithmInputs(int i) const {
+        return _algorithms[i].second.factory.inputs;
+    }
+    /// Return what else the i'th algorithm may be called
+    std::string const& getAlgorithmProvides(int i) const { return _algorithms[i].second.factory.provides; }
+    /// Return the half-width of the cutout that the i'th algorithm needs
+    int getAlgorithmHalfWidth(int i) const {
+        getHalfWidthFunc const getHalfWidth = _algorithms[i].second.factory.getHalfWidth;
+        return getHalfWidth ? getHalfWidth() : 0;
+    }
+    /**
+     * Measure a peak with the i'th algorithm, given the results that it asked for
+     *
+     * If we've been prepared, the result's schema is set to name the algorithm
+     */
+    T measureAlgorithm(int i, Cutout<ImageT> const& cutout, PeakT const& peak,
+                       AlgorithmInputs const& inputs) const {
+        Algorithm const& algorithm = _algorithms[i].second;
+        T val = algorithm.factory.func(cutout, peak, inputs);
+        if (algorithm.schema) {         // N.b. a reused result (\sa AlgorithmInputs::makeResult) already has it
+            assert(val->getSchema().get() == algorithm.classSchema || val->getSchema() == algorithm.schema);
+            val->setSchema(algorithm.schema);
+        }
+
+        return val;
+    }
+
+    static bool declare(std::string const& name, makeMeasureQuantityFunc func,
+                        getHalfWidthFunc getHalfWidth=0, std::string const& inputs="",
+                        std::string const& provides="");
+    static bool isDeclared(std::string const& name);
 private:
+    typedef boost::shared_ptr<Cutout<ImageT> > CutoutPtr;
+
     //
     // The data that we wish to measure
     //
     typename ImageT::ConstPtr _im;
+    Background::ConstPtr _background;
     //
     // The list of algorithms that we wish to use
     //
     AlgorithmList _algorithms;
     //
+    // The schema of the Values that we return;  its members are our algorithms' schemas, in order
+    //
+    Schema::ConstPtr _schema;
+    //
+    // The half-width of the cutout around each peak
+    //
+    int _halfWidth;
+    //
+    // The order to run our algorithms in, and where their inputs come from
+    //
+    AlgorithmGraph _graph;
+    //
+    // Protect prepare(), and remember if it's been done (i.e. all the schemas are known)
+    //
+    boost::mutex _mutex;
+    boost::atomic<bool> _prepared;
+
+    /// Return a Result as a T
+    static T _getResult(Result const& result) {
+        return boost::static_pointer_cast<typename T::element_type>(result.value);
+    }
+    /// Measure the peak in cutout with all our algorithms in turn, putting the answers in results
+    void _measure(Cutout<ImageT> const& cutout, PeakT const& peak, std::vector<Result> &results) const {
+        std::vector<int> const& order = _graph.getOrder();
+        for (unsigned int k = 0; k != order.size(); ++k) {
+            int const i = order[k];
+            std::vector<int> const& in = _graph.getInputs(i);
+            AlgorithmInputs const inputs(&results[0], in.empty() ? 0 : &in[0], in.size(), 1, &results[i]);
+
+            results[i] = Result(measureAlgorithm(i, cutout, peak, inputs));
+        }
+    }
+    /// Measure the peaks in [begin, end) with all our algorithms, using cutout to hold their pixels
+    template<typename PeakIterator>
+    void _measure(PeakIterator begin, PeakIterator end, MeasurementColumns<typename T::element_type> &columns,
+                  std::size_t row0, Cutout<ImageT> &cutout) const {
+        std::vector<Result> results(_algorithms.size());
+        std::size_t row = row0;
+        for (PeakIterator peak = begin; peak != end; ++peak, ++row) {
+            cutout.reset(*_im, peak->getIx(), peak->getIy(), _background.get());
+            _measure(cutout, *peak, results);
+
+            for (unsigned int i = 0; i != results.size(); ++i) {
+                columns.set(row, i, *_getResult(results[i]));
+            }
+        }
+    }
+    /// Measure peaks [begin + b, begin + e) with thread's cutout;  used by the parallel measure()
+    template<typename PeakIterator>
+    void _measureBlock(PeakIterator begin, MeasurementColumns<typename T::element_type> &columns,
+                       std::size_t row0, std::vector<CutoutPtr> &cutouts,
+                       std::size_t b, std::size_t e, int thread) {
+        CutoutPtr &cutout = cutouts[thread];
+        if (!cutout) {
+            cutout.reset(new Cutout<ImageT>(_halfWidth));
+        }
+        _measure(begin + b, begin + e, columns, row0 + b, *cutout);
+    }
+    /**
+     * Remember the schema for algorithm (the name of this type of measurement, e.g. psf) given one of
+     * its results.  The class's schema is shared, so we make our own copy with the component set
+     */
+    static void _setSchema(std::string const& name, Algorithm &algorithm, T val) {
+        Schema::Ptr schema = val->getSchema()->clone();
+        schema->setComponent(name);
+
+        algorithm.classSchema = val->getSchema().get();
+        algorithm.schema = schema;
+    }
+    /// Build _schema from the schemas of our algorithms
+    void _makeSchema() {
+        Schema::Ptr schema(new Schema);
+        for (typename AlgorithmList::const_iterator ptr = _algorithms.begin(); ptr != _algorithms.end(); ++ptr) {
+            if (ptr->second.schema) {
+                schema->add(ptr->second.schema);
+            }
+        }
+
+        _schema = schema;
+    }
+    //
     // A mapping from names to algorithms
     //
-    // _registryWorker must be inline as it contains a critical static variable, _registry
-    //    
-    typedef std::map<std::string, makeMeasureQuantityFunc> AlgorithmRegistry;
-
-    static inline makeMeasureQuantityFunc _registryWorker(std::string const& name,
-                                                          makeMeasureQuantityFunc func);
-    static makeMeasureQuantityFunc _lookupAlgorithm(std::string const& name);
-    /// The unknown algorithm; used to allow _lookupAlgorithm use _registryWorker
-    static T _iefbr14(typename ImageT::ConstPtr, PeakT const &) { return T(); }
+    // The registry is filled by declare() (usually while initialising static variables), and frozen
+    // the first time that it's searched; after that it may be read without locking
+    //
+    typedef std::map<std::string, Factory> AlgorithmRegistry;
+
+    struct Registry {
+        Registry() : algorithms(), mutex(), frozen(false) {}
+
+        AlgorithmRegistry algorithms;
+        boost::mutex mutex;             // protects algorithms until it's frozen
+        boost::atomic<bool> frozen;     // no more declarations are allowed
+    };
+    //
+    // _registry must be inline as it contains a critical static variable
+    //
+    static inline Registry &_registry();
+    static Registry &_frozenRegistry();
+    static Factory _lookupAlgorithm(std::string const& name);
     //
     // Do the real work of measuring things
     //
     // Can't be pure virtual as we create a do-nothing MeasureQuantity which we then add to
     //
-    virtual T doMeasure(typename ImageT::ConstPtr, PeakT const&) {
+    virtual T doMeasure(Cutout<ImageT> const&, PeakT const&, AlgorithmInputs const&) {
         return T();
     }
 };
@@ -341,50 +754,86 @@ private:
  * Support the algorithm registry
  */
 template<typename T, typename ImageT, typename PeakT>
-typename MeasureQuantity<T, ImageT, PeakT>::makeMeasureQuantityFunc
-MeasureQuantity<T, ImageT, PeakT>::_registryWorker(
-        std::string const& name,
-        typename MeasureQuantity<T, ImageT, PeakT>::makeMeasureQuantityFunc func
-                                           )
+typename MeasureQuantity<T, ImageT, PeakT>::Registry &
+MeasureQuantity<T, ImageT, PeakT>::_registry()
 {
-    static typename MeasureQuantity<T, ImageT, PeakT>::AlgorithmRegistry _registry;
-
-    if (func == _iefbr14) {     // lookup func
-        typename MeasureQuantity<T, ImageT, PeakT>::AlgorithmRegistry::const_iterator ptr = _registry.find(name);
-        if (ptr == _registry.end()) {
-            throw std::runtime_error("Unknown algorithm " + name);
-        }
-        
-        func = ptr->second;
-    } else {                            // register func
-        _registry[name] = func;
-    }
+    static typename MeasureQuantity<T, ImageT, PeakT>::Registry registry;
 
-    return func;
+    return registry;
 }
 
 /**
  * Register the factory function for a named algorithm
+ *
+ * The algorithm is passed a Cutout around each peak that's at least getHalfWidth() pixels in each
+ * direction (less where it's clipped by the edge of the image), and the results of the algorithms named
+ * in inputs (a list separated by spaces or commas), in that order.  Inputs may name an algorithm or
+ * what it provides;  if the algorithms being run don't include one, the algorithm must manage without it.
+ *
+ * It's an error to call this after the registry's been used to look up an algorithm
  */
 template<typename T, typename ImageT, typename PeakT>
 bool MeasureQuantity<T, ImageT, PeakT>::declare(
-        std::string const& name,
-        typename MeasureQuantity<T, ImageT, PeakT>::makeMeasureQuantityFunc func
+        std::string const& name,        ///< the algorithm's name
+        typename MeasureQuantity<T, ImageT, PeakT>::makeMeasureQuantityFunc func, ///< the factory function
+        typename MeasureQuantity<T, ImageT, PeakT>::getHalfWidthFunc getHalfWidth, ///< the cutout it needs
+        std::string const& inputs,      ///< the results that func needs
+        std::string const& provides     ///< what else the algorithm may be called (e.g. "centroid")
                                         )
 {
-    _registryWorker(name, func);
+    Registry &registry = _registry();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+
+    if (registry.frozen) {
+        throw std::runtime_error("Unable to declare algorithm " + name + " after the registry's been used");
+    }
+    registry.algorithms[name] = Factory(func, getHalfWidth, AlgorithmGraph::split(inputs), provides);
 
     return true;
 }
 
 /**
- * Return the factory function for a named algorithm
+ * Return the registry, forbidding any further declarations
+ */
+template<typename T, typename ImageT, typename PeakT>
+typename MeasureQuantity<T, ImageT, PeakT>::Registry &
+MeasureQuantity<T, ImageT, PeakT>::_frozenRegistry()
+{
+    Registry &registry = _registry();
+    if (!registry.frozen) {
+        boost::lock_guard<boost::mutex> lock(registry.mutex);
+        registry.frozen = true;
+    }
+
+    return registry;
+}
+
+/**
+ * Is there an algorithm called name?
  */
 template<typename T, typename ImageT, typename PeakT>
-typename MeasureQuantity<T, ImageT, PeakT>::makeMeasureQuantityFunc
+bool MeasureQuantity<T, ImageT, PeakT>::isDeclared(std::string const& name)
+{
+    Registry &registry = _frozenRegistry();
+
+    return registry.algorithms.find(name) != registry.algorithms.end();
+}
+
+/**
+ * Return the factory function for a named algorithm, and what it needs
+ */
+template<typename T, typename ImageT, typename PeakT>
+typename MeasureQuantity<T, ImageT, PeakT>::Factory
 MeasureQuantity<T, ImageT, PeakT>::_lookupAlgorithm(std::string const& name)
 {
-    return _registryWorker(name, _iefbr14);
+    Registry &registry = _frozenRegistry();
+
+    typename AlgorithmRegistry::const_iterator ptr = registry.algorithms.find(name);
+    if (ptr == registry.algorithms.end()) {
+        throw std::runtime_error("Unknown algorithm " + name);
+    }
+
+    return ptr->second;
 }
 
 #endif
@@ -1,65 +1,503 @@
 // -*- lsst-c++ -*-
-#include "Photometry.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <math.h>                       // lgamma, which C++03's <cmath> needn't declare
+
+#include "ModelPhotometry.h"
+#include "Simd.h"
 
 namespace {                             // N.b. none of this implementation need be globally visible
 /************************************************************************************************************/
+/*
+ * The Sersic profile is  f(s) = exp(-b_n s^(1/n)),  where s = R/r_e is the (elliptical) radius in units
+ * of the half-light radius;  its integral over the plane is  2 pi q r_e^2 n Gamma(2n)/b_n^(2n).
+ *
+ * We tabulate f and df/dn on a grid of n and of v = s^(1/4) (which is much smoother than s near the
+ * centre of high-n profiles), so fitting never calls exp or pow per pixel
+ */
+double const nMin = 0.5;                // range of tabulated Sersic indices
+double const nMax = 6.0;
+double const nStep = 0.05;
+int const nN = 111;                     // == (nMax - nMin)/nStep + 1
+double const vMax = 3.0;                // v = s^(1/4); i.e. we tabulate to 81 r_e, which covers the fitted
+int const nV = 769;                     //   pixels for any r_e >= 0.3 unless q < 0.27 (and the lookups clamp)
+int const MAX_NPIX = ModelPhotometry::MAX_NPIX; // most pixels fitted
+float const vScale = (nV - 1)/vMax;     // tabulated v are i/vScale
+
+/// Return b_n, the constant that makes r_e the half-light radius (Ciotti & Bertin, 1999, A&A, 352, 447)
+double sersicB(double n) {
+    return 2*n - 1.0/3 + 4/(405*n) + 46/(25515*n*n) + 131/(1148175*n*n*n) -
+        2194697/(30690717750*n*n*n*n);
+}
+
+/// Return db_n/dn
+double sersicDbDn(double n) {
+    return 2 - 4/(405*n*n) - 2*46/(25515*n*n*n) - 3*131/(1148175*n*n*n*n) +
+        4*2194697/(30690717750*n*n*n*n*n);
+}
+
+/// Return the part of the log of the Sersic normalisation that depends on n:  log(b_n^(2n)/(n Gamma(2n)))
+double logNormN(double n) {
+    return 2*n*std::log(sersicB(n)) - std::log(n) - ::lgamma(2*n);
+}
+
 /**
- * Implement model fit photometry.  We include the sersic index in the schema, but don't provide
- * an accessor function
+ * Tables of Sersic profiles
  */
-class ModelPhotometry : public Photometry
-{
-    /// We need a new, unused, index to save the Sersic index in.  [0, Photometry::NVALUE) are already taken
-    enum { SERSIC_N=Photometry::NVALUE, NVALUE };
+class SersicTable {
 public:
-    typedef boost::shared_ptr<ModelPhotometry> Ptr;
-    typedef boost::shared_ptr<ModelPhotometry const> ConstPtr;
+    SersicTable();
 
-    /// Create a ModelPhotometry to record our measurements
-    ModelPhotometry(double flux, float fluxErr=-1) {
-        init();                         // This allocates space for fields added by defineSchema
-        set<FLUX>(flux);                // ... if you don't, these set calls will fail an assertion
-        set<FLUX_ERR>(fluxErr);         // the type of the value must match the schema
-        set<SERSIC_N>(4);
-    }
+    void getProfile(double n, float *f, float *dfdn, double *logNorm, double *dLogNormDn) const;
+private:
+    std::vector<float> _f;              // f(v) for each n, nV values per n
+    std::vector<float> _dfdn;           // df/dn(v) for each n
+    std::vector<double> _logNorm;       // logNormN(n)
+    std::vector<double> _dLogNormDn;    // d logNormN/dn
+};
 
-    /// Add desired fields to the schema
-    virtual void defineSchema(Schema::Ptr schema ///< our schema; == ModelPhotometry::_mySchema
-                      ) {
-        Photometry::defineSchema(schema);
-        schema->add(SchemaEntry("sersic_n", SERSIC_N, Schema::INT));
+SersicTable::SersicTable() : _f(nN*nV), _dfdn(nN*nV), _logNorm(nN), _dLogNormDn(nN) {
+    for (int k = 0; k != nN; ++k) {
+        double const n = nMin + k*nStep;
+        double const b = sersicB(n);
+        double const dbdn = sersicDbDn(n);
+        for (int j = 0; j != nV; ++j) {
+            double const v = j/vScale;
+            double const s1n = (j == 0) ? 0.0 : std::pow(v, 4/n); // s^(1/n)
+            double const f = std::exp(-b*s1n);
+
+            _f[k*nV + j] = f;
+            _dfdn[k*nV + j] = (j == 0) ? 0.0 : -f*s1n*(dbdn - 4*b*std::log(v)/(n*n));
+        }
+
+        double const h = 1e-5;
+        _logNorm[k] = logNormN(n);
+        _dLogNormDn[k] = (logNormN(n + h) - logNormN(n - h))/(2*h);
     }
+}
 
-    template<typename ImageT>
-    static Photometry::Ptr doMeasure(typename ImageT::ConstPtr im, Peak const&);
+/**
+ * Interpolate the tables to Sersic index n, returning the profile f and df/dn (nV values each,
+ * at v = i/vScale), and the n-dependent part of the log of the normalisation and its derivative
+ */
+void SersicTable::getProfile(double n, float *f, float *dfdn, double *logNorm, double *dLogNormDn) const {
+    double const fk = std::min(std::max((n - nMin)/nStep, 0.0), nN - 1.0);
+    int const k = std::min(static_cast<int>(fk), nN - 2);
+    float const t = fk - k;
 
-    /// Virtual function called by operator<< to dynamically dispatch the type to a stream
-    std::ostream &output(std::ostream &os ///< the output stream
-                        ) const {
-         os << "n_s: " << get("sersic_n") << "  ";
-        return Photometry::output(os);
+    float const* f0 = &_f[k*nV];
+    float const* dfdn0 = &_dfdn[k*nV];
+    for (int j = 0; j != nV; ++j) {
+        f[j] = f0[j] + t*(f0[j + nV] - f0[j]);
+        dfdn[j] = dfdn0[j] + t*(dfdn0[j + nV] - dfdn0[j]);
     }
+    *logNorm = _logNorm[k] + t*(_logNorm[k + 1] - _logNorm[k]);
+    *dLogNormDn = _dLogNormDn[k] + t*(_dLogNormDn[k + 1] - _dLogNormDn[k]);
+}
+
+/// Return the tables, building them on first use
+SersicTable const& getSersicTable() {
+    static SersicTable const table;
+
+    return table;
+}
+
+/************************************************************************************************************/
+/**
+ * Fit a Sersic model centred at (0, 0) to a set of pixels, by Levenberg-Marquardt
+ *
+ * The parameters are flux, n, r_e, and q (the axis ratio;  the major axis is along x).  The model is
+ * evaluated at the centres of the pixels, without convolving with the PSF;  all pixels have equal weight,
+ * but if the pixels' variances are provided they're used to calculate the error in the flux.
+ *
+ * The flux is linear, so whenever we evaluate the model we set it to its best value for the other
+ * parameters, and only search for n, r_e, and q ("variable projection").  This matters for cuspy profiles:
+ * the central pixel can be 10^6 times brighter than its neighbours, and it fixes the product of the flux
+ * and the normalisation, which varies as 1/r_e^2;  searching for all four parameters means walking along
+ * a narrow valley that the (single precision) Jacobian can't resolve, and the fit stalls.
+ *
+ * All the per-pixel work is done on contiguous arrays:  the profile lookups by simd::interpolate, and the
+ * sums that make up the normal equations by simd::weightedSum
+ */
+class SersicFit {
+public:
+    enum { FLUX, N, RE, Q, NPARAM };
+    enum { NSHAPE = NPARAM - 1 };       // the parameters that we search for:  N, RE, and Q
+
+    SersicFit(float const* x2, float const* y2, float const* data, float const* variance, int npix,
+              double reMax);
+
+    bool start(double param[NPARAM]);
+    bool fit(double param[NPARAM], double *fluxErr, int maxIter=50, int maxMaxIter=400);
+private:
+    int _npix;                          // <= MAX_NPIX
+    float const* _x2;                   // x^2 for each pixel
+    float const* _y2;                   // y^2 for each pixel
+    float const* _data;
+    float const* _variance;             // the data's variance;  may be NULL
+    double _min[NPARAM], _max[NPARAM];  // allowed ranges of the parameters
+    double _dLogNorm[NPARAM];           // d log(normalisation)/d param, as last rendered
+    // Scratch space;  of fixed size, so that fitting doesn't allocate memory
+    float _fRow[nV], _dfdnRow[nV];      // the profile at the current n
+    float _u[MAX_NPIX], _v[MAX_NPIX], _f[MAX_NPIX], _dfdv[MAX_NPIX], _dfdn[MAX_NPIX], _resid[MAX_NPIX];
+    float _jac[NPARAM][MAX_NPIX];       // d model/d param for each pixel (\sa _render)
+    float _proj[NSHAPE][MAX_NPIX];      // _jac[N..Q] with the model projected out
+    float _dFluxDData[MAX_NPIX];        // d flux/d data for each pixel
+
+    double _render(double param[NPARAM], bool wantJacobian);
+    void _projectedNormalEquations(double alpha[NSHAPE][NSHAPE], double beta[NSHAPE]);
+    void _normalEquations(double alpha[NPARAM][NPARAM]);
 };
 
+SersicFit::SersicFit(float const* x2, float const* y2, float const* data, float const* variance, int npix,
+                     double reMax) :
+    _npix(npix), _x2(x2), _y2(y2), _data(data), _variance(variance)
+{
+    assert(npix <= MAX_NPIX);
+
+    _min[FLUX] = -std::numeric_limits<double>::max(); _max[FLUX] = std::numeric_limits<double>::max();
+    _min[N] = nMin;  _max[N] = nMax;
+    _min[RE] = 0.3;  _max[RE] = std::max(reMax, 0.3);
+    _min[Q] = 0.1;   _max[Q] = 1;
+}
+
+/**
+ * Evaluate the model with parameters param, setting param[FLUX] to its best value and the residuals;
+ * return chi^2.
+ *
+ * If wantJacobian, also set d model/d param;  for N, RE, and Q we only set the part due to the change in
+ * the profile's shape, and the change in the normalisation is amp*f*_dLogNorm[] (\sa fit)
+ */
+double SersicFit::_render(double param[NPARAM], bool wantJacobian) {
+    double const re = param[RE], q = param[Q];
+
+    double logNormN = 0, dLogNormDn = 0;
+    getSersicTable().getProfile(param[N], &_fRow[0], &_dfdnRow[0], &logNormN, &dLogNormDn);
+    double const norm = std::exp(logNormN - std::log(2*M_PI) - std::log(q) - 2*std::log(re));
+    //
+    // v = s^(1/4) = u^(1/8), where u = s^2 = (x^2 + y^2/q^2)/re^2
+    //
+    float const invRe2 = 1/(re*re);
+    float const invQ2 = 1/(q*q);
+    for (int i = 0; i != _npix; ++i) {
+        _u[i] = (_x2[i] + _y2[i]*invQ2)*invRe2;
+        _v[i] = std::sqrt(std::sqrt(std::sqrt(_u[i])));
+    }
+    simd::interpolate(&_fRow[0], nV, vScale, &_v[0], _npix, &_f[0], wantJacobian ? &_dfdv[0] : 0);
+
+    double sumDF = 0, sumFF = 0, unused = 0;
+    simd::weightedSum(&_f[0], _data, 0, _npix, &sumDF, &unused);
+    simd::weightedSum(&_f[0], &_f[0], 0, _npix, &sumFF, &unused);
+    param[FLUX] = (sumFF > 0) ? sumDF/(sumFF*norm) : 0;
+    float const amp = param[FLUX]*norm;
+
+    for (int i = 0; i != _npix; ++i) {
+        _resid[i] = _data[i] - amp*_f[i];
+    }
+    double chi2 = 0;
+    simd::weightedSum(&_resid[0], &_resid[0], 0, _npix, &chi2, &unused);
+
+    if (wantJacobian) {
+        simd::interpolate(&_dfdnRow[0], nV, vScale, &_v[0], _npix, &_dfdn[0], 0);
+
+        _dLogNorm[FLUX] = 0;
+        _dLogNorm[N] = dLogNormDn;
+        _dLogNorm[RE] = -2/re;
+        _dLogNorm[Q] = -1/q;
+
+        float const invRe = 1/re, invQ = 1/q;
+        float const dvdqScale = -0.25*invQ*invQ2*invRe2; // dv/dq = -v y^2/(4 q^3 re^2 u)
+        for (int i = 0; i != _npix; ++i) {
+            float const f = _f[i];
+            float const dfdv = _dfdv[i];
+            float const dvdre = -0.25f*_v[i]*invRe;
+            float const dvdq = (_u[i] > 0) ? dvdqScale*_v[i]*_y2[i]/_u[i] : 0.0f;
+
+            _jac[FLUX][i] = norm*f;
+            _jac[N][i] = amp*_dfdn[i];
+            _jac[RE][i] = amp*dfdv*dvdre;
+            _jac[Q][i] = amp*dfdv*dvdq;
+        }
+    }
+
+    return chi2;
+}
+
+/**
+ * Set the normal equations for N, RE, and Q given that the flux takes its best value, alpha = P^T P and
+ * beta = P^T r, for the Jacobian and residuals last rendered
+ *
+ * P is the Jacobian with the model projected out of each column;  that removes the change in the
+ * normalisation (which is proportional to the model) exactly, so we needn't subtract two large numbers
+ * to find the small part of d model/d r_e that isn't just a change in the central pixel
+ */
+void SersicFit::_projectedNormalEquations(double alpha[NSHAPE][NSHAPE], double beta[NSHAPE]) {
+    double sumFF = 0, unused = 0;
+    simd::weightedSum(&_f[0], &_f[0], 0, _npix, &sumFF, &unused);
+
+    for (int k = 0; k != NSHAPE; ++k) {
+        double sumJF = 0;
+        simd::weightedSum(&_jac[k + 1][0], &_f[0], 0, _npix, &sumJF, &unused);
+        float const c = (sumFF > 0) ? sumJF/sumFF : 0;
+        for (int i = 0; i != _npix; ++i) {
+            _proj[k][i] = _jac[k + 1][i] - c*_f[i];
+        }
+    }
+
+    for (int i = 0; i != NSHAPE; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            alpha[i][j] = 0;
+            simd::weightedSum(&_proj[i][0], &_proj[j][0], 0, _npix, &alpha[i][j], &unused);
+            alpha[j][i] = alpha[i][j];
+        }
+        beta[i] = 0;
+        simd::weightedSum(&_proj[i][0], &_resid[0], 0, _npix, &beta[i], &unused);
+    }
+}
+
+/// Set alpha = J^T J for all the parameters, for the Jacobian last rendered (which must be complete)
+void SersicFit::_normalEquations(double alpha[NPARAM][NPARAM]) {
+    double unused = 0;
+    for (int i = 0; i != NPARAM; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            alpha[i][j] = 0;
+            simd::weightedSum(&_jac[i][0], &_jac[j][0], 0, _npix, &alpha[i][j], &unused);
+            alpha[j][i] = alpha[i][j];
+        }
+    }
+}
+
+/// Solve the symmetric positive definite system a x = b by Cholesky decomposition;  false if it's singular
+template<int N>
+bool choleskySolve(double const a[N][N], double const b[N], double x[N]) {
+    double l[N][N];
+    for (int i = 0; i != N; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            double sum = a[i][j];
+            for (int k = 0; k != j; ++k) {
+                sum -= l[i][k]*l[j][k];
+            }
+            if (i == j) {
+                if (!(sum > 0)) {
+                    return false;
+                }
+                l[i][i] = std::sqrt(sum);
+            } else {
+                l[i][j] = sum/l[j][j];
+            }
+        }
+    }
+
+    for (int i = 0; i != N; ++i) {      // solve L y = b
+        double sum = b[i];
+        for (int k = 0; k != i; ++k) {
+            sum -= l[i][k]*x[k];
+        }
+        x[i] = sum/l[i][i];
+    }
+    for (int i = N - 1; i >= 0; --i) {  // solve L^T x = y
+        double sum = x[i];
+        for (int k = i + 1; k != N; ++k) {
+            sum -= l[k][i]*x[k];
+        }
+        x[i] = sum/l[i][i];
+    }
+
+    return true;
+}
+
+/**
+ * Choose a starting point for fit(), replacing param[FLUX], param[N] and param[RE]
+ *
+ * Levenberg-Marquardt finds the nearest minimum, and chi^2 has false minima at small r_e and n for cuspy
+ * (large n) profiles, especially when the centre's at the centre of a pixel;  so we try a coarse grid of
+ * n and of r_e around param[RE] (the size of the stamp's moments, which are biased by the wings of large n
+ * profiles), and start at the point with the smallest chi^2.  Return false if no point has a positive flux
+ */
+bool SersicFit::start(double param[NPARAM]) {
+    static double const nGrid[] = { 0.5, 1.0, 2.0, 4.0, 6.0 };
+    static double const reScale[] = { 0.25, 0.5, 1.0, 2.0 };
+    int const nNGrid = sizeof(nGrid)/sizeof(nGrid[0]), nReScale = sizeof(reScale)/sizeof(reScale[0]);
+
+    double const re0 = param[RE];
+    double bestChi2 = std::numeric_limits<double>::max();
+    bool ok = false;
+    for (int i = 0; i != nNGrid; ++i) {
+        for (int j = 0; j != nReScale; ++j) {
+            double trial[NPARAM];
+            std::copy(param, param + NPARAM, trial);
+            trial[N] = nGrid[i];
+            trial[RE] = std::min(std::max(re0*reScale[j], _min[RE]), _max[RE]);
+
+            double const chi2 = _render(trial, false);
+            if (trial[FLUX] > 0 && chi2 < bestChi2) {
+                bestChi2 = chi2;
+                std::copy(trial, trial + NPARAM, param);
+                ok = true;
+            }
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Fit the model, starting at param and returning the best fit in param.  The error in the flux is
+ * propagated from the pixels' variances if we have them, and otherwise estimated from the scatter of the
+ * residuals.
+ *
+ * We stop when a step changes chi^2 by less than a part in 10^6 and moves none of n, r_e, and q by more
+ * than a part in 10^5 (a small change in chi^2 alone may mean that Levenberg-Marquardt has taken a short
+ * step in the wrong direction);  if we haven't stopped after maxIter iterations but chi^2 fell by more than
+ * a part in 10^3 since we last checked, we double maxIter, up to maxMaxIter.  Return true if the fit
+ * converged
+ */
+bool SersicFit::fit(double param[NPARAM], double *fluxErr, int maxIter, int maxMaxIter) {
+    double const tol = 1e-6;            // fractional change in chi^2 that we call convergence
+    double const paramTol = 1e-5;       // fractional change in n, r_e, and q that we call convergence
+    double lambda = 1e-3;
+    double alpha[NSHAPE][NSHAPE], beta[NSHAPE];
+
+    double chi2 = _render(param, true);
+    double checkedChi2 = chi2;          // chi^2 when we last checked our progress
+    bool converged = false;
+    for (int iter = 0; !converged; ++iter) {
+        if (iter == maxIter) {
+            if (maxIter >= maxMaxIter || chi2 >= (1 - 1e-3)*checkedChi2) {
+                break;
+            }
+            maxIter = std::min(2*maxIter, maxMaxIter);
+            checkedChi2 = chi2;
+        }
+
+        _projectedNormalEquations(alpha, beta);
+
+        for (;;) {
+            double a[NSHAPE][NSHAPE], delta[NSHAPE], trial[NPARAM];
+            for (int i = 0; i != NSHAPE; ++i) {
+                for (int j = 0; j != NSHAPE; ++j) {
+                    a[i][j] = alpha[i][j];
+                }
+                a[i][i] *= 1 + lambda;
+            }
+
+            bool ok = choleskySolve<NSHAPE>(a, beta, delta);
+            if (ok) {
+                bool smallStep = true;
+                trial[FLUX] = param[FLUX];
+                for (int i = 1; i != NPARAM; ++i) {
+                    trial[i] = std::min(std::max(param[i] + delta[i - 1], _min[i]), _max[i]);
+                    smallStep = smallStep && std::fabs(trial[i] - param[i]) <= paramTol*param[i];
+                }
+                double const trialChi2 = _render(trial, false);
+                if (trialChi2 <= chi2) {
+                    converged = (chi2 - trialChi2 <= tol*chi2) && smallStep;
+                    std::copy(trial, trial + NPARAM, param);
+                    chi2 = _render(param, true);
+                    lambda = std::max(0.1*lambda, 1e-7);
+                    break;
+                }
+            }
+
+            lambda *= 10;
+            if (lambda > 1e10) {        // we can't make any progress, so we're at a minimum
+                chi2 = _render(param, true);
+                converged = true;
+                break;
+            }
+        }
+    }
+    //
+    // Estimate the error in the flux.  The fit's unweighted, so the change in the flux due to a change in
+    // the data is g^T J^T, where g = (J^T J)^{-1} e_FLUX;  with variances the flux's variance is
+    // sum((g^T J^T)^2 variance), otherwise we scale g_FLUX by the residual variance.  J is the complete
+    // Jacobian, so we add the normalisation's part back in
+    //
+    for (int k = 0; k != NPARAM; ++k) {
+        if (k != FLUX) {
+            float const scale = param[FLUX]*_dLogNorm[k];
+            for (int i = 0; i != _npix; ++i) {
+                _jac[k][i] += scale*_jac[FLUX][i];
+            }
+        }
+    }
+    double fullAlpha[NPARAM][NPARAM];
+    _normalEquations(fullAlpha);
+    double unit[NPARAM] = { 0 }, col[NPARAM];
+    unit[FLUX] = 1;
+    if (_npix > NPARAM && choleskySolve<NPARAM>(fullAlpha, unit, col)) {
+        if (_variance) {
+            for (int i = 0; i != _npix; ++i) {
+                double dFlux = 0;
+                for (int k = 0; k != NPARAM; ++k) {
+                    dFlux += col[k]*_jac[k][i];
+                }
+                _dFluxDData[i] = dFlux;
+            }
+            double unused = 0, fluxVar = 0;
+            simd::weightedSum(&_dFluxDData[0], &_dFluxDData[0], _variance, _npix, &unused, &fluxVar);
+            *fluxErr = std::sqrt(fluxVar);
+        } else {
+            *fluxErr = std::sqrt(col[FLUX]*chi2/(_npix - NPARAM));
+        }
+    } else {
+        *fluxErr = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    return converged;
+}
+
+}
+
 /************************************************************************************************************/
 /**
- * Process the image; calculate values
+ * Fit the npix pixels gathered by doMeasure (their offsets from the centre squared, their values with the
+ * sky subtracted, and their variances, if known), writing the answer to val
+ *
+ * sum, sumXX and sumYY are the pixels' sum and second moments, which set the initial r_e and q;  flags
+ * are those that doMeasure has already set
  */
-template<typename ImageT>
-Photometry::Ptr ModelPhotometry::doMeasure(typename ImageT::ConstPtr im, Peak const&) {
-    // Burn CPU time here
-    return boost::make_shared<ModelPhotometry>(2*(*im), 0.2);
+void ModelPhotometry::_fit(float const* x2, float const* y2, float const* data, float const* variance,
+                           int npix, double sum, double sumXX, double sumYY, int flags,
+                           ModelPhotometry *val) {
+    //
+    // Initial guesses from the moments (for a Gaussian, r_e = 1.18 sigma);  the flux is set by the fit
+    //
+    double param[SersicFit::NPARAM];
+    param[SersicFit::FLUX] = sum;
+    param[SersicFit::N] = 1.0;
+    param[SersicFit::RE] = 2.0;
+    param[SersicFit::Q] = 1.0;
+    if (sum > 0 && sumXX > 0 && sumYY > 0) {
+        param[SersicFit::RE] = std::min(std::max(1.18*std::sqrt(0.5*(sumXX + sumYY)/sum), 0.5),
+                                        double(HALF_WIDTH));
+        param[SersicFit::Q] = std::min(std::max(std::sqrt(sumYY/sumXX), 0.1), 1.0);
+    }
+
+    double fluxErr = 0;
+    SersicFit fitter(x2, y2, data, variance, npix, HALF_WIDTH);
+    fitter.start(param);
+    bool const converged = fitter.fit(param, &fluxErr);
+
+    val->setValues(param[SersicFit::FLUX], fluxErr, param[SersicFit::N], param[SersicFit::RE],
+                   param[SersicFit::Q], flags | (converged ? 0 : NOT_CONVERGED));
 }
 
 /************************************************************************************************************/
 /**
  * Declare the existence of a "model" algorithm
  */
-#define INSTANTIATE(TYPE) \
-    MeasurePhotometry<Image<TYPE> >::declare("model", &ModelPhotometry::doMeasure<Image<TYPE> >)
+#define INSTANTIATE(IMAGE_T) \
+    MeasurePhotometry<IMAGE_T >::declare(ModelPhotometry::getName(), \
+                                         &ModelPhotometry::doMeasure<IMAGE_T >, \
+                                         &ModelPhotometry::getHalfWidth, "centroid")
 
+namespace {
 volatile bool isInstance[] = {
-    INSTANTIATE(float),
-    INSTANTIATE(double)
+    INSTANTIATE(Image<float>),
+    INSTANTIATE(Image<double>),
+    INSTANTIATE(MaskedImage<float>),
+    INSTANTIATE(MaskedImage<double>)
 };
 }
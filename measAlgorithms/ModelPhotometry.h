@@ -0,0 +1,164 @@
+// -*- lsst-c++ -*-
+#if !defined(MODEL_PHOTOMETRY_H)
+#define MODEL_PHOTOMETRY_H 1
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Astrometry.h"
+#include "Photometry.h"
+
+/**
+ * Implement model fit photometry.  We include the Sersic parameters in the schema, but don't provide
+ * accessor functions
+ *
+ * doMeasure, which gathers the pixels, is defined here so that StaticMeasurePhotometry can inline it;  the
+ * fit itself is in ModelPhotometry.cc
+ */
+class ModelPhotometry : public Photometry
+{
+    /// We need new, unused, indices to save the Sersic parameters in.  [0, Photometry::NVALUE) are taken
+    enum { SERSIC_N=Photometry::NVALUE, SERSIC_RE, SERSIC_Q, FLAGS, NVALUE };
+public:
+    typedef boost::shared_ptr<ModelPhotometry> Ptr;
+    typedef boost::shared_ptr<ModelPhotometry const> ConstPtr;
+
+    /// The bits that may be set in our flags
+    enum {
+        NOT_CONVERGED = 0x1,            // the fit didn't converge, so the values are unreliable
+        BAD_PIXELS = 0x2                // some pixels were masked (\sa maskedImage::UNUSABLE) so not used
+    };
+
+    /// Create a ModelPhotometry;  the values are undefined until setValues() is called
+    ModelPhotometry() {
+        init(this);                     // This allocates space for fields added by defineSchema
+    }
+    /// Create a ModelPhotometry to record our measurements
+    ModelPhotometry(double flux, float fluxErr, float n, float re, float q, int flags=0) {
+        init(this);
+        setValues(flux, fluxErr, n, re, q, flags);
+    }
+    /// Set our values, e.g. when reusing a ModelPhotometry (\sa AlgorithmInputs::makeResult)
+    void setValues(double flux, float fluxErr, float n, float re, float q, int flags=0) {
+        set<FLUX>(flux);                // if init() wasn't called, these set calls will fail an assertion
+        set<FLUX_ERR>(fluxErr);         // the type of the value must match the schema
+        set<SERSIC_N>(n);
+        set<SERSIC_RE>(re);
+        set<SERSIC_Q>(q);
+        set<FLAGS>(flags);
+    }
+
+    /// Return our flags;  a bitwise OR of NOT_CONVERGED, BAD_PIXELS etc.
+    int getFlags() const {
+        return Measurement<Photometry>::get<FLAGS, int>();
+    }
+
+    /// Add desired fields to the schema
+    virtual void defineSchema(Schema::Ptr schema ///< our schema; == ModelPhotometry::_mySchema
+                      ) {
+        Photometry::defineSchema(schema);
+        schema->add(SchemaEntry("sersic_n",  SERSIC_N,  Schema::FLOAT));
+        schema->add(SchemaEntry("sersic_re", SERSIC_RE, Schema::FLOAT, 1, "pixel"));
+        schema->add(SchemaEntry("sersic_q",  SERSIC_Q,  Schema::FLOAT));
+        schema->add(SchemaEntry("flags",     FLAGS,     Schema::INT));
+    }
+
+    enum { HALF_WIDTH = 15 };           // half-size of the fitted region
+    enum { MAX_NPIX = (2*HALF_WIDTH + 1)*(2*HALF_WIDTH + 1) }; // the most pixels that we fit
+
+    /// Return the name that we're registered under
+    static char const* getName() { return "model"; }
+    template<typename ImageT>
+    static void doMeasure(Cutout<ImageT> const& cutout, Peak const& peak, AlgorithmInputs const& inputs,
+                          ModelPhotometry *val);
+    /// Measure peak, returning a new result or reusing our previous one (\sa AlgorithmInputs::makeResult)
+    template<typename ImageT>
+    static Photometry::Ptr doMeasure(Cutout<ImageT> const& cutout, Peak const& peak,
+                                     AlgorithmInputs const& inputs) {
+        ModelPhotometry::Ptr val = inputs.makeResult<ModelPhotometry>();
+        doMeasure(cutout, peak, inputs, val.get());
+        return val;
+    }
+    /// Return the half-width of the cutout that we fit, wherever the centroid is
+    static int getHalfWidth() { return HALF_WIDTH + Astrometry::MAX_CENTROID_SHIFT; }
+
+    /// Virtual function called by operator<< to dynamically dispatch the type to a stream
+    std::ostream &output(std::ostream &os ///< the output stream
+                        ) const {
+         os << "n_s: " << get("sersic_n") << "  ";
+        return Photometry::output(os);
+    }
+private:
+    static void _fit(float const* x2, float const* y2, float const* data, float const* variance, int npix,
+                     double sum, double sumXX, double sumYY, int flags, ModelPhotometry *val);
+};
+
+/************************************************************************************************************/
+/**
+ * Process the image; calculate values
+ *
+ * Fit a Sersic model centred at the centroid (our input; the peak if we don't have one) to the pixels
+ * within HALF_WIDTH of it, starting from the best of a grid of models around the size of the stamp's
+ * moments (\sa _fit).  The sky (\sa Cutout::getBackground) is subtracted from the pixels first;
+ * if the image has a variance plane it's gathered along with the pixels, and used for the error in the flux.
+ * Pixels that are masked as unusable aren't gathered, and set BAD_PIXELS in our flags;  if the fit doesn't
+ * converge we set NOT_CONVERGED.  The answer is written to val
+ */
+template<typename ImageT>
+void ModelPhotometry::doMeasure(Cutout<ImageT> const& cutout, Peak const& peak, AlgorithmInputs const& inputs,
+                                ModelPhotometry *val) {
+    typedef typename ImageT::Pixel PixelT;
+    Image<PixelT> const& im = cutout.getImage();
+    Image<PixelT> const* varianceImage = cutout.getVariance();
+
+    double x = 0, y = 0;
+    Astrometry::getPosition(inputs.get<Astrometry>(0), peak, &x, &y);
+    double const xc = x - im.getX0();
+    double const yc = y - im.getY0();
+    int const ix = static_cast<int>(std::floor(xc + 0.5));
+    int const iy = static_cast<int>(std::floor(yc + 0.5));
+    int const x0 = std::max(0, ix - HALF_WIDTH), x1 = std::min(im.getWidth() - 1, ix + HALF_WIDTH);
+    int const y0 = std::max(0, iy - HALF_WIDTH), y1 = std::min(im.getHeight() - 1, iy + HALF_WIDTH);
+
+    double const background = cutout.getBackground();
+
+    bool const masked = cutout.hasUnusablePixels(y0, y1);
+    int flags = 0;
+
+    float x2[MAX_NPIX], y2[MAX_NPIX], data[MAX_NPIX], variance[MAX_NPIX];
+    int npix = 0;
+    double sum = 0, sumXX = 0, sumYY = 0;
+    for (int y = y0; y <= y1; ++y) {
+        PixelT const* row = im.getRow(y);
+        PixelT const* var = varianceImage ? varianceImage->getRow(y) : 0;
+        MaskPixel const* mask = (masked && cutout.hasUnusablePixels(y, y)) ? cutout.getMask()->getRow(y) : 0;
+        float const dy = y - yc;
+        for (int x = x0; x <= x1; ++x) {
+            if (mask && (mask[x] & maskedImage::UNUSABLE)) {
+                flags |= BAD_PIXELS;
+                continue;
+            }
+            float const dx = x - xc;
+            x2[npix] = dx*dx;
+            y2[npix] = dy*dy;
+            PixelT const value = row[x] - background;
+            data[npix] = value;
+            if (var) {
+                variance[npix] = var[x];
+            }
+
+            sum += value;
+            sumXX += value*dx*dx;
+            sumYY += value*dy*dy;
+            ++npix;
+        }
+    }
+    if (npix == 0) {
+        double const NaN = std::numeric_limits<double>::quiet_NaN();
+        val->setValues(NaN, NaN, NaN, NaN, NaN, flags | NOT_CONVERGED);
+        return;
+    }
+
+    _fit(x2, y2, data, varianceImage ? variance : 0, npix, sum, sumXX, sumYY, flags, val);
+}
+
+#endif
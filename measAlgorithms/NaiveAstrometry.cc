@@ -11,10 +11,18 @@ public:
     typedef boost::shared_ptr<NaiveAstrometry> Ptr;
     typedef boost::shared_ptr<NaiveAstrometry const> ConstPtr;
 
+    /// Ctor;  the values are undefined until setValues() is called
+    NaiveAstrometry() {
+        init(this);                     // This allocates space for fields added by defineSchema
+    }
     /// Ctor
     NaiveAstrometry(double x, float xErr, double y, float yErr) {
-        init();                         // This allocates space for fields added by defineSchema
-        set<X>(x);                      // ... if you don't, these set calls will fail an assertion
+        init(this);
+        setValues(x, xErr, y, yErr);
+    }
+    /// Set our values, e.g. when reusing a NaiveAstrometry (\sa AlgorithmInputs::makeResult)
+    void setValues(double x, float xErr, double y, float yErr) {
+        set<X>(x);                      // if init() wasn't called, these set calls will fail an assertion
         set<X_ERR>(xErr);               // the type of the value must match the schema
         set<Y>(y);
         set<Y_ERR>(yErr);
@@ -27,27 +35,33 @@ public:
     }
 
     template<typename ImageT>
-    static Astrometry::Ptr doMeasure(typename ImageT::ConstPtr im, Peak const&);
+    static Astrometry::Ptr doMeasure(Cutout<ImageT> const& cutout, Peak const&, AlgorithmInputs const&);
 };
 
 /**
  * Process the image; calculate values
  */
 template<typename ImageT>
-Astrometry::Ptr NaiveAstrometry::doMeasure(typename ImageT::ConstPtr, Peak const& peak) {
+Astrometry::Ptr NaiveAstrometry::doMeasure(Cutout<ImageT> const&, Peak const& peak,
+                                           AlgorithmInputs const& inputs) {
     // Here is the real work, hiding in a comment
-    return boost::make_shared<NaiveAstrometry>(peak.getX(), 0.0, peak.getY(), 0.0);
+    NaiveAstrometry::Ptr val = inputs.makeResult<NaiveAstrometry>();
+    val->setValues(peak.getX(), 0.0, peak.getY(), 0.0);
+
+    return val;
 }
 
 /************************************************************************************************************/
 /**
  * Declare the existence of a "naive" algorithm
  */
-#define INSTANTIATE(TYPE) \
-    MeasureAstrometry<Image<TYPE> >::declare("naive", &NaiveAstrometry::doMeasure<Image<TYPE> >)
+#define INSTANTIATE(IMAGE_T) \
+    MeasureAstrometry<IMAGE_T >::declare("naive", &NaiveAstrometry::doMeasure<IMAGE_T >, 0, "", "centroid")
 
 volatile bool isInstance[] = {
-    INSTANTIATE(float),
-    INSTANTIATE(double)
+    INSTANTIATE(Image<float>),
+    INSTANTIATE(Image<double>),
+    INSTANTIATE(MaskedImage<float>),
+    INSTANTIATE(MaskedImage<double>)
 };
 }
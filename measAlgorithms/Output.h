@@ -1,9 +1,14 @@
 #if !defined(OUTPUT_H)
 #define OUTPUT_H 1
 
+#include <algorithm>
 #include <fstream>
+#include <iostream>
 #include "Measurement.h"
 #include "Source.h"
+#include "SourceCatalog.h"
+#include "CsvWriter.h"
+#include "FitsWriter.h"
 
 template<typename T>
 void showFromSchema(Measurement<T> const& v)
@@ -29,103 +34,62 @@ void showFromSchema(Measurement<T> const& v)
             if (se.getUnits() != "") {
                 std::cout << "\t" << se.getUnits();
             }
-            std::cout << std::endl;
+            std::cout << '\n';
         }
     }
 }
 
-void showFromSchema(Source const& s)
+inline void showFromSchema(Source const& s)
 {
     showFromSchema(s.getAstrometry());
     showFromSchema(s.getPhotometry());
 }
 
 /************************************************************************************************************/
-
-namespace {
-    template<typename M>
-    struct writeHeader {
-        writeHeader(std::string const& comp, Schema const& se, M const&) : _comp(comp), _se(se) {}
-        std::string operator()(int i=-1) {
-            std::ostringstream ss;
-            ss << _comp << "." << _se.getName();
-            if (i >= 0) {
-                ss << i;
-            }
-            return ss.str();
-        }
-
-        std::string const& _comp;
-        Schema const& _se;
-    };
-
-    template<typename M>
-    struct writeUnits {
-        writeUnits(std::string const&, Schema const& se, M const&) : _se(se) {}
-        std::string operator()(int= -1) {
-            return _se.getUnits();
-        }
-        Schema const& _se;
-    };
-
-    template<typename M>
-    struct writeData {
-        writeData(std::string const&, Schema const& se, M const& m) : _se(se), _m(m) {}
-        std::string operator()(int i=-1) {
-            std::ostringstream ss;
-            if (i >= 0) {
-                ss << (_se.getType() == Schema::INT ? _m.getAsLong(i, _se) : _m.get(i, _se));
-            } else {
-                ss << (_se.getType() == Schema::INT ? _m.getAsLong(_se) : _m.get(_se));
-            }
-
-            return ss.str();
-        }
-
-        Schema const& _se;
-        M const& _m;
-    };
-}
-
-template<typename outputMethod, typename M>
-void writeCsv(
-              std::ostream &fd,
-              M const& v
-             )
+/**
+ * Write Sources as a csv file (to stdout if filename is "");  they must all have the same schemas
+ *
+ * The Sources are copied into a SourceCatalog a block at a time, and written with a CsvWriter
+ */
+inline void writeCsv(std::vector<Source::Ptr> const& values,
+                     std::string const& filename=""
+                    )
 {
-    for (typename M::const_iterator vptr = v.begin(); vptr != v.end(); ++vptr) {
-        Schema const& sch = *(*vptr)->getSchema();
-
-        if (vptr != v.begin()) {
-            fd << ", ";
-        }
-        for (Schema::const_iterator sptr = sch.begin(); sptr != sch.end(); ++sptr) {
-            Schema const& se = *(*sptr);
-            outputMethod output(sch.getComponent(), se, **vptr);
+    if (values.empty()) {
+        return;
+    }
 
-            if (se.isArray()) {
-                for (int i = 0; i != se.getDimen(); ++i) {
-                    fd << output(i);
-                    if (i != se.getDimen() - 1) {
-                        fd << ", ";
-                    }
-                }
-            } else {
-                fd << output();
-            }
+    std::ofstream fs;
+    std::ostream &fd = (filename == "") ? std::cout : fs;
+    if (filename != "") {
+        fs.open(filename.c_str());
+    }
 
-            if (sptr != sch.end() - 1) {
-                fd << ", ";
-            }
+    Source const& first = *values.front();
+    SourceCatalog cat(first.getAstrometry().getSchema(), first.getPhotometry().getSchema());
+    CsvWriter writer(fd, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+    writer.writeHeader();
+
+    std::size_t const blockSize = 4096;
+    cat.reserve(std::min(values.size(), blockSize));
+    for (std::size_t i0 = 0; i0 < values.size(); i0 += blockSize) {
+        std::size_t const n = std::min(blockSize, values.size() - i0);
+        cat.resize(n);
+        for (std::size_t i = 0; i != n; ++i) {
+            cat.set(i, *values[i0 + i]);
         }
+        writer.write(cat);
     }
 }
 
-void writeCsv(std::vector<Source::Ptr> values,
-              std::string const& filename=""
-             )
+/**
+ * Write a SourceCatalog as a csv file (to stdout if filename is "");  \sa CsvWriter
+ */
+inline void writeCsv(SourceCatalog const& cat,
+                     std::string const& filename=""
+                    )
 {
-    if (values.begin() == values.end()) {
+    if (cat.empty()) {
         return;
     }
 
@@ -135,26 +99,21 @@ void writeCsv(std::vector<Source::Ptr> values,
         fs.open(filename.c_str());
     }
 
-    {
-        Source::ConstPtr first = *(values.begin());
-        writeCsv<writeHeader<Measurement<Astrometry> > >(fd, first->getAstrometry());
-        fd << ", ";
-        writeCsv<writeHeader<Measurement<Photometry> > >(fd, first->getPhotometry());
-        fd << std::endl;
-
-        writeCsv<writeUnits<Measurement<Astrometry> > >(fd, first->getAstrometry());
-        fd << ", ";
-        writeCsv<writeUnits<Measurement<Photometry> > >(fd, first->getPhotometry());
-        fd << std::endl;
-    }
-    
-    for (std::vector<Source::Ptr>::iterator ptr = values.begin(); ptr != values.end(); ++ptr) {
+    CsvWriter writer(fd, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+    writer.writeHeader();
+    writer.write(cat);
+}
 
-        writeCsv<writeData<Measurement<Astrometry> > >(fd, (*ptr)->getAstrometry());
-        fd << ", ";
-        writeCsv<writeData<Measurement<Photometry> > >(fd, (*ptr)->getPhotometry());
-        fd << std::endl;
-    }
+/**
+ * Write a SourceCatalog as a FITS binary table;  \sa FitsWriter
+ */
+inline void writeFits(SourceCatalog const& cat,
+                      std::string const& filename
+                     )
+{
+    FitsWriter writer(filename, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+    writer.write(cat);
+    writer.close();
 }
 
 #endif
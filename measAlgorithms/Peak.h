@@ -1,15 +1,21 @@
 #if !defined(PEAK_H)
 #define PEAK_H 1
 
+#include <cmath>
+#include "boost/shared_ptr.hpp"
+
 class Peak {
 public:
-    typedef 
-    boost::shared_ptr<Peak> Ptr;
-    boost::shared_ptr<Peak const> ConstPtr;
+    typedef boost::shared_ptr<Peak> Ptr;
+    typedef boost::shared_ptr<Peak const> ConstPtr;
 
     Peak(float x, float y) : _x(x), _y(y) {}
     float getX() const { return _x; }
     float getY() const { return _y; }
+    /// Return the column of the pixel containing the peak
+    int getIx() const { return static_cast<int>(std::floor(_x + 0.5)); }
+    /// Return the row of the pixel containing the peak
+    int getIy() const { return static_cast<int>(std::floor(_y + 0.5)); }
 private:
     float _x, _y;
 };
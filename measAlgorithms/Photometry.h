@@ -2,6 +2,7 @@
 #define PHOTOMETRY_H 1
 
 #include "Measurement.h"
+#include "StaticMeasureQuantity.h"
 #include "Image.h"
 #include "Peak.h"
 
@@ -52,5 +53,15 @@ class MeasurePhotometry : public MeasureQuantity<Photometry::Ptr, ImageT, Peak>
 public:
     MeasurePhotometry(typename ImageT::ConstPtr im) : MeasureQuantity<Photometry::Ptr, ImageT, Peak>(im) {}
 };
+/**
+ * Measure fluxes with a set of algorithms chosen at compile time (\sa StaticMeasureQuantity)
+ */
+template<typename ImageT, typename A1,
+         typename A2=NoAlgorithm, typename A3=NoAlgorithm, typename A4=NoAlgorithm>
+class StaticMeasurePhotometry : public StaticMeasureQuantity<Photometry::Ptr, ImageT, Peak, A1, A2, A3, A4> {
+public:
+    StaticMeasurePhotometry(typename ImageT::ConstPtr im) :
+        StaticMeasureQuantity<Photometry::Ptr, ImageT, Peak, A1, A2, A3, A4>(im) {}
+};
 
 #endif
@@ -0,0 +1,204 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cmath>
+
+#include "Psf.h"
+
+namespace {
+    /// Return the largest value of a linear function of position on bbox (it's at a corner)
+    double maxOnBBox(BBox const& bbox, double val, double dValDx, double dValDy) {
+        double const dx = (bbox.getWidth() > 0) ? bbox.getWidth() - 1 : 0;
+        double const dy = (bbox.getHeight() > 0) ? bbox.getHeight() - 1 : 0;
+
+        return val + std::max(0.0, dValDx*dx) + std::max(0.0, dValDy*dy);
+    }
+
+    /// Clamp v to [lo, hi]
+    double clamp(double v, double lo, double hi) {
+        return (v < lo) ? lo : (v > hi) ? hi : v;
+    }
+}
+
+/************************************************************************************************************/
+/**
+ * Create a GaussianPsf;  images of it extend to 4 sigma
+ */
+GaussianPsf::GaussianPsf(BBox const& bbox, ///< Region where the model is valid
+                         double sigma,     ///< Gaussian sigma (pixels) at bbox's corner
+                         double dSigmaDx,  ///< Rate of change of sigma with column
+                         double dSigmaDy   ///< Rate of change of sigma with row
+                        ) :
+    Psf(bbox, static_cast<int>(std::ceil(4*maxOnBBox(bbox, sigma, dSigmaDx, dSigmaDy)))),
+    _sigma(sigma), _dSigmaDx(dSigmaDx), _dSigmaDy(dSigmaDy)
+{
+    BBox const& bb = getBBox();
+    double const minSigma = -maxOnBBox(bb, -sigma, -dSigmaDx, -dSigmaDy);
+    if (!(minSigma > 0)) {
+        std::ostringstream msg;
+        msg << "GaussianPsf's sigma must be positive everywhere (minimum: " << minSigma << ")";
+        throw std::runtime_error(msg.str());
+    }
+}
+
+/// Return the PSF's sigma at (x, y)
+double GaussianPsf::getSigma(double x, double y) const {
+    BBox const& bbox = getBBox();
+    x = clamp(x, bbox.getX0(), bbox.getX1() - 1);
+    y = clamp(y, bbox.getY0(), bbox.getY1() - 1);
+
+    return _sigma + _dSigmaDx*(x - bbox.getX0()) + _dSigmaDy*(y - bbox.getY0());
+}
+
+double GaussianPsf::evaluate(double x, double y, double dx, double dy) const {
+    double const sigma = getSigma(x, y);
+
+    return std::exp(-0.5*(dx*dx + dy*dy)/(sigma*sigma));
+}
+
+/************************************************************************************************************/
+/**
+ * Create a PsfCache, evaluating psf on a grid of nodes
+ */
+PsfCache::PsfCache(Psf::ConstPtr psf,   ///< The Psf to cache
+                   int gridSpacing,     ///< Spacing of the nodes where psf is evaluated (pixels)
+                   int binSize          ///< Size of the position bins for which kernels are cached (pixels)
+                  ) :
+    _psf(psf), _gridSpacing(gridSpacing), _binSize(binSize),
+    _nGridX(0), _nGridY(0), _nBinX(0), _nBinY(0), _nSample(0), _nodes(), _kernels(), _hits(0), _misses(0)
+{
+    BBox const& bbox = psf->getBBox();
+    if (bbox.empty() || gridSpacing <= 0 || binSize <= 0) {
+        std::ostringstream msg;
+        msg << "Invalid PsfCache: bbox " << bbox.getWidth() << "x" << bbox.getHeight() <<
+            ", gridSpacing " << gridSpacing << ", binSize " << binSize;
+        throw std::runtime_error(msg.str());
+    }
+
+    _nGridX = (bbox.getWidth() - 1)/gridSpacing + 2;
+    _nGridY = (bbox.getHeight() - 1)/gridSpacing + 2;
+    _nBinX = (bbox.getWidth() + binSize - 1)/binSize;
+    _nBinY = (bbox.getHeight() + binSize - 1)/binSize;
+
+    int const halfSample = (psf->getHalfWidth() + 1)*OVERSAMPLE; // the table covers |offset| <= halfWidth + 1
+    _nSample = 2*halfSample + 1;
+
+    _nodes.resize(_nGridX*_nGridY);
+    for (int gy = 0; gy != _nGridY; ++gy) {
+        double const y = clamp(bbox.getY0() + gy*gridSpacing, bbox.getY0(), bbox.getY1() - 1);
+        for (int gx = 0; gx != _nGridX; ++gx) {
+            double const x = clamp(bbox.getX0() + gx*gridSpacing, bbox.getX0(), bbox.getX1() - 1);
+
+            std::vector<float> &node = _nodes[gy*_nGridX + gx];
+            node.resize(_nSample*_nSample);
+            for (int j = 0; j != _nSample; ++j) {
+                for (int i = 0; i != _nSample; ++i) {
+                    node[j*_nSample + i] = psf->evaluate(x, y, double(i - halfSample)/OVERSAMPLE,
+                                                         double(j - halfSample)/OVERSAMPLE);
+                }
+            }
+        }
+    }
+
+    std::size_t const nKernel = static_cast<std::size_t>(_nBinX)*_nBinY*NSUB*NSUB;
+    _kernels.reset(new boost::atomic<PsfKernel const*>[nKernel]);
+    for (std::size_t i = 0; i != nKernel; ++i) {
+        _kernels[i].store(0, boost::memory_order_relaxed);
+    }
+}
+
+PsfCache::~PsfCache() {
+    std::size_t const nKernel = static_cast<std::size_t>(_nBinX)*_nBinY*NSUB*NSUB;
+    for (std::size_t i = 0; i != nKernel; ++i) {
+        delete _kernels[i].load(boost::memory_order_relaxed);
+    }
+}
+
+/**
+ * Return the kernel for a star at (x, y), centred on the pixel containing (x, y)
+ */
+PsfKernel const& PsfCache::getKernel(double x, double y) const {
+    int const ix = static_cast<int>(std::floor(x + 0.5));
+    int const iy = static_cast<int>(std::floor(y + 0.5));
+    int const bx = std::min(static_cast<int>((x - ix + 0.5)*NSUB), NSUB - 1);
+    int const by = std::min(static_cast<int>((y - iy + 0.5)*NSUB), NSUB - 1);
+
+    BBox const& bbox = _psf->getBBox();
+    int const binX = static_cast<int>(clamp(std::floor(double(ix - bbox.getX0())/_binSize), 0, _nBinX - 1));
+    int const binY = static_cast<int>(clamp(std::floor(double(iy - bbox.getY0())/_binSize), 0, _nBinY - 1));
+
+    boost::atomic<PsfKernel const*> &slot = _kernels[((binY*_nBinX + binX)*NSUB + by)*NSUB + bx];
+    PsfKernel const* kernel = slot.load(boost::memory_order_acquire);
+    if (kernel) {
+        _hits.fetch_add(1, boost::memory_order_relaxed);
+        return *kernel;
+    }
+    //
+    // Make the kernel and publish it, unless another thread beat us to it
+    //
+    _misses.fetch_add(1, boost::memory_order_relaxed);
+    PsfKernel const* made = _makeKernel(binX, binY, bx, by);
+    if (!slot.compare_exchange_strong(kernel, made, boost::memory_order_acq_rel, boost::memory_order_acquire)) {
+        delete made;                    // kernel is now the other thread's
+        return *kernel;
+    }
+
+    return *made;
+}
+
+/// Return node's tabulated PSF at offset (dx, dy), interpolating between samples
+double PsfCache::_evaluateNode(int node, double dx, double dy) const {
+    int const halfSample = (_nSample - 1)/2;
+    double const fx = dx*OVERSAMPLE + halfSample;
+    double const fy = dy*OVERSAMPLE + halfSample;
+    int const i = static_cast<int>(clamp(std::floor(fx), 0, _nSample - 2));
+    int const j = static_cast<int>(clamp(std::floor(fy), 0, _nSample - 2));
+    double const tx = fx - i, ty = fy - j;
+
+    float const* row = &_nodes[node][j*_nSample + i];
+    return (1 - ty)*((1 - tx)*row[0] + tx*row[1]) + ty*((1 - tx)*row[_nSample] + tx*row[_nSample + 1]);
+}
+
+/// Make the kernel for position bin (binX, binY) and sub-pixel offset (bx, by)
+PsfKernel *PsfCache::_makeKernel(int binX, int binY, int bx, int by) const {
+    BBox const& bbox = _psf->getBBox();
+    // Where are we in the grid of nodes?
+    double const gx = (clamp(bbox.getX0() + (binX + 0.5)*_binSize, bbox.getX0(), bbox.getX1() - 1) -
+                       bbox.getX0())/_gridSpacing;
+    double const gy = (clamp(bbox.getY0() + (binY + 0.5)*_binSize, bbox.getY0(), bbox.getY1() - 1) -
+                       bbox.getY0())/_gridSpacing;
+    int const gx0 = std::min(static_cast<int>(gx), _nGridX - 2);
+    int const gy0 = std::min(static_cast<int>(gy), _nGridY - 2);
+    double const tx = gx - gx0, ty = gy - gy0;
+
+    int const nodes[4] = { gy0*_nGridX + gx0,       gy0*_nGridX + gx0 + 1,
+                           (gy0 + 1)*_nGridX + gx0, (gy0 + 1)*_nGridX + gx0 + 1 };
+    double const weights[4] = { (1 - tx)*(1 - ty), tx*(1 - ty), (1 - tx)*ty, tx*ty };
+    // The star's offset from the centre of pixel (0, 0)
+    double const dx = (bx + 0.5)/NSUB - 0.5;
+    double const dy = (by + 0.5)/NSUB - 0.5;
+
+    int const hw = _psf->getHalfWidth();
+    PsfKernel *kernel = new PsfKernel(hw);
+    double sum = 0;
+    for (int j = -hw, k = 0; j <= hw; ++j) {
+        for (int i = -hw; i <= hw; ++i, ++k) {
+            double val = 0;
+            for (int n = 0; n != 4; ++n) {
+                if (weights[n] != 0) {
+                    val += weights[n]*_evaluateNode(nodes[n], i - dx, j - dy);
+                }
+            }
+            kernel->_values[k] = val;
+            sum += val;
+        }
+    }
+
+    double sumSq = 0;
+    for (std::size_t k = 0; k != kernel->_values.size(); ++k) {
+        kernel->_values[k] /= sum;
+        sumSq += kernel->_values[k]*kernel->_values[k];
+    }
+    kernel->_sumSq = sumSq;
+
+    return kernel;
+}
@@ -0,0 +1,135 @@
+// -*- lsst-c++ -*-
+#if !defined(PSF_H)
+#define PSF_H 1
+
+#include <vector>
+
+#include "boost/atomic.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_array.hpp"
+#include "boost/shared_ptr.hpp"
+
+#include "Image.h"
+
+/**
+ * A model of the point spread function, which may vary across the image
+ *
+ * Positions are in the coordinates of the parent image (the same as Peak's);  the model is only defined
+ * within getBBox(), and positions outside it are treated as the nearest point inside
+ */
+class Psf : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<Psf> Ptr;
+    typedef boost::shared_ptr<Psf const> ConstPtr;
+
+    Psf(BBox const& bbox, int halfWidth) : _bbox(bbox), _halfWidth(halfWidth) {}
+    virtual ~Psf() {}
+
+    /// Return the region where the model is valid
+    BBox const& getBBox() const { return _bbox; }
+    /// Return the half-width of images of the PSF;  they're (2*halfWidth + 1) pixels on a side
+    int getHalfWidth() const { return _halfWidth; }
+
+    /// Return the (unnormalised) PSF at offset (dx, dy) from the centre of a star at (x, y)
+    virtual double evaluate(double x, double y, double dx, double dy) const = 0;
+private:
+    BBox _bbox;
+    int _halfWidth;
+};
+
+/**
+ * A circular Gaussian PSF whose width varies linearly across the image:
+ *    sigma(x, y) = sigma + dSigmaDx*(x - x0) + dSigmaDy*(y - y0)
+ * where (x0, y0) is the corner of the bbox
+ */
+class GaussianPsf : public Psf {
+public:
+    typedef boost::shared_ptr<GaussianPsf> Ptr;
+    typedef boost::shared_ptr<GaussianPsf const> ConstPtr;
+
+    GaussianPsf(BBox const& bbox, double sigma, double dSigmaDx=0, double dSigmaDy=0);
+
+    double getSigma(double x, double y) const;
+
+    virtual double evaluate(double x, double y, double dx, double dy) const;
+private:
+    double _sigma;
+    double _dSigmaDx, _dSigmaDy;
+};
+
+/************************************************************************************************************/
+/**
+ * An image of the PSF, normalised to unit sum, (2*halfWidth + 1) pixels on a side and centred on pixel
+ * (0, 0) (plus some sub-pixel offset)
+ */
+class PsfKernel : boost::noncopyable {
+public:
+    explicit PsfKernel(int halfWidth) :
+        _halfWidth(halfWidth), _values((2*halfWidth + 1)*(2*halfWidth + 1)), _sumSq(0) {}
+
+    /// Return the half-width of the kernel
+    int getHalfWidth() const { return _halfWidth; }
+    /// Return a pointer to row j of the kernel, j in [-halfWidth, halfWidth];  [0] is column -halfWidth
+    float const* getRow(int j) const { return &_values[(j + _halfWidth)*(2*_halfWidth + 1)]; }
+    /// Return the sum of the squares of the kernel's values
+    double getSumSq() const { return _sumSq; }
+private:
+    friend class PsfCache;
+
+    int _halfWidth;
+    std::vector<float> _values;
+    double _sumSq;
+};
+
+/**
+ * Cache images of a Psf, so that we needn't evaluate the model for every source
+ *
+ * The model is evaluated once, when the cache is created, on a coarse grid of nodes gridSpacing pixels
+ * apart;  at each node we tabulate the PSF OVERSAMPLE times more finely than the pixels.
+ *
+ * Kernels are requested for a position, which is assigned to a binSize x binSize position bin and one
+ * of NSUB x NSUB sub-pixel offsets.  The first request for a (bin, offset) interpolates the nodes to the
+ * centre of the bin and samples the result at the offset;  the kernel is then remembered and reused.
+ * getKernel() is thread safe and doesn't take a lock.
+ */
+class PsfCache : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<PsfCache> Ptr;
+    typedef boost::shared_ptr<PsfCache const> ConstPtr;
+
+    enum { NSUB = 4,                    // number of sub-pixel offsets along each axis
+           OVERSAMPLE = 4               // oversampling of the tabulated PSF at each node
+    };
+
+    explicit PsfCache(Psf::ConstPtr psf, int gridSpacing=256, int binSize=64);
+    ~PsfCache();
+
+    /// Return our Psf
+    Psf::ConstPtr getPsf() const { return _psf; }
+
+    PsfKernel const& getKernel(double x, double y) const;
+
+    /// Return the number of calls to getKernel that found the kernel already in the cache
+    long getHits() const { return _hits; }
+    /// Return the number of calls to getKernel that had to make a kernel
+    long getMisses() const { return _misses; }
+    /// Reset the hit and miss counters
+    void resetCounters() const { _hits = 0; _misses = 0; }
+private:
+    Psf::ConstPtr _psf;
+    int _gridSpacing;
+    int _binSize;
+    int _nGridX, _nGridY;               // number of nodes in each direction
+    int _nBinX, _nBinY;                 // number of position bins in each direction
+    int _nSample;                       // number of samples on a side of each node's table
+    std::vector<std::vector<float> > _nodes; // the tabulated PSF at each node
+
+    mutable boost::scoped_array<boost::atomic<PsfKernel const*> > _kernels; // indexed by bin and offset
+    mutable boost::atomic<long> _hits;
+    mutable boost::atomic<long> _misses;
+
+    double _evaluateNode(int node, double dx, double dy) const;
+    PsfKernel *_makeKernel(int binX, int binY, int bx, int by) const;
+};
+
+#endif
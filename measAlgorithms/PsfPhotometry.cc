@@ -1,51 +1,54 @@
 // -*- lsst-c++ -*-
-#include "Photometry.h"
+#include "Astrometry.h"
+#include "PsfPhotometry.h"
 
-/**
- * Implement PSF photometry.  The astronomical details are left to the reader
- */
-class PsfPhotometry : public Photometry
-{
-public:
-    typedef boost::shared_ptr<PsfPhotometry> Ptr;
-    typedef boost::shared_ptr<PsfPhotometry const> ConstPtr;
-
-    /// Ctor
-    PsfPhotometry(double flux, float fluxErr=-1) {
-        init();                         // This allocates space for fields added by defineSchema
-        set<FLUX>(flux);                // ... if you don't, these set calls will fail an assertion
-        set<FLUX_ERR>(fluxErr);         // the type of the value must match the schema
-    }
+/************************************************************************************************************/
 
-    /// Add desired fields to the schema
-    virtual void defineSchema(Schema::Ptr schema ///< our schema; == _mySchema
-                     ) {
-        Photometry::defineSchema(schema);
-    }
+namespace {
+    /// The cache of the Psf in use;  until setPsf is called, a 2-pixel Gaussian
+    PsfCache::Ptr &psfCache() {
+        static PsfCache::Ptr cache(new PsfCache(Psf::Ptr(new GaussianPsf(BBox(0, 0, 4096, 4096), 2.0))));
 
-    template<typename ImageT>
-    static Photometry::Ptr doMeasure(typename ImageT::ConstPtr im, Peak const&);
-};
+        return cache;
+    }
+}
 
 /**
- * Process the image; calculate values
+ * Set the Psf to use, and evaluate it on its grid of nodes
+ *
+ * Not thread safe;  don't call it while any thread is measuring
  */
-template<typename ImageT>
-Photometry::Ptr PsfPhotometry::doMeasure(typename ImageT::ConstPtr im, Peak const&) {
-    // Here is the real work, hiding in a comment
-    return boost::make_shared<PsfPhotometry>(3*(*im));
+void PsfPhotometry::setPsf(Psf::ConstPtr psf, ///< The PSF
+                           int gridSpacing,   ///< Spacing of the nodes where psf is evaluated (pixels)
+                           int binSize        ///< Size of the position bins for which kernels are cached
+                          ) {
+    psfCache() = PsfCache::Ptr(new PsfCache(psf, gridSpacing, binSize));
+}
+
+/// Return the cache of the Psf in use (e.g. to check its hit rate)
+PsfCache const& PsfPhotometry::getPsfCache() {
+    return *psfCache();
+}
+
+/// Return the half-width of the cutout needed to hold the Psf's kernels, wherever the centroid is
+int PsfPhotometry::getHalfWidth() {
+    return getPsfCache().getPsf()->getHalfWidth() + Astrometry::MAX_CENTROID_SHIFT;
 }
 
 /************************************************************************************************************/
 /**
  * Declare the existence of an "psf" algorithm
  */
-#define INSTANTIATE(TYPE) \
-    MeasurePhotometry<Image<TYPE> >::declare("psf", &PsfPhotometry::doMeasure<Image<TYPE> >)
+#define INSTANTIATE(IMAGE_T) \
+    MeasurePhotometry<IMAGE_T >::declare(PsfPhotometry::getName(), \
+                                         &PsfPhotometry::doMeasure<IMAGE_T >, \
+                                         &PsfPhotometry::getHalfWidth, "centroid")
 
 namespace {
     volatile bool isInstance[] = {
-        INSTANTIATE(float),
-        INSTANTIATE(double)
+        INSTANTIATE(Image<float>),
+        INSTANTIATE(Image<double>),
+        INSTANTIATE(MaskedImage<float>),
+        INSTANTIATE(MaskedImage<double>)
     };
 }
@@ -0,0 +1,160 @@
+// -*- lsst-c++ -*-
+#if !defined(PSF_PHOTOMETRY_H)
+#define PSF_PHOTOMETRY_H 1
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Astrometry.h"
+#include "Photometry.h"
+#include "Psf.h"
+#include "Simd.h"
+
+/**
+ * Implement PSF photometry:  the flux is the PSF-weighted sum of the pixels, divided by the sum of the
+ * squares of the (unit-normalised) PSF
+ *
+ * The PSF is set by setPsf();  it's sampled through a PsfCache, so it's only evaluated from scratch on a
+ * coarse grid, once per Psf.  doMeasure is defined here, so that StaticMeasurePhotometry can inline it
+ */
+class PsfPhotometry : public Photometry
+{
+    /// A new, unused, index to save our flags in.  [0, Photometry::NVALUE) are taken
+    enum { FLAGS=Photometry::NVALUE, NVALUE };
+public:
+    typedef boost::shared_ptr<PsfPhotometry> Ptr;
+    typedef boost::shared_ptr<PsfPhotometry const> ConstPtr;
+
+    /// The bits that may be set in our flags
+    enum {
+        BAD_PIXELS = 0x1                // some pixels were masked (\sa maskedImage::UNUSABLE) so not used
+    };
+
+    /// Ctor;  the values are undefined until setValues() is called
+    PsfPhotometry() {
+        init(this);                     // This allocates space for fields added by defineSchema
+    }
+    /// Ctor
+    PsfPhotometry(double flux, float fluxErr=-1, int flags=0) {
+        init(this);
+        setValues(flux, fluxErr, flags);
+    }
+    /// Set our values, e.g. when reusing a PsfPhotometry (\sa AlgorithmInputs::makeResult)
+    void setValues(double flux, float fluxErr=-1, int flags=0) {
+        set<FLUX>(flux);                // if init() wasn't called, these set calls will fail an assertion
+        set<FLUX_ERR>(fluxErr);         // the type of the value must match the schema
+        set<FLAGS>(flags);
+    }
+
+    /// Return our flags;  a bitwise OR of BAD_PIXELS etc.
+    int getFlags() const {
+        return Measurement<Photometry>::get<FLAGS, int>();
+    }
+
+    /// Add desired fields to the schema
+    virtual void defineSchema(Schema::Ptr schema ///< our schema; == _mySchema
+                     ) {
+        Photometry::defineSchema(schema);
+        schema->add(SchemaEntry("flags", FLAGS, Schema::INT));
+    }
+
+    /// Return the name that we're registered under
+    static char const* getName() { return "psf"; }
+    template<typename ImageT>
+    static void doMeasure(Cutout<ImageT> const& cutout, Peak const& peak, AlgorithmInputs const& inputs,
+                          PsfPhotometry *val);
+    /// Measure peak, returning a new result or reusing our previous one (\sa AlgorithmInputs::makeResult)
+    template<typename ImageT>
+    static Photometry::Ptr doMeasure(Cutout<ImageT> const& cutout, Peak const& peak,
+                                     AlgorithmInputs const& inputs) {
+        PsfPhotometry::Ptr val = inputs.makeResult<PsfPhotometry>();
+        doMeasure(cutout, peak, inputs, val.get());
+        return val;
+    }
+    static int getHalfWidth();
+
+    static void setPsf(Psf::ConstPtr psf, int gridSpacing=256, int binSize=64);
+    static PsfCache const& getPsfCache();
+};
+
+/************************************************************************************************************/
+/**
+ * Process the image; calculate values
+ *
+ * The PSF is centred on the centroid (our input), if there is one, and the sky (\sa Cutout::getBackground)
+ * is subtracted.  Pixels that fall off the image, or that are masked as unusable (in which case we set
+ * BAD_PIXELS), are omitted from both the weighted sum and its normalisation.
+ * The error comes from the image's variance plane, summed in the same pass as the flux;  if there's no
+ * variance plane it's set to -1.  The answer is written to val
+ */
+template<typename ImageT>
+void PsfPhotometry::doMeasure(Cutout<ImageT> const& cutout, Peak const& peak, AlgorithmInputs const& inputs,
+                              PsfPhotometry *val) {
+    typedef typename ImageT::Pixel PixelT;
+    Image<PixelT> const& im = cutout.getImage();
+    Image<PixelT> const* variance = cutout.getVariance();
+    double xc = 0, yc = 0;
+    Astrometry::getPosition(inputs.get<Astrometry>(0), peak, &xc, &yc);
+
+    PsfKernel const& kernel = getPsfCache().getKernel(xc, yc);
+    int const hw = kernel.getHalfWidth();
+    int const ix = static_cast<int>(std::floor(xc + 0.5)) - im.getX0();
+    int const iy = static_cast<int>(std::floor(yc + 0.5)) - im.getY0();
+
+    int const j0 = std::max(-hw, -iy);
+    int const j1 = std::min(hw, im.getHeight() - 1 - iy);
+    int const i0 = std::max(-hw, -ix);
+    int const i1 = std::min(hw, im.getWidth() - 1 - ix);
+    bool const masked = cutout.hasUnusablePixels(iy + j0, iy + j1);
+    bool const clipped = (j0 != -hw || j1 != hw || i0 != -hw || i1 != hw || masked);
+
+    double const background = cutout.getBackground();
+
+    double sum = 0, sumVar = 0, sumSq = 0, sumK = 0, unused = 0;
+    int nUnusable = 0;                  // the number of masked pixels that we ignored
+    for (int j = j0; j <= j1 && i1 >= i0; ++j) {
+        float const* krow = kernel.getRow(j) + hw + i0;
+        if (masked && cutout.hasUnusablePixels(iy + j, iy + j)) { // sum the usable pixels one by one
+            PixelT const* pix = im.getRow(iy + j) + ix + i0;
+            PixelT const* var = variance ? variance->getRow(iy + j) + ix + i0 : 0;
+            MaskPixel const* mask = cutout.getMask()->getRow(iy + j) + ix + i0;
+            for (int i = 0; i <= i1 - i0; ++i) {
+                if (mask[i] & maskedImage::UNUSABLE) {
+                    nUnusable += (krow[i] != 0);
+                    continue;
+                }
+                sum += krow[i]*pix[i];
+                if (var) {
+                    sumVar += krow[i]*krow[i]*var[i];
+                }
+                sumSq += krow[i]*krow[i];
+                sumK += krow[i];
+            }
+            continue;
+        }
+
+        simd::weightedSum(krow, im.getRow(iy + j) + ix + i0,
+                          variance ? variance->getRow(iy + j) + ix + i0 : 0, i1 - i0 + 1, &sum, &sumVar);
+        if (clipped) {
+            simd::weightedSum(krow, krow, 0, i1 - i0 + 1, &sumSq, &unused);
+            if (background != 0) {
+                for (int i = 0; i <= i1 - i0; ++i) {
+                    sumK += krow[i];
+                }
+            }
+        }
+    }
+    if (!clipped) {
+        sumSq = kernel.getSumSq();
+        sumK = 1;                       // the kernel has unit sum
+    }
+    sum -= background*sumK;             // the sky's contribution to sum
+
+    int const flags = (nUnusable > 0) ? BAD_PIXELS : 0;
+    if (sumSq > 0) {
+        val->setValues(sum/sumSq, variance ? std::sqrt(sumVar)/sumSq : -1.0, flags);
+    } else {
+        val->setValues(std::numeric_limits<double>::quiet_NaN(), -1, flags);
+    }
+}
+
+#endif
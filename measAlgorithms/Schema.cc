@@ -22,6 +22,44 @@ Schema const& Schema::find(
     return Schema::unknown();
 }
 
+/**
+ * Return the leaf Schema given its name and component, and the information needed to build a Key for it.
+ *
+ * The slots of a composite's members are numbered consecutively, in order, so e.g. [psf: [flux, fluxErr],
+ * aper: [flux[3], ...]] has psf.fluxErr in slot 1 and aper.flux[0] in slot 2
+ */
+Schema const& Schema::findSlot(
+        std::string const& name,        ///< The name of the desired Schema
+        std::string const& component,   ///< The component name, if not blank
+        int *element,                   ///< Set to the index of the member that contains the value, or -1
+        int *slot                       ///< Set to the value's slot
+                              ) const {
+    *element = *slot = -1;
+    int base = 0;                       // the first slot of the current member
+    for (std::vector<Schema::Ptr>::const_iterator ptr = begin(); ptr != end(); ++ptr) {
+        Schema const& val = **ptr;
+
+        if (val.getType() != UNKNOWN) {          // a leaf
+            if ((component == "" || component == _component) && val.getName() == name) {
+                *slot = val.getIndex();
+                return val;
+            }
+        } else {                                  // one of the members of a composite Measurement
+            if (val._component == component) {
+                Schema const& se = val.find(name);
+                if (se) {
+                    *element = ptr - begin();
+                    *slot = base + se.getIndex();
+                    return se;
+                }
+            }
+            base += val.size();
+        }
+    }
+        
+    return Schema::unknown();
+}
+
 /// Print v to os, using dynamic dispatch
 std::ostream &operator<<(std::ostream &os, Schema const& v)
 {
@@ -3,13 +3,13 @@
 #define SCHEMA_H 1
 #include <iostream>                     // XXXX
 
+#include <cassert>
 #include <numeric>
 #include <sstream>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
-#include "boost/any.hpp"
 #include "boost/shared_ptr.hpp"
 /**
  * Describe the schema of what we're measuring
@@ -52,10 +52,31 @@ public:
         msg << "Unknown Schema::Type " << int(t);
         throw std::runtime_error(msg.str());
     }
+    /// Return the number of bytes needed to store one element of Type t
+    static int sizeOf(Type t) {
+        switch (t) {
+          case UNKNOWN: return 0;
+          case CHAR:    return sizeof(char);
+          case SHORT:   return sizeof(short);
+          case INT:     return sizeof(int);
+          case LONG:    return sizeof(long);
+          case FLOAT:   return sizeof(float);
+          case DOUBLE:  return sizeof(double);
+        }
+
+        std::ostringstream msg;
+        msg << "Unknown Schema::Type " << int(t);
+        throw std::runtime_error(msg.str());
+    }
+    /// Map a C++ type onto a Schema::Type, e.g. TypeOf<float>::value == FLOAT
+    template<typename U> struct TypeOf { enum { value = UNKNOWN }; };
+    template<typename U> class Key;
 
     Schema(std::string const& name="", int index=0,
            Schema::Type const& type=UNKNOWN, int dimen=1, std::string const& units="") :
-        _name(name), _index(index), _type(type), _dimen(dimen), _units(units), _component(), _entries() {}
+        _name(name), _index(index), _type(type), _dimen(dimen), _units(units),
+        _offset(0), _nbyte(dimen*sizeOf(type)), _alignment(type == UNKNOWN ? 1 : sizeOf(type)),
+        _component(), _entries(), _slotOffsets(), _slotTypes() {}
     virtual ~Schema() {}
     /// Clone a Schema
     Ptr clone() const { return Ptr(_clone()); }
@@ -84,9 +105,10 @@ public:
     void add(Schema const& val) {
         add(val.clone());
     }
-    /// Add a Schema::Ptr to the list of components
+    /// Add a Schema::Ptr to the list of components, assigning it storage after the entries already present
     void add(Ptr val) {
         _entries.push_back(val);
+        _layout(*val);
     }
 
     inline virtual int size() const;
@@ -102,6 +124,22 @@ public:
     int getDimen() const { return _dimen; }
     /// Return the units if a leaf node
     std::string const& getUnits() const { return _units; }
+    /// Return the byte offset of our data within our parent's storage (\sa add)
+    int getOffset() const { return _offset; }
+    /// Return the number of bytes needed to store our data
+    int getNByte() const { return _nbyte; }
+    /// Return the alignment (in bytes) that our data requires
+    int getAlignment() const { return _alignment; }
+    /// Return the byte offset of slot i (i.e. a SchemaEntry's index + its array index) in our storage
+    int getOffset(unsigned int i) const {
+        assert(i < _slotOffsets.size());
+        return _slotOffsets[i];
+    }
+    /// Return the Type stored in slot i
+    Type getType(unsigned int i) const {
+        assert(i < _slotTypes.size());
+        return _slotTypes[i];
+    }
     /// Are there any components?
     virtual operator bool() const {
         return !_entries.empty();
@@ -111,6 +149,11 @@ public:
 
     virtual Schema const& find(std::string const& name, std::string const& component="") const;
 
+    template<typename U>
+    Key<U> getKey(std::string const& name, std::string const& component="") const;
+    Schema const& findSlot(std::string const& name, std::string const& component,
+                           int *element, int *slot) const;
+
     virtual std::ostream &output(std::ostream &os) const;
 private:
     // used if this is a leaf node
@@ -119,13 +162,120 @@ private:
     Schema::Type const _type;
     int const _dimen;
     std::string const _units;
+    // where our data lives within our parent's storage;  set by the parent's add()
+    int _offset;
+    // used if this is a composite; the storage layout of _entries
+    int _nbyte;
+    int _alignment;
     // used if this is a composite
     std::string _component;
     std::vector<Schema::Ptr> _entries;
+    std::vector<int> _slotOffsets;      // byte offset of each slot (indexed by SchemaEntry::getIndex())
+    std::vector<Type> _slotTypes;       // the Type of each slot
+
+    inline void _layout(Schema &val);
 
     virtual Schema *_clone() const { return new Schema(*this); }
 };
 
+template<> struct Schema::TypeOf<char>   { enum { value = Schema::CHAR }; };
+template<> struct Schema::TypeOf<short>  { enum { value = Schema::SHORT }; };
+template<> struct Schema::TypeOf<int>    { enum { value = Schema::INT }; };
+template<> struct Schema::TypeOf<long>   { enum { value = Schema::LONG }; };
+template<> struct Schema::TypeOf<float>  { enum { value = Schema::FLOAT }; };
+template<> struct Schema::TypeOf<double> { enum { value = Schema::DOUBLE }; };
+
+/**
+ * A typed handle to a value described by a Schema (\sa Schema::getKey)
+ *
+ * A Key remembers where the value lives (which element of a composite Measurement, and the byte offset
+ * within it), so looking it up once and reusing it avoids the string comparisons in Schema::find and the
+ * switch on Type in Measurement::get(name)
+ */
+template<typename U>
+class Schema::Key {
+public:
+    /// An invalid Key
+    Key() : _element(-1), _offset(-1), _slot(-1), _dimen(0) {}
+
+    /// Is this Key usable?
+    bool isValid() const { return _offset >= 0; }
+    /// Return the index of the Measurement within its composite, or -1 if the Key refers to a single Measurement
+    int getElement() const { return _element; }
+    /// Return the byte offset of the value within its Measurement's storage
+    int getOffset() const { return _offset; }
+    /// Return the slot of the value, counting all the slots of all the members of a composite in order
+    int getSlot() const { return _slot; }
+    /// Return the number of elements, if an array
+    int getDimen() const { return _dimen; }
+    /// Return a Key for the i'th element of an array
+    Key operator[](int i) const {
+        assert(i >= 0 && i < _dimen);
+        return Key(_element, _offset + i*sizeof(U), _slot + i, 1);
+    }
+private:
+    friend class Schema;
+
+    Key(int element, int offset, int slot, int dimen) :
+        _element(element), _offset(offset), _slot(slot), _dimen(dimen) {}
+
+    int _element;
+    int _offset;
+    int _slot;
+    int _dimen;
+};
+
+/**
+ * Return a Key that can be used to retrieve the value with the given name and component from a
+ * Measurement described by this Schema.  Throws if there is no such value, or if it isn't of type U
+ */
+template<typename U>
+Schema::Key<U> Schema::getKey(
+        std::string const& name,        ///< The name of the desired value
+        std::string const& component    ///< The component name, if not blank
+                             ) const {
+    int element = -1, slot = -1;
+    Schema const& se = findSlot(name, component, &element, &slot);
+    if (!se) {
+        throw std::runtime_error("Unable to find " + (component == "" ? name : component + "." + name));
+    }
+    if (se.getType() != static_cast<Type>(TypeOf<U>::value)) {
+        std::ostringstream msg;
+        msg << "Requested a Key of type " << static_cast<Type>(TypeOf<U>::value) <<
+            " for " << se.getName() << " which is of type " << se.getType();
+        throw std::runtime_error(msg.str());
+    }
+
+    return Key<U>(element, se.getOffset(), slot, se.getDimen());
+}
+
+/**
+ * Allocate space for val after all the entries that we already know about, respecting its alignment.
+ *
+ * Leaf entries (\sa SchemaEntry) also get their slots (index .. index + dimen - 1) recorded so that
+ * Measurement can map its compile-time indices onto byte offsets
+ */
+void Schema::_layout(Schema &val) {
+    int const align = val.getAlignment();
+    val._offset = ((_nbyte + align - 1)/align)*align;
+    _nbyte = val._offset + val.getNByte();
+    if (align > _alignment) {
+        _alignment = align;
+    }
+
+    if (val.getType() != UNKNOWN) {
+        unsigned int const end = val.getIndex() + val.getDimen();
+        if (end > _slotOffsets.size()) {
+            _slotOffsets.resize(end, -1);
+            _slotTypes.resize(end, UNKNOWN);
+        }
+        for (int i = 0; i != val.getDimen(); ++i) {
+            _slotOffsets[val.getIndex() + i] = val._offset + i*sizeOf(val.getType());
+            _slotTypes[val.getIndex() + i] = val.getType();
+        }
+    }
+}
+
 namespace {
     int findSize(int n, Schema::ConstPtr s) {
         return n + s->size();
@@ -148,6 +298,9 @@ int Schema::size() const {
  *   2/ The type
  *   3/ The index into a data structure that actually holds the data.
  * If we wanted to make this more flexible we'd have to reconsider the design, but this is good enough for now
+ *
+ * When the entry is added to a Schema it is also given a byte offset (its array elements are contiguous
+ * from there), so that the values can live in a single typed buffer rather than a vector of boost::any
  */
 class SchemaEntry : public Schema {
 public:
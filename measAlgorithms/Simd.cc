@@ -0,0 +1,767 @@
+// -*- lsst-c++ -*-
+/**
+ * Runtime-selected SIMD kernels
+ *
+ * The AVX2 and AVX-512 versions are compiled with gcc's target attribute, so the rest of the code doesn't
+ * need to be built with -mavx2;  they're only called if the CPU says that it supports them.  On other
+ * compilers and architectures only the scalar versions are available
+ */
+#include <algorithm>
+#include <cstring>
+#include "Simd.h"
+
+#if defined(__GNUC__) && !defined(__ICC) && (defined(__x86_64__) || defined(__i386__))
+#   define SIMD_X86 1
+#   include <immintrin.h>
+#   if defined(__GNUC__) && __GNUC__ >= 12 && !defined(__clang__)
+#      pragma GCC diagnostic ignored "-Wuninitialized"       // gcc's intrinsics trip these when inlined
+#      pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#   endif
+#endif
+
+namespace simd {
+
+namespace {
+    Level detectLevel() {
+#if defined(SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return AVX2;
+        }
+#endif
+        return SCALAR;
+    }
+
+    Level const bestLevel = detectLevel();
+    Level currentLevel = bestLevel;
+
+    /// Does the CPU have AVX-512's byte and word instructions (which AVX512 doesn't imply)?
+    bool detectAvx512bw() {
+#if defined(SIMD_X86)
+        return bestLevel == AVX512 && __builtin_cpu_supports("avx512bw");
+#else
+        return false;
+#endif
+    }
+
+    bool const hasAvx512bw = detectAvx512bw();
+
+    /************************************************************************************************************/
+    /*
+     * The scalar versions
+     */
+    template<typename T>
+    void weightedSumScalar(float const *w, T const *p, T const *v, int n, double *sum, double *sumVar) {
+        double s = 0;
+        for (int i = 0; i != n; ++i) {
+            s += static_cast<double>(w[i])*p[i];
+        }
+        *sum += s;
+
+        if (v) {
+            double sv = 0;
+            for (int i = 0; i != n; ++i) {
+                double const wi = w[i];
+                sv += wi*wi*v[i];
+            }
+            *sumVar += sv;
+        }
+    }
+
+    void interpolateScalar(float const *table, int n, float scale, float const *x, int npix,
+                           float *y, float *dydx) {
+        float const xmax = n - 1;
+        for (int i = 0; i != npix; ++i) {
+            float const fx = std::min(std::max(x[i]*scale, 0.0f), xmax);
+            int const ix = std::min(static_cast<int>(fx), n - 2);
+            float const t = fx - ix;
+            float const dy = table[ix + 1] - table[ix];
+
+            y[i] = table[ix] + t*dy;
+            if (dydx) {
+                dydx[i] = dy*scale;
+            }
+        }
+    }
+
+    template<int N>
+    void byteSwapScalar(char *dest, char const *src, std::size_t n) {
+        for (std::size_t i = 0; i != n; ++i, dest += N, src += N) {
+            char tmp[N];
+            for (int j = 0; j != N; ++j) {
+                tmp[j] = src[N - 1 - j];
+            }
+            std::memcpy(dest, tmp, N);
+        }
+    }
+
+    void byteSwapScalar(char *dest, char const *src, int size, std::size_t n) {
+        switch (size) {
+          case 2:  byteSwapScalar<2>(dest, src, n); return;
+          case 4:  byteSwapScalar<4>(dest, src, n); return;
+          case 8:  byteSwapScalar<8>(dest, src, n); return;
+          default: std::memmove(dest, src, n*size); return;
+        }
+    }
+
+    void correlateScalar(float const *in, float const *kernel, int nk, int n, float *out) {
+        for (int i = 0; i != n; ++i) {
+            float s = out[i];
+            for (int j = 0; j != nk; ++j) {
+                s += kernel[j]*in[i + j];
+            }
+            out[i] = s;
+        }
+    }
+
+    void weightedRowSumScalar(float const *const *rows, float const *w, int nrow, int n, float *out) {
+        for (int i = 0; i != n; ++i) {
+            out[i] = 0;
+        }
+        for (int j = 0; j != nrow; ++j) {
+            float const *row = rows[j];
+            float const wj = w[j];
+            for (int i = 0; i != n; ++i) {
+                out[i] += wj*row[i];
+            }
+        }
+    }
+
+    void butterflyScalar(float *a, float *b, int n, float wr, float wi) {
+        for (int i = 0; i != 2*n; i += 2) {
+            float const br = b[i]*wr - b[i + 1]*wi, bi = b[i]*wi + b[i + 1]*wr;
+            float const ar = a[i], ai = a[i + 1];
+            a[i] = ar + br; a[i + 1] = ai + bi;
+            b[i] = ar - br; b[i + 1] = ai - bi;
+        }
+    }
+
+    int clipScalar(float const *src, int n, float lo, float hi, float *dest) {
+        int m = 0;
+        for (int i = 0; i != n; ++i) {
+            if (src[i] >= lo && src[i] <= hi) {
+                dest[m++] = src[i];
+            }
+        }
+        return m;
+    }
+
+    void partitionScalar(float const *src, int n, float pivot, float *below, int *nBelow,
+                         float *above, int *nAbove) {
+        int nb = 0, na = 0;
+        for (int i = 0; i != n; ++i) {
+            if (src[i] < pivot) {
+                below[nb++] = src[i];
+            } else if (src[i] > pivot) {
+                above[na++] = src[i];
+            }
+        }
+        *nBelow = nb;
+        *nAbove = na;
+    }
+
+    /**
+     * For each 8-bit mask, the permutation that moves the selected elements of an 8-element vector to the
+     * front (in order);  AVX2 has no compress instruction, so it's done with a permute
+     */
+    struct CompressTable {
+        CompressTable() {
+            for (int mask = 0; mask != 256; ++mask) {
+                int n = 0;
+                for (int i = 0; i != 8; ++i) {
+                    if (mask & (1 << i)) {
+                        index[mask][n++] = i;
+                    }
+                }
+                for (; n != 8; ++n) {
+                    index[mask][n] = 0;
+                }
+            }
+        }
+
+        int index[256][8];
+    };
+
+    CompressTable const compressTable;
+
+    /// The byte shuffle that reverses each size-byte element of a 16-byte lane
+    char const* getSwapShuffle(int size) {
+        static char const shuffles[3][16] = {
+            { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+            { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+            { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 },
+        };
+        return shuffles[size == 2 ? 0 : size == 4 ? 1 : 2];
+    }
+
+#if defined(SIMD_X86)
+    /************************************************************************************************************/
+    /*
+     * AVX2
+     */
+    __attribute__((target("avx2,fma")))
+    double hsum(__m256d x) {
+        __m128d const d = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(d, _mm_unpackhi_pd(d, d)));
+    }
+
+    /*
+     * Masks for the last (partial) vector of a row;  (maskTable + 8 - n) selects the first n elements.
+     * Handling the tail with masked loads rather than a scalar loop keeps us out of non-VEX code, which
+     * would pay for the transition with dirty upper halves of the ymm registers
+     */
+    int const maskTable32[16] = { -1, -1, -1, -1, -1, -1, -1, -1,  0,  0,  0,  0,  0,  0,  0,  0 };
+    long long const maskTable64[8] = { -1, -1, -1, -1,  0,  0,  0,  0 };
+
+    /*
+     * The float pixels are widened and accumulated in double, as in weightedSumScalar, so the sums don't
+     * depend on the SIMD level beyond the order in which they're added
+     */
+    __attribute__((target("avx2,fma")))
+    void weightedSumAvx2(float const *w, float const *p, float const *v, int n, double *sum, double *sumVar) {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        __m256d sv0 = _mm256_setzero_pd(), sv1 = _mm256_setzero_pd();
+        for (int i = 0; i < n; i += 8) {
+            __m256i const m = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+                                                     maskTable32 + 8 - ((n - i < 8) ? n - i : 8)));
+            __m256 const wi = _mm256_maskload_ps(w + i, m);
+            __m256 const pi = _mm256_maskload_ps(p + i, m);
+            __m256d const w0 = _mm256_cvtps_pd(_mm256_castps256_ps128(wi));
+            __m256d const w1 = _mm256_cvtps_pd(_mm256_extractf128_ps(wi, 1));
+            s0 = _mm256_fmadd_pd(w0, _mm256_cvtps_pd(_mm256_castps256_ps128(pi)), s0);
+            s1 = _mm256_fmadd_pd(w1, _mm256_cvtps_pd(_mm256_extractf128_ps(pi, 1)), s1);
+            if (v) {
+                __m256 const vi = _mm256_maskload_ps(v + i, m);
+                sv0 = _mm256_fmadd_pd(_mm256_mul_pd(w0, w0), _mm256_cvtps_pd(_mm256_castps256_ps128(vi)), sv0);
+                sv1 = _mm256_fmadd_pd(_mm256_mul_pd(w1, w1), _mm256_cvtps_pd(_mm256_extractf128_ps(vi, 1)), sv1);
+            }
+        }
+        *sum += hsum(_mm256_add_pd(s0, s1));
+        if (v) {
+            *sumVar += hsum(_mm256_add_pd(sv0, sv1));
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void weightedSumAvx2(float const *w, double const *p, double const *v, int n, double *sum, double *sumVar) {
+        __m256d s = _mm256_setzero_pd();
+        __m256d sv = _mm256_setzero_pd();
+        for (int i = 0; i < n; i += 4) {
+            int const nleft = (n - i < 4) ? n - i : 4;
+            __m128i const m32 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(maskTable32 + 8 - nleft));
+            __m256i const m64 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(maskTable64 + 4 - nleft));
+            __m256d const wi = _mm256_cvtps_pd(_mm_maskload_ps(w + i, m32));
+            s = _mm256_fmadd_pd(wi, _mm256_maskload_pd(p + i, m64), s);
+            if (v) {
+                sv = _mm256_fmadd_pd(_mm256_mul_pd(wi, wi), _mm256_maskload_pd(v + i, m64), sv);
+            }
+        }
+        *sum += hsum(s);
+        if (v) {
+            *sumVar += hsum(sv);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void interpolateAvx2(float const *table, int n, float scale, float const *x, int npix, float *y, float *dydx) {
+        __m256 const vscale = _mm256_set1_ps(scale);
+        __m256 const vzero = _mm256_setzero_ps();
+        __m256 const vxmax = _mm256_set1_ps(n - 1);
+        __m256i const vimax = _mm256_set1_epi32(n - 2);
+        for (int i = 0; i < npix; i += 8) {
+            __m256i const m = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+                                                     maskTable32 + 8 - ((npix - i < 8) ? npix - i : 8)));
+            __m256 const fx = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_maskload_ps(x + i, m), vscale),
+                                                          vzero), vxmax);
+            __m256i const ix = _mm256_min_epi32(_mm256_cvttps_epi32(fx), vimax);
+            __m256 const t = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(ix));
+            __m256 const y0 = _mm256_i32gather_ps(table, ix, 4);
+            __m256 const dy = _mm256_sub_ps(_mm256_i32gather_ps(table + 1, ix, 4), y0);
+
+            _mm256_maskstore_ps(y + i, m, _mm256_fmadd_ps(t, dy, y0));
+            if (dydx) {
+                _mm256_maskstore_ps(dydx + i, m, _mm256_mul_ps(dy, vscale));
+            }
+        }
+    }
+
+    /*
+     * Byte swapping is limited by memory bandwidth, so the tail is simply left to the scalar code
+     */
+    __attribute__((target("avx2")))
+    void byteSwapAvx2(char *dest, char const *src, int size, std::size_t n) {
+        if (size != 2 && size != 4 && size != 8) {
+            byteSwapScalar(dest, src, size, n);
+            return;
+        }
+        __m128i const lane = _mm_loadu_si128(reinterpret_cast<__m128i const *>(getSwapShuffle(size)));
+        __m256i const shuffle = _mm256_broadcastsi128_si256(lane);
+
+        std::size_t const nbyte = n*size;
+        std::size_t i = 0;
+        for (; i + 32 <= nbyte; i += 32) {
+            __m256i const x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), _mm256_shuffle_epi8(x, shuffle));
+        }
+        byteSwapScalar(dest + i, src + i, size, (nbyte - i)/size);
+    }
+
+    /*
+     * The convolution kernels keep four vectors of outputs in registers, so that each kernel value is
+     * loaded once for 32 pixels and there are enough independent FMAs to hide their latency
+     */
+    __attribute__((target("avx2,fma")))
+    void correlateAvx2(float const *in, float const *kernel, int nk, int n, float *out) {
+        int i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256 s0 = _mm256_loadu_ps(out + i), s1 = _mm256_loadu_ps(out + i + 8);
+            __m256 s2 = _mm256_loadu_ps(out + i + 16), s3 = _mm256_loadu_ps(out + i + 24);
+            for (int j = 0; j != nk; ++j) {
+                __m256 const k = _mm256_broadcast_ss(kernel + j);
+                float const *p = in + i + j;
+                s0 = _mm256_fmadd_ps(k, _mm256_loadu_ps(p), s0);
+                s1 = _mm256_fmadd_ps(k, _mm256_loadu_ps(p + 8), s1);
+                s2 = _mm256_fmadd_ps(k, _mm256_loadu_ps(p + 16), s2);
+                s3 = _mm256_fmadd_ps(k, _mm256_loadu_ps(p + 24), s3);
+            }
+            _mm256_storeu_ps(out + i, s0);
+            _mm256_storeu_ps(out + i + 8, s1);
+            _mm256_storeu_ps(out + i + 16, s2);
+            _mm256_storeu_ps(out + i + 24, s3);
+        }
+        for (; i < n; i += 8) {
+            __m256i const m = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+                                                     maskTable32 + 8 - ((n - i < 8) ? n - i : 8)));
+            __m256 s = _mm256_maskload_ps(out + i, m);
+            for (int j = 0; j != nk; ++j) {
+                s = _mm256_fmadd_ps(_mm256_broadcast_ss(kernel + j), _mm256_maskload_ps(in + i + j, m), s);
+            }
+            _mm256_maskstore_ps(out + i, m, s);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void weightedRowSumAvx2(float const *const *rows, float const *w, int nrow, int n, float *out) {
+        int i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+            __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+            for (int j = 0; j != nrow; ++j) {
+                __m256 const wj = _mm256_broadcast_ss(w + j);
+                float const *p = rows[j] + i;
+                s0 = _mm256_fmadd_ps(wj, _mm256_loadu_ps(p), s0);
+                s1 = _mm256_fmadd_ps(wj, _mm256_loadu_ps(p + 8), s1);
+                s2 = _mm256_fmadd_ps(wj, _mm256_loadu_ps(p + 16), s2);
+                s3 = _mm256_fmadd_ps(wj, _mm256_loadu_ps(p + 24), s3);
+            }
+            _mm256_storeu_ps(out + i, s0);
+            _mm256_storeu_ps(out + i + 8, s1);
+            _mm256_storeu_ps(out + i + 16, s2);
+            _mm256_storeu_ps(out + i + 24, s3);
+        }
+        for (; i < n; i += 8) {
+            __m256i const m = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+                                                     maskTable32 + 8 - ((n - i < 8) ? n - i : 8)));
+            __m256 s = _mm256_setzero_ps();
+            for (int j = 0; j != nrow; ++j) {
+                s = _mm256_fmadd_ps(_mm256_broadcast_ss(w + j), _mm256_maskload_ps(rows[j] + i, m), s);
+            }
+            _mm256_maskstore_ps(out + i, m, s);
+        }
+    }
+
+    /*
+     * w*b is b*wr -/+ (b with its real and imaginary parts exchanged)*wi, i.e. an fmaddsub
+     */
+    __attribute__((target("avx2,fma")))
+    void butterflyAvx2(float *a, float *b, int n, float wr, float wi) {
+        __m256 const vwr = _mm256_set1_ps(wr), vwi = _mm256_set1_ps(wi);
+        int const nf = 2*n;
+        for (int i = 0; i < nf; i += 8) {
+            __m256i const m = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(
+                                                     maskTable32 + 8 - ((nf - i < 8) ? nf - i : 8)));
+            __m256 const bv = _mm256_maskload_ps(b + i, m);
+            __m256 const av = _mm256_maskload_ps(a + i, m);
+            __m256 const wb = _mm256_fmaddsub_ps(bv, vwr, _mm256_mul_ps(_mm256_permute_ps(bv, 0xb1), vwi));
+            _mm256_maskstore_ps(a + i, m, _mm256_add_ps(av, wb));
+            _mm256_maskstore_ps(b + i, m, _mm256_sub_ps(av, wb));
+        }
+    }
+
+    /*
+     * Each vector's selected elements are stored as a full vector and the output pointer advanced by their
+     * number, so the stores never run past src's size;  the tail is left to the scalar code
+     */
+    __attribute__((target("avx2")))
+    int clipAvx2(float const *src, int n, float lo, float hi, float *dest) {
+        __m256 const vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+        int m = 0, i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 const x = _mm256_loadu_ps(src + i);
+            int const k = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(x, vlo, _CMP_GE_OQ),
+                                                           _mm256_cmp_ps(x, vhi, _CMP_LE_OQ)));
+            __m256i const perm = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(compressTable.index[k]));
+            _mm256_storeu_ps(dest + m, _mm256_permutevar8x32_ps(x, perm));
+            m += __builtin_popcount(k);
+        }
+        return m + clipScalar(src + i, n - i, lo, hi, dest + m);
+    }
+
+    __attribute__((target("avx2")))
+    void partitionAvx2(float const *src, int n, float pivot, float *below, int *nBelow,
+                       float *above, int *nAbove) {
+        __m256 const vpivot = _mm256_set1_ps(pivot);
+        int nb = 0, na = 0, i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 const x = _mm256_loadu_ps(src + i);
+            int const kb = _mm256_movemask_ps(_mm256_cmp_ps(x, vpivot, _CMP_LT_OQ));
+            int const ka = _mm256_movemask_ps(_mm256_cmp_ps(x, vpivot, _CMP_GT_OQ));
+            __m256i const pb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(compressTable.index[kb]));
+            __m256i const pa = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(compressTable.index[ka]));
+            _mm256_storeu_ps(below + nb, _mm256_permutevar8x32_ps(x, pb));
+            _mm256_storeu_ps(above + na, _mm256_permutevar8x32_ps(x, pa));
+            nb += __builtin_popcount(kb);
+            na += __builtin_popcount(ka);
+        }
+        int tb = 0, ta = 0;
+        partitionScalar(src + i, n - i, pivot, below + nb, &tb, above + na, &ta);
+        *nBelow = nb + tb;
+        *nAbove = na + ta;
+    }
+
+    /************************************************************************************************************/
+    /*
+     * AVX-512;  the tails are handled with masked loads
+     */
+    /// Return the upper 8 floats of x (_mm512_extractf32x8_ps needs AVX512DQ)
+    __attribute__((target("avx512f")))
+    __m256 upper256(__m512 x) {
+        return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+    }
+
+    __attribute__((target("avx512f")))
+    void weightedSumAvx512(float const *w, float const *p, float const *v, int n, double *sum, double *sumVar) {
+        __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+        __m512d sv0 = _mm512_setzero_pd(), sv1 = _mm512_setzero_pd();
+        for (int i = 0; i < n; i += 16) {   // accumulate in double, as in weightedSumAvx2
+            __mmask16 const m = (n - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 const wi = _mm512_maskz_loadu_ps(m, w + i);
+            __m512 const pi = _mm512_maskz_loadu_ps(m, p + i);
+            __m512d const w0 = _mm512_cvtps_pd(_mm512_castps512_ps256(wi));
+            __m512d const w1 = _mm512_cvtps_pd(upper256(wi));
+            s0 = _mm512_fmadd_pd(w0, _mm512_cvtps_pd(_mm512_castps512_ps256(pi)), s0);
+            s1 = _mm512_fmadd_pd(w1, _mm512_cvtps_pd(upper256(pi)), s1);
+            if (v) {
+                __m512 const vi = _mm512_maskz_loadu_ps(m, v + i);
+                sv0 = _mm512_fmadd_pd(_mm512_mul_pd(w0, w0), _mm512_cvtps_pd(_mm512_castps512_ps256(vi)), sv0);
+                sv1 = _mm512_fmadd_pd(_mm512_mul_pd(w1, w1), _mm512_cvtps_pd(upper256(vi)), sv1);
+            }
+        }
+        *sum += _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+        if (v) {
+            *sumVar += _mm512_reduce_add_pd(_mm512_add_pd(sv0, sv1));
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void weightedSumAvx512(float const *w, double const *p, double const *v, int n, double *sum, double *sumVar) {
+        __m512d s = _mm512_setzero_pd();
+        __m512d sv = _mm512_setzero_pd();
+        for (int i = 0; i < n; i += 8) {
+            __mmask8 const m = (n - i >= 8) ? 0xff : static_cast<__mmask8>((1u << (n - i)) - 1);
+            __m512d const wi = _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(m, w + i)));
+            s = _mm512_fmadd_pd(wi, _mm512_maskz_loadu_pd(m, p + i), s);
+            if (v) {
+                sv = _mm512_fmadd_pd(_mm512_mul_pd(wi, wi), _mm512_maskz_loadu_pd(m, v + i), sv);
+            }
+        }
+        *sum += _mm512_reduce_add_pd(s);
+        if (v) {
+            *sumVar += _mm512_reduce_add_pd(sv);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void interpolateAvx512(float const *table, int n, float scale, float const *x, int npix,
+                           float *y, float *dydx) {
+        __m512 const vscale = _mm512_set1_ps(scale);
+        __m512 const vzero = _mm512_setzero_ps();
+        __m512 const vxmax = _mm512_set1_ps(n - 1);
+        __m512i const vimax = _mm512_set1_epi32(n - 2);
+        for (int i = 0; i < npix; i += 16) {
+            __mmask16 const m = (npix - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (npix - i)) - 1);
+            __m512 const fx = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i), vscale),
+                                                          vzero), vxmax);
+            __m512i const ix = _mm512_min_epi32(_mm512_cvttps_epi32(fx), vimax);
+            __m512 const t = _mm512_sub_ps(fx, _mm512_cvtepi32_ps(ix));
+            __m512 const y0 = _mm512_i32gather_ps(ix, table, 4);
+            __m512 const dy = _mm512_sub_ps(_mm512_i32gather_ps(ix, table + 1, 4), y0);
+
+            _mm512_mask_storeu_ps(y + i, m, _mm512_fmadd_ps(t, dy, y0));
+            if (dydx) {
+                _mm512_mask_storeu_ps(dydx + i, m, _mm512_mul_ps(dy, vscale));
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void correlateAvx512(float const *in, float const *kernel, int nk, int n, float *out) {
+        int i = 0;
+        for (; i + 64 <= n; i += 64) {
+            __m512 s0 = _mm512_loadu_ps(out + i), s1 = _mm512_loadu_ps(out + i + 16);
+            __m512 s2 = _mm512_loadu_ps(out + i + 32), s3 = _mm512_loadu_ps(out + i + 48);
+            for (int j = 0; j != nk; ++j) {
+                __m512 const k = _mm512_set1_ps(kernel[j]);
+                float const *p = in + i + j;
+                s0 = _mm512_fmadd_ps(k, _mm512_loadu_ps(p), s0);
+                s1 = _mm512_fmadd_ps(k, _mm512_loadu_ps(p + 16), s1);
+                s2 = _mm512_fmadd_ps(k, _mm512_loadu_ps(p + 32), s2);
+                s3 = _mm512_fmadd_ps(k, _mm512_loadu_ps(p + 48), s3);
+            }
+            _mm512_storeu_ps(out + i, s0);
+            _mm512_storeu_ps(out + i + 16, s1);
+            _mm512_storeu_ps(out + i + 32, s2);
+            _mm512_storeu_ps(out + i + 48, s3);
+        }
+        for (; i < n; i += 16) {
+            __mmask16 const m = (n - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 s = _mm512_maskz_loadu_ps(m, out + i);
+            for (int j = 0; j != nk; ++j) {
+                s = _mm512_fmadd_ps(_mm512_set1_ps(kernel[j]), _mm512_maskz_loadu_ps(m, in + i + j), s);
+            }
+            _mm512_mask_storeu_ps(out + i, m, s);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void weightedRowSumAvx512(float const *const *rows, float const *w, int nrow, int n, float *out) {
+        int i = 0;
+        for (; i + 64 <= n; i += 64) {
+            __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+            __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+            for (int j = 0; j != nrow; ++j) {
+                __m512 const wj = _mm512_set1_ps(w[j]);
+                float const *p = rows[j] + i;
+                s0 = _mm512_fmadd_ps(wj, _mm512_loadu_ps(p), s0);
+                s1 = _mm512_fmadd_ps(wj, _mm512_loadu_ps(p + 16), s1);
+                s2 = _mm512_fmadd_ps(wj, _mm512_loadu_ps(p + 32), s2);
+                s3 = _mm512_fmadd_ps(wj, _mm512_loadu_ps(p + 48), s3);
+            }
+            _mm512_storeu_ps(out + i, s0);
+            _mm512_storeu_ps(out + i + 16, s1);
+            _mm512_storeu_ps(out + i + 32, s2);
+            _mm512_storeu_ps(out + i + 48, s3);
+        }
+        for (; i < n; i += 16) {
+            __mmask16 const m = (n - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 s = _mm512_setzero_ps();
+            for (int j = 0; j != nrow; ++j) {
+                s = _mm512_fmadd_ps(_mm512_set1_ps(w[j]), _mm512_maskz_loadu_ps(m, rows[j] + i), s);
+            }
+            _mm512_mask_storeu_ps(out + i, m, s);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void butterflyAvx512(float *a, float *b, int n, float wr, float wi) {
+        __m512 const vwr = _mm512_set1_ps(wr), vwi = _mm512_set1_ps(wi);
+        int const nf = 2*n;
+        for (int i = 0; i < nf; i += 16) {
+            __mmask16 const m = (nf - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (nf - i)) - 1);
+            __m512 const bv = _mm512_maskz_loadu_ps(m, b + i);
+            __m512 const av = _mm512_maskz_loadu_ps(m, a + i);
+            __m512 const wb = _mm512_fmaddsub_ps(bv, vwr, _mm512_mul_ps(_mm512_permute_ps(bv, 0xb1), vwi));
+            _mm512_mask_storeu_ps(a + i, m, _mm512_add_ps(av, wb));
+            _mm512_mask_storeu_ps(b + i, m, _mm512_sub_ps(av, wb));
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    int clipAvx512(float const *src, int n, float lo, float hi, float *dest) {
+        __m512 const vlo = _mm512_set1_ps(lo), vhi = _mm512_set1_ps(hi);
+        int m = 0;
+        for (int i = 0; i < n; i += 16) {
+            __mmask16 const ml = (n - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 const x = _mm512_maskz_loadu_ps(ml, src + i);
+            __mmask16 const k = _mm512_mask_cmp_ps_mask(ml, x, vlo, _CMP_GE_OQ) &
+                                _mm512_mask_cmp_ps_mask(ml, x, vhi, _CMP_LE_OQ);
+            _mm512_mask_compressstoreu_ps(dest + m, k, x);
+            m += __builtin_popcount(k);
+        }
+        return m;
+    }
+
+    __attribute__((target("avx512f")))
+    void partitionAvx512(float const *src, int n, float pivot, float *below, int *nBelow,
+                         float *above, int *nAbove) {
+        __m512 const vpivot = _mm512_set1_ps(pivot);
+        int nb = 0, na = 0;
+        for (int i = 0; i < n; i += 16) {
+            __mmask16 const ml = (n - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 const x = _mm512_maskz_loadu_ps(ml, src + i);
+            __mmask16 const kb = _mm512_mask_cmp_ps_mask(ml, x, vpivot, _CMP_LT_OQ);
+            __mmask16 const ka = _mm512_mask_cmp_ps_mask(ml, x, vpivot, _CMP_GT_OQ);
+            _mm512_mask_compressstoreu_ps(below + nb, kb, x);
+            _mm512_mask_compressstoreu_ps(above + na, ka, x);
+            nb += __builtin_popcount(kb);
+            na += __builtin_popcount(ka);
+        }
+        *nBelow = nb;
+        *nAbove = na;
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    void byteSwapAvx512(char *dest, char const *src, int size, std::size_t n) {
+        if (size != 2 && size != 4 && size != 8) {
+            byteSwapScalar(dest, src, size, n);
+            return;
+        }
+        __m128i const lane = _mm_loadu_si128(reinterpret_cast<__m128i const *>(getSwapShuffle(size)));
+        __m512i const shuffle = _mm512_broadcast_i32x4(lane);
+
+        std::size_t const nbyte = n*size;
+        for (std::size_t i = 0; i < nbyte; i += 64) {
+            __mmask64 const m = (nbyte - i >= 64) ? ~static_cast<__mmask64>(0) :
+                                                    (static_cast<__mmask64>(1) << (nbyte - i)) - 1;
+            __m512i const x = _mm512_maskz_loadu_epi8(m, src + i);
+            _mm512_mask_storeu_epi8(dest + i, m, _mm512_shuffle_epi8(x, shuffle));
+        }
+    }
+#endif
+}
+
+/************************************************************************************************************/
+
+/// Print a Level
+std::ostream &operator<<(std::ostream &os, Level level) {
+    switch (level) {
+      case SCALAR: return os << "scalar";
+      case AVX2:   return os << "AVX2";
+      case AVX512: return os << "AVX-512";
+    }
+    return os << "Level(" << int(level) << ")";
+}
+
+/// Return the best level that the CPU supports
+Level getBestLevel() {
+    return bestLevel;
+}
+
+/// Return the level in use
+Level getLevel() {
+    return currentLevel;
+}
+
+/**
+ * Set the level to use (but no better than the CPU supports), returning the level actually chosen
+ *
+ * Not thread safe;  call it before starting any threads that use these kernels
+ */
+Level setLevel(Level level) {
+    currentLevel = (level < bestLevel) ? level : bestLevel;
+
+    return currentLevel;
+}
+
+void weightedSum(float const *w, float const *p, float const *v, int n, double *sum, double *sumVar) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: weightedSumAvx512(w, p, v, n, sum, sumVar); return;
+      case AVX2:   weightedSumAvx2(w, p, v, n, sum, sumVar);   return;
+#endif
+      default:     weightedSumScalar(w, p, v, n, sum, sumVar); return;
+    }
+}
+
+void weightedSum(float const *w, double const *p, double const *v, int n, double *sum, double *sumVar) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: weightedSumAvx512(w, p, v, n, sum, sumVar); return;
+      case AVX2:   weightedSumAvx2(w, p, v, n, sum, sumVar);   return;
+#endif
+      default:     weightedSumScalar(w, p, v, n, sum, sumVar); return;
+    }
+}
+
+void interpolate(float const *table, int n, float scale, float const *x, int npix, float *y, float *dydx) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: interpolateAvx512(table, n, scale, x, npix, y, dydx); return;
+      case AVX2:   interpolateAvx2(table, n, scale, x, npix, y, dydx);   return;
+#endif
+      default:     interpolateScalar(table, n, scale, x, npix, y, dydx); return;
+    }
+}
+
+void byteSwap(void *dest, void const *src, int size, std::size_t n) {
+    char *const d = static_cast<char *>(dest);
+    char const *const s = static_cast<char const *>(src);
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512:
+        if (hasAvx512bw) {
+            byteSwapAvx512(d, s, size, n);
+            return;
+        }
+        byteSwapAvx2(d, s, size, n);  // AVX-512 without byte shuffles;  AVX2 has them
+        return;
+      case AVX2:   byteSwapAvx2(d, s, size, n);   return;
+#endif
+      default:     byteSwapScalar(d, s, size, n); return;
+    }
+}
+
+void correlate(float const *in, float const *kernel, int nk, int n, float *out) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: correlateAvx512(in, kernel, nk, n, out); return;
+      case AVX2:   correlateAvx2(in, kernel, nk, n, out);   return;
+#endif
+      default:     correlateScalar(in, kernel, nk, n, out); return;
+    }
+}
+
+void weightedRowSum(float const *const *rows, float const *w, int nrow, int n, float *out) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: weightedRowSumAvx512(rows, w, nrow, n, out); return;
+      case AVX2:   weightedRowSumAvx2(rows, w, nrow, n, out);   return;
+#endif
+      default:     weightedRowSumScalar(rows, w, nrow, n, out); return;
+    }
+}
+
+void butterfly(float *a, float *b, int n, float wr, float wi) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: butterflyAvx512(a, b, n, wr, wi); return;
+      case AVX2:   butterflyAvx2(a, b, n, wr, wi);   return;
+#endif
+      default:     butterflyScalar(a, b, n, wr, wi); return;
+    }
+}
+
+int clip(float const *src, int n, float lo, float hi, float *dest) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: return clipAvx512(src, n, lo, hi, dest);
+      case AVX2:   return clipAvx2(src, n, lo, hi, dest);
+#endif
+      default:     return clipScalar(src, n, lo, hi, dest);
+    }
+}
+
+void partition(float const *src, int n, float pivot, float *below, int *nBelow, float *above, int *nAbove) {
+    switch (currentLevel) {
+#if defined(SIMD_X86)
+      case AVX512: partitionAvx512(src, n, pivot, below, nBelow, above, nAbove); return;
+      case AVX2:   partitionAvx2(src, n, pivot, below, nBelow, above, nAbove);   return;
+#endif
+      default:     partitionScalar(src, n, pivot, below, nBelow, above, nAbove); return;
+    }
+}
+
+}
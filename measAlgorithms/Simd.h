@@ -0,0 +1,78 @@
+// -*- lsst-c++ -*-
+#if !defined(SIMD_H)
+#define SIMD_H 1
+
+#include <cstddef>
+#include <iostream>
+
+/**
+ * Kernels that have SIMD implementations, chosen at runtime according to what the CPU supports
+ *
+ * The best supported level is used unless setLevel() is called (e.g. to compare implementations);
+ * all levels give the same answers up to floating point rounding
+ */
+namespace simd {
+    /// Supported instruction sets, in increasing order of capability
+    typedef enum { SCALAR, AVX2, AVX512 } Level;
+
+    std::ostream &operator<<(std::ostream &os, Level level);
+
+    Level getBestLevel();
+    Level getLevel();
+    Level setLevel(Level level);
+
+    /**
+     * Accumulate a weighted sum of n pixels:  *sum += sum_i w[i]*p[i]
+     * and, if v is non-NULL, the variance of that sum:  *sumVar += sum_i w[i]^2*v[i]
+     *
+     * The products and sums are formed in double at every level, so long sums (e.g. a chi^2) keep their
+     * precision and only the order of the additions depends on the level
+     */
+    void weightedSum(float const *w, float const *p, float const *v, int n, double *sum, double *sumVar);
+    void weightedSum(float const *w, double const *p, double const *v, int n, double *sum, double *sumVar);
+
+    /**
+     * Linearly interpolate a table of n values tabulated at x = 0, 1/scale, 2/scale, ...:  for each of the
+     * npix x[i] set y[i] to the interpolated value and, if dydx is non-NULL, dydx[i] to its slope.
+     * Values of x beyond the ends of the table are clamped to the table
+     */
+    void interpolate(float const *table, int n, float scale, float const *x, int npix, float *y, float *dydx);
+
+    /**
+     * Copy n elements of size bytes (1, 2, 4, or 8) from src to dest, reversing the order of each element's
+     * bytes (e.g. to convert to big-endian);  dest may equal src, but the arrays mustn't otherwise overlap
+     */
+    void byteSwap(void *dest, void const *src, int size, std::size_t n);
+
+    /**
+     * Correlate n pixels with a kernel of nk values, adding the result to out:
+     *    out[i] += sum_{j < nk} kernel[j]*in[i + j]
+     * so in must have n + nk - 1 elements
+     */
+    void correlate(float const *in, float const *kernel, int nk, int n, float *out);
+
+    /**
+     * Set each of n pixels to a weighted sum of the same pixel in nrow rows:  out[i] = sum_j w[j]*rows[j][i]
+     */
+    void weightedRowSum(float const *const *rows, float const *w, int nrow, int n, float *out);
+
+    /**
+     * Apply an FFT butterfly to n pairs of complex numbers (stored as real, imaginary) with twiddle factor
+     * (wr, wi):  a[i] += w*b[i];  b[i] = a[i] - w*b[i]  (where a[i] is its original value)
+     */
+    void butterfly(float *a, float *b, int n, float wr, float wi);
+
+    /**
+     * Copy the values in src[0, n) that lie in [lo, hi] to dest, in order, returning how many there were;
+     * NaNs are never copied
+     */
+    int clip(float const *src, int n, float lo, float hi, float *dest);
+
+    /**
+     * Copy the values in src[0, n) that are less than pivot to below and those that are greater than it to
+     * above (each in order), and set *nBelow and *nAbove to how many there were;  src mustn't contain NaNs
+     */
+    void partition(float const *src, int n, float pivot, float *below, int *nBelow, float *above, int *nAbove);
+}
+
+#endif
@@ -14,8 +14,10 @@ public:
 
     void setAstrometry(Measurement<Astrometry> const& astrom) { _astrom = astrom; }
     Measurement<Astrometry> const& getAstrometry() const { return _astrom; }
+    Measurement<Astrometry> &getAstrometry() { return _astrom; }
     void setPhotometry(Measurement<Photometry> const& photom) { _photom = photom; }
     Measurement<Photometry> const& getPhotometry() const { return _photom; }
+    Measurement<Photometry> &getPhotometry() { return _photom; }
 private:
     Measurement<Photometry> _photom;
     Measurement<Astrometry> _astrom;
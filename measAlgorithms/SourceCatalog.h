@@ -0,0 +1,387 @@
+// -*- lsst-c++ -*-
+#if !defined(SOURCE_CATALOG_H)
+#define SOURCE_CATALOG_H 1
+
+#include <cstring>
+#include "boost/scoped_array.hpp"
+
+#include "Source.h"
+
+/************************************************************************************************************/
+/*
+ * Columnar storage for many Measurement<T> composites that share a schema (e.g. all the Values returned
+ * by one MeasureQuantity).
+ *
+ * Each slot of the schema (a value, or one element of an array) is stored as a contiguous column of its
+ * own type, aligned to a cache line, so a scan over one quantity (e.g. all the psf fluxes) only touches
+ * that quantity's memory.  The slots are numbered as in Schema::findSlot, so a Key's slot is its column
+ */
+template<typename T>
+class MeasurementColumns {
+public:
+    enum { ALIGNMENT = 64 };            // alignment of each column, in bytes
+
+    /**
+     * A lightweight proxy for one row, providing the read accessors of a Measurement<T>
+     */
+    class Row {
+    public:
+        Row(MeasurementColumns const& columns, std::size_t row) : _columns(&columns), _row(row) {}
+
+        /// Return the schema describing our values
+        Schema::ConstPtr getSchema() const { return _columns->getSchema(); }
+        /// Return a value given a Key
+        template<typename U>
+        U get(Schema::Key<U> const& key) const { return _columns->get(_row, key); }
+        /// Return a value as a double given its name and component
+        double get(std::string const& name, std::string const& component="") const {
+            return _columns->get(_row, name, component);
+        }
+        /// Return an element of an array as a double given its name and component
+        double get(unsigned int i, std::string const& name, std::string const& component="") const {
+            return _columns->get(_row, i, name, component);
+        }
+    private:
+        MeasurementColumns const* _columns;
+        std::size_t _row;
+    };
+
+    explicit MeasurementColumns(Schema::ConstPtr schema);
+
+    /// Return the schema describing our values
+    Schema::ConstPtr getSchema() const { return _schema; }
+    /// Return the number of slots (and thus columns)
+    int getNSlot() const { return _types.size(); }
+    /// Return the number of rows
+    std::size_t size() const { return _size; }
+    void reserve(std::size_t n);
+    void resize(std::size_t n);
+
+    /// Return the column for a Key
+    template<typename U>
+    U *getColumn(Schema::Key<U> const& key) {
+        assert(_types[key.getSlot()] == static_cast<Schema::Type>(Schema::TypeOf<U>::value));
+        return reinterpret_cast<U *>(_columns[key.getSlot()]);
+    }
+    /// Return the column for a Key
+    template<typename U>
+    U const* getColumn(Schema::Key<U> const& key) const {
+        assert(_types[key.getSlot()] == static_cast<Schema::Type>(Schema::TypeOf<U>::value));
+        return reinterpret_cast<U const *>(_columns[key.getSlot()]);
+    }
+    /// Return the value in a row given a Key
+    template<typename U>
+    U get(std::size_t row, Schema::Key<U> const& key) const {
+        assert(row < _size);
+        return getColumn(key)[row];
+    }
+    /// Set the value in a row given a Key
+    template<typename U>
+    void set(std::size_t row, Schema::Key<U> const& key, U value) {
+        assert(row < _size);
+        getColumn(key)[row] = value;
+    }
+
+    /// Return a value as a double given its name and component;  the slow path
+    double get(std::size_t row, std::string const& name, std::string const& component="") const {
+        return get(row, 0, name, component);
+    }
+    double get(std::size_t row, unsigned int i, std::string const& name, std::string const& component="") const;
+    /// Return a slot's Type
+    Schema::Type getType(int slot) const { return _types[slot]; }
+    /// Return a slot's column;  its elements are of type getType(slot)
+    void *getColumn(int slot) { return _columns[slot]; }
+    /// Return a slot's column;  its elements are of type getType(slot)
+    void const* getColumn(int slot) const { return _columns[slot]; }
+    /// Return the value in a slot as a double
+    double get(std::size_t row, int slot) const { return getAsType<double>(row, slot); }
+    /// Return the value in a slot as a long
+    long getAsLong(std::size_t row, int slot) const { return getAsType<long>(row, slot); }
+
+    void set(std::size_t row, Measurement<T> const& m);
+    void set(std::size_t row, int element, Measurement<T> const& member);
+    void set(std::size_t row, MeasurementColumns const& src, std::size_t srcRow);
+private:
+    template<typename U>
+    U getAsType(std::size_t row, int slot) const;
+
+    Schema::ConstPtr _schema;
+    // Per-slot information
+    std::vector<Schema::Type> _types;   // the slot's type
+    std::vector<int> _elements;         // the index of the member of the composite holding the slot
+    std::vector<int> _offsets;          // the byte offset of the slot within that member's storage
+    std::vector<char *> _columns;       // the start of the slot's column
+    std::vector<int> _firstSlots;       // the first slot of each member of the composite (and one past the last)
+    // The storage
+    std::size_t _size;                  // number of rows in use
+    std::size_t _capacity;              // number of rows allocated
+    boost::scoped_array<char> _buf;     // all the columns, each aligned to ALIGNMENT
+
+    /// Return the byte offset of each column (and thus the total size) for a given number of rows
+    std::size_t _columnOffsets(std::size_t nrow, std::vector<std::size_t> *offsets) const;
+};
+
+/**
+ * Prepare to store Measurements described by schema, a composite
+ */
+template<typename T>
+MeasurementColumns<T>::MeasurementColumns(Schema::ConstPtr schema) :
+    _schema(schema), _types(), _elements(), _offsets(), _columns(), _firstSlots(), _size(0), _capacity(0), _buf()
+{
+    int element = 0;
+    for (Schema::const_iterator mptr = schema->begin(); mptr != schema->end(); ++mptr, ++element) {
+        int const base = _types.size();
+        _firstSlots.push_back(base);
+        _types.resize(base + (*mptr)->size(), Schema::UNKNOWN);
+        _elements.resize(_types.size(), element);
+        _offsets.resize(_types.size(), 0);
+
+        for (Schema::const_iterator sptr = (*mptr)->begin(); sptr != (*mptr)->end(); ++sptr) {
+            Schema const& se = **sptr;
+            for (int i = 0; i != se.getDimen(); ++i) {
+                int const slot = base + se.getIndex() + i;
+                _types[slot] = se.getType();
+                _offsets[slot] = se.getOffset() + i*Schema::sizeOf(se.getType());
+            }
+        }
+    }
+    _columns.resize(_types.size(), 0);
+    _firstSlots.push_back(_types.size());
+}
+
+template<typename T>
+std::size_t MeasurementColumns<T>::_columnOffsets(std::size_t nrow, std::vector<std::size_t> *offsets) const {
+    offsets->resize(_types.size());
+
+    std::size_t nbyte = 0;
+    for (unsigned int i = 0; i != _types.size(); ++i) {
+        (*offsets)[i] = nbyte;
+        nbyte += ((nrow*Schema::sizeOf(_types[i]) + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT;
+    }
+
+    return nbyte;
+}
+
+/**
+ * Make room for at least n rows
+ */
+template<typename T>
+void MeasurementColumns<T>::reserve(std::size_t n) {
+    if (n <= _capacity) {
+        return;
+    }
+    if (n < 2*_capacity) {              // grow geometrically, so that repeated set()s are amortised O(1)
+        n = 2*_capacity;
+    }
+
+    std::vector<std::size_t> offsets;
+    std::size_t const nbyte = _columnOffsets(n, &offsets);
+    boost::scoped_array<char> buf(new char[nbyte + ALIGNMENT]);
+    char *base = buf.get() + (ALIGNMENT - reinterpret_cast<std::size_t>(buf.get())%ALIGNMENT)%ALIGNMENT;
+    std::memset(base, 0, nbyte);
+
+    for (unsigned int i = 0; i != _types.size(); ++i) {
+        char *col = base + offsets[i];
+        if (_size > 0) {
+            std::memcpy(col, _columns[i], _size*Schema::sizeOf(_types[i]));
+        }
+        _columns[i] = col;
+    }
+
+    _buf.swap(buf);
+    _capacity = n;
+}
+
+/**
+ * Set the number of rows;  new rows are zero-filled, even if they were in use before the catalogue shrank
+ */
+template<typename T>
+void MeasurementColumns<T>::resize(std::size_t n) {
+    reserve(n);
+    if (n > _size) {
+        for (unsigned int i = 0; i != _types.size(); ++i) {
+            std::size_t const size = Schema::sizeOf(_types[i]);
+            std::memset(_columns[i] + _size*size, 0, (n - _size)*size);
+        }
+    }
+    _size = n;
+}
+
+/**
+ * Copy the values of m into a row, growing the catalogue if needs be.  m must be described by our schema
+ */
+template<typename T>
+void MeasurementColumns<T>::set(std::size_t row, Measurement<T> const& m) {
+    if (row >= _size) {                 // even if m has no members to grow us
+        resize(row + 1);
+    }
+    for (unsigned int i = 0; i != m._measuredValues.size(); ++i) {
+        set(row, i, *m._measuredValues[i]);
+    }
+}
+
+/**
+ * Copy the values of one member of a composite into a row, growing the catalogue if needs be.
+ * The member must be described by the element'th member of our schema
+ */
+template<typename T>
+void MeasurementColumns<T>::set(std::size_t row,                ///< the desired row
+                                int element,                    ///< which member of the composite
+                                Measurement<T> const& member    ///< the values to set
+                               ) {
+    if (row >= _size) {
+        resize(row + 1);
+    }
+    assert(element + 1 < static_cast<int>(_firstSlots.size()));
+
+    for (int i = _firstSlots[element]; i != _firstSlots[element + 1]; ++i) {
+        int const size = Schema::sizeOf(_types[i]);
+        assert(_offsets[i] + size <= static_cast<int>(member._data.size()));
+
+        std::memcpy(_columns[i] + row*size, &member._data[_offsets[i]], size);
+    }
+}
+
+/**
+ * Copy row srcRow of src, which must have our schema, into a row, growing the catalogue if needs be
+ */
+template<typename T>
+void MeasurementColumns<T>::set(std::size_t row, MeasurementColumns const& src, std::size_t srcRow) {
+    assert(src._schema == _schema && srcRow < src._size);
+    if (row >= _size) {
+        resize(row + 1);
+    }
+
+    for (unsigned int i = 0; i != _types.size(); ++i) {
+        int const size = Schema::sizeOf(_types[i]);
+        std::memcpy(_columns[i] + row*size, src._columns[i] + srcRow*size, size);
+    }
+}
+
+/**
+ * Return an element of a row as a double given its name and component
+ */
+template<typename T>
+double MeasurementColumns<T>::get(
+        std::size_t row,                ///< Desired row
+        unsigned int i,                 ///< Index into array (if an array)
+        std::string const& name,        ///< the name within T
+        std::string const& component    ///< the name within the set of measurements
+                                 ) const {
+    int element = -1, slot = -1;
+    Schema const& se = _schema->findSlot(name, component, &element, &slot);
+    if (!se) {
+        throw std::runtime_error("Unable to find " + (component == "" ? name : component + "." + name));
+    }
+    if (i >= static_cast<unsigned int>(se.getDimen())) {
+        std::ostringstream msg;
+        msg << "Index " << i << " is out of range for " << se.getName() << "[0," << se.getDimen() - 1 << "]";
+        throw std::runtime_error(msg.str());
+    }
+
+    return get(row, slot + i);
+}
+
+/**
+ * Return a value in a slot as the specified type
+ */
+template<typename T>
+template<typename U>
+U MeasurementColumns<T>::getAsType(std::size_t row, int slot) const {
+    assert(row < _size);
+    char const *col = _columns[slot];
+
+    switch (_types[slot]) {
+      case Schema::CHAR:
+        return static_cast<U>(reinterpret_cast<char const *>(col)[row]);
+      case Schema::SHORT:
+        return static_cast<U>(reinterpret_cast<short const *>(col)[row]);
+      case Schema::INT:
+        return static_cast<U>(reinterpret_cast<int const *>(col)[row]);
+      case Schema::LONG:
+        return static_cast<U>(reinterpret_cast<long const *>(col)[row]);
+      case Schema::FLOAT:
+        return static_cast<U>(reinterpret_cast<float const *>(col)[row]);
+      case Schema::DOUBLE:
+        return static_cast<U>(reinterpret_cast<double const *>(col)[row]);
+      default:
+        break;
+    }
+
+    std::ostringstream msg;
+    msg << "Unable to retrieve value of type " << _types[slot] << " from slot " << slot;
+    throw std::runtime_error(msg.str());
+}
+
+/************************************************************************************************************/
+/**
+ * A catalogue of Sources, stored as columns (\sa MeasurementColumns)
+ *
+ * Use the schemas from the MeasureAstrometry and MeasurePhotometry objects that measured the Sources
+ * (or from any of the Sources themselves), and then either append() Sources or set() their values
+ * directly using Keys
+ */
+class SourceCatalog {
+public:
+    typedef MeasurementColumns<Astrometry> AstrometryColumns;
+    typedef MeasurementColumns<Photometry> PhotometryColumns;
+
+    /**
+     * A lightweight proxy for one Source in a SourceCatalog
+     */
+    class Record {
+    public:
+        Record(SourceCatalog const& cat, std::size_t row) : _cat(&cat), _row(row) {}
+
+        AstrometryColumns::Row getAstrometry() const { return AstrometryColumns::Row(_cat->_astrom, _row); }
+        PhotometryColumns::Row getPhotometry() const { return PhotometryColumns::Row(_cat->_photom, _row); }
+    private:
+        SourceCatalog const* _cat;
+        std::size_t _row;
+    };
+
+    SourceCatalog(Schema::ConstPtr astromSchema, Schema::ConstPtr photomSchema) :
+        _astrom(astromSchema), _photom(photomSchema) {}
+
+    /// Return the number of Sources
+    std::size_t size() const { return _astrom.size(); }
+    /// Are there any Sources?
+    bool empty() const { return size() == 0; }
+    /// Make room for n Sources
+    void reserve(std::size_t n) {
+        _astrom.reserve(n);
+        _photom.reserve(n);
+    }
+    /// Set the number of Sources;  new rows are zero-filled
+    void resize(std::size_t n) {
+        _astrom.resize(n);
+        _photom.resize(n);
+    }
+    /// Return a proxy for the i'th Source
+    Record operator[](std::size_t i) const { return Record(*this, i); }
+
+    /// Copy a Source's values into the i'th row
+    void set(std::size_t i, Source const& s) {
+        _astrom.set(i, s.getAstrometry());
+        _photom.set(i, s.getPhotometry());
+    }
+    /// Copy row j of src, which must have our schemas, into the i'th row
+    void set(std::size_t i, SourceCatalog const& src, std::size_t j) {
+        _astrom.set(i, src._astrom, j);
+        _photom.set(i, src._photom, j);
+    }
+    /// Copy a Source's values into a new row at the end of the catalogue
+    void append(Source const& s) {
+        set(size(), s);
+    }
+
+    AstrometryColumns &getAstrometry() { return _astrom; }
+    AstrometryColumns const& getAstrometry() const { return _astrom; }
+    PhotometryColumns &getPhotometry() { return _photom; }
+    PhotometryColumns const& getPhotometry() const { return _photom; }
+private:
+    AstrometryColumns _astrom;
+    PhotometryColumns _photom;
+};
+
+#endif
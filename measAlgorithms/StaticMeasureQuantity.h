@@ -0,0 +1,304 @@
+// -*- lsst-c++ -*-
+#if !defined(STATIC_MEASURE_QUANTITY_H)
+#define STATIC_MEASURE_QUANTITY_H 1
+
+#include <vector>
+#include "boost/noncopyable.hpp"
+
+#include "Measurement.h"
+
+/// Marks the unused places in a StaticMeasureQuantity's list of algorithms
+struct NoAlgorithm {};
+
+/**
+ * A list of algorithm classes, A1 then A2, ...;  the unused places at the end are NoAlgorithm
+ *
+ * Each class must provide getName() (the name it's registered under) and a static
+ * doMeasure<ImageT>(Cutout const&, PeakT const&, AlgorithmInputs const&, A *val) that writes its answer into
+ * *val, and define it in its header so that it may be inlined.  Running the list is unrolled at compile time
+ * into a sequence of direct calls, one per algorithm
+ */
+template<typename T, typename ImageT, typename PeakT, typename A1, typename A2, typename A3, typename A4>
+struct StaticAlgorithms {
+    typedef StaticAlgorithms<T, ImageT, PeakT, A2, A3, A4, NoAlgorithm> Next;
+    enum { SIZE = 1 + Next::SIZE };     // the number of algorithms in the list
+
+    /// Append the algorithms' names to names, in order
+    static void getNames(std::vector<std::string> *names) {
+        names->push_back(A1::getName());
+        Next::getNames(names);
+    }
+    /**
+     * Measure peak with the i'th and subsequent algorithms, setting results[i], results[i + 1], ...
+     *
+     * inputs[i] are the indices in results of the i'th algorithm's inputs.  The results for the previous
+     * peak (if any) are overwritten in place, so once each algorithm's result has been allocated measuring
+     * a peak involves no allocation or reference counting;  the caller must have finished with them
+     */
+    static void measure(int i, Cutout<ImageT> const& cutout, PeakT const& peak,
+                        AlgorithmInputs::Result *results, std::vector<int> const* inputs) {
+        std::vector<int> const& in = inputs[i];
+        AlgorithmInputs const algorithmInputs(results, in.empty() ? 0 : &in[0], in.size(), 1, &results[i]);
+
+        if (!results[i].value) {
+            results[i] = AlgorithmInputs::Result(T(boost::make_shared<A1>()));
+        }
+        typename T::element_type *val = static_cast<typename T::element_type *>(results[i].value.get());
+        A1::template doMeasure<ImageT>(cutout, peak, algorithmInputs, static_cast<A1 *>(val));
+        Next::measure(i + 1, cutout, peak, results, inputs);
+    }
+};
+
+/// The end of a list of algorithms
+template<typename T, typename ImageT, typename PeakT>
+struct StaticAlgorithms<T, ImageT, PeakT, NoAlgorithm, NoAlgorithm, NoAlgorithm, NoAlgorithm> {
+    enum { SIZE = 0 };
+
+    static void getNames(std::vector<std::string> *) {}
+    static void measure(int, Cutout<ImageT> const&, PeakT const&, AlgorithmInputs::Result *,
+                        std::vector<int> const*) {}
+};
+
+/************************************************************************************************************/
+/**
+ * Measure a quantity using a set of algorithms that's fixed at compile time, e.g.
+ *     StaticMeasurePhotometry<Image<float>, PsfPhotometry, AperturePhotometry> measurePhotom(im);
+ *
+ * The results are exactly those of a MeasureQuantity to which the same algorithms have been added:  the
+ * Values, the schema (and hence the MeasurementColumns and the output), and the inputs that each algorithm
+ * is given are the same.  What differs is how the algorithms are run;  rather than looking each one up
+ * and calling it through a function pointer, the per-peak loop calls each algorithm's doMeasure directly,
+ * and keeps their results in a fixed-size array.
+ *
+ * The algorithms are run in the order listed, so each must come after the algorithms whose results it
+ * asks for (inputs that none of them provides are missing, as usual);  prepare() checks this.  There
+ * may be up to four algorithms.  Each must also be declared in MeasureQuantity's registry, which is
+ * where the schema and the algorithm's inputs and half-width come from
+ */
+template<typename T, typename ImageT, typename PeakT,
+         typename A1, typename A2=NoAlgorithm, typename A3=NoAlgorithm, typename A4=NoAlgorithm>
+class StaticMeasureQuantity : boost::noncopyable {
+    typedef StaticAlgorithms<T, ImageT, PeakT, A1, A2, A3, A4> Algorithms;
+public:
+    typedef typename MeasureQuantity<T, ImageT, PeakT>::Values Values;
+    enum { NALGORITHM = Algorithms::SIZE }; // the number of algorithms that we run
+
+    StaticMeasureQuantity(typename ImageT::ConstPtr im) :
+        _im(im), _background(), _quantity(im), _mutex(), _prepared(false) {
+        std::vector<std::string> names;
+        Algorithms::getNames(&names);
+        for (int i = 0; i != NALGORITHM; ++i) {
+            _quantity.addAlgorithm(names[i]);
+        }
+    }
+
+    /**
+     * Return the schema of the Values returned by measure(), suitable for Schema::getKey
+     *
+     * As for MeasureQuantity, this is empty until measure() (or prepare()) has been called
+     */
+    Schema::ConstPtr getSchema() const {
+        return _quantity.getSchema();
+    }
+    /// Return the half-width of the cutout made around each peak;  set by prepare()
+    int getHalfWidth() const {
+        return _quantity.getHalfWidth();
+    }
+    /**
+     * Use background as the sky under each peak (\sa MeasureQuantity::setBackground)
+     *
+     * N.b. Not safe to call while another thread is using this StaticMeasureQuantity
+     */
+    void setBackground(Background::ConstPtr background) {
+        _background = background;
+        _quantity.setBackground(background);
+    }
+
+    /**
+     * Actually measure im using all our algorithms, returning the result
+     *
+     * Once prepare() has run (it's called for you the first time) this doesn't modify *this, so you
+     * may call measure() from as many threads as you like
+     */
+    Values measure(PeakT const& peak     ///< approximate position of object's centre
+                  ) {
+        prepare(peak);
+
+        Cutout<ImageT> cutout(getHalfWidth());
+        cutout.reset(*_im, peak.getIx(), peak.getIy(), _background.get());
+        Result results[NALGORITHM];
+        Algorithms::measure(0, cutout, peak, results, _inputs);
+
+        Values values(getSchema());
+        for (int e = 0; e != NALGORITHM; ++e) { // in the order of getSchema()'s members
+            T val = _getResult(results[_algorithms[e]]);
+            val->setSchema(*(getSchema()->begin() + e));
+            values.add(val);
+        }
+
+        return values;
+    }
+
+    /**
+     * Measure im at each of the peaks in [begin, end), writing the results into rows row0, row0 + 1, ...
+     * of columns (which is resized if needs be);  \sa MeasureQuantity::measure
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 MeasurementColumns<typename T::element_type> &columns, ///< where to put the answers
+                 std::size_t row0=0     ///< the row for *begin
+                ) {
+        if (begin == end) {
+            return;
+        }
+        prepare(*begin);
+        if (columns.getSchema() != getSchema()) {
+            throw std::runtime_error("Columns were not created with this StaticMeasureQuantity's schema");
+        }
+        std::size_t const nrow = row0 + std::distance(begin, end);
+        if (columns.size() < nrow) {
+            columns.resize(nrow);
+        }
+
+        Cutout<ImageT> cutout(getHalfWidth());
+        _measure(begin, end, columns, row0, cutout);
+    }
+
+    /**
+     * Measure im at each of the peaks in [begin, end) using all the threads in pool, writing the results
+     * into rows row0, row0 + 1, ... of columns (which is resized if needs be);  \sa MeasureQuantity::measure
+     */
+    template<typename PeakIterator>
+    void measure(PeakIterator begin,    ///< first peak to measure
+                 PeakIterator end,      ///< one past the last peak to measure
+                 MeasurementColumns<typename T::element_type> &columns, ///< where to put the answers
+                 ThreadPool &pool,      ///< the threads to use
+                 std::size_t row0=0,    ///< the row for *begin
+                 std::size_t blockSize=256 ///< the number of peaks to give a thread at a time
+                ) {
+        if (begin == end) {
+            return;
+        }
+        prepare(*begin);                // after this, measuring doesn't modify *this
+        if (columns.getSchema() != getSchema()) {
+            throw std::runtime_error("Columns were not created with this StaticMeasureQuantity's schema");
+        }
+        std::size_t const n = std::distance(begin, end);
+        if (columns.size() < row0 + n) {
+            columns.resize(row0 + n);
+        }
+
+        std::vector<CutoutPtr> cutouts(pool.getNThread()); // made by each thread as it starts work
+        pool.run(n, blockSize, boost::bind(&StaticMeasureQuantity::template _measureBlock<PeakIterator>, this,
+                                           begin, boost::ref(columns), row0, boost::ref(cutouts),
+                                           boost::placeholders::_1, boost::placeholders::_2,
+                                           boost::placeholders::_3));
+    }
+
+    /**
+     * Make sure that getSchema() is complete (\sa MeasureQuantity::prepare), and work out where each
+     * algorithm's inputs come from
+     *
+     * This is the only part of measuring that modifies *this, and it's protected by a mutex
+     */
+    void prepare(PeakT const& peak     ///< a suitable object to measure
+                ) {
+        if (_prepared) {                // the fast path; no need to lock
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        if (_prepared) {                // someone beat us to it
+            return;
+        }
+
+        _quantity.prepare(peak);
+        //
+        // Our algorithms are in the order listed;  _quantity's (and thus getSchema()'s) are sorted by name
+        //
+        std::vector<std::string> names;
+        Algorithms::getNames(&names);
+
+        AlgorithmGraph graph;
+        for (int i = 0; i != NALGORITHM; ++i) {
+            int e = 0;
+            while (_quantity.getAlgorithmName(e) != names[i]) {
+                ++e;
+            }
+            _algorithms[e] = i;
+            graph.add(names[i], _quantity.getAlgorithmInputs(e), _quantity.getAlgorithmProvides(e));
+        }
+        graph.sort();
+
+        for (int i = 0; i != NALGORITHM; ++i) {
+            std::vector<int> const& in = graph.getInputs(i);
+            for (unsigned int j = 0; j != in.size(); ++j) {
+                if (in[j] >= i) {
+                    throw std::runtime_error("Algorithm " + names[i] + " needs the results of " +
+                                             names[in[j]] + ", so must be listed after it");
+                }
+            }
+            _inputs[i] = in;
+        }
+
+        _prepared = true;
+    }
+private:
+    typedef AlgorithmInputs::Result Result;
+    typedef boost::shared_ptr<Cutout<ImageT> > CutoutPtr;
+
+    //
+    // The data that we wish to measure
+    //
+    typename ImageT::ConstPtr _im;
+    Background::ConstPtr _background;
+    //
+    // Our algorithms looked up by name;  their schema, what they need, and the half-width of the cutout
+    //
+    MeasureQuantity<T, ImageT, PeakT> _quantity;
+    //
+    // Set by prepare():  which of our algorithms provides the e'th member of getSchema(), and the indices
+    // (in the order listed) of the i'th algorithm's inputs
+    //
+    int _algorithms[NALGORITHM];
+    std::vector<int> _inputs[NALGORITHM];
+    //
+    // Protect prepare(), and remember if it's been done
+    //
+    boost::mutex _mutex;
+    boost::atomic<bool> _prepared;
+
+    /// Return a Result as a T
+    static T _getResult(Result const& result) {
+        return boost::static_pointer_cast<typename T::element_type>(result.value);
+    }
+    /// Measure the peaks in [begin, end) with all our algorithms, using cutout to hold their pixels
+    template<typename PeakIterator>
+    void _measure(PeakIterator begin, PeakIterator end, MeasurementColumns<typename T::element_type> &columns,
+                  std::size_t row0, Cutout<ImageT> &cutout) const {
+        Result results[NALGORITHM];
+        std::size_t row = row0;
+        for (PeakIterator peak = begin; peak != end; ++peak, ++row) {
+            cutout.reset(*_im, peak->getIx(), peak->getIy(), _background.get());
+            Algorithms::measure(0, cutout, *peak, results, _inputs);
+
+            for (int e = 0; e != NALGORITHM; ++e) {
+                columns.set(row, e, *_getResult(results[_algorithms[e]]));
+            }
+        }
+    }
+    /// Measure peaks [begin + b, begin + e) with thread's cutout;  used by the parallel measure()
+    template<typename PeakIterator>
+    void _measureBlock(PeakIterator begin, MeasurementColumns<typename T::element_type> &columns,
+                       std::size_t row0, std::vector<CutoutPtr> &cutouts,
+                       std::size_t b, std::size_t e, int thread) {
+        CutoutPtr &cutout = cutouts[thread];
+        if (!cutout) {
+            cutout.reset(new Cutout<ImageT>(getHalfWidth()));
+        }
+        _measure(begin + b, begin + e, columns, row0 + b, *cutout);
+    }
+};
+
+#endif
@@ -0,0 +1,164 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <stdexcept>
+
+#include "boost/bind/bind.hpp"
+#include "ThreadPool.h"
+
+/**
+ * Create a pool of nThread threads;  if nThread <= 0, use one per hardware thread
+ */
+ThreadPool::ThreadPool(int nThread) :
+    _workers(), _threads(), _mutex(), _start(), _done(), _func(0), _n(0), _blockSize(1),
+    _generation(0), _nBusy(0), _shutdown(false), _error()
+{
+    if (nThread <= 0) {
+        nThread = std::max(1u, boost::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i != nThread; ++i) {
+        _workers.push_back(boost::shared_ptr<Worker>(new Worker));
+    }
+    for (int i = 1; i < nThread; ++i) { // thread 0 is whoever calls run()
+        _threads.create_thread(boost::bind(&ThreadPool::_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _shutdown = true;
+    }
+    _start.notify_all();
+    _threads.join_all();
+}
+
+/**
+ * Call func on every block of blockSize items in [0, n), returning when they've all been processed.
+ *
+ * If func throws, the remaining blocks are still processed and a std::runtime_error with the same
+ * message as the first exception is thrown
+ */
+void ThreadPool::run(std::size_t n,             ///< number of items
+                     std::size_t blockSize,     ///< number of items to pass to each call of func
+                     Func const& func           ///< what to do
+                    ) {
+    if (n == 0) {
+        return;
+    }
+    blockSize = std::max<std::size_t>(1, blockSize);
+    std::size_t const nBlock = (n + blockSize - 1)/blockSize;
+    int const nThread = getNThread();
+    //
+    // Divide up the blocks
+    //
+    for (int i = 0; i != nThread; ++i) {
+        Worker &worker = *_workers[i];
+        boost::lock_guard<boost::mutex> lock(worker.mutex);
+        worker.next = (nBlock*i)/nThread;
+        worker.end = (nBlock*(i + 1))/nThread;
+    }
+    //
+    // Start everyone working
+    //
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _func = &func;
+        _n = n;
+        _blockSize = blockSize;
+        _nBusy = nThread;
+        _error = "";
+        ++_generation;
+    }
+    _start.notify_all();
+
+    _work(0);
+
+    std::string error;
+    {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while (_nBusy > 0) {
+            _done.wait(lock);
+        }
+        _func = 0;
+        error.swap(_error);
+    }
+
+    if (error != "") {
+        throw std::runtime_error(error);
+    }
+}
+
+/// The main loop of threads other than 0:  wait for a job, do it, repeat
+void ThreadPool::_loop(int thread) {
+    unsigned long generation = 0;       // the last job we did
+
+    for (;;) {
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+            while (!_shutdown && _generation == generation) {
+                _start.wait(lock);
+            }
+            if (_shutdown) {
+                return;
+            }
+            generation = _generation;
+        }
+
+        _work(thread);
+    }
+}
+
+/// Process blocks until there are none left, then tell run() that we're done
+void ThreadPool::_work(int thread) {
+    std::size_t block;
+    while (_nextBlock(thread, &block)) {
+        std::size_t const begin = block*_blockSize;
+        try {
+            (*_func)(begin, std::min(begin + _blockSize, _n), thread);
+        } catch (std::exception const& e) {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            if (_error == "") {
+                _error = e.what();
+            }
+        } catch (...) {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            if (_error == "") {
+                _error = "Unknown exception in ThreadPool";
+            }
+        }
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        --_nBusy;
+    }
+    _done.notify_one();
+}
+
+/**
+ * Find the next block for thread to process;  take it from our own share if possible,
+ * otherwise steal the last block from another thread's share
+ */
+bool ThreadPool::_nextBlock(int thread, std::size_t *block) {
+    int const nThread = getNThread();
+    {
+        Worker &me = *_workers[thread];
+        boost::lock_guard<boost::mutex> lock(me.mutex);
+        if (me.next < me.end) {
+            *block = me.next++;
+            return true;
+        }
+    }
+
+    for (int i = 1; i != nThread; ++i) {
+        Worker &victim = *_workers[(thread + i)%nThread];
+        boost::lock_guard<boost::mutex> lock(victim.mutex);
+        if (victim.next < victim.end) {
+            *block = --victim.end;
+            return true;
+        }
+    }
+
+    return false;
+}
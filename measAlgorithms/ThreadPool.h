@@ -0,0 +1,69 @@
+// -*- lsst-c++ -*-
+#if !defined(THREAD_POOL_H)
+#define THREAD_POOL_H 1
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "boost/function.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/thread.hpp"
+
+/**
+ * A fixed set of threads that process a range of work, [0, n), in blocks.
+ *
+ * Each thread starts with an equal, contiguous share of the blocks, which it works through from the
+ * front;  when it runs out it steals blocks from the back of another thread's share.  The thread that
+ * calls run() takes part as thread 0, so a ThreadPool(1) doesn't start any threads at all.
+ *
+ * The work function is called as func(begin, end, thread), where thread is in [0, getNThread()) and may
+ * be used to index per-thread scratch space;  no two calls with the same thread run at the same time.
+ */
+class ThreadPool : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<ThreadPool> Ptr;
+    /// The work to do:  func(begin, end, thread)
+    typedef boost::function<void (std::size_t, std::size_t, int)> Func;
+
+    explicit ThreadPool(int nThread=0);
+    ~ThreadPool();
+
+    /// Return the number of threads (including the caller of run())
+    int getNThread() const { return _workers.size(); }
+
+    void run(std::size_t n, std::size_t blockSize, Func const& func);
+private:
+    /// One thread's share of the blocks, [next, end)
+    struct Worker {
+        Worker() : mutex(), next(0), end(0) {}
+
+        boost::mutex mutex;
+        std::size_t next;
+        std::size_t end;
+    };
+
+    std::vector<boost::shared_ptr<Worker> > _workers;
+    boost::thread_group _threads;
+    // The current job
+    boost::mutex _mutex;
+    boost::condition_variable _start; // notified when a job is available (or we're shutting down)
+    boost::condition_variable _done;  // notified when a thread has finished with the current job
+    Func const* _func;
+    std::size_t _n;
+    std::size_t _blockSize;
+    unsigned long _generation;        // incremented for each job
+    int _nBusy;                       // number of threads still working on the current job
+    bool _shutdown;
+    std::string _error;               // the what() of the first exception thrown by _func
+
+    void _loop(int thread);
+    void _work(int thread);
+    bool _nextBlock(int thread, std::size_t *block);
+};
+
+#endif
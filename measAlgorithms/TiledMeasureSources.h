@@ -0,0 +1,365 @@
+// -*- lsst-c++ -*-
+#if !defined(TILED_MEASURE_SOURCES_H)
+#define TILED_MEASURE_SOURCES_H 1
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "boost/bind/bind.hpp"
+#include "boost/noncopyable.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "CatalogPipeline.h"
+#include "ImageFile.h"
+#include "MeasureSources.h"
+#include "Peak.h"
+#include "SourceCatalog.h"
+#include "ThreadPool.h"
+
+/**
+ * Measure Sources in an image that's too large to hold in memory, a tile at a time
+ *
+ * The image (an ImageFile) is divided into square tiles;  each peak belongs to the one tile containing its
+ * pixel (peaks off the image belong to the nearest tile).  A tile is read together with a halo of pixels
+ * around it, so as long as the halo is at least as wide as the cutouts (\sa MeasureSources::getHalfWidth)
+ * every peak sees exactly the pixels that it would in the whole image, and the answers are identical.
+ *
+ * The tiles are read into a fixed pool of nBuffer buffers, whose total size is at most maxBytes;  the tile
+ * size is the largest that fits.  While one tile is measured the next is read on another thread, and the
+ * kernel's asked to start reading the one after that.  Tiles without any peaks are never read.
+ *
+ * To subtract the sky, give the MeasureSources a Background made from the whole file
+ */
+template<typename ImageT>
+class TiledMeasureSources : boost::noncopyable {
+public:
+    typedef typename ImageT::Pixel Pixel;
+    typedef ImageFile<Pixel> File;
+
+    TiledMeasureSources(MeasureSources<ImageT> &measureSources, typename File::ConstPtr file, int halo,
+                        std::size_t maxBytes, int nBuffer=2);
+    ~TiledMeasureSources();
+
+    /// Return the width of the halo read around each tile
+    int getHalo() const { return _halo; }
+    /// Return the size of a tile (excluding its halo);  tiles at the right and top may be smaller
+    int getTileSize() const { return _tileSize; }
+    /// Return the number of tiles
+    int getNTile() const { return _nx*_ny; }
+    /// Return the bytes used by the tile buffers
+    std::size_t getNByte() const { return _nbyte; }
+    /// Return the pixels belonging to a tile (excluding its halo)
+    BBox getTile(int tile) const {
+        return _file->getBBox().clip(BBox((tile%_nx)*_tileSize, (tile/_nx)*_tileSize, _tileSize, _tileSize));
+    }
+
+    void prepare(Peak const& peak);
+
+    /**
+     * Measure Sources at each of peaks, writing the results into rows 0, 1, ... of cat (which is resized
+     * if needs be), in the same order as peaks
+     *
+     * cat must have been created with the MeasureSources's schemas, so prepare() must have been called
+     */
+    void measure(std::vector<Peak> const& peaks, SourceCatalog &cat) {
+        _measure(peaks, &cat, 0, 0, 0);
+    }
+    /// As measure(peaks, cat), but measuring each tile with all the threads in pool
+    void measure(std::vector<Peak> const& peaks, SourceCatalog &cat, ThreadPool &pool,
+                 std::size_t blockSize=256) {
+        _measure(peaks, &cat, 0, &pool, blockSize);
+    }
+    /**
+     * Measure Sources at each of peaks, passing the results to pipeline a batch at a time;  the Sources
+     * are in order of tile, and within a tile in the same order as peaks
+     */
+    void measure(std::vector<Peak> const& peaks, CatalogPipeline &pipeline) {
+        _measure(peaks, 0, &pipeline, 0, 0);
+    }
+    /// As measure(peaks, pipeline), but measuring each tile with all the threads in pool
+    void measure(std::vector<Peak> const& peaks, CatalogPipeline &pipeline, ThreadPool &pool,
+                 std::size_t blockSize=256) {
+        _measure(peaks, 0, &pipeline, &pool, blockSize);
+    }
+private:
+    MeasureSources<ImageT> &_measureSources;
+    typename File::ConstPtr _file;
+    int _halo;
+    int _tileSize;
+    int _nx, _ny;                       // the number of tiles in each direction
+    std::size_t _nbyte;
+    // The buffers, and the tile that each holds (or -1)
+    std::vector<boost::shared_ptr<ImageT> > _buffers;
+    std::vector<int> _loaded;
+    // The read in progress on another thread, if any, and the error it hit
+    boost::scoped_ptr<boost::thread> _reader;
+    std::string _readError;
+    // Scratch space for _measure
+    std::vector<std::size_t> _order;    // the indices of the peaks, sorted by tile
+    std::vector<std::size_t> _tileBegins; // tile i's peaks are _order[_tileBegins[i], _tileBegins[i + 1])
+    std::vector<Peak> _peaks;           // the current tile's peaks
+    boost::scoped_ptr<SourceCatalog> _scratch; // the current tile's Sources
+
+    /// Return the tile that peak belongs to
+    int _getTileIndex(Peak const& peak) const {
+        int const ix = std::min(std::max(peak.getIx(), 0), _file->getWidth() - 1);
+        int const iy = std::min(std::max(peak.getIy(), 0), _file->getHeight() - 1);
+        return (iy/_tileSize)*_nx + ix/_tileSize;
+    }
+    /// Return the pixels read for a tile:  the tile and its halo
+    BBox _getTileWithHalo(int tile) const {
+        BBox const bbox = getTile(tile);
+        return _file->getBBox().clip(BBox(bbox.getX0() - _halo, bbox.getY0() - _halo,
+                                          bbox.getWidth() + 2*_halo, bbox.getHeight() + 2*_halo));
+    }
+
+    void _read(int tile, int buffer);
+    void _startRead(int tile, int buffer);
+    void _finishRead();
+    void _useTile(int tile, int buffer);
+    void _prepare(Peak const& peak);
+    void _measure(std::vector<Peak> const& peaks, SourceCatalog *cat, CatalogPipeline *pipeline,
+                  ThreadPool *pool, std::size_t blockSize);
+};
+
+/**
+ * Prepare to measure file with measureSources, a tile at a time
+ */
+template<typename ImageT>
+TiledMeasureSources<ImageT>::TiledMeasureSources(
+        MeasureSources<ImageT> &measureSources, ///< how to measure each tile
+        typename File::ConstPtr file,           ///< the image to measure
+        int halo,                               ///< width of the border read around each tile
+        std::size_t maxBytes,                   ///< the most memory to use for pixels
+        int nBuffer                             ///< the number of tiles to hold at once (at least 2)
+                                                ) :
+    _measureSources(measureSources), _file(file), _halo(std::max(halo, 0)), _tileSize(0), _nx(0), _ny(0),
+    _nbyte(0), _buffers(), _loaded(), _reader(), _readError(), _order(), _tileBegins(), _peaks(), _scratch()
+{
+    nBuffer = std::max(nBuffer, 2);     // one to measure while the next is read
+    //
+    // Find the largest buffers that fit in maxBytes, allowing for the padding of rows and their alignment
+    //
+    std::size_t const perBuffer = maxBytes/nBuffer;
+    int const maxSide = std::max(file->getWidth(), file->getHeight()) + 2*_halo;
+    int side = std::min<double>(maxSide, std::sqrt(static_cast<double>(perBuffer/sizeof(Pixel))));
+    for (; side > 2*_halo; --side) {
+        std::size_t const stride = ((side*sizeof(Pixel) + ImageT::ALIGNMENT - 1)/ImageT::ALIGNMENT)*
+            ImageT::ALIGNMENT;
+        if (stride*side + ImageT::ALIGNMENT <= perBuffer) {
+            break;
+        }
+    }
+    _tileSize = side - 2*_halo;
+    if (_tileSize < 1) {
+        std::ostringstream msg;
+        msg << maxBytes << " bytes is too small for " << nBuffer << " tiles with a halo of " << _halo;
+        throw std::runtime_error(msg.str());
+    }
+    _nx = std::max(1, (file->getWidth() + _tileSize - 1)/_tileSize);
+    _ny = std::max(1, (file->getHeight() + _tileSize - 1)/_tileSize);
+    //
+    // No tile (with its halo) is larger than the image
+    //
+    int const width = std::min(side, file->getWidth()), height = std::min(side, file->getHeight());
+    for (int i = 0; i != nBuffer; ++i) {
+        _buffers.push_back(boost::shared_ptr<ImageT>(new ImageT(width, height)));
+        _nbyte += _buffers.back()->getStride()*height*sizeof(Pixel) + ImageT::ALIGNMENT;
+    }
+    _loaded.assign(nBuffer, -1);
+}
+
+/// Wait for any read that's in progress
+template<typename ImageT>
+TiledMeasureSources<ImageT>::~TiledMeasureSources() {
+    try {
+        _finishRead();
+    } catch (...) {
+        ;
+    }
+}
+
+/**
+ * Read the tile containing peak, and use it to prepare the MeasureSources (\sa MeasureSources::prepare)
+ *
+ * Throws if the MeasureSources's cutouts are wider than our halo
+ */
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::prepare(Peak const& peak) {
+    _finishRead();
+
+    int const tile = _getTileIndex(peak);
+    if (_loaded[0] != tile) {
+        _read(tile, 0);
+        _finishRead();                  // rethrow any error
+    }
+    _useTile(tile, 0);
+    _prepare(peak);
+}
+
+/// Prepare the MeasureSources with the current tile, and check that our halo is wide enough
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_prepare(Peak const& peak) {
+    _measureSources.prepare(peak);
+
+    if (_measureSources.getHalfWidth() > _halo) {
+        std::ostringstream msg;
+        msg << "The tiles' halo (" << _halo << " pixels) must be at least as wide as the cutouts (" <<
+            _measureSources.getHalfWidth() << " pixels)";
+        throw std::runtime_error(msg.str());
+    }
+}
+
+/// Read a tile into a buffer;  called on the reading thread, so errors are saved in _readError
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_read(int tile, int buffer) {
+    try {
+        _loaded[buffer] = -1;
+        _file->read(_getTileWithHalo(tile), *_buffers[buffer]);
+        _loaded[buffer] = tile;
+    } catch (std::exception const& e) {
+        _readError = e.what();
+    } catch (...) {
+        _readError = "Unknown exception reading " + _file->getFilename();
+    }
+}
+
+/// Start reading a tile into a buffer on another thread
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_startRead(int tile, int buffer) {
+    _finishRead();
+    _reader.reset(new boost::thread(boost::bind(&TiledMeasureSources::_read, this, tile, buffer)));
+}
+
+/// Wait for the read that's in progress (if any), and throw if it failed
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_finishRead() {
+    if (_reader) {
+        _reader->join();
+        _reader.reset();
+    }
+    if (_readError != "") {
+        std::string const error = _readError;
+        _readError = "";
+        throw std::runtime_error(error);
+    }
+}
+
+/// Tell the MeasureSources to measure the tile in a buffer
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_useTile(int tile, int buffer) {
+    BBox const bbox = _getTileWithHalo(tile);
+    typename ImageT::Ptr im(new ImageT(*_buffers[buffer], BBox(0, 0, bbox.getWidth(), bbox.getHeight())));
+    im->setXY0(bbox.getX0(), bbox.getY0());
+
+    _measureSources.setImage(im);
+}
+
+/// Measure peaks, putting the answers into cat or pipeline (whichever isn't NULL), with pool if not NULL
+template<typename ImageT>
+void TiledMeasureSources<ImageT>::_measure(std::vector<Peak> const& peaks, SourceCatalog *cat,
+                                           CatalogPipeline *pipeline, ThreadPool *pool, std::size_t blockSize) {
+    if (peaks.empty()) {
+        return;
+    }
+    //
+    // Sort the peaks by tile (a counting sort, so each tile's peaks stay in order)
+    //
+    int const nTile = getNTile();
+    _tileBegins.assign(nTile + 1, 0);
+    for (std::size_t i = 0; i != peaks.size(); ++i) {
+        ++_tileBegins[_getTileIndex(peaks[i]) + 1];
+    }
+    std::vector<int> tiles;             // the tiles that contain peaks
+    for (int i = 0; i != nTile; ++i) {
+        if (_tileBegins[i + 1] > 0) {
+            tiles.push_back(i);
+        }
+        _tileBegins[i + 1] += _tileBegins[i];
+    }
+    _order.resize(peaks.size());
+    {
+        std::vector<std::size_t> next(_tileBegins.begin(), _tileBegins.end() - 1);
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            _order[next[_getTileIndex(peaks[i])]++] = i;
+        }
+    }
+
+    if (cat) {
+        if (cat->size() < peaks.size()) {
+            cat->resize(peaks.size());
+        }
+        if (!_scratch) {
+            _scratch.reset(new SourceCatalog(cat->getAstrometry().getSchema(), cat->getPhotometry().getSchema()));
+        }
+    }
+    //
+    // Measure the tiles, reading each while its predecessor is measured
+    //
+    int const nBuffer = _buffers.size();
+    try {
+        _finishRead();
+        if (std::find(_loaded.begin(), _loaded.end(), tiles[0]) == _loaded.end()) {
+            _startRead(tiles[0], 0);
+        }
+
+        for (unsigned int k = 0; k != tiles.size(); ++k) {
+            int const tile = tiles[k];
+            _finishRead();
+            int const buffer = std::find(_loaded.begin(), _loaded.end(), tile) - _loaded.begin();
+            assert(buffer < nBuffer);
+
+            if (k + 1 < tiles.size()) {
+                int const next = (buffer + 1)%nBuffer;
+                if (std::find(_loaded.begin(), _loaded.end(), tiles[k + 1]) == _loaded.end()) {
+                    _startRead(tiles[k + 1], next);
+                }
+                if (k + 2 < tiles.size()) {
+                    _file->prefetch(_getTileWithHalo(tiles[k + 2]));
+                }
+            }
+            _useTile(tile, buffer);
+
+            std::size_t const begin = _tileBegins[tile], end = _tileBegins[tile + 1];
+            _peaks.clear();
+            for (std::size_t i = begin; i != end; ++i) {
+                _peaks.push_back(peaks[_order[i]]);
+            }
+            if (k == 0) {
+                _prepare(_peaks[0]);
+            }
+
+            if (pipeline) {
+                if (pool) {
+                    _measureSources.measure(_peaks.begin(), _peaks.end(), *pipeline, *pool, blockSize);
+                } else {
+                    _measureSources.measure(_peaks.begin(), _peaks.end(), *pipeline);
+                }
+            } else {
+                _scratch->resize(_peaks.size());
+                if (pool) {
+                    _measureSources.measure(_peaks.begin(), _peaks.end(), *_scratch, *pool, 0, blockSize);
+                } else {
+                    _measureSources.measure(_peaks.begin(), _peaks.end(), *_scratch);
+                }
+                for (std::size_t i = begin; i != end; ++i) {
+                    cat->set(_order[i], *_scratch, i - begin);
+                }
+            }
+        }
+    } catch (...) {
+        try {
+            _finishRead();
+        } catch (...) {
+            ;
+        }
+        throw;
+    }
+}
+
+#endif
@@ -0,0 +1,1604 @@
+// -*- lsst-c++ -*-
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <math.h>                       // lgamma, which C++03's <cmath> needn't declare
+#include <new>
+#include <unistd.h>
+#include <sstream>
+
+#include "boost/atomic.hpp"
+#include "boost/bind/bind.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "Source.h"
+#include "Image.h"
+#include "MeasureSources.h"
+#include "SourceCatalog.h"
+#include "CsvWriter.h"
+#include "CatalogFile.h"
+#include "FitsWriter.h"
+#include "CatalogPipeline.h"
+#include "ImageFile.h"
+#include "TiledMeasureSources.h"
+#include "Detection.h"
+#include "Convolve.h"
+#include "Background.h"
+#include "MaskedImage.h"
+#include "ThreadPool.h"
+#include "Simd.h"
+#include "AperturePhotometry.h"
+#include "PsfPhotometry.h"
+#include "ModelPhotometry.h"
+
+typedef Image<float> ImageT;
+typedef MaskedImage<float> MaskedImageT;
+
+/************************************************************************************************************/
+/*
+ * Count the calls to operator new (operator new[] calls it too), so we can check that measuring doesn't
+ * allocate memory
+ */
+namespace {
+    boost::atomic<long> nNew(0);
+}
+//
+// C++11 dropped dynamic exception specifications (C++17 forbids them), and says that operator delete
+// is noexcept
+//
+#if __cplusplus < 201103L
+#   define NEW_THROWS throw(std::bad_alloc)
+#   define DELETE_NOTHROW throw()
+#else
+#   define NEW_THROWS
+#   define DELETE_NOTHROW noexcept
+#endif
+
+void *operator new(std::size_t size) NEW_THROWS {
+    nNew.fetch_add(1, boost::memory_order_relaxed);
+
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // we replaced operator new too
+#endif
+void operator delete(void *ptr) DELETE_NOTHROW {
+    std::free(ptr);
+}
+// The sized delete used by code compiled as C++14 or later, e.g. parts of the runtime
+void operator delete(void *ptr, std::size_t) DELETE_NOTHROW {
+    std::free(ptr);
+}
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+/************************************************************************************************************/
+
+namespace {
+    /// Return the time in seconds since some arbitrary epoch
+    double now() {
+        static boost::posix_time::ptime const epoch = boost::posix_time::microsec_clock::universal_time();
+
+        return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds()*1e-6;
+    }
+
+    int const SPACING = 32;             // separation of the sources
+    int const NX = 128;                 // number of sources in each row
+
+    /// Return the positions of n sources, on a grid with some sub-pixel jitter
+    std::vector<Peak> makePeaks(std::size_t n) {
+        std::vector<Peak> peaks;
+        peaks.reserve(n);
+        for (std::size_t i = 0; i != n; ++i) {
+            peaks.push_back(Peak(SPACING/2 + SPACING*(i%NX) + 0.1*(i%7),
+                                 SPACING/2 + SPACING*(i/NX) + 0.13*(i%5)));
+        }
+
+        return peaks;
+    }
+
+    /// Return an image containing a star (a Gaussian, with flux 1000) at each peak, plus some noise
+    ImageT::Ptr makeImage(std::vector<Peak> const& peaks) {
+        double const sigma = 2.0;
+        int const hw = SPACING/2 - 2;       // allows for the jitter
+        ImageT::Ptr im(new ImageT(SPACING*NX, SPACING*(peaks.back().getIy()/SPACING + 1), 0.0));
+
+        std::srand(1);
+        for (int y = 0; y != im->getHeight(); ++y) {
+            ImageT::Pixel *row = im->getRow(y);
+            for (int x = 0; x != im->getWidth(); ++x) {
+                row[x] = 0.1*(std::rand()/(RAND_MAX + 1.0) - 0.5);
+            }
+        }
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            for (int y = peaks[i].getIy() - hw; y <= peaks[i].getIy() + hw; ++y) {
+                for (int x = peaks[i].getIx() - hw; x <= peaks[i].getIx() + hw; ++x) {
+                    double const dx = x - peaks[i].getX(), dy = y - peaks[i].getY();
+                    (*im)(x, y) += 1000*std::exp(-0.5*(dx*dx + dy*dy)/(sigma*sigma))/(2*M_PI*sigma*sigma);
+                }
+            }
+        }
+
+        return im;
+    }
+
+    /// Are the values in two catalogues identical?
+    template<typename T>
+    bool identical(MeasurementColumns<T> const& a, MeasurementColumns<T> const& b) {
+        if (a.size() != b.size() || a.getNSlot() != b.getNSlot()) {
+            return false;
+        }
+        for (int s = 0; s != a.getNSlot(); ++s) {
+            for (std::size_t i = 0; i != a.size(); ++i) {
+                if (a.get(i, s) != b.get(i, s)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /// Are the values in two Measurements identical?
+    template<typename T>
+    bool identical(Measurement<T> const& a, Measurement<T> const& b) {
+        typename Measurement<T>::const_iterator aptr = a.begin(), bptr = b.begin();
+        for (; aptr != a.end() && bptr != b.end(); ++aptr, ++bptr) {
+            Schema const& sch = *(*aptr)->getSchema();
+            for (Schema::const_iterator sptr = sch.begin(); sptr != sch.end(); ++sptr) {
+                for (int i = 0; i != (*sptr)->getDimen(); ++i) {
+                    if ((*aptr)->get(i, **sptr) != (*bptr)->get(i, **sptr)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return aptr == a.end() && bptr == b.end();
+    }
+
+    /// Call measure() on peaks from many threads at once, checking the answers against expected
+    void hammer(MeasureSources<ImageT> *measureSources,
+                std::vector<Peak> const* peaks,
+                std::vector<Source> const* expected,
+                int thread,
+                int *ok
+               ) {
+        for (std::size_t i = 0; i != peaks->size(); ++i) {
+            std::size_t const j = (i + 7919*thread)%peaks->size(); // different threads start in different places
+            Source const source = measureSources->measure((*peaks)[j]);
+
+            if (!identical(source.getAstrometry(), (*expected)[j].getAstrometry()) ||
+                !identical(source.getPhotometry(), (*expected)[j].getPhotometry())) {
+                *ok = false;
+            }
+        }
+    }
+
+    /// Tell measureSources to use the "gaussian" centroider and algorithms
+    template<typename MeasureSourcesT>
+    void addAlgorithms(MeasureSourcesT *measureSources, std::vector<std::string> const& algorithms) {
+        measureSources->addAlgorithm("gaussian");
+        for (unsigned int i = 0; i != algorithms.size(); ++i) {
+            measureSources->addAlgorithm(algorithms[i]);
+        }
+    }
+
+    /**
+     * Measure peaks with psf and aper photometry, both through the registry (MeasurePhotometry) and with
+     * the algorithms fixed at compile time (StaticMeasurePhotometry), reporting the rates and checking that
+     * the results are identical.  The two are timed alternately, so the ratio of their rates is steadier
+     * than either rate on a busy machine
+     */
+    bool compareStatic(ImageT::Ptr im, std::vector<Peak> const& peaks) {
+        MeasurePhotometry<ImageT> measureDynamic(im);
+        measureDynamic.addAlgorithm("psf");
+        measureDynamic.addAlgorithm("aper");
+        measureDynamic.prepare(peaks[0]);
+
+        StaticMeasurePhotometry<ImageT, PsfPhotometry, AperturePhotometry> measureStatic(im);
+        measureStatic.prepare(peaks[0]);
+
+        MeasurementColumns<Photometry> dynamic(measureDynamic.getSchema()), fixed(measureStatic.getSchema());
+        dynamic.resize(peaks.size());
+        fixed.resize(peaks.size());
+
+        double tDynamic = 0, tStatic = 0; // the best of a few tries, the first of which fills the PSF cache
+        for (int i = 0; i != 7; ++i) {
+            double const t0 = now();
+            measureDynamic.measure(peaks.begin(), peaks.end(), dynamic);
+            double const t1 = now();
+            measureStatic.measure(peaks.begin(), peaks.end(), fixed);
+            double const t2 = now();
+
+            tDynamic = (i == 0) ? t1 - t0 : std::min(tDynamic, t1 - t0);
+            tStatic = (i == 0) ? t2 - t1 : std::min(tStatic, t2 - t1);
+        }
+
+        bool const ok = identical(dynamic, fixed);
+        std::cout << "psf+aper   : " << peaks.size()/tDynamic << " sources/s/core from the registry, " <<
+            peaks.size()/tStatic << " static (x" << tDynamic/tStatic << ")" <<
+            (ok ? "" : "  RESULTS DIFFER") << std::endl;
+
+        return ok;
+    }
+
+    /**
+     * Measure the peaks with photometry alone (so the astrometric schema is empty) and append() each Source
+     * to a catalogue;  check that every Source got its own row, holding the same values as measure() writes
+     */
+    bool checkAppend(ImageT::Ptr im, std::vector<Peak> const& peaks) {
+        MeasureSources<ImageT> measureSources(im);
+        measureSources.addAlgorithm("aper");
+        measureSources.prepare(peaks[0]);
+
+        SourceCatalog cat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            cat.append(measureSources.measure(peaks[i]));
+        }
+
+        SourceCatalog measured(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        measured.resize(peaks.size());
+        measureSources.measure(peaks.begin(), peaks.end(), measured);
+
+        bool const ok = cat.size() == peaks.size() &&
+            identical(measured.getAstrometry(), cat.getAstrometry()) &&
+            identical(measured.getPhotometry(), cat.getPhotometry());
+        if (!ok) {
+            std::cout << "append     : " << cat.size() << " rows from " << peaks.size() <<
+                " photometry-only Sources;  RESULTS DIFFER" << std::endl;
+        }
+
+        return ok;
+    }
+
+    /// Return a Gaussian random number with mean 0 and standard deviation 1 (Box-Muller;  uses std::rand)
+    double gaussianDeviate() {
+        double const u = (std::rand() + 1.0)/(RAND_MAX + 1.0), v = std::rand()/(RAND_MAX + 1.0);
+        return std::sqrt(-2*std::log(u))*std::cos(2*M_PI*v);
+    }
+
+    /**
+     * Measure the statistics of the "gaussian" centroids of the stars at peaks in im:  the rms error in x and
+     * y (pooled) and the mean reported error;  return the number of stars that weren't centroided
+     */
+    template<typename AnyImageT>
+    int centroidErrors(typename AnyImageT::Ptr im, std::vector<Peak> const& truth,
+                       std::vector<Peak> const& peaks, double *rms, double *meanErr) {
+        MeasureAstrometry<AnyImageT> measureCentroid(im);
+        measureCentroid.addAlgorithm("gaussian");
+        measureCentroid.prepare(peaks[0]);
+        MeasurementColumns<Astrometry> cat(measureCentroid.getSchema());
+        cat.resize(peaks.size());
+        measureCentroid.measure(peaks.begin(), peaks.end(), cat);
+
+        double sumD2 = 0, sumErr = 0;
+        int n = 0;
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            double const dx = cat.get(i, "x", "gaussian") - truth[i].getX();
+            double const dy = cat.get(i, "y", "gaussian") - truth[i].getY();
+            double const err = 0.5*(cat.get(i, "xErr", "gaussian") + cat.get(i, "yErr", "gaussian"));
+            if (err == err) {           // i.e. not NaN
+                sumD2 += dx*dx + dy*dy;
+                sumErr += err;
+                ++n;
+            }
+        }
+        *rms = (n > 0) ? std::sqrt(0.5*sumD2/n) : 0;
+        *meanErr = (n > 0) ? sumErr/n : 0;
+
+        return peaks.size() - n;
+    }
+
+    /**
+     * Centroid nStar noisy stars (Gaussians of sigma 2 and flux 1000, with noise of sigma 5 per pixel) with
+     * "gaussian", starting at the pixels containing them, with the variance estimated from the stamp and
+     * from a variance plane.  Report the rms errors and the mean reported errors;  check that every star was
+     * centroided and that the reported errors are within 10% of the rms
+     */
+    bool checkCentroids(std::size_t nStar) {
+        double const psfSigma = 2.0, noise = 5.0, flux = 1000;
+        int const hw = SPACING/2 - 2;       // allows for the jitter
+
+        std::vector<Peak> const truth = makePeaks(nStar);
+        std::vector<Peak> peaks;
+        peaks.reserve(nStar);
+        ImageT::Ptr im(new ImageT(SPACING*NX, SPACING*(truth.back().getIy()/SPACING + 1)));
+        MaskedImageT::Ptr mi(new MaskedImageT(im->getWidth(), im->getHeight()));
+
+        std::srand(2);
+        for (int y = 0; y != im->getHeight(); ++y) {
+            for (int x = 0; x != im->getWidth(); ++x) {
+                (*im)(x, y) = noise*gaussianDeviate();
+            }
+        }
+        for (std::size_t i = 0; i != truth.size(); ++i) {
+            int const ix = truth[i].getIx(), iy = truth[i].getIy();
+            for (int y = iy - hw; y <= iy + hw; ++y) {
+                for (int x = ix - hw; x <= ix + hw; ++x) {
+                    double const dx = x - truth[i].getX(), dy = y - truth[i].getY();
+                    (*im)(x, y) += flux*std::exp(-0.5*(dx*dx + dy*dy)/(psfSigma*psfSigma))/
+                        (2*M_PI*psfSigma*psfSigma);
+                }
+            }
+            peaks.push_back(Peak(ix, iy));
+        }
+        for (int y = 0; y != im->getHeight(); ++y) {
+            for (int x = 0; x != im->getWidth(); ++x) {
+                mi->set(x, y, (*im)(x, y), noise*noise);
+            }
+        }
+
+        double rms = 0, meanErr = 0, rmsVar = 0, meanErrVar = 0;
+        int const nLost = centroidErrors<ImageT>(im, truth, peaks, &rms, &meanErr);
+        int const nLostVar = centroidErrors<MaskedImageT>(mi, truth, peaks, &rmsVar, &meanErrVar);
+        bool const ok = nLost == 0 && nLostVar == 0 &&
+            std::fabs(meanErr/rms - 1) < 0.1 && std::fabs(meanErrVar/rmsVar - 1) < 0.1;
+
+        std::cout << "centroids  : " << nStar << " noisy stars, rms error " << rms << " pixels (" << rmsVar <<
+            "), mean reported " << meanErr << " (" << meanErrVar << " from the variance plane)" <<
+            (nLost + nLostVar == 0 ? "" : "  LOST STARS") << (ok ? "" : "  BAD ERRORS") << std::endl;
+
+        return ok;
+    }
+
+    /**
+     * Render noise-free Sersic galaxies (flux 1000) with a range of n, r_e, and q, centred on a pixel and
+     * between pixels, and fit each with "model" at its true centre;  check that every fit converged and
+     * recovered all four parameters to 0.1%, and report the worst errors
+     */
+    bool checkSersic() {
+        double const nGrid[] = { 0.5, 1, 2, 3, 4, 5, 6 };
+        double const reGrid[] = { 1.5, 3, 5 };
+        double const qGrid[] = { 1, 0.6 };
+        float const offsets[][2] = { { 0, 0 }, { 0.5, 0.5 }, { 0.3, -0.2 } };
+        int const size = 64;
+        double const flux = 1000, tol = 1e-3;
+
+        double worst[4] = { 0, 0, 0, 0 }; // largest fractional errors in flux, n, r_e, and q
+        int nFit = 0, nBad = 0;
+        for (unsigned int i = 0; i != sizeof(nGrid)/sizeof(nGrid[0]); ++i) {
+            double const n = nGrid[i];
+            double const b = 2*n - 1.0/3 + 4/(405*n) + 46/(25515*n*n) + 131/(1148175*n*n*n) -
+                2194697/(30690717750*n*n*n*n); // b_n, as used by ModelPhotometry
+            for (unsigned int j = 0; j != sizeof(reGrid)/sizeof(reGrid[0]); ++j) {
+                for (unsigned int k = 0; k != sizeof(qGrid)/sizeof(qGrid[0]); ++k) {
+                    double const re = reGrid[j], q = qGrid[k];
+                    double const amp = flux*std::exp(2*n*std::log(b) - std::log(n) - ::lgamma(2*n))/
+                        (2*M_PI*q*re*re);
+                    for (unsigned int o = 0; o != sizeof(offsets)/sizeof(offsets[0]); ++o) {
+                        Peak const peak(size/2 + offsets[o][0], size/2 + offsets[o][1]);
+                        ImageT::Ptr im(new ImageT(size, size));
+                        for (int y = 0; y != size; ++y) {
+                            for (int x = 0; x != size; ++x) {
+                                double const dx = x - peak.getX(), dy = y - peak.getY();
+                                double const s = std::sqrt(dx*dx + dy*dy/(q*q))/re;
+                                (*im)(x, y) = amp*std::exp(-b*std::pow(s, 1/n));
+                            }
+                        }
+
+                        MeasurePhotometry<ImageT> measureModel(im);
+                        measureModel.addAlgorithm("model");
+                        measureModel.prepare(peak);
+                        MeasurementColumns<Photometry> cat(measureModel.getSchema());
+                        cat.resize(1);
+                        std::vector<Peak> const one(1, peak);
+                        measureModel.measure(one.begin(), one.end(), cat);
+
+                        double const err[4] = {
+                            std::fabs(cat.get(0, "flux", "model")/flux - 1),
+                            std::fabs(cat.get(0, "sersic_n", "model")/n - 1),
+                            std::fabs(cat.get(0, "sersic_re", "model")/re - 1),
+                            std::fabs(cat.get(0, "sersic_q", "model")/q - 1)
+                        };
+                        bool ok = (static_cast<int>(cat.get(0, "flags", "model")) == 0);
+                        for (int p = 0; p != 4; ++p) {
+                            ok = ok && err[p] < tol; // n.b. NaNs fail
+                            worst[p] = std::max(worst[p], err[p]);
+                        }
+                        ++nFit;
+                        if (!ok) {
+                            ++nBad;
+                            std::cout << "sersic     : n = " << n << " r_e = " << re << " q = " << q <<
+                                " at (" << peak.getX() << ", " << peak.getY() << ") fitted as flux = " <<
+                                cat.get(0, "flux", "model") << " n = " << cat.get(0, "sersic_n", "model") <<
+                                " r_e = " << cat.get(0, "sersic_re", "model") << " q = " <<
+                                cat.get(0, "sersic_q", "model") << " flags = " <<
+                                cat.get(0, "flags", "model") << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+        std::cout << "sersic     : " << nFit << " galaxies, worst errors " << 100*worst[0] << "% (flux) " <<
+            100*worst[1] << "% (n) " << 100*worst[2] << "% (r_e) " << 100*worst[3] << "% (q)" <<
+            (nBad == 0 ? "" : "  BAD FITS") << std::endl;
+
+        return nBad == 0;
+    }
+
+    /**
+     * Measure all the peaks with measureInto(), reusing one Source and Workspace and copying each Source
+     * into cat, and check that once the first pass has warmed everything up no memory is allocated
+     */
+    bool checkMeasureInto(MeasureSources<ImageT> &measureSources, std::vector<Peak> const& peaks,
+                          SourceCatalog &cat) {
+        Source source;
+        MeasureSources<ImageT>::Workspace workspace;
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            measureSources.measureInto(peaks[i], source, workspace);
+        }
+
+        long const nNew0 = nNew;
+        double const t0 = now();
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            measureSources.measureInto(peaks[i], source, workspace);
+            cat.set(i, source);
+        }
+        double const t = now() - t0;
+        long const nAlloc = nNew - nNew0;
+
+        std::cout << "measureInto: " << peaks.size()/t << " sources/s  " <<
+            double(nAlloc)/peaks.size() << " allocations/source" << std::endl;
+
+        return nAlloc == 0;
+    }
+
+    /**
+     * Write cat as csv, serially and then formatting chunks with nThread threads, reporting the rates,
+     * and check that the text is the same.  The chunks are small enough that there are several per thread
+     */
+    bool checkCsv(SourceCatalog const& cat, int nThread) {
+        std::string text[2];
+        for (int i = 0; i != 2; ++i) {
+            std::ostringstream os;
+            ThreadPool pool(nThread);
+            double const t0 = now();
+            {
+                CsvWriter writer(os, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+                writer.writeHeader();
+                if (i == 0) {
+                    writer.write(cat);
+                } else {
+                    writer.write(cat, pool, std::max<std::size_t>(1, cat.size()/(8*nThread)));
+                }
+            }
+            double const t = now() - t0;
+            text[i] = os.str();
+
+            if (i == 0) {
+                std::cout << "csv        : ";
+            } else {
+                std::cout << "csv nThread " << nThread << (nThread < 10 ? " " : "") << ": ";
+            }
+            std::cout << cat.size()/t << " rows/s  " << text[i].size()/t/(1 << 20) << " MB/s" << std::endl;
+        }
+
+        bool const ok = (text[0] == text[1]);
+        if (!ok) {
+            std::cout << "csv        : PARALLEL OUTPUT DIFFERS" << std::endl;
+        }
+        return ok;
+    }
+
+    /**
+     * Write a catalogue as csv the way that writeCsv used to, before CsvWriter:  an ostringstream for every
+     * field, iostream's default formatting, and a std::endl (and thus a flush) for every row.  The values
+     * come straight from cat's columns rather than from Sources, so if anything this is faster than it was
+     */
+    void writeCsvWithIostreams(std::ostream &fd, SourceCatalog const& cat) {
+        MeasurementColumns<Astrometry> const& astrom = cat.getAstrometry();
+        MeasurementColumns<Photometry> const& photom = cat.getPhotometry();
+        int const nAstrom = astrom.getNSlot(), nColumn = nAstrom + photom.getNSlot();
+
+        for (std::size_t row = 0; row != cat.size(); ++row) {
+            for (int i = 0; i != nColumn; ++i) {
+                bool const isAstrom = (i < nAstrom);
+                int const slot = isAstrom ? i : i - nAstrom;
+                Schema::Type const type = isAstrom ? astrom.getType(slot) : photom.getType(slot);
+
+                std::ostringstream ss;
+                if (type == Schema::INT) {
+                    ss << (isAstrom ? astrom.getAsLong(row, slot) : photom.getAsLong(row, slot));
+                } else {
+                    ss << (isAstrom ? astrom.get(row, slot) : photom.get(row, slot));
+                }
+                if (i != 0) {
+                    fd << ", ";
+                }
+                fd << ss.str();
+            }
+            fd << std::endl;
+        }
+    }
+
+    /**
+     * Make a catalogue of nRow rows by repeating the rows of cat, and write it to /dev/null as csv with
+     * iostreams (as writeCsv used to;  \sa writeCsvWithIostreams) and with a CsvWriter, serially and with
+     * nThread threads;  report the rates and how much faster than iostreams each CsvWriter is
+     */
+    void compareCsv(SourceCatalog const& cat, std::size_t nRow, int nThread) {
+        SourceCatalog big(cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+        big.resize(nRow);
+        for (std::size_t i = 0; i != nRow; ++i) {
+            big.set(i, cat, i%cat.size());
+        }
+
+        double t[3];
+        for (int i = 0; i != 3; ++i) {
+            std::ofstream os("/dev/null");
+            ThreadPool pool(nThread);
+            double const t0 = now();
+            if (i == 0) {
+                writeCsvWithIostreams(os, big);
+            } else {
+                CsvWriter writer(os, big.getAstrometry().getSchema(), big.getPhotometry().getSchema());
+                writer.writeHeader();
+                if (i == 1) {
+                    writer.write(big);
+                } else {
+                    writer.write(big, pool);
+                }
+            }
+            t[i] = now() - t0;
+        }
+
+        int const nColumn = big.getAstrometry().getNSlot() + big.getPhotometry().getNSlot();
+        std::cout << "csv        : " << nRow << " rows of " << nColumn << " columns  iostreams " << t[0] <<
+            " s  CsvWriter " << t[1] << " s (x" << t[0]/t[1] << ")  " << t[2] << " s with " << nThread <<
+            " threads (x" << t[0]/t[2] << ")" << std::endl;
+    }
+
+    /**
+     * Write cat to a temporary catalogue file (in several row groups), reporting the rate, and check that
+     * reading it back gives the same values
+     */
+    bool checkCatalogFile(SourceCatalog const& cat) {
+        char filename[] = "/tmp/benchXXXXXX";
+        int const fd = ::mkstemp(filename);
+        if (fd < 0) {
+            std::cout << "catalogue  : unable to create a temporary file" << std::endl;
+            return false;
+        }
+        ::close(fd);
+
+        bool ok = true;
+        try {
+            double const t0 = now();
+            {
+                CatalogWriter writer(filename, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema(),
+                                     false, std::max<std::size_t>(1, cat.size()/4));
+                writer.write(cat);
+                writer.close();
+            }
+            double const tWrite = now() - t0;
+
+            CatalogReader reader(filename);
+            SourceCatalog group(reader.getAstrometrySchema(), reader.getPhotometrySchema());
+            ok = (reader.size() == cat.size());
+            for (int g = 0; ok && g != reader.getNRowGroup(); ++g) {
+                reader.read(g, &group);
+                std::size_t const row0 = reader.getRowGroupBegin(g);
+                for (std::size_t i = 0; ok && i != group.size(); ++i) {
+                    for (int s = 0; ok && s != group.getAstrometry().getNSlot(); ++s) {
+                        ok = (cat.getAstrometry().get(row0 + i, s) == group.getAstrometry().get(i, s));
+                    }
+                    for (int s = 0; ok && s != group.getPhotometry().getNSlot(); ++s) {
+                        ok = (cat.getPhotometry().get(row0 + i, s) == group.getPhotometry().get(i, s));
+                    }
+                }
+            }
+
+            std::cout << "catalogue  : " << cat.size()/tWrite << " rows/s  " <<
+                reader.getNByte()/tWrite/(1 << 20) << " MB/s written" << (ok ? "" : "  VALUES DIFFER") << std::endl;
+        } catch (std::exception const& e) {
+            std::cout << "catalogue  : " << e.what() << std::endl;
+            ok = false;
+        }
+        std::remove(filename);
+
+        return ok;
+    }
+
+    /**
+     * Check that a CatalogReader rejects files whose schemas are corrupt (two entries share a slot, or an
+     * entry's dimension is absurd), rather than writing past the end of its columns, and that it rejects
+     * row groups that it doesn't have
+     */
+    bool checkCorruptCatalogFile() {
+        char filename[] = "/tmp/benchXXXXXX";
+        int const fd = ::mkstemp(filename);
+        if (fd < 0) {
+            std::cout << "catalogue  : unable to create a temporary file" << std::endl;
+            return false;
+        }
+        ::close(fd);
+
+        int nRejected = 0;
+        for (int i = 0; i != 3; ++i) {
+            Schema::Ptr member(new Schema);
+            member->setComponent("bad");
+            member->add(SchemaEntry("a", 0, Schema::FLOAT, (i == 1) ? (1 << 20) : 1));
+            if (i == 0) {
+                member->add(SchemaEntry("b", 0, Schema::FLOAT));
+            }
+            Schema::Ptr schema(new Schema);
+            schema->add(member);
+
+            CatalogWriter(filename, schema, schema).close();
+            try {
+                CatalogReader reader(filename);
+                if (i == 2) {           // the schema's fine, but there are no row groups
+                    SourceCatalog cat(reader.getAstrometrySchema(), reader.getPhotometrySchema());
+                    reader.read(0, &cat);
+                }
+            } catch (std::runtime_error const&) {
+                ++nRejected;
+            }
+        }
+        std::remove(filename);
+
+        if (nRejected != 3) {
+            std::cout << "catalogue  : ACCEPTED " << 3 - nRejected << " CORRUPT FILES OR ROW GROUPS" << std::endl;
+        }
+        return nRejected == 3;
+    }
+
+    /**
+     * Decode the value of type type at ptr in a FITS table (big-endian, with CHARs offset by 128)
+     */
+    double fromFits(char const* ptr, Schema::Type type) {
+        char buf[sizeof(double)];
+        int const size = Schema::sizeOf(type);
+        for (int i = 0; i != size; ++i) {
+            buf[i] = ptr[size - 1 - i];  // this only works on little-endian machines, but so does bench
+        }
+        switch (type) {
+          case Schema::CHAR:   return static_cast<signed char>(buf[0] ^ 0x80);
+          case Schema::SHORT:  { short x;  std::memcpy(&x, buf, size); return x; }
+          case Schema::INT:    { int x;    std::memcpy(&x, buf, size); return x; }
+          case Schema::LONG:   { long x;   std::memcpy(&x, buf, size); return x; }
+          case Schema::FLOAT:  { float x;  std::memcpy(&x, buf, size); return x; }
+          case Schema::DOUBLE: { double x; std::memcpy(&x, buf, size); return x; }
+          default:             return 0;
+        }
+    }
+
+    /**
+     * Check that the FITS rows in data hold the values of one table of cat, whose first value is offset
+     * bytes into a row;  return the offset of the next table's first value
+     */
+    template<typename T>
+    std::size_t checkFitsColumns(MeasurementColumns<T> const& columns, char const* data, std::size_t rowSize,
+                                 std::size_t offset, bool *ok) {
+        Schema const& schema = *columns.getSchema();
+        int slot = 0;
+        for (Schema::const_iterator mptr = schema.begin(); mptr != schema.end(); ++mptr) {
+            for (Schema::const_iterator sptr = (*mptr)->begin(); sptr != (*mptr)->end(); ++sptr) {
+                Schema const& se = **sptr;
+                for (int i = 0; i != se.getDimen(); ++i, offset += Schema::sizeOf(se.getType())) {
+                    int const s = slot + se.getIndex() + i;
+                    for (std::size_t row = 0; *ok && row != columns.size(); ++row) {
+                        double const value = fromFits(data + row*rowSize + offset, se.getType());
+                        double const expected = columns.get(row, s);
+                        *ok = (value == expected || (value != value && expected != expected)); // NaN == NaN
+                    }
+                }
+            }
+            slot += (*mptr)->size();
+        }
+        return offset;
+    }
+
+    /**
+     * Write cat to a temporary FITS file, reporting the rate, and check that the table holds the same values
+     */
+    bool checkFits(SourceCatalog const& cat) {
+        char filename[] = "/tmp/benchXXXXXX";
+        int const fd = ::mkstemp(filename);
+        if (fd < 0) {
+            std::cout << "fits       : unable to create a temporary file" << std::endl;
+            return false;
+        }
+        ::close(fd);
+
+        bool ok = true;
+        try {
+            double const t0 = now();
+            std::size_t rowSize = 0;
+            {
+                FitsWriter writer(filename, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+                writer.write(cat);
+                writer.close();
+                rowSize = writer.getRowSize();
+            }
+            double const tWrite = now() - t0;
+
+            std::ifstream fs(filename, std::ios::binary);
+            std::string const file((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+            //
+            // The table's data start after the block containing the second END card
+            //
+            std::size_t header = 0;
+            for (int nEnd = 0; nEnd != 2 && header < file.size(); header += 80) {
+                if (file.compare(header, 8, "END     ") == 0) {
+                    ++nEnd;
+                }
+            }
+            header = ((header + 2879)/2880)*2880;
+            std::size_t const nbyte = cat.size()*rowSize;
+
+            ok = (file.size() == header + ((nbyte + 2879)/2880)*2880);
+            if (ok) {
+                std::size_t const offset = checkFitsColumns(cat.getAstrometry(), &file[header], rowSize, 0, &ok);
+                checkFitsColumns(cat.getPhotometry(), &file[header], rowSize, offset, &ok);
+            }
+
+            std::cout << "fits       : " << cat.size()/tWrite << " rows/s  " <<
+                nbyte/tWrite/(1 << 20) << " MB/s written" << (ok ? "" : "  VALUES DIFFER") << std::endl;
+        } catch (std::exception const& e) {
+            std::cout << "fits       : " << e.what() << std::endl;
+            ok = false;
+        }
+        std::remove(filename);
+
+        return ok;
+    }
+
+    /**
+     * Measure peaks with nThread threads while writing csv through a CatalogPipeline, reporting the rate,
+     * and check that the text is the same as that written from cat after measuring
+     */
+    bool checkPipeline(MeasureSources<ImageT> &measureSources, std::vector<Peak> const& peaks,
+                       SourceCatalog const& cat, int nThread) {
+        std::string text[2];
+        double t[2] = { 0, 0 };
+        ThreadPool pool(nThread);
+        for (int i = 0; i != 2; ++i) {
+            std::ostringstream os;
+            double const t0 = now();
+            {
+                CsvWriter writer(os, cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+                writer.writeHeader();
+                if (i == 0) {                 // measure everything, then write it
+                    SourceCatalog measured(cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema());
+                    measureSources.measure(peaks.begin(), peaks.end(), measured, pool);
+                    writer.write(measured);
+                } else {
+                    CatalogPipeline pipeline(cat.getAstrometry().getSchema(), cat.getPhotometry().getSchema(),
+                                             writeTo(writer), 1024);
+                    measureSources.measure(peaks.begin(), peaks.end(), pipeline, pool);
+                    pipeline.close();
+                }
+            }
+            t[i] = now() - t0;
+            text[i] = os.str();
+        }
+
+        bool const ok = (text[0] == text[1]);
+        std::cout << "pipeline   : " << peaks.size()/t[1] << " sources/s  (" << peaks.size()/t[0] <<
+            " measuring then writing)" << (ok ? "" : "  OUTPUT DIFFERS") << std::endl;
+        return ok;
+    }
+
+    /**
+     * Write im's pixels to a new temporary file, whose name replaces filename's trailing XXXXXX;
+     * return false if it couldn't be created
+     */
+    bool writeTemporary(ImageT const& im, char *filename) {
+        int const fd = ::mkstemp(filename);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = true;
+        for (int y = 0; ok && y != im.getHeight(); ++y) {
+            std::size_t const nbyte = im.getWidth()*sizeof(ImageT::Pixel);
+            ok = (::write(fd, im.getRow(y), nbyte) == static_cast<ssize_t>(nbyte));
+        }
+        ::close(fd);
+
+        return ok;
+    }
+
+    /// Return an 80-character FITS header card setting keyword to value
+    template<typename U>
+    std::string fitsCard(std::string const& keyword, U value) {
+        std::ostringstream card;
+        card << std::left << std::setw(8) << keyword << "= " << std::right << std::setw(20) << value;
+        std::string str = card.str();
+        str.resize(80, ' ');
+        return str;
+    }
+
+    /**
+     * Write im to a temporary FITS file and read it back with Image::readFits, reporting how long opening it
+     * took;  check that no rows are byte swapped until they're used, and that the pixels read back the same
+     */
+    bool checkFitsImage(ImageT const& im) {
+        char filename[] = "/tmp/benchXXXXXX";
+        int const fd = ::mkstemp(filename);
+        bool ok = (fd >= 0);
+        if (ok) {
+            int const bitpix = FitsBitpix<ImageT::Pixel>::value;
+            std::string header = fitsCard("SIMPLE", "T") + fitsCard("BITPIX", bitpix) + fitsCard("NAXIS", 2) +
+                fitsCard("NAXIS1", im.getWidth()) + fitsCard("NAXIS2", im.getHeight()) + std::string("END");
+            header.resize(((header.size() + 2879)/2880)*2880, ' ');
+            ok = (::write(fd, header.data(), header.size()) == static_cast<ssize_t>(header.size()));
+
+            std::vector<char> row(im.getWidth()*sizeof(ImageT::Pixel));
+            for (int y = 0; ok && y != im.getHeight(); ++y) {
+                std::memcpy(&row[0], im.getRow(y), row.size());
+                if (!isBigEndian()) {
+                    swapBytes(&row[0], im.getWidth(), sizeof(ImageT::Pixel));
+                }
+                ok = (::write(fd, &row[0], row.size()) == static_cast<ssize_t>(row.size()));
+            }
+            ::close(fd);
+        }
+
+        try {
+            double const t0 = now();
+            ImageT::ConstPtr fits = ok ? ImageT::readFits(filename) : ImageT::ConstPtr();
+            double const t = now() - t0;
+            if (ok) {
+                boost::shared_ptr<RowSwapper const> swapper = fits->getSwapper();
+                long const nSwapped0 = swapper ? swapper->getNSwapped() : 0;
+
+                BBox const bbox(im.getWidth()/4, im.getHeight()/4, im.getWidth()/2, 10);
+                ImageT::ConstPtr sub = fits->subimage(bbox);
+                for (int y = 0; y != sub->getHeight(); ++y) {
+                    ok = ok && std::equal(sub->getRow(y), sub->getRow(y) + sub->getWidth(),
+                                          im.getRow(bbox.getY0() + y) + bbox.getX0());
+                }
+                long const nSwapped1 = swapper ? swapper->getNSwapped() : 0;
+                ok = ok && nSwapped0 == 0 && nSwapped1 == (swapper ? bbox.getHeight() : 0);
+
+                for (int y = 0; y != im.getHeight(); ++y) {
+                    ok = ok && std::equal(fits->getRow(y), fits->getRow(y) + im.getWidth(), im.getRow(y));
+                }
+                std::cout << "fits image : opened in " << t*1e3 << " ms  " << nSwapped1 << "/" <<
+                    im.getHeight() << " rows swapped to read " << bbox.getHeight() <<
+                    (ok ? "" : "  PIXELS DIFFER") << std::endl;
+            } else {
+                std::cout << "fits image : unable to write a temporary file" << std::endl;
+            }
+        } catch (std::exception const& e) {
+            std::cout << "fits image : " << e.what() << std::endl;
+            ok = false;
+        }
+        std::remove(filename);
+
+        return ok;
+    }
+
+    /**
+     * Write im to a temporary file and measure it a tile at a time (with about 16 tiles), with nThread
+     * threads, reporting the rate;  check that the results are identical to those in cat
+     */
+    bool checkTiled(ImageT const& im, std::vector<Peak> const& peaks, std::vector<std::string> const& algorithms,
+                    int halo, SourceCatalog const& cat, int nThread) {
+        char filename[] = "/tmp/benchXXXXXX";
+        if (!writeTemporary(im, filename)) {
+            std::cout << "tiled      : unable to write a temporary file" << std::endl;
+            std::remove(filename);
+            return false;
+        }
+        bool ok = true;
+
+        try {
+            MeasureSources<ImageT> measureSources((ImageT::ConstPtr()));
+            addAlgorithms(&measureSources, algorithms);
+
+            int const side = std::max(im.getWidth(), im.getHeight())/4 + 2*halo + 16;
+            TiledMeasureSources<ImageT> tiled(measureSources,
+                                              ImageFile<ImageT::Pixel>::openRaw(filename, im.getWidth(),
+                                                                                im.getHeight()),
+                                              halo, 2*side*side*sizeof(ImageT::Pixel));
+            tiled.prepare(peaks[0]);
+
+            ThreadPool pool(nThread);
+            SourceCatalog tiledCat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+            double const t0 = now();
+            tiled.measure(peaks, tiledCat, pool);
+            double const t = now() - t0;
+
+            ok = ok && identical(cat.getAstrometry(), tiledCat.getAstrometry()) &&
+                identical(cat.getPhotometry(), tiledCat.getPhotometry());
+            std::cout << "tiled      : " << peaks.size()/t << " sources/s  " << tiled.getNTile() << " tiles  " <<
+                tiled.getNByte()/double(1 << 20) << " MB of pixels" << (ok ? "" : "  RESULTS DIFFER") << std::endl;
+        } catch (std::exception const& e) {
+            std::cout << "tiled      : " << e.what() << std::endl;
+            ok = false;
+        }
+        std::remove(filename);
+
+        return ok;
+    }
+
+    /// Return an elongated, rotated Gaussian kernel (which isn't separable) of half-width hw
+    ConvolutionKernel makeEllipticalKernel(int hw) {
+        int const n = 2*hw + 1;
+        double const sigmaMajor = hw/3.0, sigmaMinor = hw/6.0;
+        std::vector<float> values(n*n);
+        for (int j = 0; j != n; ++j) {
+            for (int i = 0; i != n; ++i) {
+                double const u = 0.8*(i - hw) + 0.6*(j - hw), v = -0.6*(i - hw) + 0.8*(j - hw);
+                values[j*n + i] = std::exp(-0.5*(u*u/(sigmaMajor*sigmaMajor) + v*v/(sigmaMinor*sigmaMinor)));
+            }
+        }
+        return ConvolutionKernel(n, n, &values[0]);
+    }
+
+    /// Return the largest difference between two images of the same size, relative to a's largest value
+    double maxRelDiff(ImageT const& a, ImageT const& b) {
+        double amax = 0, diff = 0;
+        for (int y = 0; y != a.getHeight(); ++y) {
+            for (int x = 0; x != a.getWidth(); ++x) {
+                amax = std::max(amax, std::fabs(double(a(x, y))));
+                diff = std::max(diff, std::fabs(double(a(x, y)) - b(x, y)));
+            }
+        }
+        return (amax == 0) ? diff : diff/amax;
+    }
+
+    /**
+     * Convolve im with a separable Gaussian and with small and large non-separable kernels, reporting
+     * the rate of each strategy;  check that the strategies agree (on a corner of im, as the direct
+     * convolution with the large kernel is slow) and that convolving with nThread threads gives the same
+     * answers as convolving serially
+     */
+    bool checkConvolution(ImageT const& im, int nThread) {
+        using namespace convolution;
+        ConvolutionKernel const kernels[] = {
+            ConvolutionKernel::makeGaussian(2.0), makeEllipticalKernel(3), makeEllipticalKernel(20)
+        };
+        char const* names[] = { "gaussian", "small", "large" };
+        Strategy const strategies[] = { SEPARABLE, DIRECT, FFT };
+        int const nKernel = sizeof(kernels)/sizeof(kernels[0]);
+        int const nStrategy = sizeof(strategies)/sizeof(strategies[0]);
+
+        ImageT::ConstPtr corner = im.subimage(BBox(0, 0, std::min(im.getWidth(), 512),
+                                                   std::min(im.getHeight(), 512)));
+        double const npix = double(corner->getWidth())*corner->getHeight();
+        ThreadPool pool(nThread);
+
+        bool allOk = true;
+        for (int k = 0; k != nKernel; ++k) {
+            ConvolutionKernel const& kernel = kernels[k];
+            ImageT direct(corner->getWidth(), corner->getHeight()), out(corner->getWidth(), corner->getHeight());
+            convolve(*corner, direct, kernel, DIRECT);
+
+            std::cout << "convolve   : " << std::setw(8) << std::left << names[k] << " " <<
+                kernel.getWidth() << "x" << kernel.getHeight() << " ";
+            bool ok = true;
+            for (int s = 0; s != nStrategy; ++s) {
+                if (strategies[s] == SEPARABLE && !kernel.isSeparable()) {
+                    continue;
+                }
+                double const t0 = now();
+                convolve(*corner, out, kernel, strategies[s]);
+                double const t = now() - t0;
+                ok = ok && maxRelDiff(direct, out) < 1e-4;
+                std::cout << " " << strategies[s] << " " << npix/t*1e-6;
+            }
+            std::cout << " Mpix/s";
+            //
+            // The whole image, with the strategy of choice
+            //
+            ImageT serial(im.getWidth(), im.getHeight()), parallel(im.getWidth(), im.getHeight());
+            double const t0 = now();
+            convolve(im, serial, kernel);
+            double const t1 = now();
+            convolve(im, parallel, kernel, pool);
+            double const t2 = now();
+            ok = ok && maxRelDiff(serial, parallel) == 0;
+
+            double const nPixel = double(im.getWidth())*im.getHeight();
+            std::cout << "  (" << chooseStrategy(kernel, im.getWidth(), im.getHeight()) << ": " <<
+                nPixel/(t1 - t0)*1e-6 << ", " << nPixel/(t2 - t1)*1e-6 << " with " << nThread << " threads)" <<
+                (ok ? "" : "  RESULTS DIFFER") << std::endl;
+            allOk = allOk && ok;
+        }
+
+        return allOk;
+    }
+
+    /// Are two lists of Footprints identical?
+    bool identical(std::vector<Footprint> const& a, std::vector<Footprint> const& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i != a.size(); ++i) {
+            std::vector<Span> const& aSpans = a[i].getSpans(), &bSpans = b[i].getSpans();
+            std::vector<Peak> const& aPeaks = a[i].getPeaks(), &bPeaks = b[i].getPeaks();
+            if (aSpans.size() != bSpans.size() || aPeaks.size() != bPeaks.size()) {
+                return false;
+            }
+            for (std::size_t j = 0; j != aSpans.size(); ++j) {
+                if (aSpans[j].y != bSpans[j].y || aSpans[j].x0 != bSpans[j].x0 || aSpans[j].x1 != bSpans[j].x1) {
+                    return false;
+                }
+            }
+            for (std::size_t j = 0; j != aPeaks.size(); ++j) {
+                if (aPeaks[j].getX() != bPeaks[j].getX() || aPeaks[j].getY() != bPeaks[j].getY()) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Detect the stars in im, serially and with nThread threads (with strips short enough that the stars
+     * straddle their boundaries), reporting the rates;  check that the answers agree, and that there's
+     * exactly one peak within a pixel of each of the true positions
+     */
+    bool checkDetection(ImageT const& im, std::vector<Peak> const& peaks, int nThread) {
+        DetectSources<ImageT> const detectSources(5.0);
+        double const npix = double(im.getWidth())*im.getHeight();
+
+        std::vector<Footprint> serial, parallel;
+        ThreadPool pool(nThread);
+        double const t0 = now();
+        detectSources.detect(im, serial);
+        double const t1 = now();
+        detectSources.detect(im, parallel, pool, 2*SPACING/3);
+        double const t2 = now();
+
+        bool ok = identical(serial, parallel);
+        std::vector<Peak> const detected = getPeaks(serial);
+        ok = ok && detected.size() == peaks.size();
+        std::vector<int> found(peaks.size(), 0);
+        for (std::size_t i = 0; ok && i != detected.size(); ++i) {
+            // the stars are in raster order on a grid, but the footprints are in order of their first pixel
+            std::size_t const j = NX*((detected[i].getIy() + SPACING/2)/SPACING - 1) +
+                (detected[i].getIx() + SPACING/2)/SPACING - 1;
+            ok = j < peaks.size() && found[j]++ == 0 &&
+                std::fabs(detected[i].getX() - peaks[j].getX()) <= 1 &&
+                std::fabs(detected[i].getY() - peaks[j].getY()) <= 1;
+        }
+
+        std::cout << "detect     : " << npix/(t1 - t0)*1e-6 << " Mpix/s serially, " << npix/(t2 - t1)*1e-6 <<
+            " with " << nThread << " threads  " << serial.size() << " footprints, " << detected.size() <<
+            " peaks" << (ok ? "" : "  WRONG PEAKS") << std::endl;
+
+        return ok;
+    }
+
+    /// Return the sky that checkBackground adds to the image:  a gentle gradient, with some curvature
+    double sky(double x, double y) {
+        return 10 + 2e-4*x + 1e-4*y + 0.5*std::sin(x/700)*std::cos(y/900);
+    }
+
+    /// Are a and b within tol of each other (relative to b if |b| > 1)?
+    bool close(double a, double b, double tol) {
+        return std::fabs(a - b) <= tol*std::max(1.0, std::fabs(b)) || (a != a && b != b);
+    }
+
+    /**
+     * Add a smooth sky to im, and model it with a Background serially, with nThread threads, and from a file,
+     * reporting the rates;  check that the models are identical and follow the sky, and that measuring the
+     * peaks with the sky subtracted gives positions and fluxes close to those found by subtracting a model
+     * of im itself (the stars are so crowded that they bias the sky, but equally in both)
+     */
+    bool checkBackground(ImageT::Ptr im, std::vector<Peak> const& peaks,
+                         std::vector<std::string> const& algorithms, int nThread) {
+        ImageT::Ptr skyIm(new ImageT(im->getWidth(), im->getHeight()));
+        for (int y = 0; y != im->getHeight(); ++y) {
+            for (int x = 0; x != im->getWidth(); ++x) {
+                (*skyIm)(x, y) = (*im)(x, y) + sky(x, y);
+            }
+        }
+        double const npix = double(im->getWidth())*im->getHeight();
+        ThreadPool pool(nThread);
+
+        double const t0 = now();
+        Background const serial(*skyIm);
+        double const t1 = now();
+        Background::Ptr background(new Background(*skyIm, pool));
+        double const t2 = now();
+
+        char filename[] = "/tmp/benchXXXXXX";
+        bool ok = writeTemporary(*skyIm, filename);
+        try {
+            if (ok) {
+                Background const fromFile(*ImageFile<ImageT::Pixel>::openRaw(filename, im->getWidth(),
+                                                                             im->getHeight()), pool);
+                for (int j = 0; j != serial.getNCellY(); ++j) {
+                    for (int i = 0; i != serial.getNCellX(); ++i) {
+                        ok = ok && background->getCell(i, j) == serial.getCell(i, j) &&
+                            fromFile.getCell(i, j) == serial.getCell(i, j);
+                    }
+                }
+            }
+        } catch (std::exception const& e) {
+            std::cout << "background : " << e.what() << std::endl;
+            ok = false;
+        }
+        std::remove(filename);
+        //
+        // Measure the peaks, subtracting the sky;  and measure im, subtracting its own model
+        //
+        MeasureSources<ImageT> measureSources(skyIm);
+        addAlgorithms(&measureSources, algorithms);
+        measureSources.setBackground(background);
+        measureSources.prepare(peaks[0]);
+
+        SourceCatalog skyCat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        skyCat.resize(peaks.size());
+        double const t3 = now();
+        measureSources.measure(peaks.begin(), peaks.end(), skyCat, pool);
+        double const t4 = now();
+        long const nEvaluated = background->getNEvaluated();
+
+        Background::Ptr imBackground(new Background(*im, pool));
+        measureSources.setImage(im);
+        measureSources.setBackground(imBackground);
+        SourceCatalog cat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        cat.resize(peaks.size());
+        measureSources.measure(peaks.begin(), peaks.end(), cat, pool);
+
+        bool same = true;
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            same = same && close(skyCat.getAstrometry().get(i, "x", "gaussian"),
+                                 cat.getAstrometry().get(i, "x", "gaussian"), 1e-2) &&
+                close(skyCat.getAstrometry().get(i, "y", "gaussian"),
+                      cat.getAstrometry().get(i, "y", "gaussian"), 1e-2);
+            for (unsigned int a = 0; a != algorithms.size(); ++a) {
+                int const n = (algorithms[a] == "aper") ? AperturePhotometry::getRadii().size() : 1;
+                for (int k = 0; k != n; ++k) {
+                    same = same && close(skyCat.getPhotometry().get(i, k, "flux", algorithms[a]),
+                                         cat.getPhotometry().get(i, k, "flux", algorithms[a]), 1e-2);
+                }
+            }
+        }
+        //
+        // How well did we model the sky?
+        //
+        double maxErr = 0;
+        for (int y = 0; y < im->getHeight(); y += 7) {
+            for (int x = 0; x < im->getWidth(); x += 7) {
+                maxErr = std::max(maxErr, std::fabs(background->getValue(x, y) - imBackground->getValue(x, y) -
+                                                    sky(x, y)));
+            }
+        }
+        ok = ok && maxErr < 0.01;
+
+        std::cout << "background : " << npix/(t1 - t0)*1e-6 << " Mpix/s serially, " << npix/(t2 - t1)*1e-6 <<
+            " with " << nThread << " threads  " << serial.getNCellX() << "x" << serial.getNCellY() <<
+            " cells, max error " << maxErr << "  " << peaks.size()/(t4 - t3) << " sources/s measured (" <<
+            nEvaluated << "/" << background->getNTile() << " tiles evaluated)" << (ok ? "" : "  MODELS DIFFER") <<
+            (same ? "" : "  RESULTS DIFFER") << std::endl;
+
+        return ok && same;
+    }
+
+    /**
+     * Measure the peaks in planar and interleaved MaskedImage copies of im, with the variance of its noise,
+     * reporting the rates;  check that the positions and fluxes are identical to those measured from im
+     * (serial), that the two layouts give identical errors, and that the aperture errors are right
+     */
+    bool checkMaskedImage(ImageT::Ptr im, std::vector<Peak> const& peaks,
+                          std::vector<std::string> const& algorithms, SourceCatalog const& serial,
+                          int nThread) {
+        double const sigma = 0.1/std::sqrt(12.0); // the noise is uniform in [-0.05, 0.05)
+        ThreadPool pool(nThread);
+
+        std::vector<SourceCatalog *> cats;
+        maskedImage::Layout const layouts[] = { maskedImage::PLANAR, maskedImage::INTERLEAVED };
+        bool same = true;
+        for (int l = 0; l != 2; ++l) {
+            MaskedImageT::Ptr mi(new MaskedImageT(im->getWidth(), im->getHeight(), layouts[l]));
+            for (int y = 0; y != im->getHeight(); ++y) {
+                for (int x = 0; x != im->getWidth(); ++x) {
+                    mi->set(x, y, (*im)(x, y), sigma*sigma);
+                }
+            }
+
+            MeasureSources<MaskedImageT> measureSources(mi);
+            addAlgorithms(&measureSources, algorithms);
+            measureSources.prepare(peaks[0]);
+
+            cats.push_back(new SourceCatalog(measureSources.getAstrometrySchema(),
+                                             measureSources.getPhotometrySchema()));
+            SourceCatalog &cat = *cats.back();
+            cat.resize(peaks.size());
+            double const t0 = now();
+            measureSources.measure(peaks.begin(), peaks.end(), cat, pool);
+            double const t = now() - t0;
+            std::cout << (l == 0 ? "planar     : " : "interleaved: ") << peaks.size()/t <<
+                " sources/s with " << nThread << " threads" << std::endl;
+
+            for (std::size_t i = 0; i != peaks.size(); ++i) {
+                same = same && cat.getAstrometry().get(i, "x", "gaussian") ==
+                    serial.getAstrometry().get(i, "x", "gaussian");
+                same = same && cat.getAstrometry().get(i, "y", "gaussian") ==
+                    serial.getAstrometry().get(i, "y", "gaussian");
+                for (unsigned int a = 0; a != algorithms.size(); ++a) {
+                    int const n = (algorithms[a] == "aper") ? AperturePhotometry::getRadii().size() : 1;
+                    for (int k = 0; k != n; ++k) {
+                        same = same && cat.getPhotometry().get(i, k, "flux", algorithms[a]) ==
+                            serial.getPhotometry().get(i, k, "flux", algorithms[a]);
+                    }
+                }
+            }
+        }
+        bool const sameErrors = identical(cats[0]->getAstrometry(), cats[1]->getAstrometry()) &&
+            identical(cats[0]->getPhotometry(), cats[1]->getPhotometry());
+        //
+        // The aperture errors should be a little less than sigma*sqrt(area), as the pixels on the edge are
+        // only partly included
+        //
+        bool errorsOk = true;
+        if (std::find(algorithms.begin(), algorithms.end(), "aper") != algorithms.end()) {
+            std::vector<float> const& radii = AperturePhotometry::getRadii();
+            for (std::size_t i = 0; i != peaks.size(); ++i) {
+                for (unsigned int k = 0; k != radii.size(); ++k) {
+                    double const ratio = cats[0]->getPhotometry().get(i, k, "fluxErr", "aper")/
+                        (sigma*std::sqrt(M_PI)*radii[k]);
+                    errorsOk = errorsOk && ratio > 0.95 && ratio <= 1.0 + 1e-6;
+                }
+            }
+        }
+        delete cats[0];
+        delete cats[1];
+
+        if (!same || !sameErrors || !errorsOk) {
+            std::cout << "maskedImage: " << (same ? "" : "RESULTS DIFFER  ") <<
+                (sameErrors ? "" : "LAYOUTS DIFFER  ") << (errorsOk ? "" : "BAD ERRORS") << std::endl;
+        }
+
+        return same && sameErrors && errorsOk;
+    }
+
+    /**
+     * Measure the peaks in a MaskedImage copy of im in which a pixel in the wings of every other star has
+     * been replaced by garbage and masked BAD, and check that the garbage was ignored:  measurements that
+     * set no flags (nor did their centroid) must be identical to those from im (serial), and those that
+     * did must be close to them.  Every other centroid must be flagged
+     */
+    bool checkMask(ImageT::Ptr im, std::vector<Peak> const& peaks, std::vector<std::string> const& algorithms,
+                   SourceCatalog const& serial, int nThread) {
+        double const sigma = 0.1/std::sqrt(12.0); // the noise is uniform in [-0.05, 0.05)
+        MaskedImageT::Ptr mi(new MaskedImageT(im->getWidth(), im->getHeight()));
+        for (int y = 0; y != im->getHeight(); ++y) {
+            for (int x = 0; x != im->getWidth(); ++x) {
+                mi->set(x, y, (*im)(x, y), sigma*sigma);
+            }
+        }
+        for (std::size_t i = 0; i < peaks.size(); i += 2) { // 4 pixels from the centre;  c.f. sigma == 2
+            mi->set(peaks[i].getIx() + 4, peaks[i].getIy(), 1e4, sigma*sigma, maskedImage::BAD);
+        }
+
+        ThreadPool pool(nThread);
+        MeasureSources<MaskedImageT> measureSources(mi);
+        addAlgorithms(&measureSources, algorithms);
+        measureSources.prepare(peaks[0]);
+        SourceCatalog cat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        cat.resize(peaks.size());
+        measureSources.measure(peaks.begin(), peaks.end(), cat, pool);
+
+        int nFlagged = 0, nWrong = 0;
+        for (std::size_t i = 0; i != peaks.size(); ++i) {
+            bool const centroidFlagged = (cat.getAstrometry().get(i, "flags", "gaussian") != 0);
+            nWrong += (centroidFlagged != (i%2 == 0));
+            for (int c = 0; c != 2; ++c) {
+                char const* name = (c == 0) ? "x" : "y";
+                double const value = cat.getAstrometry().get(i, name, "gaussian");
+                double const expected = serial.getAstrometry().get(i, name, "gaussian");
+                nWrong += centroidFlagged ? !(std::fabs(value - expected) < 0.05) : (value != expected);
+            }
+
+            for (unsigned int a = 0; a != algorithms.size(); ++a) {
+                int const n = (algorithms[a] == "aper") ? AperturePhotometry::getRadii().size() : 1;
+                for (int k = 0; k != n; ++k) {
+                    bool const flagged = (cat.getPhotometry().get(i, k, "flags", algorithms[a]) != 0);
+                    double const flux = cat.getPhotometry().get(i, k, "flux", algorithms[a]);
+                    double const expected = serial.getPhotometry().get(i, k, "flux", algorithms[a]);
+                    nFlagged += flagged;
+                    nWrong += (flagged || centroidFlagged) ?
+                        !close(flux, expected, 0.02) : (flux != expected);
+                }
+            }
+        }
+
+        std::cout << "mask       : " << peaks.size()/2 << " stars with a masked pixel, " << nFlagged <<
+            " flagged fluxes" << (nWrong == 0 ? "" : "  MASKED PIXELS USED") << std::endl;
+
+        return nWrong == 0 && (nFlagged > 0 || algorithms.empty());
+    }
+
+    /**
+     * Hammer measure() from nThread threads at once, all sharing the same MeasureSources object
+     * (which hasn't been used yet, so the threads also race to prepare() it).  Useful with -fsanitize=thread
+     */
+    bool stress(int nThread, std::vector<Peak> const& peaks, std::vector<std::string> const& algorithms) {
+        ImageT::Ptr im = makeImage(peaks);
+
+        std::vector<Source> expected(peaks.size());
+        {
+            MeasureSources<ImageT> measureSources(im);
+            addAlgorithms(&measureSources, algorithms);
+            for (std::size_t i = 0; i != peaks.size(); ++i) {
+                expected[i] = measureSources.measure(peaks[i]);
+            }
+        }
+
+        MeasureSources<ImageT> measureSources(im);
+        addAlgorithms(&measureSources, algorithms);
+
+        std::vector<int> ok(nThread, true);
+        boost::thread_group threads;
+        double const t0 = now();
+        for (int i = 0; i != nThread; ++i) {
+            threads.create_thread(boost::bind(hammer, &measureSources, &peaks, &expected, i, &ok[i]));
+        }
+        threads.join_all();
+        double const t = now() - t0;
+
+        bool const allOk = std::find(ok.begin(), ok.end(), static_cast<int>(false)) == ok.end();
+        std::cout << "stress " << nThread << " threads: " << nThread*peaks.size()/t << " sources/s" <<
+            (allOk ? "" : "  RESULTS DIFFER") << std::endl;
+
+        return allOk;
+    }
+}
+
+/************************************************************************************************************/
+//
+// Usage: ./bench [-s] [-l level] [-c nRow] nSource nThread type [type ...]
+//    where type is one of "aper", "psf", and "model", and level is one of "scalar", "avx2", and "avx512"
+//
+// Measure nSource peaks serially, and then with 1, 2, 4, ... nThread threads, reporting the rate
+// and checking that the results are identical
+//
+// With -s, instead have nThread threads each call measure() on all the peaks, sharing the same
+// MeasureSources object
+//
+// With -l, use SIMD kernels no better than level (default: the best that the CPU supports)
+//
+// With -c, also write nRow rows (the catalogue, repeated) as csv both as writeCsv used to, with iostreams,
+// and with a CsvWriter, serially and with nThread threads, and report how much faster the CsvWriter is
+//
+// The image contains a star at each peak;  before measuring them all, each algorithm's rate on its own
+// (on one core, and without the inputs that the other algorithms would give it) is reported, as is the
+// rate of psf and aper photometry with the algorithms chosen at runtime and at compile time.  Sources
+// measured with aper alone (so with no astrometry) are appended to a catalogue one by one, which must give
+// each its own row.  2000 noisy stars are centroided with "gaussian", whose reported errors must match the
+// scatter to 10%, and noise-free Sersic galaxies are fitted with "model", which must recover their
+// parameters to 0.1%.  The image is convolved with a few kernels in each possible way, which must agree,
+// and the stars are then detected, serially and in parallel, which must find one peak at each.
+//
+// After the serial run, the peaks are measured one Source at a time with measureInto();  that's required
+// not to allocate any memory once it's warmed up.  After the parallel runs, a smooth sky is added to the
+// image and modelled with a Background (serially, in parallel, and from a file, which must agree), and
+// measuring the peaks with it subtracted must give nearly the same positions and fluxes as subtracting a
+// Background of the original image.  The image is then copied to planar and interleaved MaskedImages
+// with a variance plane, which must give the same positions and fluxes and identical errors;  written to a
+// FITS file and read back (swapping only the rows that are used);  and written to a file and measured a
+// tile at a time, which must give the same results.  Finally the catalogue is
+// written as csv, serially and in parallel (which must give the same text), to a catalogue file (which
+// must read back the same), and to a FITS table (which must hold the same values).  Then the peaks are
+// measured again while a CatalogPipeline writes them as csv, which must give the same text
+//
+int main(int argc, char **argv) {
+    char const* prog = argv[0];
+    bool doStress = false;
+    std::size_t nCsvRow = 0;            // the number of rows for compareCsv;  0 to skip it
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        if (std::strcmp(argv[1], "-s") == 0) {
+            doStress = true;
+        } else if (std::strcmp(argv[1], "-l") == 0 && argc > 2) {
+            std::string const level = argv[2];
+            simd::setLevel(level == "scalar" ? simd::SCALAR : level == "avx2" ? simd::AVX2 : simd::AVX512);
+            --argc; ++argv;
+        } else if (std::strcmp(argv[1], "-c") == 0 && argc > 2) {
+            nCsvRow = std::atol(argv[2]);
+            --argc; ++argv;
+        } else {
+            argc = 0;                   // print the usage message
+            break;
+        }
+    }
+    if (argc < 3) {
+        std::cerr << "Usage: " << prog << " [-s] [-l level] [-c nRow] nSource nThread type [type ...]" <<
+            std::endl;
+        return 1;
+    }
+    std::cout << "SIMD level " << simd::getLevel() << std::endl;
+    std::size_t const nSource = std::atol(argv[1]);
+    int const nThreadMax = std::atoi(argv[2]);
+
+    std::vector<Peak> const peaks = makePeaks(nSource);
+    if (peaks.empty()) {
+        return 0;
+    }
+
+    if (doStress) {
+        return stress(nThreadMax, peaks, std::vector<std::string>(argv + 3, argv + argc)) ? 0 : 1;
+    }
+
+    ImageT::Ptr im = makeImage(peaks);
+    //
+    // Each algorithm on its own
+    //
+    {
+        MeasureAstrometry<ImageT> measureOne(im);
+        measureOne.addAlgorithm("gaussian");
+        measureOne.prepare(peaks[0]);
+
+        SourceCatalog cat(measureOne.getSchema(), Schema::ConstPtr(new Schema));
+        cat.resize(nSource);
+        double const t0 = now();
+        measureOne.measure(peaks.begin(), peaks.end(), cat.getAstrometry());
+        double const t = now() - t0;
+        std::cout << std::setw(11) << std::left << "gaussian" << ": " << nSource/t << " fits/s/core" << std::endl;
+    }
+    for (int i = 3; i < argc; ++i) {
+        MeasurePhotometry<ImageT> measureOne(im);
+        measureOne.addAlgorithm(argv[i]);
+        measureOne.prepare(peaks[0]);
+
+        SourceCatalog cat(Schema::ConstPtr(new Schema), measureOne.getSchema());
+        cat.resize(nSource);
+        double const t0 = now();
+        measureOne.measure(peaks.begin(), peaks.end(), cat.getPhotometry());
+        double const t = now() - t0;
+        std::cout << std::setw(11) << std::left << argv[i] << ": " << nSource/t << " fits/s/core" << std::endl;
+    }
+
+    if (!compareStatic(im, peaks) || !checkAppend(im, peaks)) {
+        return 1;
+    }
+    //
+    // Centroid noisy stars
+    //
+    if (!checkCentroids(2000)) {
+        return 1;
+    }
+    //
+    // Recover the parameters of Sersic galaxies
+    //
+    if (!checkSersic()) {
+        return 1;
+    }
+    //
+    // Convolve the image
+    //
+    if (!checkConvolution(*im, nThreadMax)) {
+        return 1;
+    }
+    //
+    // Find the stars
+    //
+    if (!checkDetection(*im, peaks, nThreadMax)) {
+        return 1;
+    }
+
+    MeasureSources<ImageT> measureSources(im);
+    addAlgorithms(&measureSources, std::vector<std::string>(argv + 3, argv + argc));
+    measureSources.prepare(peaks[0]);
+    //
+    // The serial version
+    //
+    SourceCatalog serial(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+    serial.resize(nSource);
+    double const t0 = now();
+    measureSources.measure(peaks.begin(), peaks.end(), serial);
+    double const tSerial = now() - t0;
+    std::cout << "serial     : " << nSource/tSerial << " sources/s" << std::endl;
+    //
+    // One Source at a time, reusing its storage
+    //
+    {
+        SourceCatalog cat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        cat.resize(nSource);
+
+        bool const noAlloc = checkMeasureInto(measureSources, peaks, cat);
+        bool const ok = identical(serial.getAstrometry(), cat.getAstrometry()) &&
+            identical(serial.getPhotometry(), cat.getPhotometry());
+        if (!noAlloc || !ok) {
+            std::cout << "measureInto: " << (noAlloc ? "" : "ALLOCATED MEMORY  ") << (ok ? "" : "RESULTS DIFFER") <<
+                std::endl;
+            return 1;
+        }
+    }
+    //
+    // And in parallel
+    //
+    for (int nThread = 1; nThread <= nThreadMax; nThread = (nThread == nThreadMax) ? nThread + 1 :
+             std::min(2*nThread, nThreadMax)) {
+        ThreadPool pool(nThread);
+        SourceCatalog cat(measureSources.getAstrometrySchema(), measureSources.getPhotometrySchema());
+        cat.resize(nSource);
+
+        double const t0 = now();
+        measureSources.measure(peaks.begin(), peaks.end(), cat, pool);
+        double const t = now() - t0;
+
+        bool const ok = identical(serial.getAstrometry(), cat.getAstrometry()) &&
+            identical(serial.getPhotometry(), cat.getPhotometry());
+        std::cout << "nThread " << nThread << (nThread < 10 ? "  " : " ") << ": " << nSource/t <<
+            " sources/s  speedup " << tSerial/t << (ok ? "" : "  RESULTS DIFFER") << std::endl;
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    //
+    // With a sky to subtract
+    //
+    if (!checkBackground(im, peaks, std::vector<std::string>(argv + 3, argv + argc), nThreadMax)) {
+        return 1;
+    }
+    //
+    // With variance and mask planes
+    //
+    if (!checkMaskedImage(im, peaks, std::vector<std::string>(argv + 3, argv + argc), serial, nThreadMax) ||
+        !checkMask(im, peaks, std::vector<std::string>(argv + 3, argv + argc), serial, nThreadMax)) {
+        return 1;
+    }
+    //
+    // Read the image from a FITS file
+    //
+    if (!checkFitsImage(*im)) {
+        return 1;
+    }
+    //
+    // A tile at a time, reading the image from a file
+    //
+    if (!checkTiled(*im, peaks, std::vector<std::string>(argv + 3, argv + argc), measureSources.getHalfWidth(),
+                    serial, nThreadMax)) {
+        return 1;
+    }
+
+    //
+    // Write the catalogue as csv
+    //
+    if (!checkCsv(serial, nThreadMax)) {
+        return 1;
+    }
+    if (nCsvRow > 0) {
+        compareCsv(serial, nCsvRow, nThreadMax);
+    }
+    //
+    // And as a binary catalogue file
+    //
+    if (!checkCatalogFile(serial) || !checkCorruptCatalogFile()) {
+        return 1;
+    }
+    //
+    // And as a FITS table
+    //
+    if (!checkFits(serial)) {
+        return 1;
+    }
+    //
+    // And as csv while measuring
+    //
+    if (!checkPipeline(measureSources, peaks, serial, nThreadMax)) {
+        return 1;
+    }
+
+    PsfCache const& psfCache = PsfPhotometry::getPsfCache();
+    if (psfCache.getHits() + psfCache.getMisses() > 0) {
+        std::cout << "PSF cache  : " << psfCache.getHits() << " hits, " << psfCache.getMisses() <<
+            " misses" << std::endl;
+    }
+
+    return 0;
+}
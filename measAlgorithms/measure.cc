@@ -4,8 +4,9 @@
 #include "Source.h"
 #include "Schema.h"
 #include "Measurement.h"
-#include "Photometry.h"
+#include "MeasureSources.h"
 #include "Image.h"
+#include "SourceCatalog.h"
 #include "Output.h"
 
 #include "AperturePhotometry.h"
@@ -17,36 +18,31 @@ typedef Image<float> ImageT;
 // Usage: ./main type [type ...]  where type is one of "aper", "psf", and "model"
 //
 int main(int argc, char **argv) {
-    ImageT::Ptr im (new ImageT(1.0));
+    ImageT::Ptr im (new ImageT(128, 128, 1.0));
 
-    // Create our astrometric measuring object
-    MeasureAstrometry<ImageT> *measureAstro = new MeasureAstrometry<ImageT>(im);
-    measureAstro->addAlgorithm("naive");
+    // Create our measuring object:  a centroider, and the photometric algorithms in argv (which
+    // are given the centroid)
+    MeasureSources<ImageT> *measureSources = new MeasureSources<ImageT>(im);
+    measureSources->addAlgorithm("gaussian");
 
-    // Create our photometric measuring object based on argv
-    MeasurePhotometry<ImageT> *measurePhoto = new MeasurePhotometry<ImageT>(im);
-    
     for (int i = 1; i != argc; ++i) {
-        measurePhoto->addAlgorithm(argv[i]);
+        measureSources->addAlgorithm(argv[i]);
     }
     // Measure the data and retrieve the answers
-    std::vector<Source::Ptr> sources;
+    Source::Ptr s = boost::make_shared<Source>(measureSources->measure(Peak(10, 20)));
+    Source::Ptr s2 = boost::make_shared<Source>(measureSources->measure(Peak(20, 100)));
+    //
+    // Measure a list of peaks all at once, storing the answers as columns
+    //
+    std::vector<Peak> peaks;
+    peaks.push_back(Peak(10, 20));
+    peaks.push_back(Peak(20, 100));
 
-    Source::Ptr s = boost::make_shared<Source>();
-    {
-        Peak peak(10, 20);
-        s->setAstrometry(measureAstro->measure(peak));
-        s->setPhotometry(measurePhoto->measure(peak));
-    }
-    sources.push_back(s);
+    measureSources->prepare(peaks[0]);  // make sure that we know the schemas
 
-    Source::Ptr s2 = boost::make_shared<Source>();
-    {
-        Peak peak(20, 100);
-        s2->setAstrometry(measureAstro->measure(peak));
-        s2->setPhotometry(measurePhoto->measure(peak));
-    }
-    sources.push_back(s2);
+    SourceCatalog sources(measureSources->getAstrometrySchema(), measureSources->getPhotometrySchema());
+    sources.resize(peaks.size());
+    measureSources->measure(peaks.begin(), peaks.end(), sources);
 
     std::cout << *s << std::endl;
     std::cout << *s2 << std::endl;
@@ -77,15 +73,31 @@ int main(int argc, char **argv) {
         Photometry::Ptr photom = *v.find("psf");
         std::cout << photom->getAlgorithm() << 
             " flux: " << photom->getFlux() << " fluxErr: " << photom->get("fluxErr") << std::endl;
+        //
+        // If you're going to read the same value from many Sources, look up a Key once and use that
+        //
+        Schema::Key<double> const fluxKey = v.getSchema()->getKey<double>("flux", "psf");
+        for (std::size_t i = 0; i != sources.size(); ++i) {
+            std::cout << "psf flux (Key): " << sources[i].getPhotometry().get(fluxKey) << std::endl;
+        }
     }
     std::cout << std::endl;
     //
     // Write out the first Source, using the schema
     //
-    showFromSchema(*(*sources.begin()));
+    showFromSchema(*s);
     std::cout << std::endl;
     //
-    // Write a csv file containing all our measurements, using the schema
+    // Write a csv file containing all our measurements, using the schema.  The rows are passed to
+    // the writer as they're measured, rather than being kept until the end
     //
-    writeCsv(sources, "");
+    CsvWriter writer(std::cout, measureSources->getAstrometrySchema(), measureSources->getPhotometrySchema());
+    writer.writeHeader();
+    {
+        CatalogPipeline pipeline(measureSources->getAstrometrySchema(), measureSources->getPhotometrySchema(),
+                                 writeTo(writer));
+        measureSources->measure(peaks.begin(), peaks.end(), pipeline);
+        pipeline.close();
+    }
+    writer.flush();
 }